@@ -253,8 +253,10 @@ enum
 #define CS_STICKY_BINDS CS_STICKY_BINDS
 	CS_SERVERADDR = 9206,
 #define CS_SERVERADDR CS_SERVERADDR
-	CS_PORT = 9300
+	CS_PORT = 9300,
 #define CS_PORT CS_PORT
+	CS_PIPELINE = 9301
+#define CS_PIPELINE CS_PIPELINE
 };
 
 /* Arbitrary precision math operators */
@@ -100,6 +100,15 @@ struct _cs_context
 	/* code changes end here - CS_CONFIG - 01*/
 	TDSCONTEXT *tds_ctx;
 	CS_CONFIG config;
+
+	/** network I/O mode for new connections (CS_SYNC_IO, CS_ASYNC_IO or CS_DEFER_IO) */
+	CS_INT netio;
+	/** connections waiting data for an asynchronous operation */
+	TDSPOLLER *poller;
+	/** connections with an asynchronous operation completed, not reported yet by ct_poll */
+	CS_CONNECTION *async_done;
+	/** asynchronous operations not reported yet */
+	int async_pending;
 };
 
 /*
@@ -115,6 +124,28 @@ typedef struct _cs_command_list CS_COMMAND_LIST;
 typedef struct _cs_dynamic CS_DYNAMIC_LIST;
 typedef struct _cs_dynamic CS_DYNAMIC;
 
+/*
+ * Asynchronous operation pending on a connection.
+ * Only one operation at a time is allowed.
+ */
+typedef struct _ct_async
+{
+	/** function (CT_SEND, CT_RESULTS or CT_FETCH), 0 if nothing pending */
+	CS_INT func;
+	CS_COMMAND *cmd;
+	/** output parameter of operation (result type or rows read) */
+	CS_INT *result;
+	/** ct_fetch parameters */
+	CS_INT type, offset, option;
+	/** operation result, valid if completed */
+	CS_RETCODE status;
+	int completed;
+	/** set while ct_poll executes the operation */
+	int running;
+	/** next in context list of completed operations */
+	CS_CONNECTION *next_done;
+} CT_ASYNC;
+
 struct _cs_connection
 {
 	CS_CONTEXT *ctx;
@@ -127,7 +158,13 @@ struct _cs_connection
 	CS_LOCALE *locale;
 	CS_COMMAND_LIST *cmds;
 	CS_DYNAMIC_LIST *dynlist;
+	TDSNAMEINDEX dyn_index;		/**< dynlist indexed by id */
 	char *server_addr;
+	/** network I/O mode (CS_SYNC_IO, CS_ASYNC_IO or CS_DEFER_IO) */
+	CS_INT netio;
+	CT_ASYNC async;
+	/** queue commands in ct_send() and send them together at first ct_results() (CS_PIPELINE) */
+	CS_INT pipeline;
 };
 
 /*
@@ -178,6 +215,7 @@ struct _cs_dynamic
 	char *id;
 	char *stmt;
 	CS_DYNAMIC_PARAM *param_list;
+	TDSDYNAMIC *tdsdyn;	/**< statement prepared on server, can come from connection cache */
 	struct _cs_dynamic *next;
 }; 
 
@@ -232,6 +270,9 @@ struct _cs_command
 	TDSCURSOR *cursor;
 	void *userdata;
 	int userdata_len;
+	/** command was queued in connection pipeline, its results are not read yet */
+	short pipelined;
+	unsigned int pipeline_pos;	/**< position in connection pipeline */
 };
 
 struct _cs_command_list
@@ -278,6 +319,8 @@ CS_INT _ct_diag_clearmsg(CS_CONTEXT * context, CS_INT type);
 void _cs_locale_free(CS_LOCALE *locale);
 CS_LOCALE *_cs_locale_copy(CS_LOCALE *orig);
 int _cs_locale_copy_inplace(CS_LOCALE *new_locale, CS_LOCALE *orig);
+CS_RETCODE _cs_convert(CS_CONTEXT * ctx, CS_DATAFMT * srcfmt, CS_VOID * srcdata, CS_DATAFMT * destfmt, CS_VOID * destdata,
+		       CS_INT * resultlen, TDSCOLUMN * col);
 
 #ifdef __cplusplus
 #if 0
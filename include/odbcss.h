@@ -17,8 +17,14 @@
  * Boston, MA 02111-1307, USA.
  */
 
-/* $Id: odbcss.h,v 1.1 2008/05/07 08:42:30 freddy77 Exp $ */
+/* $Id: odbcss.h,v 1.2 2011/09/19 10:21:36 freddy77 Exp $ */
 
 #define SQL_DIAG_SS_MSGSTATE	(-1150)
 #define SQL_DIAG_SS_LINE	(-1154)
 
+/* FreeTDS specific connection attributes */
+#define SQL_COPT_TDSODBC_IMPL_BASE	1500
+/* prepared statements reused from connection cache (read only, SQLULEN) */
+#define SQL_COPT_TDSODBC_PREPARED_CACHE_HITS	(SQL_COPT_TDSODBC_IMPL_BASE+1)
+/* prepared statements sent to server with cache enabled (read only, SQLULEN) */
+#define SQL_COPT_TDSODBC_PREPARED_CACHE_MISSES	(SQL_COPT_TDSODBC_IMPL_BASE+2)
@@ -41,6 +41,7 @@
 /* forward declaration */
 typedef struct tdsiconvinfo TDSICONV;
 typedef struct tds_socket TDSSOCKET;
+typedef struct tds_poller TDSPOLLER;
 typedef struct tds_column TDSCOLUMN;
 
 #include "tdsver.h"
@@ -413,6 +414,7 @@ typedef enum tds_encryption_level {
 #define is_collate_type(x) (x==XSYBVARCHAR || x==XSYBCHAR || x==SYBTEXT || x==XSYBNVARCHAR || x==XSYBNCHAR || x==SYBNTEXT)
 #define is_ascii_type(x) ( x==XSYBCHAR || x==XSYBVARCHAR || x==SYBTEXT || x==SYBCHAR || x==SYBVARCHAR)
 #define is_char_type(x) (is_unicode_type(x) || is_ascii_type(x))
+#define is_binary_type(x) (x==SYBBINARY || x==SYBVARBINARY || x==SYBIMAGE || x==XSYBBINARY || x==XSYBVARBINARY)
 #define is_similar_type(x, y) ((is_char_type(x) && is_char_type(y)) || ((is_unicode_type(x) && is_unicode_type(y))))
 
 
@@ -474,6 +476,7 @@ typedef enum tds_encryption_level {
 #define TDS_STR_ASA_DATABASE	"asa database"
 #define TDS_STR_ENCRYPTION	 "encryption"
 #define TDS_STR_USENTLMV2	"use ntlmv2"
+#define TDS_STR_PREPCACHE	"prepared cache size"
 /* conf values */
 #define TDS_STR_ENCRYPTION_OFF	 "off"
 #define TDS_STR_ENCRYPTION_REQUEST "request"
@@ -523,6 +526,7 @@ typedef struct tds_login
 	DSTR dump_file;
 	int debug_flags;
 	int text_size;
+	int prepared_cache_size;	/**< prepared statements to keep for reuse, 0 to disable */
 
 	unsigned char option_flag2;
 
@@ -599,6 +603,13 @@ typedef struct tds_column_funcs
 //	TDSRET (*convert)(TDSSOCKET *tds, TDSCOLUMN *col);
 } TDSCOLUMNFUNCS;
 
+union conv_result;
+struct tds_context;
+
+/** convert a value, same parameters as tds_convert(), see tds_get_converter() */
+typedef TDS_INT (*TDS_CONVERT_FUNC) (const struct tds_context * context, int srctype, const TDS_CHAR * src, TDS_UINT srclen,
+				     int desttype, union conv_result * cr);
+
 /** 
  * Metadata about columns in regular and compute rows 
  */
@@ -636,6 +647,8 @@ struct tds_column
 
 	unsigned char *column_data;
 	void (*column_data_free)(struct tds_column *column);
+	/** row buffer while column_data points into network buffer, see tds_detach_row_data() */
+	unsigned char *column_row_data;
 	unsigned int column_nullable:1;
 	unsigned int column_writeable:1;
 	unsigned int column_identity:1;
@@ -643,6 +656,7 @@ struct tds_column
 	unsigned int column_hidden:1;
 	unsigned int column_output:1;
 	unsigned int column_timestamp:1;
+	unsigned int column_stream:1;	/**< client reads data incrementally, see tds_stream_start() */
 	TDS_UCHAR column_collation[5];
 
 	/* additional fields flags for compute results */
@@ -664,6 +678,10 @@ struct tds_column
 	TDS_INT column_textpos;
 	TDS_INT column_text_sqlgetdatapos;
 	TDS_CHAR column_text_sqlputdatainfo;
+	/** converter from column_convert_src to column_convert_dest, see tds_column_converter() */
+	TDS_CONVERT_FUNC column_convert;
+	TDS_SMALLINT column_convert_src;
+	TDS_SMALLINT column_convert_dest;
 
 	BCPCOLDATA *bcp_column_data;
 	/**
@@ -699,6 +717,8 @@ typedef struct tds_result_info
 	TDS_SMALLINT computeid;
 	TDS_SMALLINT *bycolumns;
 	TDS_SMALLINT by_cols;
+	/** operation to decode every column, computed on first row */
+	unsigned char *decode_plan;
 } TDSRESULTINFO;
 
 /** values for tds->state */
@@ -854,6 +874,25 @@ typedef struct tds_env
 	char *database;
 } TDSENV;
 
+/** slot of a TDSNAMEINDEX */
+typedef struct tds_name_index_slot
+{
+	const char *name;	/**< key, owned by item, NULL for free slots */
+	void *item;
+	TDS_UINT hash;
+} TDSNAMEINDEXSLOT;
+
+/**
+ * Hash index of objects by name (open addressing, linear probing).
+ * Objects are still kept in their lists, index just speed up searches.
+ */
+typedef struct tds_name_index
+{
+	TDSNAMEINDEXSLOT *slots;
+	unsigned int size;	/**< number of slots, 0 or a power of 2 */
+	unsigned int count;	/**< used slots */
+} TDSNAMEINDEX;
+
 /**
  * Holds information for a dynamic (also called prepared) query.
  */
@@ -886,6 +925,13 @@ typedef struct tds_dynamic
 	int emulated;
 	/** saved query, we need to know original query if prepare is impossible */
 	char *query;
+	/**
+	 * normalized query and parameter types, used to find the statement
+	 * in connection cache. NULL if statement cannot be reused.
+	 */
+	char *cache_key;
+	TDS_UINT cache_hash;		/**< hash of cache_key */
+	struct tds_dynamic *cache_next;	/**< next idle statement in connection cache */
 } TDSDYNAMIC;
 
 typedef enum {
@@ -900,6 +946,53 @@ typedef struct tds_multiple
 	unsigned int flags;
 } TDSMULTIPLE;
 
+/**
+ * Requests queued by tds_pipeline_query(), tds_pipeline_rpc() and
+ * tds_pipeline_execute(). Requests are packed in a single multiple RPC
+ * request, responses are read in order, one at a time.
+ * A mark call (sp_executesql returning only the TDS_PIPELINE_MARK output
+ * parameter) follows every request but the last, procedures called by
+ * a request end with a DONEPROC too so only the mark tells where its
+ * response ends.
+ */
+typedef struct tds_pipeline
+{
+	TDSMULTIPLE multiple;
+	unsigned int num_requests;	/**< requests queued */
+	unsigned int current;		/**< request whose response is being read */
+	TDS_TINYINT *sp_called;		/**< internal_sp_called of every request */
+	unsigned int sp_called_size;	/**< allocated elements in sp_called */
+	/** response of current request is complete, next ones wait tds_pipeline_next() */
+	unsigned int boundary:1;
+	unsigned int held_status:1;	/**< return status followed by parameters, can be of the mark call */
+	unsigned int mark:1;		/**< mark call read, its DONEPROC ends the response */
+	unsigned int param_pending:1;	/**< parameters of the request read, returned by next tds_process_tokens() */
+	TDS_INT ret_status;		/**< held return status */
+} TDSPIPELINE;
+
+#define TDS_PIPELINE_MARK "@tds_pipeline_mark"
+
+/**
+ * A query converted for sp_executesql, sp_prepare or sp_prepexec together
+ * with the declaration of its parameters, see tds7_get_query_def().
+ */
+typedef struct tds_query_def
+{
+	TDS_UINT hash;			/**< hash of query and parameter types */
+	char *query;			/**< query as given by client, NULL if entry is free */
+	TDS_UINT *types;		/**< types of the parameters used to build param_def */
+	unsigned int num_types;		/**< elements in types */
+	char *ucs2_query;		/**< query in UCS-2LE with placeholders replaced by @Pn */
+	size_t ucs2_query_len;		/**< length of ucs2_query in bytes */
+	char *param_def;		/**< declaration of parameters in UCS-2LE */
+	size_t param_def_len;		/**< length of param_def in bytes */
+} TDSQUERYDEF;
+
+/** queries kept in a connection query cache */
+#define TDS_QUERY_CACHE_SIZE 8
+/** longer converted queries are not kept in the cache */
+#define TDS_QUERY_CACHE_MAX_LEN 32768
+
 /* forward declaration */
 typedef struct tds_context TDSCONTEXT;
 typedef int (*err_handler_t) (const TDSCONTEXT *, TDSSOCKET *, TDSMESSAGE *);
@@ -949,21 +1042,62 @@ struct tds_socket_conn
 	void *tls_session;
 	void *tls_credentials;
 	TDSAUTHENTICATION *authentication;
+
+	/**
+	 * Receive buffer. Data are read from the socket as they arrive and
+	 * packets are handed to the reader directly from here (in_buf points inside it).
+	 */
+	unsigned char *recv_buf;
+	unsigned int recv_buf_size;	/**< allocated receive buffer */
+	unsigned int recv_pos;		/**< first byte not yet returned as a packet */
+	unsigned int recv_len;		/**< bytes of valid data in recv_buf */
+
+	int char_conv_count;
+	TDSICONV **char_convs;
+#define TDS_ICONV_HASH_SIZE 16
+	/** conversions allocated by tds_iconv_get_info, hashed by client and server charsets */
+	TDSICONV *char_conv_hash[TDS_ICONV_HASH_SIZE];
+
+	TDSCURSOR *cursors;		/**< linked list of cursors allocated for this connection */
+	TDSDYNAMIC *dyns;		/**< list of dynamic allocate for this connection */
+	TDSNAMEINDEX dyn_index;		/**< dyns indexed by id */
+	/** prepared statements released by their users, most recently used first */
+	TDSDYNAMIC *dyn_cache;
+	unsigned int dyn_cache_count;	/**< statements in dyn_cache */
+	unsigned int dyn_cache_max;	/**< maximum statements in dyn_cache, 0 if cache is disabled */
+	unsigned long dyn_cache_hits;	/**< prepares satisfied by dyn_cache */
+	unsigned long dyn_cache_misses;	/**< prepares sent to server with cache enabled */
+	TDS_UCHAR tds72_transaction[8];	/**< transaction descriptor, shared by all sessions */
+
+	/** MARS is enabled, packets are wrapped in SMP frames */
+	unsigned int mars:1;
+	/** sessions sharing this connection, NULL entries are free */
+	TDSSOCKET **sessions;
+	unsigned int num_sessions;
+	TDS_USMALLINT next_sid;		/**< id to use for next session */
 };
 typedef struct tds_socket_conn TDSSOCKETCONN;
 
+/** a packet received for a MARS session */
+typedef struct tds_packet
+{
+	struct tds_packet *next;
+	unsigned int len;
+	unsigned char buf[1];
+} TDSPACKET;
+
 /**
  * Information for a server connection
  */
 struct tds_socket
 {
-	TDSSOCKETCONN conn;
+	TDSSOCKETCONN *conn;		/**< physical connection, shared by MARS sessions */
 
 	TDS_USMALLINT tds_version;
 
-	unsigned char *in_buf;		/**< input buffer */
-	unsigned char *out_buf;		/**< output buffer */
-	unsigned int in_buf_max;	/**< allocated input buffer */
+	unsigned char *in_buf;		/**< input buffer, current packet inside conn->recv_buf or recv_packet */
+	unsigned char *out_buf;		/**< output buffer, current packet inside send_buf */
+	unsigned int in_buf_max;	/**< size of current input packet */
 	unsigned in_pos;		/**< current position in in_buf */
 	unsigned out_pos;		/**< current position in out_buf */
 	unsigned in_len;		/**< input buffer length */
@@ -971,6 +1105,13 @@ struct tds_socket
 	unsigned char in_flag;		/**< input buffer type */
 	unsigned char out_flag;		/**< output buffer type */
 
+	/**
+	 * Packets to send. Full packets are queued here and sent all
+	 * together when the queue is full or the last packet is written.
+	 */
+	unsigned char *send_buf;
+	unsigned int send_buf_size;	/**< allocated send buffer */
+
 	/**
 	 * Current query information. 
 	 * Contains information in process, both normal and compute results.
@@ -982,7 +1123,6 @@ struct tds_socket
 	TDSCOMPUTEINFO **comp_info;
 	TDSPARAMINFO *param_info;
 	TDSCURSOR *cur_cursor;		/**< cursor in use */
-	TDSCURSOR *cursors;		/**< linked list of cursors allocated for this connection */
 	TDS_TINYINT has_status; 	/**< true is ret_status is valid */
 	TDS_INT ret_status;     	/**< return status from store procedure */
 	TDS_STATE state;
@@ -995,29 +1135,54 @@ struct tds_socket
 	TDSENV env;
 
 	TDSDYNAMIC *cur_dyn;		/**< dynamic structure in use */
-	TDSDYNAMIC *dyns;		/**< list of dynamic allocate for this connection */
-
-	int char_conv_count;
-	TDSICONV **char_convs;
 
 	TDSLOGIN *login;	/**< config for login stuff. After login this field is NULL */
 
 	int spid;
 	TDS_UCHAR collation[5];
-	TDS_UCHAR tds72_transaction[8];
 	void (*env_chg_func) (TDSSOCKET * tds, int type, char *oldval, char *newval);
 	int internal_sp_called;
 
 	int option_value;
+
+	/* large column of current row read incrementally, see tds_stream_chunks() */
+	TDSCOLUMN *stream_col;		/**< streamed column, NULL if none */
+	TDS_UINT stream_left;		/**< bytes left in current chunk */
+	unsigned char stream_plp;	/**< other PLP chunks follow current one */
+
+	/**
+	 * Client reads row data before reading again from network, so
+	 * character and binary data can be left in network buffer (zero-copy).
+	 */
+	unsigned int zero_copy:1;
+	unsigned int wire_row:1;	/**< some column of res_info points into network buffer */
+	/** calls of sp_executesql sent by tds_multiple_query(), results are like a language batch */
+	unsigned int multiple_query:1;
+	unsigned int multiple_stmt_done:1;	/**< some statement of current multiple query call completed */
+
+	/* MARS session, used only if conn->mars is set */
+	TDS_USMALLINT sid;		/**< SMP session id */
+	TDS_UINT send_seq;		/**< sequence number of last DATA frame sent */
+	TDS_UINT send_wnd;		/**< last sequence number server allows us to send */
+	TDS_UINT recv_seq;		/**< sequence number of last DATA frame read */
+	TDS_UINT recv_wnd;		/**< last sequence number we allow server to send */
+	TDSPACKET *recv_packet;		/**< packet in in_buf */
+	TDSPACKET *packet_queue;	/**< packets received for this session and not read yet */
+
+	TDSPIPELINE pipeline;		/**< pipelined requests, see tds_pipeline_send() */
+
+	/** last converted queries, see tds7_get_query_def() */
+	TDSQUERYDEF query_cache[TDS_QUERY_CACHE_SIZE];
+	unsigned int query_cache_next;	/**< entry replaced on next miss */
 };
 
-#define tds_conn(tds) (&(tds)->conn)
-#define tds_get_ctx(tds) ((tds)->conn.tds_ctx)
-#define tds_set_ctx(tds, val) do { ((tds)->conn.tds_ctx) = (val); } while(0)
-#define tds_get_parent(tds) ((tds)->conn.parent)
-#define tds_set_parent(tds, val) do { ((tds)->conn.parent) = (val); } while(0)
-#define tds_get_s(tds) ((tds)->conn.s)
-#define tds_set_s(tds, val) do { ((tds)->conn.s) = (val); } while(0)
+#define tds_conn(tds) ((tds)->conn)
+#define tds_get_ctx(tds) ((tds)->conn->tds_ctx)
+#define tds_set_ctx(tds, val) do { ((tds)->conn->tds_ctx) = (val); } while(0)
+#define tds_get_parent(tds) ((tds)->conn->parent)
+#define tds_set_parent(tds, val) do { ((tds)->conn->parent) = (val); } while(0)
+#define tds_get_s(tds) ((tds)->conn->s)
+#define tds_set_s(tds, val) do { ((tds)->conn->s) = (val); } while(0)
 
 int tds_init_write_buf(TDSSOCKET * tds);
 void tds_free_result_info(TDSRESULTINFO * info);
@@ -1044,6 +1209,7 @@ TDSCOMPUTEINFO **tds_alloc_compute_results(TDSSOCKET * tds, int num_cols, int by
 TDSCONTEXT *tds_alloc_context(void * parent);
 void tds_free_context(TDSCONTEXT * locale);
 TDSSOCKET *tds_alloc_socket(TDSCONTEXT * context, int bufsize);
+TDSSOCKET *tds_alloc_additional_socket(TDSSOCKET * tds);
 
 /* config.c */
 const TDS_COMPILETIME_SETTINGS *tds_get_compiletime_settings(void);
@@ -1101,6 +1267,10 @@ char *tds_alloc_client_sqlstate(int msgno);
 char *tds_alloc_lookup_sqlstate(TDSSOCKET * tds, int msgno);
 TDSLOGIN *tds_alloc_login(void);
 TDSDYNAMIC *tds_alloc_dynamic(TDSSOCKET * tds, const char *id);
+TDSRET tds_name_index_add(TDSNAMEINDEX * idx, const char *name, void *item);
+void *tds_name_index_find(const TDSNAMEINDEX * idx, const char *name, size_t len);
+void tds_name_index_remove(TDSNAMEINDEX * idx, const char *name, void *item);
+void tds_name_index_free(TDSNAMEINDEX * idx);
 void tds_free_login(TDSLOGIN * login);
 TDSLOGIN *tds_alloc_connection(TDSLOCALE * locale);
 TDSLOCALE *tds_alloc_locale(void);
@@ -1108,6 +1278,7 @@ void *tds_alloc_param_data(TDSCOLUMN * curparam);
 void tds_free_locale(TDSLOCALE * locale);
 TDSCURSOR * tds_alloc_cursor(TDSSOCKET * tds, const char *name, TDS_INT namelen, const char *query, TDS_INT querylen);
 void tds_free_row(TDSRESULTINFO * res_info, unsigned char *row);
+void tds_free_query_def(TDSQUERYDEF * def);
 
 /* login.c */
 void tds_set_packet(TDSLOGIN * tds_login, int packet_size);
@@ -1139,6 +1310,8 @@ const char *tds_next_placeholder(const char *start);
 int tds_count_placeholders(const char *query);
 int tds_needs_unprepare(TDSSOCKET * tds, TDSDYNAMIC * dyn);
 TDSRET tds_submit_unprepare(TDSSOCKET * tds, TDSDYNAMIC * dyn);
+TDSDYNAMIC *tds_dynamic_cache_get(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params);
+TDSDYNAMIC *tds_dynamic_cache_put(TDSSOCKET * tds, TDSDYNAMIC * dyn);
 TDSRET tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params);
 TDSRET tds_submit_optioncmd(TDSSOCKET * tds, TDS_OPTION_CMD command, TDS_OPTION option, TDS_OPTION_ARG *param, TDS_INT param_size);
 TDSRET tds_submit_begin_tran(TDSSOCKET *tds);
@@ -1169,6 +1342,12 @@ TDSRET tds_multiple_init(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDS_MULTIPLE_TYP
 TDSRET tds_multiple_done(TDSSOCKET *tds, TDSMULTIPLE *multiple);
 TDSRET tds_multiple_query(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDSPARAMINFO * params);
 TDSRET tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn);
+TDSRET tds_multiple_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *rpc_name, TDSPARAMINFO * params);
+TDSRET tds_pipeline_query(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params);
+TDSRET tds_pipeline_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params);
+TDSRET tds_pipeline_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn);
+TDSRET tds_pipeline_send(TDSSOCKET * tds);
+TDSRET tds_pipeline_next(TDSSOCKET * tds);
 
 /* token.c */
 TDSRET tds_process_cancel(TDSSOCKET * tds);
@@ -1186,6 +1365,15 @@ TDSRET tds_process_tokens(TDSSOCKET * tds, /*@out@*/ TDS_INT * result_type, /*@o
 /* data.c */
 void tds_set_param_type(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_SERVER_TYPE type);
 void tds_set_column_type(TDSSOCKET * tds, TDSCOLUMN * curcol, int type);
+/** receive a chunk of a streamed column, return bytes consumed */
+typedef size_t (*TDS_CHUNK_FUNC) (void *param, const void *data, size_t len);
+TDSRET tds_stream_start(TDSSOCKET * tds, TDSCOLUMN * curcol);
+int tds_stream_chunks(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_CHUNK_FUNC func, void *param);
+int tds_stream_read(TDSSOCKET * tds, TDSCOLUMN * curcol, void *buf, size_t len);
+TDSRET tds_stream_skip(TDSSOCKET * tds);
+TDSRET tds_stream_load(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_INT offset);
+TDSRET tds_get_row_data(TDSSOCKET * tds, TDSRESULTINFO * info, const unsigned char *nullmap);
+void tds_detach_row_data(TDSSOCKET * tds, int copy);
 
 
 /* tds_convert.c */
@@ -1201,19 +1389,96 @@ int tds_put_buf(TDSSOCKET * tds, const unsigned char *buf, int dsize, int ssize)
 unsigned char tds_get_byte(TDSSOCKET * tds);
 void tds_unget_byte(TDSSOCKET * tds);
 unsigned char tds_peek(TDSSOCKET * tds);
-TDS_SMALLINT tds_get_smallint(TDSSOCKET * tds);
-TDS_INT tds_get_int(TDSSOCKET * tds);
-TDS_INT8 tds_get_int8(TDSSOCKET * tds);
+TDS_SMALLINT tds_get_smallint_slow(TDSSOCKET * tds);
+TDS_INT tds_get_int_slow(TDSSOCKET * tds);
+TDS_INT8 tds_get_int8_slow(TDSSOCKET * tds);
+const unsigned char *tds_get_span_slow(TDSSOCKET * tds, unsigned int n);
 int tds_get_string(TDSSOCKET * tds, int string_len, char *dest, size_t dest_size);
 TDSRET tds_get_char_data(TDSSOCKET * tds, char *dest, size_t wire_size, TDSCOLUMN * curcol);
 void *tds_get_n(TDSSOCKET * tds, /*@out@*/ /*@null@*/ void *dest, int n);
 int tds_get_size_by_type(int servertype);
 
+/**
+ * Get n bytes from the server without copying them.
+ * Returns a pointer into the network buffer, valid till next read, or
+ * NULL if data are not contiguous (they cross a packet boundary). On
+ * NULL nothing is consumed and caller should use tds_get_n.
+ */
+static inline const unsigned char *
+tds_get_span(TDSSOCKET * tds, unsigned int n)
+{
+	if (tds->in_len - tds->in_pos >= n) {
+		const unsigned char *p = tds->in_buf + tds->in_pos;
+		tds->in_pos += n;
+		return p;
+	}
+	return tds_get_span_slow(tds, n);
+}
+
+/*
+ * Integers are read directly from network buffer if all bytes are
+ * available, otherwise read.c functions handle packet boundaries.
+ */
+#if WORDS_BIGENDIAN
+#define TDS_WIRE_LE(tds) (tds_conn(tds)->emul_little_endian)
+#else
+#define TDS_WIRE_LE(tds) 1
+#endif
+
+/** Get an int16 from the server. */
+static inline TDS_SMALLINT
+tds_get_smallint(TDSSOCKET * tds)
+{
+	const unsigned char *p = tds->in_buf + tds->in_pos;
+
+	if (tds->in_len - tds->in_pos < 2)
+		return tds_get_smallint_slow(tds);
+	tds->in_pos += 2;
+	if (TDS_WIRE_LE(tds))
+		return (TDS_SMALLINT) (p[0] | (p[1] << 8));
+	return (TDS_SMALLINT) ((p[0] << 8) | p[1]);
+}
+
+/** Get an int32 from the server. */
+static inline TDS_INT
+tds_get_int(TDSSOCKET * tds)
+{
+	const unsigned char *p = tds->in_buf + tds->in_pos;
+
+	if (tds->in_len - tds->in_pos < 4)
+		return tds_get_int_slow(tds);
+	tds->in_pos += 4;
+	if (TDS_WIRE_LE(tds))
+		return (TDS_INT) (p[0] | (p[1] << 8) | (p[2] << 16) | ((TDS_UINT) p[3] << 24));
+	return (TDS_INT) (((TDS_UINT) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+/** Get an int64 from the server. */
+static inline TDS_INT8
+tds_get_int8(TDSSOCKET * tds)
+{
+	const unsigned char *p = tds->in_buf + tds->in_pos;
+	TDS_UINT l, h;
+
+	if (tds->in_len - tds->in_pos < 8)
+		return tds_get_int8_slow(tds);
+	tds->in_pos += 8;
+	if (TDS_WIRE_LE(tds)) {
+		l = p[0] | (p[1] << 8) | (p[2] << 16) | ((TDS_UINT) p[3] << 24);
+		h = p[4] | (p[5] << 8) | (p[6] << 16) | ((TDS_UINT) p[7] << 24);
+	} else {
+		h = ((TDS_UINT) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		l = ((TDS_UINT) p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+	}
+	return (TDS_INT8) (((TDS_UINT8) h << 32) | l);
+}
+
 
 /* util.c */
 int tdserror (const TDSCONTEXT * tds_ctx, TDSSOCKET * tds, int msgno, int errnum);
 TDS_STATE tds_set_state(TDSSOCKET * tds, TDS_STATE state);
 int tds_swap_bytes(unsigned char *buf, int bytes);
+unsigned int tds_gettime_ms(void);
 
 /* log.c */
 void tdsdump_off(void);
@@ -1245,13 +1510,26 @@ extern int tds_g_append_mode;
 TDSERRNO tds_open_socket(TDSSOCKET * tds, const char *ip_addr, unsigned int port, int timeout, int *p_oserr);
 int tds_close_socket(TDSSOCKET * tds);
 int tds_read_packet(TDSSOCKET * tds);
+int tds_read_available(TDSSOCKET * tds);
+int tds_response_ready(TDSSOCKET * tds);
+TDSRET tds_mars_open_session(TDSSOCKET * tds);
+unsigned int tds_mars_close_session(TDSSOCKET * tds);
 TDSRET tds_write_packet(TDSSOCKET * tds, unsigned char final);
+int tds_write_direct(TDSSOCKET * tds, const unsigned char *buf, size_t len);
 int tds7_get_instance_ports(FILE *output, const char *ip_addr);
 int tds7_get_instance_port(const char *ip_addr, const char *instance);
 TDSRET tds_ssl_init(TDSSOCKET *tds);
 void tds_ssl_deinit(TDSSOCKET *tds);
 const char *tds_prwsaerror(int erc);
 
+/* poller.c */
+TDSPOLLER *tds_alloc_poller(void);
+void tds_free_poller(TDSPOLLER * poller);
+int tds_poller_add(TDSPOLLER * poller, TDSSOCKET * tds);
+void tds_poller_remove(TDSPOLLER * poller, TDSSOCKET * tds);
+int tds_poller_wait(TDSPOLLER * poller, int timeout_ms, TDSSOCKET ** ready);
+int tds_wait_response(TDSSOCKET * tds, int timeout_ms);
+
 
 
 /* vstrbuild.c */
@@ -1259,9 +1537,15 @@ TDSRET tds_vstrbuild(char *buffer, int buflen, int *resultlen, const char *text,
 		  va_list ap);
 
 /* numeric.c */
+char *tds_format_uint8(char *s, TDS_UINT8 n);
+char *tds_flt8_to_string(TDS_FLOAT value, char *s);
+char *tds_real_to_string(TDS_REAL value, char *s);
 char *tds_money_to_string(const TDS_MONEY * money, char *s);
 TDS_INT tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s);
 TDS_INT tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, unsigned char new_scale);
+TDS_INT tds_numeric_from_string(TDS_NUMERIC * numeric, const char *s, const char *end);
+TDS_INT tds_numeric_to_int8(const TDS_NUMERIC * numeric, TDS_INT8 * value);
+TDS_INT tds_numeric_to_flt8(const TDS_NUMERIC * numeric, TDS_FLOAT * value);
 
 /* getmac.c */
 void tds_getmac(TDS_SYS_SOCKET s, unsigned char mac[6]);
@@ -1317,11 +1601,13 @@ TDSRET tds_writetext_end(TDSSOCKET *tds);
 #define IS_TDS71(x) (x->tds_version==0x701)
 #define IS_TDS72(x) (x->tds_version==0x702)
 #define IS_TDS73(x) (x->tds_version==0x703)
+#define IS_TDS74(x) (x->tds_version==0x704)
 
 #define IS_TDS7_PLUS(x) ((x)->tds_version>=0x700)
 #define IS_TDS71_PLUS(x) ((x)->tds_version>=0x701)
 #define IS_TDS72_PLUS(x) ((x)->tds_version>=0x702)
 #define IS_TDS73_PLUS(x) ((x)->tds_version>=0x703)
+#define IS_TDS74_PLUS(x) ((x)->tds_version>=0x704)
 
 #define TDS_MAJOR(x) ((x)->tds_version >> 8)
 #define TDS_MINOR(x) ((x)->tds_version & 0xff)
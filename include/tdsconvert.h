@@ -75,14 +75,33 @@ CONV_RESULT;
 /* sized types */
 #define TDS_CONVERT_CHAR	256
 #define TDS_CONVERT_BINARY	257
+/** destination is a TDSDATEREC, only for tds_convert_batch */
+#define TDS_CONVERT_DATEREC	258
 
 unsigned char tds_willconvert(int srctype, int desttype);
 
 TDS_INT tds_get_null_type(int srctype);
 TDS_INT tds_char2hex(TDS_CHAR *dest, TDS_UINT destlen, const TDS_CHAR * src, TDS_UINT srclen);
 TDS_INT tds_convert(const TDSCONTEXT * context, int srctype, const TDS_CHAR * src, TDS_UINT srclen, int desttype, CONV_RESULT * cr);
+TDS_CONVERT_FUNC tds_get_converter(int srctype, int desttype);
+TDS_CONVERT_FUNC tds_column_converter(TDSCOLUMN * col, int srctype, int desttype);
+TDS_INT tds_convert_batch(const TDSCONTEXT * context, int srctype, const TDS_CHAR * src, TDS_UINT srcstride, const TDS_INT * srclens,
+			  int desttype, TDS_CHAR * dest, TDS_UINT deststride, TDS_INT * destlens, TDS_SMALLINT * nullind, TDS_UINT count);
+
+/** date format compiled by tds_datefmt_compile */
+typedef struct tds_datefmt
+{
+	/** original format, used directly if it can't be compiled */
+	const char *format;
+	/** length of prog, 0 if format is not compiled */
+	unsigned int prog_len;
+	/** operations to do, see convert.c */
+	unsigned char prog[96];
+} TDSDATEFMT;
 
 size_t tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * timeptr, int prec);
+int tds_datefmt_compile(TDSDATEFMT * fmt, const char *format);
+size_t tds_datefmt_format(const TDSDATEFMT * fmt, char *buf, size_t maxsize, const TDSDATEREC * dr, int prec);
 
 #ifdef __cplusplus
 #if 0
@@ -93,6 +93,7 @@ struct tdsiconvinfo
 #define TDS_ENCODING_INDIRECT 1
 #define TDS_ENCODING_SWAPBYTE 2
 #define TDS_ENCODING_MEMCPY   4
+#define TDS_ENCODING_NATIVE   8	/* use built-in converters instead of iconv */
 	unsigned int flags;
 
 	iconv_t to_wire;	/* conversion from client charset to server's format */
@@ -110,6 +111,11 @@ struct tdsiconvinfo
 	 * can prepopulate it.  
 	 */ 
 	TDS_ERRNO_MESSAGE_FLAGS suppress;
+
+	/** process wide cache entry descriptors were taken from, see iconv.c */
+	struct tds_iconv_cache *cache;
+	/** next conversion in connection hash table (char_conv_hash) */
+	struct tdsiconvinfo *hash_next;
 };
 
 /* We use ICONV_CONST for tds_iconv(), even if we don't have iconv() */
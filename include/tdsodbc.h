@@ -376,6 +376,11 @@ struct _hstmt
 	SQLSMALLINT htype;	/* do not reorder this field */
 	struct _sql_errors errs;	/* do not reorder this field */
 	struct _hdbc *dbc;
+	/**
+	 * socket used by the statement while it's processing a query,
+	 * connection one or a MARS session. NULL if statement is not active
+	 */
+	TDSSOCKET *tds;
 	/** query to execute */
 	char *query;
 
@@ -492,7 +497,8 @@ BOOL get_login_info(HWND hwndParent, TDSLOGIN * login);
 	ODBC_PARAM(APP) \
 	ODBC_PARAM(WSID) \
 	ODBC_PARAM(UseNTLMv2) \
-	ODBC_PARAM(MARS_Connection)
+	ODBC_PARAM(MARS_Connection) \
+	ODBC_PARAM(PreparedCacheSize)
 
 #define ODBC_PARAM(p) ODBC_PARAM_##p,
 enum {
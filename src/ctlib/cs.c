@@ -374,6 +374,7 @@ cs_ctx_alloc(CS_INT version, CS_CONTEXT ** ctx)
 		return CS_FAIL;
 	}
 	(*ctx)->tds_ctx = tds_ctx;
+	(*ctx)->netio = CS_SYNC_IO;
 	if (tds_ctx->locale && !tds_ctx->locale->date_fmt) {
 		/* set default in case there's no locale file */
 		tds_ctx->locale->date_fmt = strdup(STD_DATETIME_FMT);
@@ -407,6 +408,7 @@ cs_ctx_drop(CS_CONTEXT * ctx)
 	if (ctx) {
 		_ct_diag_clearmsg(ctx, CS_ALLMSG_TYPE);
 		free(ctx->userdata);
+		tds_free_poller(ctx->poller);
 		if (ctx->tds_ctx)
 			tds_free_context(ctx->tds_ctx);
 		free(ctx);
@@ -510,6 +512,17 @@ cs_config(CS_CONTEXT * ctx, CS_INT action, CS_INT property, CS_VOID * buffer, CS
 
 CS_RETCODE
 cs_convert(CS_CONTEXT * ctx, CS_DATAFMT * srcfmt, CS_VOID * srcdata, CS_DATAFMT * destfmt, CS_VOID * destdata, CS_INT * resultlen)
+{
+	return _cs_convert(ctx, srcfmt, srcdata, destfmt, destdata, resultlen, NULL);
+}
+
+/**
+ * Like cs_convert, col (can be NULL) is the column converted and is used
+ * to cache the converter between rows
+ */
+CS_RETCODE
+_cs_convert(CS_CONTEXT * ctx, CS_DATAFMT * srcfmt, CS_VOID * srcdata, CS_DATAFMT * destfmt, CS_VOID * destdata, CS_INT * resultlen,
+	    TDSCOLUMN * col)
 {
 	int src_type, src_len, desttype, destlen, len, i = 0;
 	CONV_RESULT cres;
@@ -517,6 +530,7 @@ cs_convert(CS_CONTEXT * ctx, CS_DATAFMT * srcfmt, CS_VOID * srcdata, CS_DATAFMT
 	CS_RETCODE ret;
 	CS_INT dummy;
 	CS_VARCHAR *destvc = NULL;
+	TDS_CONVERT_FUNC convert;
 
 	tdsdump_log(TDS_DBG_FUNC, "cs_convert(%p, %p, %p, %p, %p, %p)\n", ctx, srcfmt, srcdata, destfmt, destdata, resultlen);
 
@@ -715,7 +729,8 @@ cs_convert(CS_CONTEXT * ctx, CS_DATAFMT * srcfmt, CS_VOID * srcdata, CS_DATAFMT
 	}
 
 	tdsdump_log(TDS_DBG_FUNC, "cs_convert() calling tds_convert\n");
-	len = tds_convert(ctx->tds_ctx, src_type, (TDS_CHAR*) srcdata, src_len, desttype, &cres);
+	convert = col ? tds_column_converter(col, src_type, desttype) : tds_convert;
+	len = convert(ctx->tds_ctx, src_type, (TDS_CHAR*) srcdata, src_len, desttype, &cres);
 
 	tdsdump_log(TDS_DBG_FUNC, "cs_convert() tds_convert returned %d\n", len);
 
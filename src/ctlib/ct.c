@@ -33,9 +33,14 @@
 #include <string.h>
 #endif /* HAVE_STRING_H */
 
+#if HAVE_ERRNO_H
+# include <errno.h>
+#endif /* HAVE_ERRNO_H */
+
 #include "ctpublic.h"
 #include "ctlib.h"
 #include "tdsstring.h"
+#include "tdsconvert.h"
 #include "replacements.h"
 
 TDS_RCSID(var, "$Id: ct.c,v 1.218 2011/07/27 16:30:24 freddy77 Exp $");
@@ -56,9 +61,36 @@ void _ctclient_msg(CS_CONNECTION * con, const char *funcname, int layer, int ori
 			  const char *fmt, ...);
 int _ct_bind_data(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo, CS_INT offset);
 static void _ct_initialise_cmd(CS_COMMAND *cmd);
+
+/* column of an array bind converted with tds_convert_batch at the end of ct_fetch */
+typedef struct _ct_batch_col
+{
+	int srctype;
+	TDS_UINT srcsize;
+	/** raw values, bind count * srcsize bytes, followed by lens */
+	TDS_CHAR *data;
+	/** lengths of raw values, negative for NULL */
+	TDS_INT *lens;
+	/* bind of the column, saved in case results are freed */
+	int desttype;
+	TDS_CHAR *dest;
+	TDS_INT destlen;
+	TDS_INT *lenbind;
+	TDS_SMALLINT *nullbind;
+} CT_BATCH_COL;
+static int _ct_bind_row(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo, CS_INT offset, CT_BATCH_COL * batch);
+static CT_BATCH_COL *_ct_batch_alloc(TDSRESULTINFO * resinfo, CS_INT count);
+static void _ct_batch_convert(CS_CONTEXT * ctx, int num_cols, CT_BATCH_COL * batch, CS_INT rows);
+static CS_RETCODE _ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type);
 static CS_RETCODE _ct_cancel_cleanup(CS_COMMAND * cmd);
 static CS_RETCODE _ct_cmd_drop(CS_COMMAND * cmd, CS_INT free_conn_ref);
 
+/* asynchronous operations */
+#define _ct_async_wanted(con) ((con)->netio != CS_SYNC_IO && !(con)->async.running)
+static CS_RETCODE _ct_async_start(CS_COMMAND * cmd, CS_INT func, CS_INT * result, CS_INT type, CS_INT offset, CS_INT option);
+static void _ct_async_run(CS_CONNECTION * con);
+static void _ct_async_clear(CS_CONNECTION * con);
+
 /* Added for CT_DIAG */
 /* Code changes starts here - CT_DIAG - 01 */
 
@@ -160,6 +192,12 @@ _ct_get_user_api_layer_error(int error)
 	case 143:
 		return "parameter name(s) must be supplied for LANGUAGE command.";
 		break;
+	case 144:
+		return "This routine cannot be called while an asynchronous operation is pending on the connection.";
+		break;
+	case 145:
+		return "Results of commands queued before this one on the connection must be processed first.";
+		break;
 	case 16843163:
 		return "This routine cannot be called when the command structure is idle.";
 		break;
@@ -286,6 +324,7 @@ ct_con_alloc(CS_CONTEXT * ctx, CS_CONNECTION ** con)
 	}
 	(*con)->tds_login = login;
 	(*con)->server_addr = NULL;
+	(*con)->netio = ctx->netio;
 
 	/* so we know who we belong to */
 	(*con)->ctx = ctx;
@@ -439,6 +478,16 @@ ct_con_props(CS_CONNECTION * con, CS_INT action, CS_INT property, CS_VOID * buff
 			memcpy(&intval, buffer, sizeof(intval));
 			tds_set_packet(tds_login, (short) intval);
 			break;
+		case CS_NETIO:
+			memcpy(&intval, buffer, sizeof(intval));
+			if ((intval != CS_SYNC_IO && intval != CS_ASYNC_IO && intval != CS_DEFER_IO) || con->async.func)
+				return CS_FAIL;
+			con->netio = intval;
+			break;
+		case CS_PIPELINE:
+			memcpy(&intval, buffer, sizeof(intval));
+			con->pipeline = intval ? CS_TRUE : CS_FALSE;
+			break;
 		case CS_TDS_VERSION:
 			/*
 			 * FIXME
@@ -541,6 +590,16 @@ ct_con_props(CS_CONNECTION * con, CS_INT action, CS_INT property, CS_VOID * buff
 			if (out_len)
 				*out_len = sizeof(intval);
 			break;
+		case CS_NETIO:
+			memcpy(buffer, &con->netio, sizeof(con->netio));
+			if (out_len)
+				*out_len = sizeof(con->netio);
+			break;
+		case CS_PIPELINE:
+			memcpy(buffer, &con->pipeline, sizeof(con->pipeline));
+			if (out_len)
+				*out_len = sizeof(con->pipeline);
+			break;
 		case CS_TDS_VERSION:
 			switch (tds->tds_version) {
 			case 0x400:
@@ -852,6 +911,80 @@ _ct_initialise_cmd(CS_COMMAND *cmd)
 	cmd->rpc = NULL;
 }
 
+/**
+ * Queue a command in the connection pipeline (CS_PIPELINE property).
+ * Queued commands are sent all together by first ct_results() call.
+ */
+static CS_RETCODE
+_ct_pipeline_queue(CS_COMMAND * cmd)
+{
+	TDSSOCKET *tds = cmd->con->tds_socket;
+	TDSPARAMINFO *pparam_info;
+	TDSDYNAMIC *tdsdyn;
+	unsigned int pos = tds->pipeline.num_requests;
+	TDSRET ret;
+
+	tdsdump_log(TDS_DBG_FUNC, "_ct_pipeline_queue(%p) position %u\n", cmd, pos);
+
+	switch (cmd->command_type) {
+	case CS_LANG_CMD:
+		ret = tds_pipeline_query(tds, cmd->query, NULL);
+		break;
+	case CS_RPC_CMD:
+		if (cmd->rpc == NULL || cmd->rpc->name == NULL)
+			return CS_FAIL;
+		pparam_info = paraminfoalloc(tds, cmd->rpc->param_list);
+		ret = tds_pipeline_rpc(tds, cmd->rpc->name, pparam_info);
+		tds_free_param_results(pparam_info);
+		break;
+	default:
+		tdsdyn = cmd->dyn ? cmd->dyn->tdsdyn : NULL;
+		if (!tdsdyn)
+			return CS_FAIL;
+		tds_free_input_params(tdsdyn);
+		tdsdyn->params = paraminfoalloc(tds, cmd->dyn->param_list);
+		ret = tds_pipeline_execute(tds, tdsdyn);
+		break;
+	}
+
+	if (ret != TDS_SUCCESS)
+		return CS_FAIL;
+
+	ct_set_command_state(cmd, _CS_COMMAND_SENT);
+	cmd->pipelined = 1;
+	cmd->pipeline_pos = pos;
+	return CS_SUCCEED;
+}
+
+/**
+ * Prepare reading results of a pipelined command. Send the pipeline if
+ * not already sent and move to the response of the command.
+ */
+static CS_RETCODE
+_ct_pipeline_results(CS_COMMAND * cmd)
+{
+	TDSSOCKET *tds = cmd->con->tds_socket;
+
+	/* pipeline terminated (for instance cancelled), no more results */
+	if (tds->state == TDS_IDLE) {
+		cmd->pipelined = 0;
+		return CS_SUCCEED;
+	}
+
+	if (tds->state == TDS_QUERYING && tds_pipeline_send(tds) != TDS_SUCCESS)
+		return CS_FAIL;
+
+	if (tds->pipeline.current == cmd->pipeline_pos)
+		return CS_SUCCEED;
+
+	/* responses are read in order, previous command must be completed */
+	if (tds->pipeline.current + 1 == cmd->pipeline_pos && tds_pipeline_next(tds) == TDS_SUCCESS)
+		return CS_SUCCEED;
+
+	_ctclient_msg(cmd->con, "ct_results", 1, 1, 1, 145, "");
+	return CS_FAIL;
+}
+
 CS_RETCODE
 ct_send(CS_COMMAND * cmd)
 {
@@ -869,6 +1002,9 @@ ct_send(CS_COMMAND * cmd)
 	if (!cmd->con || !cmd->con->tds_socket)
 		return CS_FAIL;
 
+	if (_ct_async_wanted(cmd->con))
+		return _ct_async_start(cmd, CT_SEND, NULL, 0, 0, 0);
+
 	tds = cmd->con->tds_socket;
 
 	if (cmd->cancel_state == _CS_CANCEL_PENDING) {
@@ -884,6 +1020,16 @@ ct_send(CS_COMMAND * cmd)
 
 	cmd->results_state = _CS_RES_NONE;
 
+	/*
+	 * with CS_PIPELINE queue commands libTDS can send as RPCs,
+	 * language commands with parameters are sent as usual
+	 */
+	cmd->pipelined = 0;
+	if (cmd->con->pipeline && IS_TDS7_PLUS(tds)
+	    && ((cmd->command_type == CS_LANG_CMD && !cmd->input_params) || cmd->command_type == CS_RPC_CMD
+		|| (cmd->command_type == CS_DYNAMIC_CMD && cmd->dynamic_cmd == CS_EXECUTE)))
+		return _ct_pipeline_queue(cmd);
+
 	if (cmd->command_type == CS_DYNAMIC_CMD) {
 
 		if (cmd->dyn == NULL)
@@ -891,14 +1037,26 @@ ct_send(CS_COMMAND * cmd)
 
 		switch (cmd->dynamic_cmd) {
 		case CS_PREPARE:
-			if (tds_submit_prepare(tds, cmd->dyn->stmt, cmd->dyn->id, NULL, NULL) == TDS_FAIL)
+			if (cmd->dyn->tdsdyn)
+				return CS_FAIL;
+			/* statement prepared by a previous command, nothing to send */
+			cmd->dyn->tdsdyn = tds_dynamic_cache_get(tds, cmd->dyn->stmt, NULL);
+			if (cmd->dyn->tdsdyn) {
+				tds->cur_dyn = cmd->dyn->tdsdyn;
+				ct_set_command_state(cmd, _CS_COMMAND_SENT);
+				cmd->results_state = _CS_RES_CMD_SUCCEED;
+				return CS_SUCCEED;
+			}
+			/* cached statements keep their id so let libTDS choose a free one */
+			if (tds_submit_prepare(tds, cmd->dyn->stmt, tds_conn(tds)->dyn_cache_max ? NULL : cmd->dyn->id,
+					       &cmd->dyn->tdsdyn, NULL) == TDS_FAIL)
 				return CS_FAIL;
 			ct_set_command_state(cmd, _CS_COMMAND_SENT);
 			return CS_SUCCEED;
 			break;
 		case CS_EXECUTE:
 			pparam_info = paraminfoalloc(tds, cmd->dyn->param_list);
-			tdsdyn = tds_lookup_dynamic(tds, cmd->dyn->id);
+			tdsdyn = cmd->dyn->tdsdyn;
 			if (!tdsdyn) {
 				tdsdump_log(TDS_DBG_INFO1, "ct_send(CS_EXECUTE) no tdsdyn!\n");
 				return CS_FAIL;
@@ -928,13 +1086,26 @@ ct_send(CS_COMMAND * cmd)
 			break;
 
 		case CS_DEALLOC:
-			tdsdyn = tds_lookup_dynamic(tds, cmd->dyn->id);
+			tdsdyn = cmd->dyn->tdsdyn;
 			if (!tdsdyn) {
 				tdsdump_log(TDS_DBG_INFO1, "ct_send(CS_DEALLOC) no tdsdyn!\n");
 				return CS_FAIL;
 			}
-			if (tds_submit_unprepare(tds, tdsdyn) == TDS_FAIL)
+			/* keep statement in connection cache, unprepare what we get back */
+			cmd->dyn->tdsdyn = tds_dynamic_cache_put(tds, tdsdyn);
+			if (!cmd->dyn->tdsdyn) {
+				ct_set_command_state(cmd, _CS_COMMAND_SENT);
+				cmd->results_state = _CS_RES_CMD_SUCCEED;
+				return CS_SUCCEED;
+			}
+			if (tds_submit_unprepare(tds, cmd->dyn->tdsdyn) == TDS_FAIL) {
+				/* our statement is cached, drop the evicted one */
+				if (cmd->dyn->tdsdyn != tdsdyn) {
+					tds_free_dynamic(tds, cmd->dyn->tdsdyn);
+					cmd->dyn->tdsdyn = NULL;
+				}
 				return CS_FAIL;
+			}
 
 			ct_set_command_state(cmd, _CS_COMMAND_SENT);
 			return CS_SUCCEED;
@@ -1128,6 +1299,9 @@ ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 	if (!cmd->con || !cmd->con->tds_socket)
 		return CS_FAIL;
 
+	if (_ct_async_wanted(cmd->con))
+		return _ct_async_start(cmd, CT_RESULTS, result_type, 0, 0, 0);
+
 	cmd->bind_count = CS_UNUSED;
 
 	context = cmd->con->ctx;
@@ -1164,6 +1338,9 @@ ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 		break;
 	}
 
+	if (cmd->pipelined && _ct_pipeline_results(cmd) != CS_SUCCEED)
+		return CS_FAIL;
+
 	/*
 	 * see what "result" tokens we have. a "result" in ct-lib terms also
 	 * includes row data. Some result types always get reported back  to
@@ -1178,6 +1355,14 @@ ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 		tdsdump_log(TDS_DBG_FUNC, "ct_results() process_result_tokens returned %d (type %d) \n",
 			    tdsret, res_type);
 
+		/*
+		 * pipelined language commands are executed by sp_executesql,
+		 * their statements end with DONEINPROC instead of DONE
+		 */
+		if (tdsret == TDS_SUCCESS && res_type == TDS_DONEINPROC_RESULT && cmd->pipelined
+		    && cmd->command_type == CS_LANG_CMD)
+			res_type = TDS_DONE_RESULT;
+
 		switch (tdsret) {
 
 		case TDS_SUCCESS:
@@ -1287,6 +1472,9 @@ ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 
 				if ((cmd->command_type == CS_DYNAMIC_CMD) &&
 					(cmd->dynamic_cmd == CS_PREPARE || cmd->dynamic_cmd == CS_DEALLOC)) {
+					/* do not let other commands reuse a failed statement */
+					if (cmd->dynamic_cmd == CS_PREPARE && (done_flags & TDS_DONE_ERROR) && cmd->dyn->tdsdyn)
+						TDS_ZERO_FREE(cmd->dyn->tdsdyn->cache_key);
 					*result_type = CS_CMD_SUCCEED;
 					cmd->results_state = _CS_RES_CMD_DONE;
 					return CS_SUCCEED;
@@ -1418,6 +1606,7 @@ ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 				cmd->command_type == CS_DYNAMIC_CMD) {
 				ct_set_command_state(cmd, _CS_COMMAND_READY);
 			}
+			cmd->pipelined = 0;
 			/* if we have just completed processing a dynamic deallocate */
 			/* get rid of our dynamic statement structure...             */
 
@@ -1512,13 +1701,21 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 	TDS_INT marker;
 	TDS_INT temp_count;
 	TDSSOCKET *tds;
+	TDSRESULTINFO *resinfo;
+	TDSCOLUMN *curcol;
 	CS_INT rows_read_dummy;
+	CT_BATCH_COL *batch = NULL;
+	int batch_cols = 0;
+	CS_RETCODE ret_code = CS_SUCCEED;
 
 	tdsdump_log(TDS_DBG_FUNC, "ct_fetch(%p, %d, %d, %d, %p)\n", cmd, type, offset, option, prows_read);
 
 	if (!cmd->con || !cmd->con->tds_socket)
 		return CS_FAIL;
 
+	if (_ct_async_wanted(cmd->con))
+		return _ct_async_start(cmd, CT_FETCH, prows_read, type, offset, option);
+
 	if (cmd->command_state == _CS_COMMAND_IDLE) {
 		_ctclient_msg(cmd->con, "ct_fetch", 1, 1, 1, 16843163, "");
 		return CS_FAIL;
@@ -1567,13 +1764,33 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 		return CS_CMD_FAIL;
 
 
+	/* discard data of previous row not read with ct_get_data */
+	if (tds_stream_skip(tds) != TDS_SUCCESS)
+		return CS_FAIL;
+
 	marker = tds_peek(tds);
-	if ((cmd->curr_result_type == CS_ROW_RESULT    && marker != TDS_ROW_TOKEN)
+	if ((cmd->curr_result_type == CS_ROW_RESULT    && marker != TDS_ROW_TOKEN && marker != TDS_NBC_ROW_TOKEN)
 	||  (cmd->curr_result_type == CS_STATUS_RESULT && marker != TDS_RETURNSTATUS_TOKEN) )
 		return CS_END_DATA;
 
+	/* last column not bound can be read incrementally with ct_get_data */
+	resinfo = tds->current_results;
+	if (resinfo && resinfo->num_cols > 0) {
+		curcol = resinfo->columns[resinfo->num_cols - 1];
+		curcol->column_stream = cmd->bind_count == 1 && !curcol->column_varaddr;
+	}
+
+	/* bound data are converted before reading further, data can stay in network buffer */
+	tds->zero_copy = 1;
+
 	/* Array Binding Code changes start here */
 
+	/* columns of array binds are converted all together at the end */
+	if (cmd->bind_count > 1 && cmd->curr_result_type == CS_ROW_RESULT && resinfo) {
+		batch = _ct_batch_alloc(resinfo, cmd->bind_count);
+		batch_cols = resinfo->num_cols;
+	}
+
 	for (temp_count = 0; temp_count < cmd->bind_count; temp_count++) {
 
 		ret = tds_process_tokens(tds, &ret_type, NULL,
@@ -1586,37 +1803,51 @@ ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * p
 				if (ret_type == TDS_ROW_RESULT || ret_type == TDS_COMPUTE_RESULT) {
 					cmd->get_data_item = 0;
 					cmd->get_data_bytes_returned = 0;
-					if (_ct_bind_data(cmd->con->ctx, tds->current_results, tds->current_results, temp_count))
-						return CS_ROW_FAIL;
+					if (_ct_bind_row(cmd->con->ctx, tds->current_results, tds->current_results, temp_count,
+							 tds->current_results == resinfo ? batch : NULL)) {
+						ret_code = CS_ROW_FAIL;
+						goto Cleanup;
+					}
 					(*prows_read)++;
 					break;
 				}
 			case TDS_NO_MORE_RESULTS:
-				return CS_END_DATA;
+				ret_code = CS_END_DATA;
+				goto Cleanup;
 				break;
 
 			case TDS_CANCELLED:
 				cmd->cancel_state = _CS_CANCEL_NOCANCEL;
-				return CS_CANCELED;
+				ret_code = CS_CANCELED;
+				goto Cleanup;
 				break;
 
 			default:
-				return CS_FAIL;
+				ret_code = CS_FAIL;
+				goto Cleanup;
 				break;
 		}
 
 		/* have we reached the end of the rows ? */
 
+		/* row data still to read, can't look further */
+		if (tds->stream_col)
+			break;
+
 		marker = tds_peek(tds);
 
-		if (cmd->curr_result_type == CS_ROW_RESULT && marker != TDS_ROW_TOKEN)
+		if (cmd->curr_result_type == CS_ROW_RESULT && marker != TDS_ROW_TOKEN && marker != TDS_NBC_ROW_TOKEN)
 			break;
 
 	}
 
 	/* Array Binding Code changes end here */
 
-	return CS_SUCCEED;
+Cleanup:
+	tds->zero_copy = 0;
+	if (batch)
+		_ct_batch_convert(cmd->con->ctx, batch_cols, batch, *prows_read + (ret_code == CS_ROW_FAIL));
+	return ret_code;
 }
 
 static CS_RETCODE
@@ -1709,8 +1940,115 @@ _ct_fetch_cursor(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS
 }
 
 
+/**
+ * Check if a bound column can be converted a whole array at a time.
+ * Only conversions that cannot fail and give same results of cs_convert
+ * are handled this way, so errors are still reported for the right row.
+ * @return server type of source, 0 if column can't be converted in batch
+ */
+static int
+_ct_batch_type(TDSCOLUMN * curcol)
+{
+	int srctype, desttype;
+
+	if (curcol->column_hidden || !curcol->column_varaddr || curcol->column_bindlen <= 0 || is_blob_col(curcol))
+		return 0;
+
+	srctype = _ct_get_server_type(_ct_get_client_type(curcol));
+	desttype = _ct_get_server_type(curcol->column_bindtype);
+	switch (srctype) {
+	/* integers to same or bigger integers */
+	case SYBINT1:
+		if (desttype == SYBINT1)
+			return srctype;
+	case SYBINT2:
+		if (desttype == SYBINT2)
+			return srctype;
+	case SYBINT4:
+		if (desttype == SYBINT4)
+			return srctype;
+	case SYBINT8:
+		if (desttype == SYBINT8)
+			return srctype;
+		break;
+	case SYBNUMERIC:
+	case SYBDECIMAL:
+		if (desttype == SYBFLT8)
+			return srctype;
+		break;
+	case SYBFLT8:
+	case SYBDATETIME:
+		if (desttype == srctype)
+			return srctype;
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Allocate buffers to save raw values of columns converted in batch.
+ * @return array of num_cols elements or NULL if no column can be
+ *         converted this way
+ */
+static CT_BATCH_COL *
+_ct_batch_alloc(TDSRESULTINFO * resinfo, CS_INT count)
+{
+	CT_BATCH_COL *batch = NULL;
+	TDSCOLUMN *curcol;
+	int i, srctype;
+
+	for (i = 0; i < resinfo->num_cols; ++i) {
+		if (!(srctype = _ct_batch_type(resinfo->columns[i])))
+			continue;
+		if (!batch && !(batch = (CT_BATCH_COL *) calloc(resinfo->num_cols, sizeof(CT_BATCH_COL))))
+			return NULL;
+		batch[i].srctype = srctype;
+		batch[i].srcsize = is_numeric_type(srctype) ? sizeof(TDS_NUMERIC) : tds_get_size_by_type(srctype);
+		batch[i].data = (TDS_CHAR *) malloc(count * (batch[i].srcsize + sizeof(TDS_INT)));
+		/* no memory, convert row by row */
+		if (!batch[i].data)
+			continue;
+		batch[i].lens = (TDS_INT *) (batch[i].data + count * batch[i].srcsize);
+		curcol = resinfo->columns[i];
+		batch[i].desttype = _ct_get_server_type(curcol->column_bindtype);
+		batch[i].dest = curcol->column_varaddr;
+		batch[i].destlen = curcol->column_bindlen;
+		batch[i].lenbind = curcol->column_lenbind;
+		batch[i].nullbind = curcol->column_nullbind;
+	}
+	return batch;
+}
+
+/** Convert saved values to bound variables and free batch */
+static void
+_ct_batch_convert(CS_CONTEXT * ctx, int num_cols, CT_BATCH_COL * batch, CS_INT rows)
+{
+	int i;
+
+	for (i = 0; i < num_cols; ++i) {
+		if (!batch[i].data)
+			continue;
+		if (rows > 0)
+			tds_convert_batch(ctx->tds_ctx, batch[i].srctype, batch[i].data, batch[i].srcsize, batch[i].lens,
+					  batch[i].desttype, batch[i].dest, batch[i].destlen, batch[i].lenbind, batch[i].nullbind, rows);
+		free(batch[i].data);
+	}
+	free(batch);
+}
+
 int
 _ct_bind_data(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo, CS_INT offset)
+{
+	return _ct_bind_row(ctx, resinfo, bindinfo, offset, NULL);
+}
+
+/**
+ * Copy a row to bound variables.
+ * Columns in batch (if not NULL) are only saved, see _ct_batch_alloc.
+ * @return 0 on success
+ */
+static int
+_ct_bind_row(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo, CS_INT offset, CT_BATCH_COL * batch)
 {
 	TDSCOLUMN *curcol, *bindcol;
 	unsigned char *src, *dest, *temp_add;
@@ -1732,6 +2070,13 @@ _ct_bind_data(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo,
 		if (curcol->column_hidden)
 			continue;
 
+		if (batch && batch[i].data) {
+			batch[i].lens[offset] = curcol->column_cur_size;
+			if (curcol->column_cur_size >= 0)
+				memcpy(batch[i].data + offset * batch[i].srcsize, curcol->column_data, batch[i].srcsize);
+			continue;
+		}
+
 		/*
 		 * Retrieve the initial bound column_varaddress and increment it if offset specified
 		 */
@@ -1768,7 +2113,7 @@ _ct_bind_data(CS_CONTEXT *ctx, TDSRESULTINFO * resinfo, TDSRESULTINFO *bindinfo,
 				destfmt.format = bindcol->column_bindfmt;
 
 				/* if convert return FAIL mark error but process other columns */
-				if ((result= cs_convert(ctx, &srcfmt, src, &destfmt, dest, pdatalen) != CS_SUCCEED)) {
+				if ((result= _cs_convert(ctx, &srcfmt, src, &destfmt, dest, pdatalen, curcol) != CS_SUCCEED)) {
 					tdsdump_log(TDS_DBG_FUNC, "cs_convert-result = %d\n", result);
 					result = 1;
 					tdsdump_log(TDS_DBG_INFO1, "error: converted only %d bytes for type %d \n",
@@ -1860,6 +2205,7 @@ ct_close(CS_CONNECTION * con, CS_INT option)
 {
 	tdsdump_log(TDS_DBG_FUNC, "ct_close(%p, %d)\n", con, option);
 
+	_ct_async_clear(con);
 	tds_free_socket(con->tds_socket);
 	con->tds_socket = NULL;
 	return CS_SUCCEED;
@@ -1873,6 +2219,7 @@ ct_con_drop(CS_CONNECTION * con)
 	tdsdump_log(TDS_DBG_FUNC, "ct_con_drop(%p)\n", con);
 
 	if (con) {
+		_ct_async_clear(con);
 		free(con->userdata);
 		if (con->tds_login)
 			tds_free_login(con->tds_login);
@@ -1888,6 +2235,7 @@ ct_con_drop(CS_CONNECTION * con)
 		}
 		if (con->locale)
 			_cs_locale_free(con->locale);
+		tds_name_index_free(&con->dyn_index);
 		free(con->server_addr);
 		free(con);
 	}
@@ -2043,14 +2391,31 @@ _ct_get_server_type(int datatype)
 
 CS_RETCODE
 ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type)
+{
+	CS_CONNECTION *con = conn ? conn : (cmd ? cmd->con : NULL);
+	CS_RETCODE ret;
+
+	tdsdump_log(TDS_DBG_FUNC, "ct_cancel(%p, %p, %d)\n", conn, cmd, type);
+
+	if (!con)
+		return _ct_cancel(conn, cmd, type);
+
+	/* cancel is always synchronous, pending asynchronous operation is discarded */
+	_ct_async_clear(con);
+	con->async.running = 1;
+	ret = _ct_cancel(conn, cmd, type);
+	con->async.running = 0;
+	return ret;
+}
+
+static CS_RETCODE
+_ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type)
 {
 	CS_RETCODE ret;
 	CS_COMMAND_LIST *cmds;
 	CS_COMMAND *conn_cmd;
 	CS_CONNECTION *cmd_conn;
 
-	tdsdump_log(TDS_DBG_FUNC, "ct_cancel(%p, %p, %d)\n", conn, cmd, type);
-
 	/*
 	 * Comments taken from Sybase ct-library reference manual
 	 * ------------------------------------------------------
@@ -2409,6 +2774,30 @@ ct_config(CS_CONTEXT * ctx, CS_INT action, CS_INT property, CS_VOID * buffer, CS
 			ret = CS_FAIL;
 		}
 		break;
+	case CS_NETIO:
+		switch (action) {
+		case CS_SUPPORTED:
+			*buf = CS_TRUE;
+			break;
+		case CS_SET:
+			if (*buf != CS_SYNC_IO && *buf != CS_ASYNC_IO && *buf != CS_DEFER_IO)
+				ret = CS_FAIL;
+			else
+				ctx->netio = *buf;
+			break;
+		case CS_GET:
+			if (buf)
+				*buf = ctx->netio;
+			else
+				ret = CS_FAIL;
+			break;
+		case CS_CLEAR:
+			ctx->netio = CS_SYNC_IO;
+			break;
+		default:
+			ret = CS_FAIL;
+		}
+		break;
 	case CS_VER_STRING: {
 		ret = CS_FAIL;
 		switch (action) {
@@ -2636,6 +3025,16 @@ ct_compute_info(CS_COMMAND * cmd, CS_INT type, CS_INT colnum, CS_VOID * buffer,
 	return CS_SUCCEED;
 }
 
+/* copy column data to client buffer, data are read from network if column is streamed */
+static int
+_ct_get_data_copy(TDSSOCKET * tds, TDSCOLUMN * curcol, CS_VOID * buffer, const unsigned char *src, CS_INT len)
+{
+	if (tds->stream_col == curcol)
+		return tds_stream_read(tds, curcol, buffer, len);
+	memcpy(buffer, src, len);
+	return len;
+}
+
 CS_RETCODE
 ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_INT * outlen)
 {
@@ -2743,7 +3142,8 @@ ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_I
 	/* if we have enough buffer to cope with all the data */
 
 	if (buflen >= srclen) {
-		memcpy(buffer, src, srclen);
+		if (_ct_get_data_copy(cmd->con->tds_socket, curcol, buffer, src, srclen) != srclen)
+			return CS_FAIL;
 		cmd->get_data_bytes_returned += srclen;
 		if (outlen)
 			*outlen = srclen;
@@ -2752,7 +3152,8 @@ ct_get_data(CS_COMMAND * cmd, CS_INT item, CS_VOID * buffer, CS_INT buflen, CS_I
 		return CS_END_DATA;
 
 	}
-	memcpy(buffer, src, buflen);
+	if (_ct_get_data_copy(cmd->con->tds_socket, curcol, buffer, src, buflen) != buflen)
+		return CS_FAIL;
 	cmd->get_data_bytes_returned += buflen;
 	if (outlen)
 		*outlen = buflen;
@@ -3654,15 +4055,187 @@ SEND_OPTION:
 	return CS_SUCCEED;
 }				/* end ct_options() */
 
+/**
+ * Start an asynchronous operation.
+ * Operation is executed immediately if it does not need to wait for the server,
+ * otherwise when ct_poll finds the connection ready.
+ * \return CS_PENDING or CS_BUSY if another operation is pending
+ */
+static CS_RETCODE
+_ct_async_start(CS_COMMAND * cmd, CS_INT func, CS_INT * result, CS_INT type, CS_INT offset, CS_INT option)
+{
+	CS_CONNECTION *con = cmd->con;
+	CS_CONTEXT *ctx = con->ctx;
+	TDSSOCKET *tds = con->tds_socket;
+	CT_ASYNC *async = &con->async;
+
+	tdsdump_log(TDS_DBG_FUNC, "_ct_async_start(%p, %d)\n", cmd, func);
+
+	if (async->func) {
+		_ctclient_msg(con, func == CT_SEND ? "ct_send" : func == CT_RESULTS ? "ct_results" : "ct_fetch",
+			      1, 1, 1, 144, "");
+		return CS_BUSY;
+	}
+
+	async->func = func;
+	async->cmd = cmd;
+	async->result = result;
+	async->type = type;
+	async->offset = offset;
+	async->option = option;
+	async->completed = 0;
+	++ctx->async_pending;
+
+	/*
+	 * Sending does not wait for the server and if the response is
+	 * already buffered reading does not wait either.
+	 * If the connection can't be polled wait synchronously.
+	 */
+	if (func == CT_SEND || IS_TDSDEAD(tds) || tds->state == TDS_IDLE || tds_response_ready(tds)
+	    || (!ctx->poller && !(ctx->poller = tds_alloc_poller()))
+	    || tds_poller_add(ctx->poller, tds) < 0)
+		_ct_async_run(con);
+
+	return CS_PENDING;
+}
+
+/**
+ * Execute pending asynchronous operation and queue it for ct_poll.
+ */
+static void
+_ct_async_run(CS_CONNECTION * con)
+{
+	CT_ASYNC *async = &con->async;
+	CS_CONNECTION **p;
+
+	tdsdump_log(TDS_DBG_FUNC, "_ct_async_run(%p)\n", con);
+
+	if (con->ctx->poller)
+		tds_poller_remove(con->ctx->poller, con->tds_socket);
+
+	async->running = 1;
+	switch (async->func) {
+	case CT_SEND:
+		async->status = ct_send(async->cmd);
+		break;
+	case CT_RESULTS:
+		async->status = ct_results(async->cmd, async->result);
+		break;
+	case CT_FETCH:
+		async->status = ct_fetch(async->cmd, async->type, async->offset, async->option, async->result);
+		break;
+	}
+	async->running = 0;
+	async->completed = 1;
+
+	/* append to completed list, reported in order */
+	for (p = &con->ctx->async_done; *p; p = &(*p)->async.next_done)
+		continue;
+	*p = con;
+	async->next_done = NULL;
+}
+
+/**
+ * Remove pending asynchronous operation, if any.
+ */
+static void
+_ct_async_clear(CS_CONNECTION * con)
+{
+	CS_CONTEXT *ctx = con->ctx;
+	CS_CONNECTION **p;
+
+	if (!con->async.func)
+		return;
+
+	if (con->async.completed) {
+		for (p = &ctx->async_done; *p; p = &(*p)->async.next_done)
+			if (*p == con) {
+				*p = con->async.next_done;
+				break;
+			}
+	} else if (ctx->poller && con->tds_socket) {
+		tds_poller_remove(ctx->poller, con->tds_socket);
+	}
+	con->async.func = 0;
+	con->async.completed = 0;
+	--ctx->async_pending;
+}
+
+/**
+ * Check for completed asynchronous operations.
+ * Connections in CS_ASYNC_IO and CS_DEFER_IO mode are handled the same,
+ * completions are reported only by ct_poll.
+ * \param ctx context to check, used if \a connection is NULL
+ * \param connection connection to check, NULL to check all connections of the context
+ * \param milliseconds time to wait, CS_NO_LIMIT to wait forever, 0 to not wait
+ * \param compconn output, connection with the completed operation
+ * \param compcmd output, command with the completed operation
+ * \param compid output, function completed (CT_SEND, CT_RESULTS or CT_FETCH)
+ * \param compstatus output, return code of the function completed
+ * \return CS_SUCCEED an operation completed, CS_TIMED_OUT, CS_QUIET no operation pending,
+ *	CS_INTERRUPT or CS_FAIL
+ */
 CS_RETCODE
 ct_poll(CS_CONTEXT * ctx, CS_CONNECTION * connection, CS_INT milliseconds, CS_CONNECTION ** compconn, CS_COMMAND ** compcmd,
 	CS_INT * compid, CS_INT * compstatus)
 {
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED ct_poll()\n");
+	CS_CONNECTION *con;
+	TDSSOCKET *tds;
+	int timeout, rc;
+
 	tdsdump_log(TDS_DBG_FUNC, "ct_poll(%p, %p, %d, %p, %p, %p, %p)\n",
 				ctx, connection, milliseconds, compconn, compcmd, compid, compstatus);
 
-	return CS_FAIL;
+	if (connection)
+		ctx = connection->ctx;
+	if (!ctx)
+		return CS_FAIL;
+
+	if (milliseconds == CS_NO_LIMIT)
+		timeout = -1;
+	else if (milliseconds >= 0)
+		timeout = milliseconds;
+	else
+		return CS_FAIL;
+
+	if (connection) {
+		con = connection;
+		if (!con->async.func)
+			return CS_QUIET;
+		if (!con->async.completed) {
+			rc = tds_wait_response(con->tds_socket, timeout);
+			if (rc == 0)
+				return CS_TIMED_OUT;
+			if (rc < 0)
+				return sock_errno == TDSSOCK_EINTR ? CS_INTERRUPT : CS_FAIL;
+			_ct_async_run(con);
+		}
+	} else {
+		if (!ctx->async_pending)
+			return CS_QUIET;
+		if (!ctx->async_done) {
+			/* only connections waiting data are in the poller, so any ready connection completes */
+			rc = tds_poller_wait(ctx->poller, timeout, &tds);
+			if (rc == 0)
+				return CS_TIMED_OUT;
+			if (rc < 0)
+				return sock_errno == TDSSOCK_EINTR ? CS_INTERRUPT : CS_FAIL;
+			_ct_async_run((CS_CONNECTION *) tds_get_parent(tds));
+		}
+		con = ctx->async_done;
+	}
+
+	if (compconn)
+		*compconn = con;
+	if (compcmd)
+		*compcmd = con->async.cmd;
+	if (compid)
+		*compid = con->async.func;
+	if (compstatus)
+		*compstatus = con->async.status;
+	_ct_async_clear(con);
+
+	return CS_SUCCEED;
 }
 
 CS_RETCODE
@@ -4527,9 +5100,19 @@ _ct_allocate_dynamic(CS_CONNECTION * con, char *id, int idlen)
 
 	if (dyn != NULL) {
 		dyn->id = (char*) malloc(id_len + 1);
+		if (!dyn->id) {
+			free(dyn);
+			return NULL;
+		}
 		strncpy(dyn->id, id, id_len);
 		dyn->id[id_len] = '\0';
 
+		if (tds_name_index_add(&con->dyn_index, dyn->id, dyn) != TDS_SUCCESS) {
+			free(dyn->id);
+			free(dyn);
+			return NULL;
+		}
+
 		if (con->dynlist == NULL) {
 			tdsdump_log(TDS_DBG_INFO1, "_ct_allocate_dynamic() attaching dynamic command to head\n");
 			con->dynlist = dyn;
@@ -4558,13 +5141,8 @@ _ct_locate_dynamic(CS_CONNECTION * con, char *id, int idlen)
 	else
 		id_len = idlen;
 
-	tdsdump_log(TDS_DBG_INFO1, "_ct_locate_dynamic() looking for %s\n", (char *) id);
-
-	for (dyn = con->dynlist; dyn != NULL; dyn = dyn->next) {
-		tdsdump_log(TDS_DBG_INFO1, "_ct_locate_dynamic() matching with %s\n", (char *) dyn->id);
-		if (strncmp(dyn->id, id, id_len) == 0)
-			break;
-	}
+	dyn = (CS_DYNAMIC *) tds_name_index_find(&con->dyn_index, id, id_len);
+	tdsdump_log(TDS_DBG_INFO1, "_ct_locate_dynamic() %.*s %sfound\n", id_len, id, dyn ? "" : "not ");
 
 	return (dyn);
 }
@@ -4576,12 +5154,9 @@ _ct_deallocate_dynamic(CS_CONNECTION * con, CS_DYNAMIC *dyn)
 	CS_DYNAMIC_LIST *prev = NULL;
 	CS_DYNAMIC_LIST *next = NULL;
 	TDSDYNAMIC *tdsdyn;
-	char myid[256];
 
 	tdsdump_log(TDS_DBG_FUNC, "_ct_deallocate_dynamic(%p, %p)\n", con, dyn);
 
-	strcpy(myid,"");
-
 	victim = con->dynlist;
 
 	for (;;) {
@@ -4598,11 +5173,10 @@ _ct_deallocate_dynamic(CS_CONNECTION * con, CS_DYNAMIC *dyn)
 	tdsdump_log(TDS_DBG_FUNC, "ct_deallocate_dynamic() : command entry found in list\n");
 
 	next = victim->next;
+	tdsdyn = victim->tdsdyn;
 
-	if (victim->id) {
-		strcpy(myid, victim->id);
-		free(victim->id);
-	}
+	tds_name_index_remove(&con->dyn_index, victim->id, victim);
+	free(victim->id);
 	free(victim->stmt);
 	param_clear(victim->param_list);
 
@@ -4617,12 +5191,9 @@ _ct_deallocate_dynamic(CS_CONNECTION * con, CS_DYNAMIC *dyn)
 
 	tdsdump_log(TDS_DBG_FUNC, "ct_deallocate_dynamic() : relinked list\n");
 
-	if (strlen(myid) > 0) {
-		tdsdyn = tds_lookup_dynamic(con->tds_socket, myid);
-		if (tdsdyn) {
-			tds_free_dynamic(con->tds_socket, tdsdyn);
-		}
-	}
+	/* statement the connection cache did not keep */
+	if (tdsdyn)
+		tds_free_dynamic(con->tds_socket, tdsdyn);
 
 	return CS_SUCCEED;
 
@@ -0,0 +1,139 @@
+#include <config.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include <stdio.h>
+#include <ctpublic.h>
+#include "common.h"
+
+static char software_version[] = "$Id: ct_pipeline.c,v 1.1 2011/09/26 11:37:02 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+/* read all results of a command, it must return a single row with given value */
+static void
+check_results(CS_COMMAND * cmd, CS_INT expected)
+{
+	CS_RETCODE ret;
+	CS_INT result_type, count, col1, rows = 0;
+	CS_DATAFMT datafmt;
+
+	while ((ret = ct_results(cmd, &result_type)) == CS_SUCCEED) {
+		switch (result_type) {
+		case CS_ROW_RESULT:
+			memset(&datafmt, 0, sizeof(datafmt));
+			datafmt.datatype = CS_INT_TYPE;
+			datafmt.format = CS_FMT_UNUSED;
+			datafmt.maxlength = sizeof(col1);
+			datafmt.count = 1;
+			if (ct_bind(cmd, 1, &datafmt, &col1, NULL, NULL) != CS_SUCCEED) {
+				fprintf(stderr, "ct_bind() failed\n");
+				exit(1);
+			}
+			while ((ret = ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, &count)) == CS_SUCCEED) {
+				if (col1 != expected) {
+					fprintf(stderr, "wrong value %d fetched, expected %d\n", (int) col1, (int) expected);
+					exit(1);
+				}
+				++rows;
+			}
+			if (ret != CS_END_DATA) {
+				fprintf(stderr, "ct_fetch() returned %d\n", (int) ret);
+				exit(1);
+			}
+			break;
+		case CS_CMD_SUCCEED:
+		case CS_CMD_DONE:
+			break;
+		default:
+			fprintf(stderr, "unexpected result type %d\n", (int) result_type);
+			exit(1);
+		}
+	}
+	if (ret != CS_END_RESULTS || rows != 1) {
+		fprintf(stderr, "ct_results() returned %d, %d rows\n", (int) ret, (int) rows);
+		exit(1);
+	}
+}
+
+/* Testing: commands queued with CS_PIPELINE */
+int
+main(int argc, char *argv[])
+{
+	CS_CONTEXT *ctx;
+	CS_CONNECTION *conn;
+	CS_COMMAND *cmd, *cmd2;
+	int verbose = 0;
+
+	CS_RETCODE ret;
+	CS_INT pipeline, result_type;
+	char query[64];
+	int i;
+
+	fprintf(stdout, "%s: Testing pipelined commands\n", __FILE__);
+	ret = try_ctlogin(&ctx, &conn, &cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Login failed\n");
+		return 1;
+	}
+	if (ct_cmd_alloc(conn, &cmd2) != CS_SUCCEED) {
+		fprintf(stderr, "ct_cmd_alloc() failed\n");
+		return 1;
+	}
+
+	pipeline = CS_TRUE;
+	if (ct_con_props(conn, CS_SET, CS_PIPELINE, &pipeline, CS_UNUSED, NULL) != CS_SUCCEED) {
+		fprintf(stderr, "ct_con_props(CS_PIPELINE) failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < 5; ++i) {
+		sprintf(query, "select %d", i * 2);
+		if (ct_command(cmd, CS_LANG_CMD, query, CS_NULLTERM, CS_UNUSED) != CS_SUCCEED
+		    || ct_send(cmd) != CS_SUCCEED) {
+			fprintf(stderr, "sending first command failed\n");
+			return 1;
+		}
+		sprintf(query, "select %d", i * 2 + 1);
+		if (ct_command(cmd2, CS_LANG_CMD, query, CS_NULLTERM, CS_UNUSED) != CS_SUCCEED
+		    || ct_send(cmd2) != CS_SUCCEED) {
+			fprintf(stderr, "sending second command failed\n");
+			return 1;
+		}
+
+		/* responses come in order, second command must wait */
+		if (i == 0 && ct_results(cmd2, &result_type) != CS_FAIL) {
+			fprintf(stderr, "ct_results() should fail for second command\n");
+			return 1;
+		}
+
+		check_results(cmd, i * 2);
+		check_results(cmd2, i * 2 + 1);
+	}
+
+	pipeline = CS_FALSE;
+	if (ct_con_props(conn, CS_SET, CS_PIPELINE, &pipeline, CS_UNUSED, NULL) != CS_SUCCEED) {
+		fprintf(stderr, "ct_con_props(CS_PIPELINE) failed\n");
+		return 1;
+	}
+	if (ct_command(cmd, CS_LANG_CMD, "select 123", CS_NULLTERM, CS_UNUSED) != CS_SUCCEED
+	    || ct_send(cmd) != CS_SUCCEED) {
+		fprintf(stderr, "sending command failed\n");
+		return 1;
+	}
+	check_results(cmd, 123);
+
+	ct_cmd_drop(cmd2);
+	ret = try_ctlogout(ctx, conn, cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Logout failed\n");
+		return 1;
+	}
+
+	return 0;
+}
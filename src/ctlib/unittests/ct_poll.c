@@ -0,0 +1,161 @@
+#include <config.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include <stdio.h>
+#include <ctpublic.h>
+#include "common.h"
+
+static char software_version[] = "$Id: ct_poll.c,v 1.1 2011/08/29 15:12:40 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static CS_CONTEXT *ctx;
+
+/* wait for completion of an asynchronous operation, check it and return its status */
+static CS_RETCODE
+wait_completion(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT id)
+{
+	CS_CONNECTION *compconn = NULL;
+	CS_COMMAND *compcmd = NULL;
+	CS_INT compid = 0, compstatus = CS_FAIL;
+	CS_RETCODE ret;
+
+	ret = ct_poll(ctx, NULL, 10000, &compconn, &compcmd, &compid, &compstatus);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "ct_poll() returned %d\n", (int) ret);
+		exit(1);
+	}
+	if (compconn != conn || compcmd != cmd || compid != id) {
+		fprintf(stderr, "ct_poll() reported wrong completion %d\n", (int) compid);
+		exit(1);
+	}
+
+	/* nothing else is pending */
+	if (ct_poll(ctx, conn, 0, NULL, NULL, NULL, NULL) != CS_QUIET) {
+		fprintf(stderr, "ct_poll() reported more completions\n");
+		exit(1);
+	}
+	return compstatus;
+}
+
+/* Testing: asynchronous network I/O with ct_poll */
+int
+main(int argc, char *argv[])
+{
+	CS_CONNECTION *conn;
+	CS_COMMAND *cmd;
+	int verbose = 0;
+
+	CS_RETCODE ret;
+	CS_INT result_type, netio, count, row_count = 0, col1;
+	CS_DATAFMT datafmt;
+
+	fprintf(stdout, "%s: Testing asynchronous network I/O\n", __FILE__);
+	ret = try_ctlogin(&ctx, &conn, &cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Login failed\n");
+		return 1;
+	}
+
+	netio = CS_DEFER_IO;
+	if (ct_con_props(conn, CS_SET, CS_NETIO, &netio, CS_UNUSED, NULL) != CS_SUCCEED) {
+		fprintf(stderr, "ct_con_props(CS_NETIO) failed\n");
+		return 1;
+	}
+
+	if (ct_poll(ctx, NULL, 0, NULL, NULL, NULL, NULL) != CS_QUIET) {
+		fprintf(stderr, "ct_poll() should report nothing pending\n");
+		return 1;
+	}
+
+	ret = ct_command(cmd, CS_LANG_CMD, "waitfor delay '00:00:01' select 1 union all select 2", CS_NULLTERM, CS_UNUSED);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "ct_command() failed\n");
+		return 1;
+	}
+	if (ct_send(cmd) != CS_PENDING || wait_completion(conn, cmd, CT_SEND) != CS_SUCCEED) {
+		fprintf(stderr, "ct_send() failed\n");
+		return 1;
+	}
+
+	/* server is still waiting, operation can't complete immediately */
+	if (ct_results(cmd, &result_type) != CS_PENDING) {
+		fprintf(stderr, "ct_results() should be pending\n");
+		return 1;
+	}
+	if (ct_poll(ctx, conn, 0, NULL, NULL, NULL, NULL) != CS_TIMED_OUT) {
+		fprintf(stderr, "ct_poll() should time out\n");
+		return 1;
+	}
+	if (ct_results(cmd, &result_type) != CS_BUSY) {
+		fprintf(stderr, "ct_results() should fail while pending\n");
+		return 1;
+	}
+
+	while ((ret = wait_completion(conn, cmd, CT_RESULTS)) == CS_SUCCEED) {
+		switch (result_type) {
+		case CS_ROW_RESULT:
+			memset(&datafmt, 0, sizeof(datafmt));
+			datafmt.datatype = CS_INT_TYPE;
+			datafmt.format = CS_FMT_UNUSED;
+			datafmt.maxlength = sizeof(col1);
+			datafmt.count = 1;
+			if (ct_bind(cmd, 1, &datafmt, &col1, NULL, NULL) != CS_SUCCEED) {
+				fprintf(stderr, "ct_bind() failed\n");
+				return 1;
+			}
+			for (;;) {
+				if (ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, &count) != CS_PENDING) {
+					fprintf(stderr, "ct_fetch() should be pending\n");
+					return 1;
+				}
+				ret = wait_completion(conn, cmd, CT_FETCH);
+				if (ret != CS_SUCCEED)
+					break;
+				if (col1 != ++row_count) {
+					fprintf(stderr, "wrong value %d fetched\n", (int) col1);
+					return 1;
+				}
+			}
+			if (ret != CS_END_DATA) {
+				fprintf(stderr, "ct_fetch() returned %d\n", (int) ret);
+				return 1;
+			}
+			break;
+		case CS_CMD_SUCCEED:
+		case CS_CMD_DONE:
+			break;
+		default:
+			fprintf(stderr, "unexpected result type %d\n", (int) result_type);
+			return 1;
+		}
+		if (ct_results(cmd, &result_type) != CS_PENDING) {
+			fprintf(stderr, "ct_results() should be pending\n");
+			return 1;
+		}
+	}
+	if (ret != CS_END_RESULTS || row_count != 2) {
+		fprintf(stderr, "ct_results() returned %d, %d rows\n", (int) ret, row_count);
+		return 1;
+	}
+
+	netio = CS_SYNC_IO;
+	if (ct_con_props(conn, CS_SET, CS_NETIO, &netio, CS_UNUSED, NULL) != CS_SUCCEED) {
+		fprintf(stderr, "ct_con_props(CS_NETIO) failed\n");
+		return 1;
+	}
+
+	ret = try_ctlogout(ctx, conn, cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Logout failed\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -745,6 +745,7 @@ _bcp_exec_out(DBPROCESS * dbproc, DBINT * rows_copied)
 	int row_of_query;
 	int rows_written;
 	const char *bcpdatefmt;
+	TDSDATEFMT datefmt;
 	TDSRET tdsret;
 
 	tdsdump_log(TDS_DBG_FUNC, "_bcp_exec_out(%p, %p)\n", dbproc, rows_copied);
@@ -757,6 +758,7 @@ _bcp_exec_out(DBPROCESS * dbproc, DBINT * rows_copied)
 	bcpdatefmt = getenv("FREEBCP_DATEFMT");
 	if (!bcpdatefmt)
 		bcpdatefmt = "%Y-%m-%d %H:%M:%S.%z";
+	tds_datefmt_compile(&datefmt, bcpdatefmt);
 
 	if (dbproc->bcpinfo->direction == DB_QUERYOUT ) {
 		if (tds_submit_query(tds, dbproc->bcpinfo->tablename) == TDS_FAIL)
@@ -960,8 +962,8 @@ _bcp_exec_out(DBPROCESS * dbproc, DBINT * rows_copied)
 				if ((srctype == SYBDATETIME || srctype == SYBDATETIME4)
 				    && (hostcol->datatype == SYBCHAR || hostcol->datatype == SYBVARCHAR)) {
 					tds_datecrack(srctype, src, &when);
-					buflen = (int)tds_strftime((TDS_CHAR *)hostcol->bcp_column_data->data, 256,
-								 bcpdatefmt, &when, 3);
+					buflen = (int)tds_datefmt_format(&datefmt, (TDS_CHAR *)hostcol->bcp_column_data->data, 256,
+									 &when, 3);
 				} else {
 					/*
 					 * For null columns, the above work to determine the output buffer size is moot,
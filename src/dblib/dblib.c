@@ -36,6 +36,10 @@
 #include <assert.h>
 #include <stdio.h>
 
+#if HAVE_LIMITS_H
+#include <limits.h>
+#endif /* HAVE_LIMITS_H */
+
 #if HAVE_STDLIB_H
 #include <stdlib.h>
 #endif /* HAVE_STDLIB_H */
@@ -80,7 +84,7 @@ static char *_dbprdate(char *timestr);
 static int _dbnullable(DBPROCESS * dbproc, int column);
 static const char *tds_prdatatype(TDS_SERVER_TYPE datatype_token);
 
-static void copy_data_to_host_var(DBPROCESS *, int, const BYTE *, DBINT, int, BYTE *, DBINT, int, DBINT *);
+static void copy_data_to_host_var(DBPROCESS *, int, const BYTE *, DBINT, int, BYTE *, DBINT, int, DBINT *, TDS_CONVERT_FUNC);
 static int default_err_handler(DBPROCESS * dbproc, int severity, int dberr, int oserr, char *dberrstr, char *oserrstr);
 
 static RETCODE dbgetnull(DBPROCESS *dbproc, int bindtype, int varlen, BYTE* varaddr);
@@ -199,6 +203,11 @@ typedef struct dblib_context
 	int recftos_filenum;
 	int login_timeout;	/**< not used unless positive */
 	int query_timeout;	/**< not used unless positive */
+
+	/** poller used by dbpoll() for all connections, allocated at first use */
+	TDSPOLLER *poller;
+	/** set while dbpoll() is waiting on all connections */
+	int polling;
 }
 DBLIBCONTEXT;
 
@@ -241,6 +250,8 @@ dblib_add_connection(DBLIBCONTEXT * ctx, TDSSOCKET * tds)
 		return 1;
 	} else {
 		ctx->connection_list[i] = tds;
+		if (ctx->poller)
+			tds_poller_add(ctx->poller, tds);
 		return 0;
 	}
 }
@@ -261,6 +272,8 @@ dblib_del_connection(DBLIBCONTEXT * ctx, TDSSOCKET * tds)
 		/* remove it */
 		ctx->connection_list[i] = NULL;
 	}
+	if (ctx->poller)
+		tds_poller_remove(ctx->poller, tds);
 }
 
 static TDSCONTEXT*
@@ -1511,6 +1524,9 @@ dbexit()
 		return;
 	}
 
+	tds_free_poller(g_dblib_ctx.poller);
+	g_dblib_ctx.poller = NULL;
+
 	list_size = g_dblib_ctx.connection_list_size;
 
 	for (i = 0; i < list_size; i++) {
@@ -2616,6 +2632,8 @@ dbbind(DBPROCESS * dbproc, int column, int vartype, DBINT varlen, BYTE * varaddr
 	colinfo->column_varaddr = (char *) varaddr;
 	colinfo->column_bindtype = vartype;
 	colinfo->column_bindlen = varlen;
+	/* resolve converter now, rows will use it */
+	tds_column_converter(colinfo, srctype, desttype);
 
 	return SUCCEED;
 }				/* dbbind()  */
@@ -4210,6 +4228,7 @@ dbaltbind(DBPROCESS * dbproc, int computeid, int column, int vartype, DBINT varl
 	colinfo->column_varaddr = (char *) varaddr;
 	colinfo->column_bindtype = vartype;
 	colinfo->column_bindlen = varlen;
+	tds_column_converter(colinfo, srctype, desttype);
 
 	return SUCCEED;
 }
@@ -4626,6 +4645,10 @@ dbsqlok(DBPROCESS * dbproc)
 		dbproc->text_sent = 0;
 	}
 
+	/* results of a command queued by dbsqlqueue(), previous one is complete */
+	if (tds->pipeline.boundary && tds_pipeline_next(tds) == TDS_SUCCESS)
+		dbproc->dbresults_state = _DB_RES_INIT;
+
 	/* 
 	 * See what the next packet from the server is.
 	 * We want to skip any messages which are not processable. 
@@ -4941,7 +4964,170 @@ dbmsghandle(MHANDLEFUNC handler)
 	return retFun;
 }
 
-#if defined(DBLIB_UNIMPLEMENTED)
+/*
+ * Money kernel.
+ * A DBMONEY is a 64 bit integer counting 1/10000 of unit, split in two
+ * 32 bit halves. All money functions join the halves, work on the
+ * native integer and split the result back.
+ */
+#define MNY_SCALE 10000u
+
+static TDS_INT8
+_dbmny_get(const DBMONEY * m)
+{
+	return (TDS_INT8) (((TDS_UINT8) (TDS_UINT) m->mnyhigh << 32) | m->mnylow);
+}
+
+static void
+_dbmny_set(DBMONEY * m, TDS_INT8 value)
+{
+	m->mnyhigh = (DBINT) (value >> 32);
+	m->mnylow = (TDS_UINT) value;
+}
+
+/* magnitude of a 64 bit signed value, works for the minimum too */
+static TDS_UINT8
+_dbmny_abs(TDS_INT8 value)
+{
+	return value < 0 ? 0 - (TDS_UINT8) value : (TDS_UINT8) value;
+}
+
+/* build a signed result from a magnitude, return FAIL on overflow */
+static RETCODE
+_dbmny_signed(TDS_UINT8 mag, int negative, TDS_INT8 * result)
+{
+	const TDS_UINT8 limit = (TDS_UINT8) 1 << 63;
+
+	if (negative) {
+		if (mag > limit)
+			return FAIL;
+		*result = (TDS_INT8) (0 - mag);
+	} else {
+		if (mag >= limit)
+			return FAIL;
+		*result = (TDS_INT8) mag;
+	}
+	return SUCCEED;
+}
+
+static RETCODE
+_dbmny_add(TDS_INT8 a, TDS_INT8 b, TDS_INT8 * result)
+{
+	TDS_INT8 sum = (TDS_INT8) ((TDS_UINT8) a + (TDS_UINT8) b);
+
+	/* overflow if both operands have a sign different from the result */
+	if (((a ^ sum) & (b ^ sum)) < 0)
+		return FAIL;
+	*result = sum;
+	return SUCCEED;
+}
+
+static RETCODE
+_dbmny_sub(TDS_INT8 a, TDS_INT8 b, TDS_INT8 * result)
+{
+	TDS_INT8 diff = (TDS_INT8) ((TDS_UINT8) a - (TDS_UINT8) b);
+
+	if (((a ^ b) & (a ^ diff)) < 0)
+		return FAIL;
+	*result = diff;
+	return SUCCEED;
+}
+
+/*
+ * Compute a * b / divisor rounding half away from zero.
+ * divisor must be between 1 and 2^32-1.
+ */
+static RETCODE
+_dbmny_muldiv(TDS_INT8 a, TDS_INT8 b, TDS_UINT divisor, TDS_INT8 * result)
+{
+	TDS_UINT8 ua = _dbmny_abs(a), ub = _dbmny_abs(b);
+	TDS_UINT8 lo, hi, mid, p00, p01, p10, cur;
+	TDS_UINT words[4];
+	int i;
+
+	/* fast path, product fits in 64 bit */
+	if ((ua >> 32) == 0 && (ub >> 32) == 0) {
+		lo = ua * ub + divisor / 2;
+		return _dbmny_signed(lo / divisor, (a < 0) != (b < 0), result);
+	}
+
+	/* full 128 bit product */
+	p00 = (ua & 0xffffffffu) * (ub & 0xffffffffu);
+	p01 = (ua & 0xffffffffu) * (ub >> 32);
+	p10 = (ua >> 32) * (ub & 0xffffffffu);
+	mid = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+	lo = (mid << 32) | (p00 & 0xffffffffu);
+	hi = (ua >> 32) * (ub >> 32) + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+
+	/* round */
+	cur = lo;
+	lo += divisor / 2;
+	hi += lo < cur;
+
+	/* quotient must fit in 64 bit */
+	if (hi >= divisor)
+		return FAIL;
+
+	words[3] = (TDS_UINT) (hi >> 32);
+	words[2] = (TDS_UINT) hi;
+	words[1] = (TDS_UINT) (lo >> 32);
+	words[0] = (TDS_UINT) lo;
+	cur = 0;
+	for (i = 3; i >= 0; --i) {
+		cur = (cur << 32) | words[i];
+		words[i] = (TDS_UINT) (cur / divisor);
+		cur %= divisor;
+	}
+	return _dbmny_signed(((TDS_UINT8) words[1] << 32) | words[0], (a < 0) != (b < 0), result);
+}
+
+/* compute a * MNY_SCALE / b rounding half away from zero */
+static RETCODE
+_dbmny_div(TDS_INT8 a, TDS_INT8 b, TDS_INT8 * result)
+{
+	TDS_UINT8 ua = _dbmny_abs(a), ub = _dbmny_abs(b);
+	TDS_UINT8 lo, hi, q, rem, carry;
+	int i;
+
+	if (b == 0)
+		return FAIL;
+
+	if (ua < (~(TDS_UINT8) 0) / MNY_SCALE) {
+		/* fast path, dividend fits in 64 bit */
+		lo = ua * MNY_SCALE;
+		q = lo / ub;
+		rem = lo % ub;
+	} else {
+		/* dividend is hi:lo, 128 bit */
+		lo = (ua & 0xffffffffu) * MNY_SCALE;
+		hi = (ua >> 32) * MNY_SCALE + (lo >> 32);
+		lo = (hi << 32) | (lo & 0xffffffffu);
+		hi >>= 32;
+		if (hi >= ub)
+			return FAIL;
+
+		/* binary long division, remainder always fits in 64 bit */
+		rem = hi;
+		q = 0;
+		for (i = 0; i < 64; ++i) {
+			carry = rem >> 63;
+			rem = (rem << 1) | (lo >> 63);
+			lo <<= 1;
+			q <<= 1;
+			if (carry || rem >= ub) {
+				rem -= ub;
+				q |= 1;
+			}
+		}
+	}
+	/* round */
+	if (rem >= ub - rem) {
+		if (++q == 0)
+			return FAIL;
+	}
+	return _dbmny_signed(q, (a < 0) != (b < 0), result);
+}
+
 /**
  * \ingroup dblib_money
  * \brief Add two DBMONEY values.
@@ -4950,20 +5136,24 @@ dbmsghandle(MHANDLEFUNC handler)
  * \param m1 first operand.
  * \param m2 other operand. 
  * \param sum \em output: result of computation.  
- * \retval SUCCEED Always.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnyadd(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * sum)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnyadd(%p, %p, %p, %p)\n", dbproc, m1, m2, sum);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(m1,  "dbmnyadd", 2, FAIL);
 	CHECK_NULP(m2,  "dbmnyadd", 3, FAIL);
 	CHECK_NULP(sum, "dbmnyadd", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnyadd()\n");
+	if (_dbmny_add(_dbmny_get(m1), _dbmny_get(m2), &res) != SUCCEED)
+		return FAIL;
+	_dbmny_set(sum, res);
 	return SUCCEED;
 }
 
@@ -4976,20 +5166,24 @@ dbmnyadd(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * sum)
  * \param m1 first operand.
  * \param m2 other operand, subtracted from \a m1. 
  * \param difference \em output: result of computation.  
- * \retval SUCCEED Always.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnysub(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * difference)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnysub(%p, %p, %p, %p)\n", dbproc, m1, m2, difference);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(m1, "dbmnysub", 2, FAIL);
 	CHECK_NULP(m2, "dbmnysub", 3, FAIL);
 	CHECK_NULP(difference, "dbmnysub", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnysyb()\n");
+	if (_dbmny_sub(_dbmny_get(m1), _dbmny_get(m2), &res) != SUCCEED)
+		return FAIL;
+	_dbmny_set(difference, res);
 	return SUCCEED;
 }
 
@@ -5000,21 +5194,25 @@ dbmnysub(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * difference)
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
  * \param m1 first operand.
  * \param m2 other operand. 
- * \param prod \em output: result of computation.  
- * \retval SUCCEED Always.  
+ * \param prod \em output: result of computation, rounded to 4 decimal digits.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnymul(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * prod)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnymul(%p, %p, %p, %p)\n", dbproc, m1, m2, prod);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(m1, "dbmnymul", 2, FAIL);
 	CHECK_NULP(m2, "dbmnymul", 3, FAIL);
 	CHECK_NULP(prod, "dbmnymul", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnymul()\n");
+	if (_dbmny_muldiv(_dbmny_get(m1), _dbmny_get(m2), MNY_SCALE, &res) != SUCCEED)
+		return FAIL;
+	_dbmny_set(prod, res);
 	return SUCCEED;
 }
 
@@ -5025,24 +5223,27 @@ dbmnymul(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * prod)
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
  * \param m1 dividend.
  * \param m2 divisor. 
- * \param quotient \em output: result of computation.  
- * \retval SUCCEED Always.  
+ * \param quotient \em output: result of computation, rounded to 4 decimal digits.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow or division by zero.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnydivide(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * quotient)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnydivide(%p, %p, %p, %p)\n", dbproc, m1, m2, quotient);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(m1, "dbmnydivide", 2, FAIL);
 	CHECK_NULP(m2, "dbmnydivide", 3, FAIL);
 	CHECK_NULP(quotient, "dbmnydivide", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnydivide()\n");
+	if (_dbmny_div(_dbmny_get(m1), _dbmny_get(m2), &res) != SUCCEED)
+		return FAIL;
+	_dbmny_set(quotient, res);
 	return SUCCEED;
 }
-#endif
 
 /**
  * \ingroup dblib_money
@@ -5059,27 +5260,20 @@ dbmnydivide(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2, DBMONEY * quotient)
 int
 dbmnycmp(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2)
 {
+	TDS_INT8 v1, v2;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnycmp(%p, %p, %p)\n", dbproc, m1, m2);
 	CHECK_PARAMETER(dbproc, SYBENULL, 0);
 	CHECK_NULP(m1, "dbmnycmp", 2, 0);
 	CHECK_NULP(m2, "dbmnycmp", 3, 0);
 
-	if (m1->mnyhigh < m2->mnyhigh) {
+	v1 = _dbmny_get(m1);
+	v2 = _dbmny_get(m2);
+	if (v1 < v2)
 		return -1;
-	}
-	if (m1->mnyhigh > m2->mnyhigh) {
-		return 1;
-	}
-	if (m1->mnylow < m2->mnylow) {
-		return -1;
-	}
-	if (m1->mnylow > m2->mnylow) {
-		return 1;
-	}
-	return 0;
+	return v1 > v2;
 }
 
-#if defined(DBLIB_UNIMPLEMENTED)
 /**
  * \ingroup dblib_money
  * \brief Multiply a DBMONEY value by a positive integer, and add an amount. 
@@ -5088,22 +5282,27 @@ dbmnycmp(DBPROCESS * dbproc, DBMONEY * m1, DBMONEY * m2)
  * \param amount starting amount of money, also holds output.
  * \param multiplier amount to multiply \a amount by. 
  * \param addend amount to add to \a amount, after multiplying by \a multiplier. 
- * \retval SUCCEED Always.  
- * \remarks This function is goofy.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow.  
+ * \remarks This function is goofy.  \a amount and \a addend are taken in 1/10000 units
+ * so dbmnyscale(dbproc, amount, 10, digit) appends a digit to \a amount.
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnyscale(DBPROCESS * dbproc, DBMONEY * amount, int multiplier, int addend)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnyscale(%p, %p, %d, %d)\n", dbproc, amount, multiplier, addend);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(amount, "dbmnyscale", 2, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnyscale()\n");
+	if (_dbmny_muldiv(_dbmny_get(amount), multiplier, 1, &res) != SUCCEED
+	    || _dbmny_add(res, addend, &res) != SUCCEED)
+		return FAIL;
+	_dbmny_set(amount, res);
 	return SUCCEED;
 }
-#endif
 
 /**
  * \ingroup dblib_money
@@ -5121,8 +5320,7 @@ dbmnyzero(DBPROCESS * dbproc, DBMONEY * dest)
 	CHECK_CONN(FAIL);
 	CHECK_NULP(dest, "dbmnyzero", 2, FAIL);
 
-	dest->mnylow = 0;
-	dest->mnyhigh = 0;
+	_dbmny_set(dest, 0);
 	return SUCCEED;
 }
 
@@ -5168,7 +5366,6 @@ dbmnymaxneg(DBPROCESS * dbproc, DBMONEY * amount)
 	return SUCCEED;
 }
 
-#if defined(DBLIB_UNIMPLEMENTED)
 /**
  * \ingroup dblib_money
  * \brief Get the least significant digit of a DBMONEY value, represented as a character.
@@ -5178,20 +5375,28 @@ dbmnymaxneg(DBPROCESS * dbproc, DBMONEY * amount)
  * \param digit the character value (between '0' and '9') of the rightmost digit in \a mnyptr.  
  * \param zero \em output: \c TRUE if \a mnyptr is zero on output, else \c FALSE.  
  * \retval SUCCEED Always.  
+ * \remarks Call dbmnyinit() first, negative amounts give the digits of the absolute value.
+ * dbconvert() is much faster to get all digits.
  * \sa dbconvert(), dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \remarks Unimplemented and likely to remain so.  We'd be amused to learn anyone wants this function.  
- * \todo Unimplemented.
  */
 RETCODE
 dbmnyndigit(DBPROCESS * dbproc, DBMONEY * mnyptr, DBCHAR * digit, DBBOOL * zero)
 {
-	tdsdump_log(TDS_DBG_FUNC, "dbmnyndigit(%p, %p, %s, %p)\n", dbproc, mnyptr, digit, zero);
+	TDS_INT8 value;
+	int rem;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbmnyndigit(%p, %p, %p, %p)\n", dbproc, mnyptr, digit, zero);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(mnyptr, "dbmnyndigit", 2, FAIL);
 	CHECK_NULP(digit, "dbmnyndigit", 3, FAIL);
 	CHECK_NULP(zero, "dbmnyndigit", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnyndigit()\n");
+	value = _dbmny_get(mnyptr);
+	rem = (int) (value % 10);
+	value /= 10;
+	*digit = '0' + (rem < 0 ? -rem : rem);
+	*zero = (value == 0);
+	_dbmny_set(mnyptr, value);
 	return SUCCEED;
 }
 
@@ -5200,22 +5405,33 @@ dbmnyndigit(DBPROCESS * dbproc, DBMONEY * mnyptr, DBCHAR * digit, DBBOOL * zero)
  * \brief Prepare a DBMONEY value for use with dbmnyndigit().
  * 
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
- * \param amount address of a DBMONEY structure.  
+ * \param amount address of a DBMONEY structure, \em output: absolute value with \a trim digits removed.  
  * \param trim number of digits to trim from \a amount.
  * \param negative \em output: \c TRUE if \a amount < 0.  
- * \retval SUCCEED Always.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  \a trim is negative or the absolute value does not fit.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnyinit(DBPROCESS * dbproc, DBMONEY * amount, int trim, DBBOOL * negative)
 {
+	TDS_INT8 value;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnyinit(%p, %p, %d, %p)\n", dbproc, amount, trim, negative);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(amount, "dbmnyinit", 2, FAIL);
 	CHECK_NULP(negative, "dbmnyinit", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnyinit()\n");
+	if (trim < 0)
+		return FAIL;
+
+	value = _dbmny_get(amount);
+	for (; trim > 0 && value != 0; --trim)
+		value /= 10;
+	*negative = (value < 0);
+	if (_dbmny_signed(_dbmny_abs(value), 0, &value) != SUCCEED)
+		return FAIL;
+	_dbmny_set(amount, value);
 	return SUCCEED;
 }
 
@@ -5228,21 +5444,28 @@ dbmnyinit(DBPROCESS * dbproc, DBMONEY * amount, int trim, DBBOOL * negative)
  * \param amount address of a DBMONEY structure.  
  * \param divisor of \a amount.
  * \param remainder \em output: modulo of integer division.
- * \retval SUCCEED Always.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  \a divisor is not positive.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmnydown(DBPROCESS * dbproc, DBMONEY * amount, int divisor, int *remainder)
 {
+	TDS_INT8 value;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnydown(%p, %p, %d, %p)\n", dbproc, amount, divisor, remainder);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(amount, "dbmnydown", 2, FAIL);
 	CHECK_NULP(remainder, "dbmnydown", 4, FAIL);
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmnydown()\n");
+
+	if (divisor <= 0)
+		return FAIL;
+
+	value = _dbmny_get(amount);
+	*remainder = (int) (value % divisor);
+	_dbmny_set(amount, value / divisor);
 	return SUCCEED;
 }
-#endif
 
 /**
  * \ingroup dblib_money
@@ -5256,18 +5479,15 @@ dbmnydown(DBPROCESS * dbproc, DBMONEY * amount, int divisor, int *remainder)
 RETCODE
 dbmnyinc(DBPROCESS * dbproc, DBMONEY * amount)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnyinc(%p, %p)\n", dbproc, amount);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(amount, "dbmnyinc", 2, FAIL);
 
-	if (amount->mnylow != 0xFFFFFFFFlu) {
-		++amount->mnylow;
-		return SUCCEED;
-	}
-	if (amount->mnyhigh == 0x7FFFFFFFl)
+	if (_dbmny_add(_dbmny_get(amount), 1, &res) != SUCCEED)
 		return FAIL;
-	amount->mnylow = 0;
-	++amount->mnyhigh;
+	_dbmny_set(amount, res);
 	return SUCCEED;
 }
 
@@ -5284,18 +5504,15 @@ dbmnyinc(DBPROCESS * dbproc, DBMONEY * amount)
 RETCODE
 dbmnydec(DBPROCESS * dbproc, DBMONEY * amount)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnydec(%p, %p)\n", dbproc, amount);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(amount, "dbmnydec", 2, FAIL);
 
-	if (amount->mnylow != 0) {
-		--amount->mnylow;
-		return SUCCEED;
-	}
-	if (amount->mnyhigh == -0x80000000l)
+	if (_dbmny_sub(_dbmny_get(amount), 1, &res) != SUCCEED)
 		return FAIL;
-	amount->mnylow = 0xFFFFFFFFlu;
-	--amount->mnyhigh;
+	_dbmny_set(amount, res);
 	return SUCCEED;
 }
 
@@ -5312,18 +5529,134 @@ dbmnydec(DBPROCESS * dbproc, DBMONEY * amount)
 RETCODE
 dbmnyminus(DBPROCESS * dbproc, DBMONEY * src, DBMONEY * dest)
 {
+	TDS_INT8 res;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbmnyminus(%p, %p, %p)\n", dbproc, src, dest);
 	CHECK_CONN(FAIL);
 	CHECK_NULP(src, "dbmnyminus", 2, FAIL);
 	CHECK_NULP(dest, "dbmnyminus", 3, FAIL);
 
-	if (src->mnyhigh == -0x80000000l && src->mnylow == 0)
+	if (_dbmny_sub(0, _dbmny_get(src), &res) != SUCCEED)
 		return FAIL;
-	dest->mnyhigh = -src->mnyhigh;
-	dest->mnylow = (~src->mnylow) + 1u;
+	_dbmny_set(dest, res);
 	return SUCCEED;
 }
 
+/**
+ * \ingroup dblib_money
+ * \brief Sum an array of DBMONEY values.
+ * 
+ * Partial sums can exceed the DBMONEY range, only the final result has to fit.
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param values array of \a count DBMONEY values.
+ * \param count number of values.
+ * \param sum \em output: result of computation, zero if \a count is zero.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  on overflow or negative \a count.  
+ * \remarks FreeTDS extension.
+ * \sa dbmnyadd(), dbmnymin(), dbmnymax().
+ */
+RETCODE
+dbmnysum(DBPROCESS * dbproc, const DBMONEY * values, int count, DBMONEY * sum)
+{
+	TDS_UINT8 lo = 0, prev;
+	TDS_INT8 value, hi = 0;
+	int i;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbmnysum(%p, %p, %d, %p)\n", dbproc, values, count, sum);
+	CHECK_CONN(FAIL);
+	CHECK_NULP(values, "dbmnysum", 2, FAIL);
+	CHECK_NULP(sum, "dbmnysum", 4, FAIL);
+
+	if (count < 0)
+		return FAIL;
+
+	/* accumulate in a 128 bit integer hi:lo */
+	for (i = 0; i < count; ++i) {
+		value = _dbmny_get(&values[i]);
+		prev = lo;
+		lo += (TDS_UINT8) value;
+		hi += (lo < prev) - (value < 0);
+	}
+	if (hi != ((TDS_INT8) lo < 0 ? -1 : 0))
+		return FAIL;
+	_dbmny_set(sum, (TDS_INT8) lo);
+	return SUCCEED;
+}
+
+/**
+ * \ingroup dblib_money
+ * \brief Get the minimum of an array of DBMONEY values.
+ * 
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param values array of \a count DBMONEY values.
+ * \param count number of values.
+ * \param min \em output: minimum value.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  \a count is not positive.  
+ * \remarks FreeTDS extension.
+ * \sa dbmnycmp(), dbmnysum(), dbmnymax().
+ */
+RETCODE
+dbmnymin(DBPROCESS * dbproc, const DBMONEY * values, int count, DBMONEY * min)
+{
+	TDS_INT8 value, res;
+	int i;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbmnymin(%p, %p, %d, %p)\n", dbproc, values, count, min);
+	CHECK_CONN(FAIL);
+	CHECK_NULP(values, "dbmnymin", 2, FAIL);
+	CHECK_NULP(min, "dbmnymin", 4, FAIL);
+
+	if (count <= 0)
+		return FAIL;
+
+	res = _dbmny_get(&values[0]);
+	for (i = 1; i < count; ++i) {
+		value = _dbmny_get(&values[i]);
+		if (value < res)
+			res = value;
+	}
+	_dbmny_set(min, res);
+	return SUCCEED;
+}
+
+/**
+ * \ingroup dblib_money
+ * \brief Get the maximum of an array of DBMONEY values.
+ * 
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param values array of \a count DBMONEY values.
+ * \param count number of values.
+ * \param max \em output: maximum value.  
+ * \retval SUCCEED usually.  
+ * \retval FAIL  \a count is not positive.  
+ * \remarks FreeTDS extension.
+ * \sa dbmnycmp(), dbmnysum(), dbmnymin().
+ */
+RETCODE
+dbmnymax(DBPROCESS * dbproc, const DBMONEY * values, int count, DBMONEY * max)
+{
+	TDS_INT8 value, res;
+	int i;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbmnymax(%p, %p, %d, %p)\n", dbproc, values, count, max);
+	CHECK_CONN(FAIL);
+	CHECK_NULP(values, "dbmnymax", 2, FAIL);
+	CHECK_NULP(max, "dbmnymax", 4, FAIL);
+
+	if (count <= 0)
+		return FAIL;
+
+	res = _dbmny_get(&values[0]);
+	for (i = 1; i < count; ++i) {
+		value = _dbmny_get(&values[i]);
+		if (value > res)
+			res = value;
+	}
+	_dbmny_set(max, res);
+	return SUCCEED;
+}
 
 /**
  * \ingroup dblib_money
@@ -5434,7 +5767,16 @@ dbmny4sub(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * diff)
 	return SUCCEED;
 }
 
-#if defined(DBLIB_UNIMPLEMENTED)
+/* store a money kernel result in a DBMONEY4, return FAIL if out of range */
+static RETCODE
+_dbmny4_set(DBMONEY4 * m, TDS_INT8 value)
+{
+	if (value < -0x7fffffff - 1 || value > 0x7fffffff)
+		return FAIL;
+	m->mny4 = (DBINT) value;
+	return SUCCEED;
+}
+
 /**
  * \ingroup dblib_money
  * \brief Multiply two DBMONEY4 values.
@@ -5442,15 +5784,15 @@ dbmny4sub(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * diff)
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
  * \param m1 first operand.
  * \param m2 other operand. 
- * \param prod \em output: result of computation.  
+ * \param prod \em output: result of computation, rounded to 4 decimal digits.  
  * \retval SUCCEED usually.  
- * \retval FAIL a parameter is NULL.  
+ * \retval FAIL a parameter is NULL or on overflow.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmny4mul(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * prod)
 {
+	TDS_INT8 res;
 
 	tdsdump_log(TDS_DBG_FUNC, "dbmny4mul(%p, %p, %p, %p)\n", dbproc, m1, m2, prod);
 	CHECK_CONN(FAIL);
@@ -5458,8 +5800,9 @@ dbmny4mul(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * prod)
 	CHECK_NULP(m2, "dbmny4mul", 3, FAIL);
 	CHECK_NULP(prod, "dbmny4mul", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmny4mul()\n");
-	return FAIL;
+	if (_dbmny_muldiv(m1->mny4, m2->mny4, MNY_SCALE, &res) != SUCCEED)
+		return FAIL;
+	return _dbmny4_set(prod, res);
 }
 
 /**
@@ -5469,15 +5812,15 @@ dbmny4mul(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * prod)
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
  * \param m1 dividend.
  * \param m2 divisor. 
- * \param quotient \em output: result of computation.  
+ * \param quotient \em output: result of computation, rounded to 4 decimal digits.  
  * \retval SUCCEED usually.  
- * \retval FAIL a parameter is NULL.  
+ * \retval FAIL a parameter is NULL, on overflow or division by zero.  
  * \sa dbmnyadd(), dbmnysub(), dbmnymul(), dbmnydivide(), dbmnyminus(), dbmny4add(), dbmny4sub(), dbmny4mul(), dbmny4divide(), dbmny4minus().
- * \todo Unimplemented.
  */
 RETCODE
 dbmny4divide(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * quotient)
 {
+	TDS_INT8 res;
 
 	tdsdump_log(TDS_DBG_FUNC, "dbmny4divide(%p, %p, %p, %p)\n", dbproc, m1, m2, quotient);
 	CHECK_CONN(FAIL);
@@ -5485,10 +5828,10 @@ dbmny4divide(DBPROCESS * dbproc, DBMONEY4 * m1, DBMONEY4 * m2, DBMONEY4 * quotie
 	CHECK_NULP(m2, "dbmny4divide", 3, FAIL);
 	CHECK_NULP(quotient, "dbmny4divide", 4, FAIL);
 
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbmny4divide()\n");
-	return FAIL;
+	if (_dbmny_div(m1->mny4, m2->mny4, &res) != SUCCEED)
+		return FAIL;
+	return _dbmny4_set(quotient, res);
 }
-#endif
 
 /**
  * \ingroup dblib_money
@@ -6452,8 +6795,14 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 
 	if (curcol->column_textpos == 0) {
 		const int mask = TDS_STOPAT_ROWFMT|TDS_STOPAT_DONE|TDS_RETURN_ROW|TDS_RETURN_COMPUTE;
+		TDSRET rc;
+
 		buffer_save_row(dbproc);
-		switch (tds_process_tokens(dbproc->tds_socket, &result_type, NULL, mask)) {
+		/* a single text column is read directly from the network in pieces */
+		curcol->column_stream = (resinfo->num_cols == 1);
+		rc = tds_process_tokens(dbproc->tds_socket, &result_type, NULL, mask);
+		curcol->column_stream = 0;
+		switch (rc) {
 		case TDS_FAIL:
 			return -1;
 		case TDS_SUCCESS:
@@ -6467,7 +6816,18 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 	/* find the number of bytes to return */
 	bytes_avail = curcol->column_cur_size - curcol->column_textpos;
 	cpbytes = bytes_avail > bufsize ? bufsize : bytes_avail;
-	memcpy(buf, &((TDSBLOB *) curcol->column_data)->textvalue[curcol->column_textpos], cpbytes);
+	if (tds->stream_col == curcol) {
+		cpbytes = tds_stream_read(tds, curcol, buf, cpbytes);
+		if (cpbytes < 0)
+			return -1;
+		/* less data than expected, end of text */
+		if (cpbytes == 0 && bytes_avail > 0) {
+			curcol->column_textpos = 0;
+			return 0;
+		}
+	} else {
+		memcpy(buf, &((TDSBLOB *) curcol->column_data)->textvalue[curcol->column_textpos], cpbytes);
+	}
 	curcol->column_textpos += cpbytes;
 	return cpbytes;
 }
@@ -6574,6 +6934,8 @@ dbtds(DBPROCESS * dbproc)
 			return DBTDS_7_2;
 		case 0x703:
 			return DBTDS_7_3;
+		case 0x704:
+			return DBTDS_7_4;
 		default:
 			return DBTDS_UNKNOWN;
 		}
@@ -6783,28 +7145,16 @@ dbservcharset(DBPROCESS * dbproc)
 }
 
 /**
- * \ingroup dblib_core
- * \brief Transmit the command buffer to the server.  \em Non-blocking, does not wait for a response.
- * 
- * \param dbproc contains all information needed by db-lib to manage communications with the server.
- * \retval SUCCEED SQL sent.
- * \retval FAIL protocol problem, unless dbsqlsend() when it's not supposed to be (in which case a db-lib error
- message will be emitted).  
- * \sa dbcmd(), dbfcmd(), DBIORDESC(), DBIOWDESC(), dbnextrow(), dbpoll(), dbresults(), dbsettime(), dbsqlexec(), dbsqlok().  
+ * Prepare the connection for a new command: wait the end of previous results and
+ * send options set by dbsetopt().
  */
-RETCODE
-dbsqlsend(DBPROCESS * dbproc)
+static RETCODE
+_dbsqlsend_prepare(DBPROCESS * dbproc)
 {
-	TDSSOCKET *tds;
+	TDSSOCKET *tds = dbproc->tds_socket;
 	char *cmdstr;
 	TDSRET rc;
 	TDS_INT result_type;
-	char timestr[256];
-
-	tdsdump_log(TDS_DBG_FUNC, "dbsqlsend(%p)\n", dbproc);
-	CHECK_CONN(FAIL);
-
-	tds = dbproc->tds_socket;
 
 	if (tds->state == TDS_PENDING) {
 
@@ -6835,17 +7185,61 @@ dbsqlsend(DBPROCESS * dbproc)
 			return FAIL;
 		}
 	}
-	dbproc->more_results = TRUE;
+	return SUCCEED;
+}
+
+/** Write command buffer to file set by dbrecftos() */
+static void
+_dbsqlsend_trace(DBPROCESS * dbproc)
+{
+	char timestr[256];
 
 	if (dbproc->ftos != NULL) {
 		fprintf(dbproc->ftos, "%s\n", dbproc->dbbuf);
 		fprintf(dbproc->ftos, "go /* %s */\n", _dbprdate(timestr));
 		fflush(dbproc->ftos);
 	}
+}
 
-	if (tds_submit_query(dbproc->tds_socket, (char *) dbproc->dbbuf) != TDS_SUCCESS) {
-		return FAIL;
+/**
+ * \ingroup dblib_core
+ * \brief Transmit the command buffer to the server.  \em Non-blocking, does not wait for a response.
+ * 
+ * If commands were queued by dbsqlqueue() the command buffer, if not already queued, is
+ * queued too and all commands are sent together.
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \retval SUCCEED SQL sent.
+ * \retval FAIL protocol problem, unless dbsqlsend() when it's not supposed to be (in which case a db-lib error
+ message will be emitted).  
+ * \sa dbcmd(), dbfcmd(), DBIORDESC(), DBIOWDESC(), dbnextrow(), dbpoll(), dbresults(), dbsettime(), dbsqlexec(), dbsqlok(),
+ 	dbsqlqueue().
+ */
+RETCODE
+dbsqlsend(DBPROCESS * dbproc)
+{
+	TDSSOCKET *tds;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbsqlsend(%p)\n", dbproc);
+	CHECK_CONN(FAIL);
+
+	tds = dbproc->tds_socket;
+
+	if (tds->pipeline.num_requests && tds->state == TDS_QUERYING) {
+		if (dbproc->command_state == DBCMDPEND && dbsqlqueue(dbproc) != SUCCEED)
+			return FAIL;
+		if (tds_pipeline_send(tds) != TDS_SUCCESS)
+			return FAIL;
+	} else {
+		if (_dbsqlsend_prepare(dbproc) != SUCCEED)
+			return FAIL;
+
+		_dbsqlsend_trace(dbproc);
+
+		if (tds_submit_query(dbproc->tds_socket, (char *) dbproc->dbbuf) != TDS_SUCCESS) {
+			return FAIL;
+		}
 	}
+	dbproc->more_results = TRUE;
 	dbproc->avail_flag = FALSE;
 	dbproc->envchange_rcv = 0;
 	dbproc->dbresults_state = _DB_RES_INIT;
@@ -6853,6 +7247,49 @@ dbsqlsend(DBPROCESS * dbproc)
 	return SUCCEED;
 }
 
+/**
+ * \ingroup dblib_core
+ * \brief Queue the command buffer, to be transmitted with other commands by dbsqlsend().
+ *
+ * This is a FreeTDS extension, available with Microsoft servers (TDS 7.0 and later).
+ * All commands queued are sent to the server in a single request, saving a round trip
+ * for every command. Every command is executed using sp_executesql so changes
+ * to the session (like SET options or temporary tables) do not last after the command.
+ * After dbsqlsend() call dbsqlok() and dbresults() for every command, in the order
+ * they were queued; dbresults() returns NO_MORE_RESULTS at the end of every command.
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \retval SUCCEED command queued.
+ * \retval FAIL command cannot be queued, results are pending or protocol does not support queueing.
+ * \sa dbcmd(), dbfcmd(), dbresults(), dbsqlok(), dbsqlsend().
+ */
+RETCODE
+dbsqlqueue(DBPROCESS * dbproc)
+{
+	TDSSOCKET *tds;
+
+	tdsdump_log(TDS_DBG_FUNC, "dbsqlqueue(%p)\n", dbproc);
+	CHECK_CONN(FAIL);
+
+	tds = dbproc->tds_socket;
+
+	if (!dbproc->dbbuf) {
+		dbperror(dbproc, SYBEASEC, 0); /* Attempt to send an empty command buffer to the server */
+		return FAIL;
+	}
+
+	/* first command queued, connection must be ready like for dbsqlsend() */
+	if (!tds->pipeline.num_requests && _dbsqlsend_prepare(dbproc) != SUCCEED)
+		return FAIL;
+
+	_dbsqlsend_trace(dbproc);
+
+	if (tds_pipeline_query(tds, (char *) dbproc->dbbuf, NULL) != TDS_SUCCESS)
+		return FAIL;
+	dbproc->avail_flag = FALSE;
+	dbproc->command_state = DBCMDSENT;
+	return SUCCEED;
+}
+
 /**
  * \ingroup dblib_core
  * \brief Get user-defined datatype of a compute column.
@@ -6907,6 +7344,7 @@ dbaltlen(DBPROCESS * dbproc, int computeid, int column)
  * \brief See if a server response has arrived.
  * 
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ *	If \c NULL all open connections are checked.
  * \param milliseconds how long to wait for the server before returning:
  	- \c  0 return immediately.
 	- \c -1 do not return until the server responds or a system interrupt occurs.
@@ -6919,21 +7357,79 @@ dbaltlen(DBPROCESS * dbproc, int computeid, int column)
 	- \c DBINTERRUPT operating-system interrupt occurred before the server responded.
  * \retval SUCCEED everything worked.
  * \retval FAIL a server connection died.
+ * \remarks A response is considered arrived when it is fully buffered so following
+ *	dbsqlok() and dbresults() calls do not wait for the network.
+ *	When checking all connections they are returned in the order responses arrived,
+ *	a connection is returned again if its response was not read.
+ *	Connections should not be opened or closed by other threads while dbpoll() waits on all connections.
+ *	Registered procedure notifications are not supported, DBNOTIFICATION is never returned.
  * \sa  DBIORDESC(), DBRBUF(), dbresults(), dbreghandle(), dbsqlok(). 
- * \todo Unimplemented.
  */
-#if defined(DBLIB_UNIMPLEMENTED)
 RETCODE
 dbpoll(DBPROCESS * dbproc, long milliseconds, DBPROCESS ** ready_dbproc, int *return_reason)
 {
+	TDSSOCKET *tds = NULL;
+	int rc, timeout;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbpoll(%p, %ld, %p, %p)\n", dbproc, milliseconds, ready_dbproc, return_reason);
-	CHECK_CONN(FAIL);
+	if (dbproc)
+		CHECK_CONN(FAIL);
 	CHECK_NULP(ready_dbproc, "dbpoll", 3, FAIL);
 	CHECK_NULP(return_reason, "dbpoll", 4, FAIL);
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED dbpoll()\n");
-	return SUCCEED;
+
+	*ready_dbproc = NULL;
+	*return_reason = DBTIMEOUT;
+
+	timeout = milliseconds < 0 ? -1 : (milliseconds > INT_MAX ? INT_MAX : (int) milliseconds);
+
+	if (dbproc) {
+		tds = dbproc->tds_socket;
+		rc = tds_wait_response(tds, timeout);
+	} else {
+		TDS_MUTEX_LOCK(&dblib_mutex);
+		if (g_dblib_ctx.polling) {
+			TDS_MUTEX_UNLOCK(&dblib_mutex);
+			dbperror(NULL, SYBEPOLL, 0);
+			return FAIL;
+		}
+		if (!g_dblib_ctx.poller) {
+			int i;
+
+			if (!(g_dblib_ctx.poller = tds_alloc_poller())) {
+				TDS_MUTEX_UNLOCK(&dblib_mutex);
+				dbperror(NULL, SYBEMEM, errno);
+				return FAIL;
+			}
+			for (i = 0; i < g_dblib_ctx.connection_list_size; ++i)
+				if (g_dblib_ctx.connection_list[i])
+					tds_poller_add(g_dblib_ctx.poller, g_dblib_ctx.connection_list[i]);
+		}
+		g_dblib_ctx.polling = 1;
+		TDS_MUTEX_UNLOCK(&dblib_mutex);
+
+		rc = tds_poller_wait(g_dblib_ctx.poller, timeout, &tds);
+
+		TDS_MUTEX_LOCK(&dblib_mutex);
+		g_dblib_ctx.polling = 0;
+		TDS_MUTEX_UNLOCK(&dblib_mutex);
+	}
+
+	if (rc < 0) {
+		if (sock_errno == TDSSOCK_EINTR) {
+			*return_reason = DBINTERRUPT;
+			return SUCCEED;
+		}
+		tdsdump_log(TDS_DBG_ERROR, "dbpoll: error %d waiting for responses\n", sock_errno);
+		return FAIL;
+	}
+
+	if (rc == 0)
+		return SUCCEED;
+
+	*ready_dbproc = (DBPROCESS *) tds_get_parent(tds);
+	*return_reason = DBRESULT;
+	return IS_TDSDEAD(tds) ? FAIL : SUCCEED;
 }
-#endif
 
 /** \internal
  * \ingroup dblib_internal
@@ -7151,7 +7647,7 @@ tds_prdatatype(TDS_SERVER_TYPE datatype_token)
 static void
 copy_data_to_host_var(DBPROCESS * dbproc, int srctype, const BYTE * src, DBINT srclen, 
 				int desttype, BYTE * dest, DBINT destlen,
-				int bindtype, DBINT *indicator)
+				int bindtype, DBINT *indicator, TDS_CONVERT_FUNC convert)
 {
 	CONV_RESULT dres;
 	DBINT ret;
@@ -7288,7 +7784,7 @@ copy_data_to_host_var(DBPROCESS * dbproc, int srctype, const BYTE * src, DBINT s
 
 	} /* end srctype == desttype */
 
-	len = tds_convert(g_dblib_ctx.tds_ctx, srctype, (const TDS_CHAR *) src, srclen, desttype, &dres);
+	len = convert(g_dblib_ctx.tds_ctx, srctype, (const TDS_CHAR *) src, srclen, desttype, &dres);
 
 	tdsdump_log(TDS_DBG_INFO1, "copy_data_to_host_var(): tds_convert returned %d\n", len);
 
@@ -0,0 +1,229 @@
+/*
+ * Purpose: Test money arithmetic functions
+ * Functions: dbmnyadd dbmnysub dbmnymul dbmnydivide dbmnyscale dbmnyinit dbmnyndigit dbmnydown
+ *            dbmny4mul dbmny4divide dbmnysum dbmnymin dbmnymax
+ */
+
+#include "common.h"
+
+static char software_version[] = "$Id: money.c,v 1.1 2011/09/16 11:08:42 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static int failed = 0;
+static DBPROCESS *dbproc = NULL;
+
+static DBMONEY
+mny(const char *s)
+{
+	DBMONEY m;
+
+	if (dbconvert(dbproc, SYBCHAR, (const BYTE *) s, -1, SYBMONEY, (BYTE *) &m, sizeof(m)) != sizeof(m)) {
+		fprintf(stderr, "error converting %s\n", s);
+		exit(1);
+	}
+	return m;
+}
+
+typedef RETCODE (*mny_op) (DBPROCESS *, DBMONEY *, DBMONEY *, DBMONEY *);
+
+static void
+test_op(const char *name, mny_op op, const char *a, const char *b, const char *expected, int line)
+{
+	DBMONEY m1 = mny(a), m2 = mny(b), res, exp;
+	RETCODE ret;
+
+	ret = op(dbproc, &m1, &m2, &res);
+	if (!expected) {
+		if (ret == FAIL)
+			return;
+		fprintf(stderr, "line %d: %s(%s, %s) should fail\n", line, name, a, b);
+		failed = 1;
+		return;
+	}
+	exp = mny(expected);
+	if (ret != SUCCEED || dbmnycmp(dbproc, &res, &exp) != 0) {
+		fprintf(stderr, "line %d: %s(%s, %s) wrong result, expected %s\n", line, name, a, b, expected);
+		failed = 1;
+	}
+}
+
+#define ADD(a, b, res) test_op("dbmnyadd", dbmnyadd, a, b, res, __LINE__)
+#define SUB(a, b, res) test_op("dbmnysub", dbmnysub, a, b, res, __LINE__)
+#define MUL(a, b, res) test_op("dbmnymul", dbmnymul, a, b, res, __LINE__)
+#define DIV(a, b, res) test_op("dbmnydivide", dbmnydivide, a, b, res, __LINE__)
+
+#define MAXPOS "922337203685477.5807"
+#define MAXNEG "-922337203685477.5808"
+
+static void
+test_digits(const char *s, int trim, const char *expected)
+{
+	DBMONEY m = mny(s);
+	DBBOOL negative, zero;
+	DBCHAR digit;
+	char buf[32], *p = buf + sizeof(buf) - 1;
+
+	*p = 0;
+	if (dbmnyinit(dbproc, &m, trim, &negative) != SUCCEED) {
+		fprintf(stderr, "dbmnyinit(%s, %d) failed\n", s, trim);
+		failed = 1;
+		return;
+	}
+	do {
+		dbmnyndigit(dbproc, &m, &digit, &zero);
+		*--p = digit;
+	} while (!zero && p > buf + 1);
+	if (negative)
+		*--p = '-';
+	if (strcmp(p, expected) != 0) {
+		fprintf(stderr, "digits of %s trim %d got %s expected %s\n", s, trim, p, expected);
+		failed = 1;
+	}
+}
+
+static void
+test_aggregates(void)
+{
+	DBMONEY values[5], res, exp;
+
+	values[0] = mny("10.5");
+	values[1] = mny("-3.25");
+	values[2] = mny(MAXPOS);
+	values[3] = mny("0.0001");
+	values[4] = mny("-922337203685000");
+
+	/* partial sums overflow but total fits */
+	exp = mny("477.5808");
+	if (dbmnysum(dbproc, values + 2, 3, &res) != SUCCEED || dbmnycmp(dbproc, &res, &exp) != 0) {
+		fprintf(stderr, "wrong dbmnysum result\n");
+		failed = 1;
+	}
+	if (dbmnysum(dbproc, values, 3, &res) != FAIL) {
+		fprintf(stderr, "dbmnysum should overflow\n");
+		failed = 1;
+	}
+	exp = mny("0");
+	if (dbmnysum(dbproc, values, 0, &res) != SUCCEED || dbmnycmp(dbproc, &res, &exp) != 0) {
+		fprintf(stderr, "dbmnysum of no values should be zero\n");
+		failed = 1;
+	}
+
+	exp = mny("-922337203685000");
+	if (dbmnymin(dbproc, values, 5, &res) != SUCCEED || dbmnycmp(dbproc, &res, &exp) != 0) {
+		fprintf(stderr, "wrong dbmnymin result\n");
+		failed = 1;
+	}
+	exp = mny(MAXPOS);
+	if (dbmnymax(dbproc, values, 5, &res) != SUCCEED || dbmnycmp(dbproc, &res, &exp) != 0) {
+		fprintf(stderr, "wrong dbmnymax result\n");
+		failed = 1;
+	}
+	if (dbmnymax(dbproc, values, 0, &res) != FAIL) {
+		fprintf(stderr, "dbmnymax of no values should fail\n");
+		failed = 1;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	LOGINREC *login;
+	DBMONEY m;
+	DBMONEY4 m1, m2, m4;
+	int rem;
+
+	read_login_info(argc, argv);
+
+	printf("Starting %s\n", argv[0]);
+	dbinit();
+
+	dberrhandle(syb_err_handler);
+	dbmsghandle(syb_msg_handler);
+
+	login = dblogin();
+	DBSETLPWD(login, PASSWORD);
+	DBSETLUSER(login, USER);
+	DBSETLAPP(login, "money");
+
+	printf("About to open %s.%s\n", SERVER, DATABASE);
+
+	dbproc = dbopen(login, SERVER);
+	if (strlen(DATABASE))
+		dbuse(dbproc, DATABASE);
+	dbloginfree(login);
+
+	ADD("1.5", "2.25", "3.75");
+	ADD("-1.5", "0.0001", "-1.4999");
+	ADD("4294967295", "1", "4294967296");
+	ADD(MAXPOS, "0.0001", NULL);
+	ADD(MAXNEG, "-0.0001", NULL);
+	ADD(MAXPOS, MAXNEG, "-0.0001");
+
+	SUB("1.5", "2.25", "-0.75");
+	SUB(MAXNEG, "0.0001", NULL);
+	SUB("0", MAXNEG, NULL);
+	SUB("-0.0001", MAXPOS, MAXNEG);
+	SUB("-1", MAXPOS, NULL);
+
+	MUL("1.5", "2.25", "3.375");
+	MUL("0.0001", "0.5", "0.0001");
+	MUL("-0.0001", "0.5", "-0.0001");
+	MUL("0.0001", "0.4999", "0");
+	MUL("123456789.1234", "-1000", "-123456789123.4");
+	MUL("922337203685.4775", "1000", "922337203685477.5");
+	MUL(MAXPOS, "1", MAXPOS);
+	MUL(MAXNEG, "1", MAXNEG);
+	MUL(MAXNEG, "-1", NULL);
+	MUL("922337203685.4775", "1000.0001", NULL);
+
+	DIV("1", "3", "0.3333");
+	DIV("2", "3", "0.6667");
+	DIV("-2", "3", "-0.6667");
+	DIV("1", "0", NULL);
+	DIV(MAXPOS, "1", MAXPOS);
+	DIV(MAXNEG, "-1", NULL);
+	DIV(MAXPOS, "0.5", NULL);
+	DIV("922337203685", "0.0001", NULL);
+	DIV("92233720368", "0.0001", "922337203680000");
+
+	test_digits("123.4567", 0, "1234567");
+	test_digits("-123.4567", 2, "-12345");
+	test_digits("0.0009", 4, "0");
+	test_digits(MAXNEG, 1, "-922337203685477580");
+
+	/* 12 is 120000 units, * 10 + 5 = 1200005, / 1000 = 1200 remainder 5 */
+	m = mny("12");
+	if (dbmnyscale(dbproc, &m, 10, 5) != SUCCEED || dbmnydown(dbproc, &m, 1000, &rem) != SUCCEED || rem != 5
+	    || m.mnyhigh != 0 || m.mnylow != 1200) {
+		fprintf(stderr, "wrong dbmnyscale/dbmnydown result\n");
+		failed = 1;
+	}
+	m = mny(MAXPOS);
+	if (dbmnyscale(dbproc, &m, 2, 0) != FAIL) {
+		fprintf(stderr, "dbmnyscale should overflow\n");
+		failed = 1;
+	}
+
+	m1.mny4 = 15000;
+	m2.mny4 = 22500;
+	if (dbmny4mul(dbproc, &m1, &m2, &m4) != SUCCEED || m4.mny4 != 33750) {
+		fprintf(stderr, "wrong dbmny4mul result\n");
+		failed = 1;
+	}
+	if (dbmny4divide(dbproc, &m1, &m2, &m4) != SUCCEED || m4.mny4 != 6667) {
+		fprintf(stderr, "wrong dbmny4divide result\n");
+		failed = 1;
+	}
+	m2.mny4 = 0x7fffffff;
+	if (dbmny4mul(dbproc, &m1, &m2, &m4) != FAIL) {
+		fprintf(stderr, "dbmny4mul should overflow\n");
+		failed = 1;
+	}
+
+	test_aggregates();
+
+	printf("dblib %s on %s\n", (failed ? "failed!" : "okay"), __FILE__);
+	dbexit();
+
+	return failed ? 1 : 0;
+}
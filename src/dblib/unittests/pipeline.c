@@ -0,0 +1,116 @@
+/*
+ * Purpose: Test commands queued and sent together
+ * Functions: dbsqlqueue dbsqlsend dbsqlok dbresults
+ */
+
+#include "common.h"
+
+static char software_version[] = "$Id: pipeline.c,v 1.1 2011/09/26 11:37:02 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#define NUM_CMDS 10
+
+static int failed = 0;
+
+static void
+check_results(DBPROCESS * dbproc, int n)
+{
+	int nresults = 0, rows = 0;
+	RETCODE erc;
+
+	if (dbsqlok(dbproc) != SUCCEED) {
+		fprintf(stderr, "dbsqlok failed for command %d\n", n);
+		exit(1);
+	}
+	while ((erc = dbresults(dbproc)) == SUCCEED) {
+		++nresults;
+		while (dbnextrow(dbproc) == REG_ROW) {
+			if (*(DBINT *) dbdata(dbproc, 1) != n) {
+				fprintf(stderr, "wrong value %d for command %d\n", (int) *(DBINT *) dbdata(dbproc, 1), n);
+				failed = 1;
+			}
+			++rows;
+		}
+	}
+	/* even commands select a row, odd ones update a row */
+	if (erc != NO_MORE_RESULTS || nresults != 1 || rows != (n % 2 ? 0 : 1)) {
+		fprintf(stderr, "wrong results for command %d\n", n);
+		failed = 1;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	LOGINREC *login;
+	DBPROCESS *dbproc;
+	int i;
+
+	set_malloc_options();
+
+	read_login_info(argc, argv);
+	fprintf(stdout, "Starting %s\n", argv[0]);
+
+	dbinit();
+
+	dberrhandle(syb_err_handler);
+	dbmsghandle(syb_msg_handler);
+
+	login = dblogin();
+	DBSETLPWD(login, PASSWORD);
+	DBSETLUSER(login, USER);
+	DBSETLAPP(login, "pipeline");
+
+	dbproc = dbopen(login, SERVER);
+	if (strlen(DATABASE))
+		dbuse(dbproc, DATABASE);
+	dbloginfree(login);
+
+	if (DBTDS(dbproc) < DBTDS_7_0) {
+		fprintf(stdout, "Commands can be queued only with TDS 7.0 or later\n");
+		dbexit();
+		return 0;
+	}
+
+	dbcmd(dbproc, "create table #pipeline(i int)\n"
+		"insert into #pipeline values(1)\n"
+		"insert into #pipeline select i + 1 from #pipeline\n"
+		"insert into #pipeline select i + 2 from #pipeline\n"
+		"insert into #pipeline select i + 4 from #pipeline\n"
+		"insert into #pipeline select i + 8 from #pipeline");
+	dbsqlexec(dbproc);
+	while (dbresults(dbproc) != NO_MORE_RESULTS)
+		continue;
+
+	/* last command is queued by dbsqlsend */
+	for (i = 0; i < NUM_CMDS; ++i) {
+		if (i % 2)
+			dbfcmd(dbproc, "update #pipeline set i = i + 100 where i = %d", i);
+		else
+			dbfcmd(dbproc, "select %d", i);
+		if (i < NUM_CMDS - 1 && dbsqlqueue(dbproc) != SUCCEED) {
+			fprintf(stderr, "dbsqlqueue failed\n");
+			exit(1);
+		}
+	}
+	if (dbsqlsend(dbproc) != SUCCEED) {
+		fprintf(stderr, "dbsqlsend failed\n");
+		exit(1);
+	}
+	for (i = 0; i < NUM_CMDS; ++i)
+		check_results(dbproc, i);
+
+	/* connection can be used as usual, all updates were done */
+	dbcmd(dbproc, "select count(*) from #pipeline where i > 100");
+	dbsqlexec(dbproc);
+	if (dbresults(dbproc) != SUCCEED || dbnextrow(dbproc) != REG_ROW || *(DBINT *) dbdata(dbproc, 1) != NUM_CMDS / 2) {
+		fprintf(stderr, "wrong results after pipeline\n");
+		failed = 1;
+	}
+	dbcancel(dbproc);
+
+	dbexit();
+
+	fprintf(stdout, "%s %s\n", __FILE__, (failed ? "failed!" : "OK"));
+	return failed ? 1 : 0;
+}
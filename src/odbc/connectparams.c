@@ -235,6 +235,9 @@ odbc_get_dsn_info(TDS_ERRS *errs, const char *DSN, TDSLOGIN * login)
 		login->mars = 1;
 	}
 
+	if (myGetPrivateProfileString(DSN, odbc_param_PreparedCacheSize, tmp) > 0)
+		tds_parse_conf_section(TDS_STR_PREPCACHE, tmp, login);
+
 	return 1;
 }
 
@@ -392,6 +395,8 @@ odbc_parse_connect_string(TDS_ERRS *errs, const char *connect_string, const char
 		} else if (CHK_PARAM(MARS_Connection)) {
 			if (tds_config_boolean(tds_dstr_cstr(&value)))
 				login->mars = 1;
+		} else if (CHK_PARAM(PreparedCacheSize)) {
+			tds_parse_conf_section(TDS_STR_PREPCACHE, tds_dstr_cstr(&value), login);
 		}
 
 		if (num_param >= 0 && parsed_params) {
@@ -632,6 +637,7 @@ static const char *const aTDSver[] = {
 	"7.1",
 	"7.2",
 	"7.3",
+	"7.4",
 	NULL
 };
 
@@ -747,7 +753,8 @@ ODBCINSTGetProperties(HODBCINSTPROPERTY hLastProperty)
 		" 7.0 MSSQL 7\n"
 		" 7.1 MSSQL 2000\n"
 		" 7.2 MSSQL 2005\n"
-		" 7.3 MSSQL 2008"
+		" 7.3 MSSQL 2008\n"
+		" 7.4 MSSQL 2012"
 		);
 
 	hLastProperty = definePropertyList(hLastProperty, odbc_param_Language, "us_english", (void*) aLanguage, sizeof(aLanguage),
@@ -59,7 +59,7 @@ odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT
 
 	TDSICONV *conv = curcol->char_conv;
 	if (!conv)
-		conv = tds->char_convs[client2server_chardata];
+		conv = tds_conn(tds)->char_convs[client2server_chardata];
 	if (desttype == SQL_C_WCHAR) {
 		/* SQL_C_WCHAR, convert to wide encode */
 		conv = tds_iconv_get(tds, ODBC_WIDE_NAME, conv->server_charset.name);
@@ -334,7 +334,9 @@ odbc_tds2sql(TDS_STMT * stmt, TDSCOLUMN *curcol, int srctype, TDS_CHAR * src, TD
 		nRetVal = strlen(buf);
 		memcpy(dest, buf, destlen < nRetVal ? destlen : nRetVal);
 	} else {
-		nRetVal = tds_convert(context, srctype, src, srclen, nDestSybType, &ores);
+		TDS_CONVERT_FUNC convert = curcol ? tds_column_converter(curcol, srctype, nDestSybType) : tds_convert;
+
+		nRetVal = convert(context, srctype, src, srclen, nDestSybType, &ores);
 	}
 	if (nRetVal < 0) {
 		odbc_convert_err_set(&stmt->errs, nRetVal);
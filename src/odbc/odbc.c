@@ -50,6 +50,7 @@
 #include <ctype.h>
 
 #include "tdsodbc.h"
+#include "odbcss.h"
 #include "tdsiconv.h"
 #include "tdsstring.h"
 #include "tdsconvert.h"
@@ -89,6 +90,7 @@ static SQLRETURN odbc_prepare(TDS_STMT *stmt);
 static SQLSMALLINT odbc_swap_datetime_sql_type(SQLSMALLINT sql_type);
 static int odbc_process_tokens(TDS_STMT * stmt, unsigned flag);
 static int odbc_lock_statement(TDS_STMT* stmt);
+static void odbc_unlock_statement(TDS_STMT* stmt);
 
 #if ENABLE_EXTRA_CHECKS
 static void odbc_ird_check(TDS_STMT * stmt);
@@ -184,7 +186,7 @@ odbc_col_setname(TDS_STMT * stmt, int colpos, const char *name)
 	IRD_CHECK;
 
 #if ENABLE_EXTRA_CHECKS
-	if (colpos > 0 && stmt->dbc->tds_socket != NULL && (resinfo = stmt->dbc->tds_socket->current_results) != NULL) {
+	if (colpos > 0 && stmt->tds != NULL && (resinfo = stmt->tds->current_results) != NULL) {
 		if (colpos <= resinfo->num_cols) {
 			/* no overflow possible, name is always shorter */
 			strcpy(resinfo->columns[colpos - 1]->column_name, name);
@@ -450,7 +452,7 @@ odbc_update_ird(TDS_STMT *stmt, TDS_ERRS *errs)
 static SQLRETURN
 odbc_prepare(TDS_STMT *stmt)
 {
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSSOCKET *tds = stmt->tds;
 	int in_row = 0;
 
 	if (tds_submit_prepare(tds, stmt->prepared_query, NULL, &stmt->dyn, stmt->params) == TDS_FAIL) {
@@ -501,13 +503,12 @@ odbc_prepare(TDS_STMT *stmt)
 		break;
 	}
 
-	if (stmt->dbc->current_statement == stmt)
-		stmt->dbc->current_statement = NULL;
 	if (stmt->errs.lastrc == SQL_ERROR && !stmt->dyn->emulated) {
 		TDSDYNAMIC *dyn = stmt->dyn;
 		stmt->dyn = NULL;
 		tds_free_dynamic(tds, dyn);
 	}
+	odbc_unlock_statement(stmt);
 	stmt->need_reprepare = 0;
 	ODBC_RETURN_(stmt);
 }
@@ -756,27 +757,60 @@ SQLExtendedFetch(SQLHSTMT hstmt, SQLUSMALLINT fFetchType, SQLROWOFFSET irow, SQL
 	ODBC_RETURN_(stmt);
 }
 
+/**
+ * Lock a socket for the statement.
+ * The connection socket is used if free, otherwise if MARS is enabled
+ * a new session is opened on the connection for this statement.
+ * \return 1 on success, 0 on failure (error added to statement)
+ */
 static int
 odbc_lock_statement(TDS_STMT* stmt)
 {
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDS_DBC *dbc = stmt->dbc;
+	TDSSOCKET *tds = stmt->tds;
 
 	/* FIXME quite bad... two thread can lock the same TDSSOCKET */
-	if (stmt->dbc->current_statement != NULL
-	    && stmt->dbc->current_statement != stmt) {
-		if (!tds || tds->state != TDS_IDLE) {
-			odbc_errs_add(&stmt->errs, "24000", NULL);
-			return 0;
+	if (!tds) {
+		tds = dbc->tds_socket;
+		if (dbc->current_statement != NULL && dbc->current_statement != stmt
+		    && (!tds || tds->state != TDS_IDLE)) {
+			/* connection busy, try another MARS session */
+			if (!tds || !(tds = tds_alloc_additional_socket(tds))) {
+				odbc_errs_add(&stmt->errs, "24000", NULL);
+				return 0;
+			}
+		} else {
+			/* previous statement lost its results */
+			if (dbc->current_statement)
+				dbc->current_statement->tds = NULL;
+			dbc->current_statement = stmt;
 		}
+		stmt->tds = tds;
 	}
 	if (tds)
 		tds->query_timeout = (stmt->attr.query_timeout != DEFAULT_QUERY_TIMEOUT) ?
-			stmt->attr.query_timeout : stmt->dbc->default_query_timeout;
-	stmt->dbc->current_statement = stmt;
+			stmt->attr.query_timeout : dbc->default_query_timeout;
 	stmt->cancel_sent = 0;
 	return 1;
 }
 
+/**
+ * Release the socket locked by the statement.
+ * MARS sessions are closed, the connection socket is made available.
+ */
+static void
+odbc_unlock_statement(TDS_STMT* stmt)
+{
+	TDS_DBC *dbc = stmt->dbc;
+	TDSSOCKET *tds = stmt->tds;
+
+	if (dbc->current_statement == stmt)
+		dbc->current_statement = NULL;
+	stmt->tds = NULL;
+	if (tds && tds != dbc->tds_socket)
+		tds_free_socket(tds);
+}
+
 SQLRETURN ODBC_API
 SQLMoreResults(SQLHSTMT hstmt)
 {
@@ -791,11 +825,11 @@ SQLMoreResults(SQLHSTMT hstmt)
 
 	tdsdump_log(TDS_DBG_FUNC, "SQLMoreResults(%p)\n", hstmt);
 
-	tds = stmt->dbc->tds_socket;
+	tds = stmt->tds;
 
 	/* We already read all results... */
 	/* TODO cursor */
-	if (stmt->dbc->current_statement != stmt)
+	if (!tds)
 		ODBC_RETURN(stmt, SQL_NO_DATA);
 
 	stmt->row_count = TDS_NO_COUNT;
@@ -820,12 +854,11 @@ SQLMoreResults(SQLHSTMT hstmt)
 						result_type, stmt->row_count, stmt->errs.lastrc);
 		switch (result_type) {
 		case TDS_CMD_DONE:
-			if (stmt->dbc->current_statement == stmt)
-				stmt->dbc->current_statement = NULL;
 #if 1 /* !UNIXODBC */
 			tds_free_all_results(tds);
 #endif
 			odbc_populate_ird(stmt);
+			odbc_unlock_statement(stmt);
 			if (stmt->row_count == TDS_NO_COUNT && !in_row) {
 				stmt->row_status = NOT_IN_ROW;
 				tdsdump_log(TDS_DBG_INFO1, "SQLMoreResults: row_status=%d\n", stmt->row_status);
@@ -1181,12 +1214,11 @@ SQLSetPos(SQLHSTMT hstmt, SQLSETPOSIROW irow, SQLUSMALLINT fOption, SQLUSMALLINT
 		break;
 	}
 
-	tds = stmt->dbc->tds_socket;
-
 	if (!odbc_lock_statement(stmt)) {
 		tds_free_param_results(params);
 		ODBC_RETURN_(stmt);
 	}
+	tds = stmt->tds;
 
 	if (tds_cursor_update(tds, stmt->cursor, op, irow, params) != TDS_SUCCESS) {
 		tds_free_param_results(params);
@@ -1197,7 +1229,7 @@ SQLSetPos(SQLHSTMT hstmt, SQLSETPOSIROW irow, SQLUSMALLINT fOption, SQLUSMALLINT
 	params = NULL;
 
 	ret = tds_process_simple_query(tds);
-	stmt->dbc->current_statement = NULL;
+	odbc_unlock_statement(stmt);
 	if (ret != TDS_SUCCESS) {
 		ODBC_SAFE_ERROR(stmt);
 		ODBC_RETURN_(stmt);
@@ -1793,13 +1825,15 @@ SQLCancel(SQLHSTMT hstmt)
 
 	tdsdump_log(TDS_DBG_FUNC, "SQLCancel(%p)\n", hstmt);
 
-	tds = stmt->dbc->tds_socket;
-	if (!tds) {
+	if (!stmt->dbc->tds_socket) {
 		odbc_errs_add(&stmt->errs, "HY010", NULL);
 		ODBC_RETURN_(stmt);
 	}
 
-	/* FIXME test current statement */
+	/* statement is not executing, nothing to cancel */
+	tds = stmt->tds;
+	if (!tds)
+		ODBC_RETURN_(stmt);
 
 	stmt->cancel_sent = 1;
 	if (tds_send_cancel(tds) == TDS_FAIL) {
@@ -1813,8 +1847,8 @@ SQLCancel(SQLHSTMT hstmt)
 	}
 
 	/* only if we processed cancel reset statement */
-	if (stmt->dbc->current_statement && stmt->dbc->current_statement == stmt && tds->state == TDS_IDLE)
-		stmt->dbc->current_statement = NULL;
+	if (stmt->tds == tds && tds->state == TDS_IDLE)
+		odbc_unlock_statement(stmt);
 
 	ODBC_RETURN_(stmt);
 }
@@ -2254,18 +2288,32 @@ SQLDisconnect(SQLHDBC hdbc)
 	ODBC_RETURN_(dbc);
 }
 
+/** return statement using given socket (connection or MARS session), NULL if none */
+static TDS_STMT *
+odbc_get_statement(TDS_DBC * dbc, TDSSOCKET * tds)
+{
+	TDS_STMT *stmt;
+
+	if (tds == dbc->tds_socket)
+		return dbc->current_statement;
+	for (stmt = dbc->stmt_list; stmt; stmt = stmt->next)
+		if (stmt->tds == tds)
+			return stmt;
+	return NULL;
+}
+
 static int
 odbc_errmsg_handler(const TDSCONTEXT * ctx, TDSSOCKET * tds, TDSMESSAGE * msg)
 {
 	struct _sql_errors *errs = NULL;
 	TDS_DBC *dbc = NULL;
+	TDS_STMT *stmt = NULL;
 
 	tdsdump_log(TDS_DBG_INFO1, "msgno %d %d\n", (int) msg->msgno, TDSETIME);
 
 	if (msg->msgno == TDSETIME) {
 		tdsdump_log(TDS_DBG_INFO1, "in timeout\n");
-		if (tds && (dbc = (TDS_DBC *) tds_get_parent(tds)) && dbc->current_statement) {
-			TDS_STMT *stmt = dbc->current_statement;
+		if (tds && (dbc = (TDS_DBC *) tds_get_parent(tds)) && (stmt = odbc_get_statement(dbc, tds)) != NULL) {
 			/* cancel sent, handling interrupt */
 			if (tds->in_cancel && stmt->cancel_sent) {
 				stmt->cancel_sent = 0;
@@ -2296,8 +2344,8 @@ odbc_errmsg_handler(const TDSCONTEXT * ctx, TDSSOCKET * tds, TDSMESSAGE * msg)
 	if (tds && tds_get_parent(tds)) {
 		dbc = (TDS_DBC *) tds_get_parent(tds);
 		errs = &dbc->errs;
-		if (dbc->current_statement)
-			errs = &dbc->current_statement->errs;
+		if ((stmt = odbc_get_statement(dbc, tds)) != NULL)
+			errs = &stmt->errs;
 		/* set server info if not setted in dbc */
 		if (msg->server && tds_dstr_isempty(&dbc->server))
 			tds_dstr_copy(&dbc->server, msg->server);
@@ -2896,13 +2944,13 @@ odbc_ird_check(TDS_STMT * stmt)
 	TDSRESULTINFO *res_info = NULL;
 	int cols = 0, i;
 
-	if (!stmt->dbc->tds_socket)
+	if (!stmt->tds)
 		return;
-	if (stmt->dbc->tds_socket->current_results) {
-		res_info = stmt->dbc->tds_socket->current_results;
+	if (stmt->tds->current_results) {
+		res_info = stmt->tds->current_results;
 		cols = res_info->num_cols;
 	}
-	if (stmt->cursor != NULL || stmt->dbc->current_statement != stmt)
+	if (stmt->cursor != NULL)
 		return;
 
 	/* check columns number */
@@ -2967,7 +3015,7 @@ odbc_populate_ird(TDS_STMT * stmt)
 	int i;
 
 	desc_free_records(ird);
-	if (!stmt->dbc->tds_socket || !(res_info = stmt->dbc->tds_socket->current_results))
+	if (!stmt->tds || !(res_info = stmt->tds->current_results))
 		return SQL_SUCCESS;
 	num_cols = res_info->num_cols;
 
@@ -3103,7 +3151,7 @@ odbc_populate_ird(TDS_STMT * stmt)
 static TDSRET
 odbc_cursor_execute(TDS_STMT * stmt)
 {
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSSOCKET *tds = stmt->tds;
 	int send = 0, i;
 	TDSRET ret;
 	TDSCURSOR *cursor;
@@ -3121,7 +3169,7 @@ odbc_cursor_execute(TDS_STMT * stmt)
 	else
 		cursor = tds_alloc_cursor(tds, tds_dstr_cstr(&stmt->cursor_name), tds_dstr_len(&stmt->cursor_name), stmt->prepared_query, strlen(stmt->prepared_query));
 	if (!cursor) {
-		stmt->dbc->current_statement = NULL;
+		odbc_unlock_statement(stmt);
 
 		odbc_errs_add(&stmt->errs, "HY001", NULL);
 		return TDS_FAIL;
@@ -3176,7 +3224,6 @@ odbc_cursor_execute(TDS_STMT * stmt)
 	if (ret == TDS_SUCCESS && IS_TDS7_PLUS(tds) && !tds_dstr_isempty(&stmt->cursor_name)) {
 		ret = odbc_process_tokens(stmt, TDS_RETURN_MSG|TDS_RETURN_DONE|TDS_STOPAT_ROW|TDS_STOPAT_COMPUTE);
 		stmt->row_count = tds->rows_affected;
-		stmt->dbc->current_statement = NULL;
 		if (ret == TDS_CMD_DONE && cursor->cursor_id != 0) {
 			ret = tds_cursor_setname(tds, cursor);
 			tds_set_state(tds, TDS_PENDING);
@@ -3195,20 +3242,20 @@ static SQLRETURN
 _SQLExecute(TDS_STMT * stmt)
 {
 	TDSRET ret;
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSSOCKET *tds;
 	TDS_INT result_type;
 	TDS_INT done = 0;
 	int in_row = 0;
 	SQLUSMALLINT param_status;
 	int found_info = 0, found_error = 0;
+	TDS_INT8 total_rows = TDS_NO_COUNT;
+	int had_socket;
 
 	tdsdump_log(TDS_DBG_FUNC, "_SQLExecute(%p)\n", 
 			stmt);
 
 	stmt->row = 0;
 		
-	tdsdump_log(TDS_DBG_FUNC, "_SQLExecute() starting with state %d\n", tds->state);
-
 	/* check parameters are all OK */
 	if (stmt->params && stmt->param_num <= stmt->param_count) {
 		/* TODO what error ?? */
@@ -3216,25 +3263,32 @@ _SQLExecute(TDS_STMT * stmt)
 		return SQL_ERROR;
 	}
 
+	/* statement can already own a socket with pending results */
+	had_socket = stmt->tds != NULL;
+	if (!odbc_lock_statement(stmt))
+		return SQL_ERROR;
+	tds = stmt->tds;
+
+	tdsdump_log(TDS_DBG_FUNC, "_SQLExecute() starting with state %d\n", tds->state);
+
 	if (tds->state != TDS_IDLE) {
 		if (tds->state == TDS_DEAD) {
 			odbc_errs_add(&stmt->errs, "08S01", NULL);
 		} else {
 			odbc_errs_add(&stmt->errs, "24000", NULL);
 		}
+		/* release socket locked here, pending results are kept */
+		if (!had_socket)
+			odbc_unlock_statement(stmt);
 		return SQL_ERROR;
 	}
 
-	if (!odbc_lock_statement(stmt))
-		return SQL_ERROR;
-
 	stmt->curr_param_row = 0;
 	stmt->num_param_rows = ODBC_MAX(1, stmt->apd->header.sql_desc_array_size);
 
 	stmt->row_count = TDS_NO_COUNT;
 
 	if (stmt->prepared_query_is_rpc) {
-		/* TODO support stmt->apd->header.sql_desc_array_size for RPC */
 		/* get rpc name */
 		/* TODO change method */
 		/* TODO cursor change way of calling */
@@ -3252,7 +3306,28 @@ _SQLExecute(TDS_STMT * stmt)
 		stmt->prepared_pos = end;
 		tmp = *end;
 		*end = 0;
-		ret = tds_submit_rpc(tds, name, stmt->params);
+		if (stmt->num_param_rows <= 1) {
+			ret = tds_submit_rpc(tds, name, stmt->params);
+		} else {
+			/* pack all calls in a single request */
+			TDSMULTIPLE multiple;
+
+			ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_RPC);
+			for (stmt->curr_param_row = 0; ret == TDS_SUCCESS; ) {
+				ret = tds_multiple_rpc(tds, &multiple, name, stmt->params);
+				if (++stmt->curr_param_row >= stmt->num_param_rows)
+					break;
+				/* than process others parameters, parsing restart after name */
+				*end = tmp;
+				if (start_parse_prepared_query(stmt, 1) != SQL_SUCCESS)
+					break;
+				stmt->prepared_pos = end;
+				*end = 0;
+			}
+			if (ret == TDS_SUCCESS)
+				ret = tds_multiple_done(tds, &multiple);
+			stmt->prepared_pos = end;
+		}
 		*end = tmp;
 	} else if (stmt->attr.cursor_type != SQL_CURSOR_FORWARD_ONLY || stmt->attr.concurrency != SQL_CONCUR_READ_ONLY) {
 		ret = odbc_cursor_execute(stmt);
@@ -3267,7 +3342,7 @@ _SQLExecute(TDS_STMT * stmt)
 				ret = tds_submit_execdirect(tds, stmt->query, stmt->params);
 			}
 		} else {
-			/* pack multiple submit using language */
+			/* pack multiple submit, using sp_executesql for TDS7+ or language */
 			TDSMULTIPLE multiple;
 
 			ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY);
@@ -3290,7 +3365,16 @@ _SQLExecute(TDS_STMT * stmt)
 					ODBC_RETURN(stmt, SQL_ERROR);
 			}
 			stmt->need_reprepare = 0;
-			ret = tds71_submit_prepexec(tds, stmt->prepared_query, NULL, &stmt->dyn, stmt->params);
+			stmt->dyn = tds_dynamic_cache_get(tds, stmt->prepared_query, stmt->params);
+			if (stmt->dyn) {
+				tds_free_input_params(stmt->dyn);
+				stmt->dyn->params = stmt->params;
+				/* prevent double free */
+				stmt->params = NULL;
+				ret = tds_submit_execute(tds, stmt->dyn);
+			} else {
+				ret = tds71_submit_prepexec(tds, stmt->prepared_query, NULL, &stmt->dyn, stmt->params);
+			}
 	} else {
 		/* TODO cursor change way of calling */
 		/* SQLPrepare */
@@ -3306,6 +3390,9 @@ _SQLExecute(TDS_STMT * stmt)
 			}
 			stmt->need_reprepare = 0;
 
+			stmt->dyn = tds_dynamic_cache_get(tds, stmt->prepared_query, stmt->params);
+		}
+		if (!stmt->dyn) {
 			tdsdump_log(TDS_DBG_INFO1, "Creating prepared statement\n");
 			/* TODO use tds_submit_prepexec (mssql2k, tds71) */
 			if (tds_submit_prepare(tds, stmt->prepared_query, NULL, &stmt->dyn, stmt->params) == TDS_FAIL) {
@@ -3400,6 +3487,11 @@ _SQLExecute(TDS_STMT * stmt)
 				found_info = 1;
 			if (stmt->errs.lastrc == SQL_ERROR)
 				found_error = 1;
+			/* sum counts of all parameter sets */
+			if (stmt->row_count != TDS_NO_COUNT) {
+				total_rows = (total_rows == TDS_NO_COUNT ? 0 : total_rows) + stmt->row_count;
+				stmt->row_count = TDS_NO_COUNT;
+			}
 			stmt->errs.lastrc = SQL_SUCCESS;
 			param_status = SQL_PARAM_SUCCESS;
 			++stmt->curr_param_row;
@@ -3427,6 +3519,8 @@ _SQLExecute(TDS_STMT * stmt)
 	}
 	if ((found_info || found_error) && stmt->errs.lastrc != SQL_ERROR)
 		stmt->errs.lastrc = SQL_SUCCESS_WITH_INFO;
+	if (total_rows != TDS_NO_COUNT)
+		stmt->row_count = (stmt->row_count == TDS_NO_COUNT ? 0 : stmt->row_count) + total_rows;
 	if (stmt->curr_param_row < stmt->num_param_rows) {
 		if (stmt->ipd->header.sql_desc_array_status_ptr)
 			stmt->ipd->header.sql_desc_array_status_ptr[stmt->curr_param_row] = param_status;
@@ -3438,8 +3532,7 @@ _SQLExecute(TDS_STMT * stmt)
 	odbc_populate_ird(stmt);
 	switch (result_type) {
 	case TDS_CMD_DONE:
-		if (stmt->dbc->current_statement == stmt)
-			stmt->dbc->current_statement = NULL;
+		odbc_unlock_statement(stmt);
 		if (stmt->errs.lastrc == SQL_SUCCESS && stmt->dbc->env->attr.odbc_version == SQL_OV_ODBC3
 		    && stmt->row_count == TDS_NO_COUNT && !stmt->cursor)
 			ODBC_RETURN(stmt, SQL_NO_DATA);
@@ -3527,7 +3620,7 @@ odbc_process_tokens(TDS_STMT * stmt, unsigned flag)
 {
 	TDS_INT result_type;
 	int done_flags;
-	TDSSOCKET * tds = stmt->dbc->tds_socket;
+	TDSSOCKET * tds = stmt->tds;
 
 	flag |= TDS_RETURN_DONE | TDS_RETURN_PROC;
 	for (;;) {
@@ -3566,7 +3659,8 @@ odbc_process_tokens(TDS_STMT * stmt, unsigned flag)
 			/* test for internal_sp not very fine, used for param set  -- freddy77 */
 			if ((done_flags & (TDS_DONE_COUNT|TDS_DONE_ERROR)) != 0
 			    || (stmt->errs.lastrc == SQL_SUCCESS_WITH_INFO && stmt->dbc->env->attr.odbc_version == SQL_OV_ODBC3)
-			    || (result_type == TDS_DONEPROC_RESULT && tds->internal_sp_called == TDS_SP_EXECUTE)) {
+			    || (result_type == TDS_DONEPROC_RESULT && tds->internal_sp_called == TDS_SP_EXECUTE)
+			    || (result_type == TDS_DONEPROC_RESULT && stmt->num_param_rows > 1 && IS_TDS7_PLUS(tds))) {
 				/* FIXME this row is used only as a flag for update binding, should be cleared if binding/result changed */
 				stmt->row = 0;
 #if 0
@@ -3612,7 +3706,7 @@ odbc_process_tokens(TDS_STMT * stmt, unsigned flag)
 static void
 odbc_fix_data_type_col(TDS_STMT *stmt, int idx)
 {
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSSOCKET *tds = stmt->tds;
 	TDSRESULTINFO *resinfo;
 	TDSCOLUMN *colinfo;
 
@@ -3676,7 +3770,6 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 
 	ard = stmt->ard;
 
-	tds = stmt->dbc->tds_socket;
 	num_rows = ard->header.sql_desc_array_size;
 
 	/* TODO cursor check also type of cursor (scrollable, not forward) */
@@ -3690,6 +3783,7 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 		TDSCURSOR *cursor = stmt->cursor;
 		TDS_CURSOR_FETCH fetch_type = TDS_CURSOR_FETCH_NEXT;
 
+		tds = stmt->tds;
 		switch (FetchOrientation) {
 		case SQL_FETCH_NEXT:
 			break;
@@ -3737,7 +3831,8 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 		stmt->row_status = PRE_NORMAL_ROW;
 	}
 
-	if (stmt->dbc->current_statement != stmt || stmt->row_status == NOT_IN_ROW) {
+	tds = stmt->tds;
+	if (!tds || stmt->row_status == NOT_IN_ROW) {
 		odbc_errs_add(&stmt->errs, "24000", NULL);
 		return SQL_ERROR;
 	}
@@ -3773,7 +3868,7 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 		case AFTER_COMPUTE_ROW:
 			/* handle done if needed */
 			/* FIXME doesn't seem so fine ... - freddy77 */
-			tds_process_tokens(stmt->dbc->tds_socket, &result_type, NULL, TDS_TOKEN_TRAILING);
+			tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_TRAILING);
 			goto all_done;
 
 		case IN_COMPUTE_ROW:
@@ -3784,8 +3879,21 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 			break;
 
 		default:
+			/* last column not bound can be read incrementally by SQLGetData */
+			resinfo = tds->current_results;
+			if (resinfo && resinfo->num_cols > 0) {
+				i = resinfo->num_cols - 1;
+				resinfo->columns[i]->column_stream = !stmt->cursor && num_rows == 1
+					&& stmt->special_row == ODBC_SPECIAL_NONE
+					&& (i >= ard->header.sql_desc_count || !ard->records[i].sql_desc_data_ptr);
+			}
+			/* row is converted before reading further, special rows are changed in place */
+			tds->zero_copy = stmt->special_row == ODBC_SPECIAL_NONE;
+			result_type = odbc_process_tokens(stmt, TDS_STOPAT_ROWFMT|TDS_RETURN_ROW|TDS_STOPAT_COMPUTE);
+			tds->zero_copy = 0;
+
 			/* FIXME stmt->row_count set correctly ?? TDS_DONE_COUNT not checked */
-			switch (odbc_process_tokens(stmt, TDS_STOPAT_ROWFMT|TDS_RETURN_ROW|TDS_STOPAT_COMPUTE)) {
+			switch (result_type) {
 			case TDS_ROW_RESULT:
 				break;
 			default:
@@ -3912,8 +4020,8 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
       all_done:
 	/* TODO cursor correct ?? */
 	if (stmt->cursor) {
-		tds_process_tokens(stmt->dbc->tds_socket, &result_type, NULL, TDS_TOKEN_TRAILING);
-		stmt->dbc->current_statement = NULL;
+		tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_TRAILING);
+		odbc_unlock_statement(stmt);
 	}
 	if (*fetched_ptr == 0 && (stmt->errs.lastrc == SQL_SUCCESS || stmt->errs.lastrc == SQL_SUCCESS_WITH_INFO))
 		ODBC_RETURN(stmt, SQL_NO_DATA);
@@ -4098,12 +4206,12 @@ _SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 	if (fOption == SQL_DROP || fOption == SQL_CLOSE) {
 		SQLRETURN retcode;
 
-		tds = stmt->dbc->tds_socket;
+		tds = stmt->tds;
 		/*
 		 * FIXME -- otherwise make sure the current statement is complete
 		 */
 		/* do not close other running query ! */
-		if (tds && tds->state != TDS_IDLE && tds->state != TDS_DEAD && stmt->dbc->current_statement == stmt) {
+		if (tds && tds->state != TDS_IDLE && tds->state != TDS_DEAD) {
 			if (tds_send_cancel(tds) == TDS_SUCCESS)
 				tds_process_cancel(tds);
 		}
@@ -4112,6 +4220,9 @@ _SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 		retcode = odbc_free_cursor(stmt);
 		if (!force && retcode != SQL_SUCCESS)
 			return retcode;
+
+		/* release the socket, closing MARS session */
+		odbc_unlock_statement(stmt);
 	}
 
 	/* free it */
@@ -4135,8 +4246,6 @@ _SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 		free(stmt->prepared_query);
 		tds_free_param_results(stmt->params);
 		odbc_errs_reset(&stmt->errs);
-		if (stmt->dbc->current_statement == stmt)
-			stmt->dbc->current_statement = NULL;
 		tds_dstr_free(&stmt->cursor_name);
 		desc_free(stmt->ird);
 		desc_free(stmt->ipd);
@@ -4320,7 +4429,7 @@ _SQLGetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER Value, SQLINTEG
 		if (stmt->cursor && odbc_lock_statement(stmt)) {
 			TDS_UINT row_number, row_count;
 
-			tds_cursor_get_cursor_info(stmt->dbc->tds_socket, stmt->cursor, &row_number, &row_count);
+			tds_cursor_get_cursor_info(stmt->tds, stmt->cursor, &row_number, &row_count);
 			stmt->attr.row_number = row_number;
 		}
 		size = sizeof(stmt->attr.row_number);
@@ -4770,6 +4879,12 @@ SQLSetParam(SQLHSTMT hstmt, SQLUSMALLINT ipar, SQLSMALLINT fCType, SQLSMALLINT f
 	case SQL_COPT_SS_MARS_ENABLED:
 		*((SQLUINTEGER *) Value) = dbc->attr.mars_enabled;
 		break;
+	case SQL_COPT_TDSODBC_PREPARED_CACHE_HITS:
+		*((SQLULEN *) Value) = dbc->tds_socket ? tds_conn(dbc->tds_socket)->dyn_cache_hits : 0;
+		break;
+	case SQL_COPT_TDSODBC_PREPARED_CACHE_MISSES:
+		*((SQLULEN *) Value) = dbc->tds_socket ? tds_conn(dbc->tds_socket)->dyn_cache_misses : 0;
+		break;
 	case SQL_ATTR_TRANSLATE_LIB:
 	case SQL_ATTR_TRANSLATE_OPTION:
 		odbc_errs_add(&dbc->errs, "HYC00", NULL);
@@ -4825,7 +4940,7 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 	}
 
 	/* read data from TDS only if current statement */
-	if ((stmt->cursor == NULL && stmt->dbc->current_statement != stmt) 
+	if ((stmt->cursor == NULL && !stmt->tds) 
 		|| stmt->row_status == PRE_NORMAL_ROW 
 		|| stmt->row_status == NOT_IN_ROW) 
 	{
@@ -4838,7 +4953,7 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 	if (!pcbValue)
 		pcbValue = &dummy_cb;
 
-	tds = stmt->dbc->tds_socket;
+	tds = stmt->tds;
 	context = stmt->dbc->env->tds_ctx;
 
 	resinfo = stmt->cursor ? stmt->cursor->res_info : tds->current_results;
@@ -4881,6 +4996,37 @@ SQLGetData(SQLHSTMT hstmt, SQLUSMALLINT icol, SQLSMALLINT fCType, SQLPOINTER rgb
 		}
 		assert(fCType);
 
+		/* data still in the network buffer, binary is copied directly, other types need all data */
+		if (tds && tds->stream_col == colinfo) {
+			if (fCType == SQL_C_BINARY && is_binary_type(nSybType)) {
+				SQLLEN remain = colinfo->column_cur_size - colinfo->column_text_sqlgetdatapos;
+				int n = 0;
+
+				if (cbValueMax > 0 && remain > 0) {
+					n = tds_stream_read(tds, colinfo, rgbValue, cbValueMax < remain ? cbValueMax : remain);
+					if (n < 0) {
+						odbc_errs_add(&stmt->errs, "08S01", NULL);
+						ODBC_RETURN(stmt, SQL_ERROR);
+					}
+				}
+				colinfo->column_text_sqlgetdatapos += n;
+				*pcbValue = remain;
+
+				/* avoid infinite SQL_SUCCESS on empty data */
+				if (colinfo->column_text_sqlgetdatapos == 0 && cbValueMax > 0)
+					++colinfo->column_text_sqlgetdatapos;
+				if (colinfo->column_text_sqlgetdatapos < colinfo->column_cur_size) {
+					odbc_errs_add(&stmt->errs, "01004", "String data, right truncated");
+					ODBC_RETURN_(stmt);
+				}
+				ODBC_RETURN_(stmt);
+			}
+			if (tds_stream_load(tds, colinfo, colinfo->column_text_sqlgetdatapos) != TDS_SUCCESS) {
+				odbc_errs_add(&stmt->errs, "08S01", NULL);
+				ODBC_RETURN(stmt, SQL_ERROR);
+			}
+		}
+
 		*pcbValue = odbc_tds2sql(stmt, colinfo, nSybType, src, srclen, fCType, (TDS_CHAR *) rgbValue, cbValueMax, NULL);
 		if (*pcbValue == SQL_NULL_DATA)
 			ODBC_RETURN(stmt, SQL_ERROR);
@@ -5629,7 +5775,7 @@ _SQLGetInfo(TDS_DBC * dbc, SQLUSMALLINT fInfoType, SQLPOINTER rgbInfoValue, SQLS
 		break;
 #if (ODBCVER >= 0x0300)
 	case SQL_PARAM_ARRAY_ROW_COUNTS:
-		UIVAL = SQL_PARC_BATCH;
+		UIVAL = SQL_PARC_NO_BATCH;
 		break;
 	case SQL_PARAM_ARRAY_SELECTS:
 		UIVAL = SQL_PAS_BATCH;
@@ -5868,7 +6014,7 @@ odbc_upper_column_names(TDS_STMT * stmt)
 	IRD_CHECK;
 
 #if ENABLE_EXTRA_CHECKS
-	tds = stmt->dbc->tds_socket;
+	tds = stmt->tds;
 	if (!tds || !tds->current_results)
 		return;
 
@@ -5981,7 +6127,8 @@ SQLGetTypeInfo(SQLHSTMT hstmt, SQLSMALLINT fSqlType)
 	 * Some program use first entry so we discard all entry before varchar
 	 */
 	n = 0;
-	while (tds->current_results) {
+	tds = stmt->tds;
+	while (tds && tds->current_results) {
 		TDSRESULTINFO *resinfo;
 		TDSCOLUMN *colinfo;
 		char *name;
@@ -5990,7 +6137,7 @@ SQLGetTypeInfo(SQLHSTMT hstmt, SQLSMALLINT fSqlType)
 		if (n == (varchar_pos - 1))
 			break;
 
-		switch (tds_process_tokens(stmt->dbc->tds_socket, &result_type, &compute_id, TDS_STOPAT_ROWFMT|TDS_RETURN_ROW)) {
+		switch (tds_process_tokens(tds, &result_type, &compute_id, TDS_STOPAT_ROWFMT|TDS_RETURN_ROW)) {
 		case TDS_SUCCESS:
 			if (result_type == TDS_ROW_RESULT)
 				break;
@@ -7101,35 +7248,75 @@ static SQLRETURN
 odbc_free_dynamic(TDS_STMT * stmt)
 {
 	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSDYNAMIC *dyn;
+	SQLRETURN ret = SQL_SUCCESS;
+	int locked = 0;
 
-	if (stmt->dyn) {
-		if (!tds_needs_unprepare(tds, stmt->dyn)) {
-			tds_free_dynamic(tds, stmt->dyn);
-			stmt->dyn = NULL;
-		} else if (tds_submit_unprepare(tds, stmt->dyn) == TDS_SUCCESS) {
-			if (tds_process_simple_query(tds) != TDS_SUCCESS) {
-				ODBC_SAFE_ERROR(stmt);
-				return SQL_ERROR;
-			}
-			tds_free_dynamic(tds, stmt->dyn);
+	if (!stmt->dyn)
+		return SQL_SUCCESS;
+
+	/* give statement to connection cache, we get back what to unprepare */
+	dyn = tds_dynamic_cache_put(tds, stmt->dyn);
+	if (dyn != stmt->dyn)
+		stmt->dyn = NULL;
+	if (!dyn)
+		return SQL_SUCCESS;
+
+	if (!tds_needs_unprepare(tds, dyn)) {
+		tds_free_dynamic(tds, dyn);
+		stmt->dyn = NULL;
+		return SQL_SUCCESS;
+	}
+
+	/* we need a socket to talk to server, connection could be used by another statement */
+	if (!stmt->tds) {
+		if (!odbc_lock_statement(stmt)) {
+			if (!stmt->dyn)
+				tds_free_dynamic(tds, dyn);
+			return SQL_ERROR;
+		}
+		locked = 1;
+	}
+	tds = stmt->tds;
+
+	if (tds_submit_unprepare(tds, dyn) == TDS_SUCCESS) {
+		if (tds_process_simple_query(tds) == TDS_SUCCESS) {
+			tds_free_dynamic(tds, dyn);
 			stmt->dyn = NULL;
 		} else {
-			/* TODO if fail add to odbc to free later, when we are in idle */
 			ODBC_SAFE_ERROR(stmt);
-			return SQL_ERROR;
+			ret = SQL_ERROR;
 		}
+	} else {
+		/* TODO if fail add to odbc to free later, when we are in idle */
+		ODBC_SAFE_ERROR(stmt);
+		ret = SQL_ERROR;
 	}
-	return SQL_SUCCESS;
+	/* evicted statement is not owned by us, do not leak it */
+	if (ret != SQL_SUCCESS && !stmt->dyn)
+		tds_free_dynamic(tds, dyn);
+	if (locked)
+		odbc_unlock_statement(stmt);
+	return ret;
 }
 
 static SQLRETURN
 odbc_free_cursor(TDS_STMT * stmt)
 {
 	TDSCURSOR *cursor = stmt->cursor;
-	TDSSOCKET *tds = stmt->dbc->tds_socket;
+	TDSSOCKET *tds;
+
+	if (cursor && stmt->dbc->tds_socket) {
+		int error = 1, locked = 0;
+
+		/* we need a socket to talk to server, connection could be used by another statement */
+		if (!stmt->tds) {
+			if (!odbc_lock_statement(stmt))
+				ODBC_RETURN(stmt, SQL_ERROR);
+			locked = 1;
+		}
+		tds = stmt->tds;
 
-	if (cursor && tds) {
-		int error = 1;
 		cursor->status.dealloc   = TDS_CURSOR_STATE_REQUESTED;
 		/* TODO if fail add to odbc to free later, when we are in idle */
 		if (tds_cursor_close(tds, cursor) == TDS_SUCCESS) {
@@ -7139,6 +7326,8 @@ odbc_free_cursor(TDS_STMT * stmt)
 			tds_cursor_dealloc(tds, cursor);
 			stmt->cursor = NULL;
 		}
+		if (locked)
+			odbc_unlock_statement(stmt);
 		if (error)
 			ODBC_RETURN(stmt, SQL_ERROR);
 	}
@@ -0,0 +1,112 @@
+#include "common.h"
+
+/* Test MARS, many statements with pending results on the same connection */
+
+static char software_version[] = "$Id: mars1.c,v 1.1 2011/08/30 09:12:44 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#ifndef SQL_COPT_SS_BASE
+#define SQL_COPT_SS_BASE	1200
+#endif
+
+#ifndef SQL_COPT_SS_MARS_ENABLED
+#define SQL_COPT_SS_MARS_ENABLED	(SQL_COPT_SS_BASE+24)
+#endif
+
+#ifndef SQL_MARS_ENABLED_YES
+#define SQL_MARS_ENABLED_YES	1
+#endif
+
+static void
+my_attrs(void)
+{
+	SQLSetConnectAttr(odbc_conn, SQL_COPT_SS_MARS_ENABLED, (SQLPOINTER) SQL_MARS_ENABLED_YES, SQL_IS_UINTEGER);
+}
+
+static SQLINTEGER
+fetch_int(HSTMT stmt)
+{
+	SQLINTEGER n = -1;
+	SQLLEN ind;
+
+	CHKR2(SQLFetch, (stmt), SQL_HANDLE_STMT, stmt, "S");
+	CHKR2(SQLGetData, (stmt, 1, SQL_C_SLONG, &n, sizeof(n), &ind), SQL_HANDLE_STMT, stmt, "S");
+	return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	HSTMT stmt2 = SQL_NULL_HSTMT;
+	SQLINTEGER n, i;
+	SQLRETURN rc;
+
+	odbc_set_conn_attr = my_attrs;
+	odbc_connect();
+
+	if (!odbc_db_is_microsoft() || odbc_db_version_int() < 0x09000000u) {
+		odbc_disconnect();
+		printf("MARS requires mssql2005 or later\n");
+		return 0;
+	}
+
+	odbc_command("CREATE TABLE #mars1 (n INT)");
+	odbc_command("DECLARE @i INT SET @i = 1 WHILE @i <= 1000 BEGIN INSERT INTO #mars1 VALUES(@i) SET @i = @i + 1 END");
+
+	CHKAllocHandle(SQL_HANDLE_STMT, odbc_conn, &stmt2, "S");
+
+	/* keep a result set pending on first statement */
+	odbc_command("SELECT n FROM #mars1 ORDER BY n");
+	if (fetch_int(odbc_stmt) != 1) {
+		fprintf(stderr, "wrong first row\n");
+		return 1;
+	}
+
+	/* second statement must work while first one still has rows */
+	rc = CHKR2(SQLExecDirect, (stmt2, T("SELECT COUNT(*) FROM #mars1"), SQL_NTS), SQL_HANDLE_STMT, stmt2, "SIE");
+	if (rc == SQL_ERROR) {
+		odbc_read_error();
+		printf("MARS not supported: %s\n", odbc_err);
+		CHKFreeStmt(SQL_CLOSE, "S");
+		CHKR2(SQLFreeHandle, (SQL_HANDLE_STMT, stmt2), SQL_HANDLE_STMT, stmt2, "S");
+		odbc_disconnect();
+		return 0;
+	}
+	if ((n = fetch_int(stmt2)) != 1000) {
+		fprintf(stderr, "wrong count %d\n", (int) n);
+		return 1;
+	}
+	CHKR2(SQLMoreResults, (stmt2), SQL_HANDLE_STMT, stmt2, "No");
+
+	/* update using second statement, then continue reading the first one */
+	CHKR2(SQLExecDirect, (stmt2, T("UPDATE #mars1 SET n = n WHERE n = 1"), SQL_NTS), SQL_HANDLE_STMT, stmt2, "SI");
+	CHKR2(SQLMoreResults, (stmt2), SQL_HANDLE_STMT, stmt2, "No");
+
+	for (i = 2; i <= 1000; ++i) {
+		if ((n = fetch_int(odbc_stmt)) != i) {
+			fprintf(stderr, "wrong row %d, expected %d\n", (int) n, (int) i);
+			return 1;
+		}
+	}
+	CHKFetch("No");
+	CHKMoreResults("No");
+
+	/* freeing a statement with pending results must not disturb the other */
+	odbc_command("SELECT n FROM #mars1 ORDER BY n DESC");
+	CHKR2(SQLExecDirect, (stmt2, T("SELECT n FROM #mars1 ORDER BY n"), SQL_NTS), SQL_HANDLE_STMT, stmt2, "SI");
+	if (fetch_int(stmt2) != 1 || fetch_int(odbc_stmt) != 1000) {
+		fprintf(stderr, "wrong rows\n");
+		return 1;
+	}
+	CHKR2(SQLFreeHandle, (SQL_HANDLE_STMT, stmt2), SQL_HANDLE_STMT, stmt2, "S");
+	if (fetch_int(odbc_stmt) != 999) {
+		fprintf(stderr, "wrong row after free\n");
+		return 1;
+	}
+	CHKFreeStmt(SQL_CLOSE, "S");
+
+	odbc_disconnect();
+
+	printf("Done.\n");
+	return 0;
+}
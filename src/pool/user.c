@@ -119,13 +119,13 @@ pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s, struct sockaddr_in *sin)
 	tds_set_parent(tds, NULL);
 	/* FIX ME - little endian emulation should be config file driven */
 	tds_conn(tds)->emul_little_endian = 1;
-	tds->in_buf = (unsigned char *) calloc(1, BLOCKSIZ);
+	tds->in_buf = tds_conn(tds)->recv_buf = (unsigned char *) calloc(1, BLOCKSIZ);
 	tds_set_s(tds, fd);
 	if (!tds->in_buf) {
 		tds_free_socket(tds);
 		return NULL;
 	}
-	tds->in_buf_max = BLOCKSIZ;
+	tds->in_buf_max = tds_conn(tds)->recv_buf_size = BLOCKSIZ;
 	tds->out_flag = TDS_LOGIN;
 	puser->tds = tds;
 	puser->user_state = TDS_SRV_LOGIN;
@@ -219,9 +219,9 @@ tds7_read_login(TDSSOCKET * tds, TDSLOGIN * login)
 	tds7_decrypt_pass((unsigned char *) unicode_string, unicode_len, (unsigned char *) unicode_string);
 	pbuf = tds_dstr_buf(&login->password);
 	
-	memset(&tds->char_convs[client2ucs2]->suppress, 0, sizeof(tds->char_convs[client2ucs2]->suppress));
+	memset(&tds_conn(tds)->char_convs[client2ucs2]->suppress, 0, sizeof(tds_conn(tds)->char_convs[client2ucs2]->suppress));
 	psrc = unicode_string;
-	a = tds_iconv(tds, tds->char_convs[client2ucs2], to_client, (const char **) &psrc, &unicode_len, &pbuf,
+	a = tds_iconv(tds, tds_conn(tds)->char_convs[client2ucs2], to_client, (const char **) &psrc, &unicode_len, &pbuf,
 			 &password_len);
 	if (a < 0 ) {
 		fprintf(stderr, "error: %s:%d: tds7_read_login: tds_iconv() failed\n", __FILE__, __LINE__);
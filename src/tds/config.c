@@ -235,6 +235,7 @@ tds_read_config_info(TDSSOCKET * tds, TDSLOGIN * login, TDSLOCALE * locale)
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "dump_file", tds_dstr_cstr(&connection->dump_file));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %x\n", "debug_flags", connection->debug_flags);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "text_size", connection->text_size);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "prepared_cache_size", connection->prepared_cache_size);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "broken_dates", connection->broken_dates);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "emul_little_endian", connection->emul_little_endian);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "server_realm_name", tds_dstr_cstr(&connection->server_realm_name));
@@ -590,6 +591,9 @@ tds_parse_conf_section(const char *option, const char *value, void *param)
 	} else if (!strcmp(option, TDS_STR_TEXTSZ)) {
 		if (atoi(value))
 			login->text_size = atoi(value);
+	} else if (!strcmp(option, TDS_STR_PREPCACHE)) {
+		if (atoi(value) >= 0)
+			login->prepared_cache_size = atoi(value);
 	} else if (!strcmp(option, TDS_STR_CHARSET)) {
 		tds_dstr_copy(&login->server_charset, value);
 		tdsdump_log(TDS_DBG_INFO1, "%s is %s.\n", option, tds_dstr_cstr(&login->server_charset));
@@ -676,6 +680,8 @@ tds_config_login(TDSLOGIN * connection, TDSLOGIN * login)
 
 	if (login->query_timeout)
 		connection->query_timeout = login->query_timeout;
+	if (login->prepared_cache_size)
+		connection->prepared_cache_size = login->prepared_cache_size;
 
 	/* copy other info not present in configuration file */
 	memcpy(connection->capabilities, login->capabilities, TDS_MAX_CAPABILITY);
@@ -764,6 +770,8 @@ tds_config_verstr(const char *tdsver, TDSLOGIN * login)
 		version = 0x702;
 	else if (!strcmp(tdsver, "7.3"))
 		version = 0x703;
+	else if (!strcmp(tdsver, "7.4"))
+		version = 0x704;
 	else if (!strcmp(tdsver, "0.0"))
 		version = 0;
 	else 
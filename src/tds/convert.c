@@ -76,13 +76,16 @@ struct tds_time
 	int tm_min;  /**< minutes (0-59) */
 	int tm_sec;  /**< seconds (0-59) */
 	int tm_ns;   /**< nanoseconds (0-999999999) */
+	int tm_offset; /**< offset from UTC in minutes, valid if tm_has_offset */
+	int tm_has_offset; /**< offset specified */
 };
 
 static TDS_INT tds_convert_int1(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr);
 static TDS_INT tds_convert_int2(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr);
 static TDS_INT tds_convert_int4(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr);
 static TDS_INT tds_convert_int8(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr);
-static int string_to_datetime(const char *datestr, int desttype, CONV_RESULT * cr);
+static int string_to_datetime(const char *datestr, TDS_UINT len, int desttype, CONV_RESULT * cr);
+static int tds_time_to_datetime(const struct tds_time *t, int desttype, CONV_RESULT * cr);
 static int is_dd_mon_yyyy(char *t);
 static int store_dd_mon_yyy_date(char *datestr, struct tds_time *t);
 
@@ -172,6 +175,27 @@ string_to_result(int desttype, const char *s, CONV_RESULT * cr)
 #define string_to_result(s, cr) \
 	string_to_result(desttype, s, cr)
 
+/**
+ * Format an integer in decimal without using printf
+ * @param s buffer, at least 21 characters
+ * @return s, null terminated
+ */
+static char *
+int_to_string(char *s, TDS_INT8 n)
+{
+	char *p = s;
+
+	if (n < 0) {
+		*p++ = '-';
+		/* unsigned to handle -2^63 */
+		p = tds_format_uint8(p, -(TDS_UINT8) n);
+	} else {
+		p = tds_format_uint8(p, n);
+	}
+	*p = 0;
+	return s;
+}
+
 /**
  * Copy binary data to to result and return len or TDS_CONVERT_NOMEM
  */
@@ -490,8 +514,7 @@ tds_convert_char(int srctype, const TDS_CHAR * src, TDS_UINT srclen, int desttyp
 	case SYBMSDATE:
 	case SYBMSDATETIME2:
 	case SYBMSDATETIMEOFFSET:
-		/* FIXME not null terminated */
-		return string_to_datetime(src, desttype, cr);
+		return string_to_datetime(src, srclen, desttype, cr);
 		break;
 	case SYBNUMERIC:
 	case SYBDECIMAL:
@@ -650,14 +673,13 @@ static TDS_INT
 tds_convert_int1(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr)
 {
 	TDS_TINYINT buf;
-	TDS_CHAR tmp_str[5];
+	TDS_CHAR tmp_str[24];
 
 	buf = *((TDS_TINYINT *) src);
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%d", buf);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(int_to_string(tmp_str, buf), cr);
 		break;
 	case CASE_ALL_BINARY:
 		return binary_to_result(src, 1, cr);
@@ -701,8 +723,7 @@ tds_convert_int1(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 		break;
 	case SYBNUMERIC:
 	case SYBDECIMAL:
-		sprintf(tmp_str, "%d", buf);
-		return stringz_to_numeric(tmp_str, cr);
+		return stringz_to_numeric(int_to_string(tmp_str, buf), cr);
 		break;
 		/* conversions not allowed */
 	case SYBUNIQUE:
@@ -719,14 +740,13 @@ static TDS_INT
 tds_convert_int2(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr)
 {
 	TDS_SMALLINT buf;
-	TDS_CHAR tmp_str[16];
+	TDS_CHAR tmp_str[24];
 
 	memcpy(&buf, src, sizeof(buf));
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%d", buf);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(int_to_string(tmp_str, buf), cr);
 		break;
 	case CASE_ALL_BINARY:
 		return binary_to_result(src, 2, cr);
@@ -772,8 +792,7 @@ tds_convert_int2(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 		break;
 	case SYBNUMERIC:
 	case SYBDECIMAL:
-		sprintf(tmp_str, "%d", buf);
-		return stringz_to_numeric(tmp_str, cr);
+		return stringz_to_numeric(int_to_string(tmp_str, buf), cr);
 		break;
 		/* conversions not allowed */
 	case SYBUNIQUE:
@@ -790,14 +809,13 @@ static TDS_INT
 tds_convert_int4(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT * cr)
 {
 	TDS_INT buf;
-	TDS_CHAR tmp_str[16];
+	TDS_CHAR tmp_str[24];
 
 	memcpy(&buf, src, sizeof(buf));
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%d", buf);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(int_to_string(tmp_str, buf), cr);
 		break;
 	case CASE_ALL_BINARY:
 		return binary_to_result(src, 4, cr);
@@ -848,8 +866,7 @@ tds_convert_int4(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 		break;
 	case SYBNUMERIC:
 	case SYBDECIMAL:
-		sprintf(tmp_str, "%d", buf);
-		return stringz_to_numeric(tmp_str, cr);
+		return stringz_to_numeric(int_to_string(tmp_str, buf), cr);
 		break;
 		/* conversions not allowed */
 	case SYBUNIQUE:
@@ -872,8 +889,7 @@ tds_convert_int8(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%" PRId64, buf);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(int_to_string(tmp_str, buf), cr);
 		break;
 	case CASE_ALL_BINARY:
 		return binary_to_result(src, sizeof(TDS_INT8), cr);
@@ -927,8 +943,7 @@ tds_convert_int8(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 		break;
 	case SYBNUMERIC:
 	case SYBDECIMAL:
-		sprintf(tmp_str, "%" PRId64, buf);
-		return stringz_to_numeric(tmp_str, cr);
+		return stringz_to_numeric(int_to_string(tmp_str, buf), cr);
 		break;
 		/* conversions not allowed */
 	case SYBUNIQUE:
@@ -944,7 +959,7 @@ tds_convert_int8(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 static TDS_INT
 tds_convert_numeric(int srctype, const TDS_NUMERIC * src, TDS_INT srclen, int desttype, CONV_RESULT * cr)
 {
-	char tmpstr[MAXPRECISION];
+	char tmpstr[MAXPRECISION + 4];
 	TDS_INT i, ret;
 	TDS_INT8 bi;
 
@@ -959,58 +974,36 @@ tds_convert_numeric(int srctype, const TDS_NUMERIC * src, TDS_INT srclen, int de
 		return binary_to_result(src, sizeof(TDS_NUMERIC), cr);
 		break;
 	case SYBINT1:
-		cr->n = *src;
-		ret = tds_numeric_change_prec_scale(&(cr->n), 3, 0);
+		ret = tds_numeric_to_int8(src, &bi);
 		if (ret < 0)
 			return ret;
-		if (cr->n.array[1] || (cr->n.array[0] && cr->n.array[2]))
+		if (!IS_TINYINT(bi))
 			return TDS_CONVERT_OVERFLOW;
-		cr->ti = cr->n.array[2];
+		cr->ti = (TDS_TINYINT) bi;
 		return sizeof(TDS_TINYINT);
 		break;
 	case SYBINT2:
-		cr->n = *src;
-		ret = tds_numeric_change_prec_scale(&(cr->n), 5, 0);
+		ret = tds_numeric_to_int8(src, &bi);
 		if (ret < 0)
 			return ret;
-		if (cr->n.array[1])
-			return TDS_CONVERT_OVERFLOW;
-		i = TDS_GET_UA2BE(&(cr->n.array[2]));
-		if (cr->n.array[0])
-			i = -i;
-		if (((i >> 15) ^ cr->n.array[0]) & 1)
+		if (!IS_SMALLINT(bi))
 			return TDS_CONVERT_OVERFLOW;
-		cr->si = (TDS_SMALLINT) i;
+		cr->si = (TDS_SMALLINT) bi;
 		return sizeof(TDS_SMALLINT);
 		break;
 	case SYBINT4:
-		cr->n = *src;
-		ret = tds_numeric_change_prec_scale(&(cr->n), 10, 0);
+		ret = tds_numeric_to_int8(src, &bi);
 		if (ret < 0)
 			return ret;
-		if (cr->n.array[1])
+		if (!IS_INT(bi))
 			return TDS_CONVERT_OVERFLOW;
-		i = TDS_GET_UA4BE(&(cr->n.array[2]));
-		if (cr->n.array[0])
-			i = -i;
-		if (((i >> 31) ^ cr->n.array[0]) & 1)
-			return TDS_CONVERT_OVERFLOW;
-		cr->i = i;
+		cr->i = (TDS_INT) bi;
 		return sizeof(TDS_INT);
 		break;
 	case SYBINT8:
-		cr->n = *src;
-		ret = tds_numeric_change_prec_scale(&(cr->n), 20, 0);
+		ret = tds_numeric_to_int8(src, &bi);
 		if (ret < 0)
 			return ret;
-		if (cr->n.array[1])
-			return TDS_CONVERT_OVERFLOW;
-		bi = TDS_GET_UA4BE(&(cr->n.array[2]));
-		bi = (bi << 32) + TDS_GET_UA4BE(&(cr->n.array[6]));
-		if (cr->n.array[0])
-			bi = -bi;
-		if (((bi >> 63) ^ cr->n.array[0]) & 1)
-			return TDS_CONVERT_OVERFLOW;
 		cr->bi = bi;
 		return sizeof(TDS_INT8);
 		break;
@@ -1033,15 +1026,14 @@ tds_convert_numeric(int srctype, const TDS_NUMERIC * src, TDS_INT srclen, int de
 		}
 		break;
 	case SYBFLT8:
-		if (tds_numeric_to_string(src, tmpstr) < 0)
+		if (tds_numeric_to_flt8(src, &cr->f) < 0)
 			return TDS_CONVERT_FAIL;
-		cr->f = atof(tmpstr);
 		return 8;
 		break;
 	case SYBREAL:
-		if (tds_numeric_to_string(src, tmpstr) < 0)
+		if (tds_numeric_to_flt8(src, &cr->f) < 0)
 			return TDS_CONVERT_FAIL;
-		cr->r = (TDS_REAL) atof(tmpstr);
+		cr->r = (TDS_REAL) cr->f;
 		return 4;
 		break;
 		/* TODO conversions to money */
@@ -1056,36 +1048,52 @@ tds_convert_numeric(int srctype, const TDS_NUMERIC * src, TDS_INT srclen, int de
 	return TDS_CONVERT_NOAVAIL;
 }
 
+/**
+ * Format a SMALLMONEY value with 2 decimal digits like server does
+ * @param s buffer, at least 16 characters
+ * @return s, null terminated
+ */
+static char *
+money4_to_string(char *s, TDS_INT mny4)
+{
+	char *p = s;
+	TDS_UINT dollars;
+
+	/*
+	 * round to 2 decimal digits
+	 * rounding with dollars = (mny4 + 5000) /10000
+	 * can give arithmetic overflow so I use
+	 * dollars = (mny4/50 + 1)/2 
+	 */
+	/* TODO round also all conversions to int and from money ?? */
+	if (mny4 < 0) {
+		*p++ = '-';
+		/* here (-mny4 / 50 + 1 ) / 2 can cause overflow in -mny4 */
+		dollars = -(mny4 / 50 - 1 ) / 2;
+	} else {
+		dollars = (mny4 / 50 + 1 ) / 2;
+	}
+	/* print only 2 decimal digits as server does */
+	p = tds_format_uint8(p, dollars / 100);
+	*p++ = '.';
+	*p++ = '0' + dollars % 100 / 10;
+	*p++ = '0' + dollars % 10;
+	*p = 0;
+	return s;
+}
+
 static TDS_INT
 tds_convert_money4(int srctype, const TDS_CHAR * src, int srclen, int desttype, CONV_RESULT * cr)
 {
 	TDS_MONEY4 mny;
 	long dollars, fraction;
 	char tmp_str[33];
-	char *p;
 
 	memcpy(&mny, src, sizeof(mny));
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		/*
-		 * round to 2 decimal digits
-		 * rounding with dollars = (mny.mny4 + 5000) /10000
-		 * can give arithmetic overflow so I use
-		 * dollars = (mny.mny4/50 + 1)/2 
-		 */
-		/* TODO round also all conversions to int and from money ?? */
-		p = tmp_str;
-		if (mny.mny4 < 0) {
-			*p++ = '-';
-			/* here (-mny.mny4 / 50 + 1 ) / 2 can cause overflow in -mny.mny4 */
-			dollars = -(mny.mny4 / 50 - 1 ) / 2;
-		} else {
-			dollars = (mny.mny4 / 50 + 1 ) / 2;
-		}
-		/* print only 2 decimal digits as server does */
-		sprintf(p, "%ld.%02lu", dollars / 100, dollars % 100);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(money4_to_string(tmp_str, mny.mny4), cr);
 		break;
 	case CASE_ALL_BINARY:
 		return binary_to_result(src, sizeof(TDS_MONEY4), cr);
@@ -1389,8 +1397,7 @@ tds_convert_real(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%.7g", the_value);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(tds_real_to_string(the_value, tmp_str), cr);
 		break;
 
 	case CASE_ALL_BINARY:
@@ -1483,8 +1490,7 @@ tds_convert_flt8(int srctype, const TDS_CHAR * src, int desttype, CONV_RESULT *
 	switch (desttype) {
 	case TDS_CONVERT_CHAR:
 	case CASE_ALL_CHAR:
-		sprintf(tmp_str, "%.16g", the_value);
-		return string_to_result(tmp_str, cr);
+		return string_to_result(tds_flt8_to_string(the_value, tmp_str), cr);
 		break;
 
 	case CASE_ALL_BINARY:
@@ -1709,8 +1715,561 @@ tds_convert(const TDSCONTEXT * tds_ctx, int srctype, const TDS_CHAR * src, TDS_U
 	return length;
 }
 
+/*
+ * Specialized converters returned by tds_get_converter() for common
+ * conversions, they must give the same results as tds_convert().
+ */
+#define CONV_FUNC(name) static TDS_INT \
+name(const TDSCONTEXT * tds_ctx, int srctype, const TDS_CHAR * src, TDS_UINT srclen, int desttype, CONV_RESULT * cr)
+
+#define CONV_INT_CHAR(name, type) CONV_FUNC(name) \
+{ \
+	type n; \
+	TDS_CHAR tmp_str[24]; \
+\
+	memcpy(&n, src, sizeof(n)); \
+	return string_to_result(int_to_string(tmp_str, n), cr); \
+}
+
+CONV_INT_CHAR(tds_conv_int1_char, TDS_TINYINT)
+CONV_INT_CHAR(tds_conv_int2_char, TDS_SMALLINT)
+CONV_INT_CHAR(tds_conv_int4_char, TDS_INT)
+CONV_INT_CHAR(tds_conv_int8_char, TDS_INT8)
+
+#define CONV_COPY(name, size) CONV_FUNC(name) \
+{ \
+	memcpy(cr, src, size); \
+	return size; \
+}
+
+CONV_COPY(tds_conv_copy1, 1)
+CONV_COPY(tds_conv_copy2, 2)
+CONV_COPY(tds_conv_copy4, 4)
+CONV_COPY(tds_conv_copy8, 8)
+
+CONV_FUNC(tds_conv_int1_int4)
+{
+	cr->i = *(const TDS_TINYINT *) src;
+	return sizeof(TDS_INT);
+}
+
+CONV_FUNC(tds_conv_int2_int4)
+{
+	TDS_SMALLINT n;
+
+	memcpy(&n, src, sizeof(n));
+	cr->i = n;
+	return sizeof(TDS_INT);
+}
+
+CONV_FUNC(tds_conv_int4_int8)
+{
+	TDS_INT n;
+
+	memcpy(&n, src, sizeof(n));
+	cr->bi = n;
+	return sizeof(TDS_INT8);
+}
+
+CONV_FUNC(tds_conv_money_char)
+{
+	char tmp_str[64];
+
+	return string_to_result(tds_money_to_string((const TDS_MONEY *) src, tmp_str), cr);
+}
+
+CONV_FUNC(tds_conv_money4_char)
+{
+	TDS_MONEY4 mny;
+	char tmp_str[33];
+
+	memcpy(&mny, src, sizeof(mny));
+	return string_to_result(money4_to_string(tmp_str, mny.mny4), cr);
+}
+
+CONV_FUNC(tds_conv_char_int4)
+{
+	TDS_INT n, rc;
+
+	if ((rc = string_to_int(src, src + srclen, &n)) < 0)
+		return rc;
+	cr->i = n;
+	return sizeof(TDS_INT);
+}
+
+CONV_FUNC(tds_conv_char_int8)
+{
+	TDS_INT8 n;
+	TDS_INT rc;
+
+	if ((rc = string_to_int8(src, src + srclen, &n)) < 0)
+		return rc;
+	cr->bi = n;
+	return sizeof(TDS_INT8);
+}
+
+CONV_FUNC(tds_conv_char_datetime)
+{
+	return string_to_datetime(src, srclen, desttype, cr);
+}
+
+#include "tds_convert_table.h"
+
+/**
+ * Get a function to convert from srctype to desttype.
+ * The function takes the same parameters as tds_convert() and can be
+ * called in place of it for every value, avoiding to check types again.
+ * For common conversions specialized functions are returned.
+ * \param srctype  type of source
+ * \param desttype type of destination
+ * \return converter, never NULL
+ */
+TDS_CONVERT_FUNC
+tds_get_converter(int srctype, int desttype)
+{
+	return tds_converters[tds_convert_type_index(srctype)][tds_convert_type_index(desttype)];
+}
+
+/**
+ * Get converter for a column, the converter is resolved once and cached
+ * in the column so client libraries can call this for every row.
+ * \param col      column to convert
+ * \param srctype  type of source
+ * \param desttype type of destination
+ * \return converter, never NULL
+ */
+TDS_CONVERT_FUNC
+tds_column_converter(TDSCOLUMN * col, int srctype, int desttype)
+{
+	if (!col->column_convert || col->column_convert_src != srctype || col->column_convert_dest != desttype) {
+		col->column_convert = tds_get_converter(srctype, desttype);
+		col->column_convert_src = srctype;
+		col->column_convert_dest = desttype;
+	}
+	return col->column_convert;
+}
+
+/*
+ * Batch conversions, see tds_convert_batch().
+ * Every kernel converts a whole array, values with negative source
+ * length are NULL and are skipped.
+ */
+#define BATCH_PARAMS const TDS_CHAR * src, TDS_UINT srcstride, const TDS_INT * srclens, \
+	TDS_CHAR * dest, TDS_UINT deststride, TDS_INT * destlens, TDS_UINT count
+#define BATCH_LOOP for (i = 0; i < count; ++i, src += srcstride, dest += deststride) \
+	if (!srclens || srclens[i] >= 0)
+#define BATCH_RESULT(len) do { if (destlens) destlens[i] = (len); } while(0)
+
 static int
-string_to_datetime(const char *instr, int desttype, CONV_RESULT * cr)
+batch_int_index(int type)
+{
+	switch (type) {
+	case SYBINT1:
+		return 0;
+	case SYBINT2:
+		return 1;
+	case SYBINT4:
+		return 2;
+	case SYBINT8:
+		return 3;
+	}
+	return -1;
+}
+
+#define BATCH_WIDEN(stype, dtype) \
+	BATCH_LOOP { \
+		stype s; \
+		dtype d; \
+		memcpy(&s, src, sizeof(s)); \
+		d = s; \
+		memcpy(dest, &d, sizeof(d)); \
+		BATCH_RESULT(sizeof(d)); \
+	}
+
+/** integer to integer of same or bigger size, cannot fail */
+static void
+batch_int_widen(int from, int to, BATCH_PARAMS)
+{
+	TDS_UINT i;
+
+	switch (from * 4 + to) {
+	case 0 * 4 + 0:
+		BATCH_WIDEN(TDS_TINYINT, TDS_TINYINT);
+		break;
+	case 0 * 4 + 1:
+		BATCH_WIDEN(TDS_TINYINT, TDS_SMALLINT);
+		break;
+	case 0 * 4 + 2:
+		BATCH_WIDEN(TDS_TINYINT, TDS_INT);
+		break;
+	case 0 * 4 + 3:
+		BATCH_WIDEN(TDS_TINYINT, TDS_INT8);
+		break;
+	case 1 * 4 + 1:
+		BATCH_WIDEN(TDS_SMALLINT, TDS_SMALLINT);
+		break;
+	case 1 * 4 + 2:
+		BATCH_WIDEN(TDS_SMALLINT, TDS_INT);
+		break;
+	case 1 * 4 + 3:
+		BATCH_WIDEN(TDS_SMALLINT, TDS_INT8);
+		break;
+	case 2 * 4 + 2:
+		BATCH_WIDEN(TDS_INT, TDS_INT);
+		break;
+	case 2 * 4 + 3:
+		BATCH_WIDEN(TDS_INT, TDS_INT8);
+		break;
+	case 3 * 4 + 3:
+		BATCH_WIDEN(TDS_INT8, TDS_INT8);
+		break;
+	}
+}
+
+/** float or real to string, same format of tds_convert_flt8/tds_convert_real */
+static void
+batch_float_char(int srctype, BATCH_PARAMS)
+{
+	TDS_UINT i;
+	char tmp_str[32];
+	int len;
+
+	BATCH_LOOP {
+		if (srctype == SYBREAL) {
+			TDS_REAL r;
+
+			memcpy(&r, src, sizeof(r));
+			len = (int) strlen(tds_real_to_string(r, tmp_str));
+		} else {
+			TDS_FLOAT f;
+
+			memcpy(&f, src, sizeof(f));
+			len = (int) strlen(tds_flt8_to_string(f, tmp_str));
+		}
+		memcpy(dest, tmp_str, (TDS_UINT) len < deststride ? (TDS_UINT) len : deststride);
+		BATCH_RESULT(len);
+	}
+}
+
+/**
+ * numeric to float, values are read directly from the array skipping
+ * tds_convert dispatch.
+ */
+static TDS_INT
+batch_numeric_flt8(BATCH_PARAMS)
+{
+	TDS_UINT i;
+	TDS_INT res = (TDS_INT) count, len;
+	TDS_NUMERIC num;
+	TDS_FLOAT f;
+
+	BATCH_LOOP {
+		memcpy(&num, src, sizeof(num));
+		len = tds_numeric_to_flt8(&num, &f);
+		if (len >= 0) {
+			memcpy(dest, &f, sizeof(f));
+			len = sizeof(f);
+		} else if (res >= 0) {
+			res = len;
+		}
+		BATCH_RESULT(len);
+	}
+	return res;
+}
+
+/**
+ * datetime to TDSDATEREC.
+ * Consecutive values often have the same day (like rows ordered by date),
+ * in this case only time is computed.
+ */
+static void
+batch_datetime_daterec(BATCH_PARAMS)
+{
+	TDS_UINT i;
+	TDSDATEREC *dr, *prev = NULL;
+	TDS_DATETIME dt;
+	TDS_INT prev_days = 0;
+	unsigned int dt_time;
+
+	BATCH_LOOP {
+		memcpy(&dt, src, sizeof(dt));
+		dr = (TDSDATEREC *) dest;
+		if (prev && dt.dtdays == prev_days) {
+			*dr = *prev;
+			dt_time = dt.dttime;
+			dr->decimicrosecond = ((dt_time % 300) * 1000 + 150) / 300 * 10000u;
+			dt_time = dt_time / 300;
+			dr->second = dt_time % 60;
+			dt_time = dt_time / 60;
+			dr->minute = dt_time % 60;
+			dr->hour = dt_time / 60;
+		} else {
+			tds_datecrack(SYBDATETIME, &dt, dr);
+		}
+		prev = dr;
+		prev_days = dt.dtdays;
+		BATCH_RESULT(sizeof(TDSDATEREC));
+	}
+}
+
+/** generic conversion using tds_get_converter */
+static TDS_INT
+batch_generic(const TDSCONTEXT * context, int srctype, int desttype, BATCH_PARAMS)
+{
+	TDS_CONVERT_FUNC convert = tds_get_converter(srctype, desttype);
+	TDS_UINT i;
+	TDS_INT res = (TDS_INT) count, len;
+	int srclen = tds_get_size_by_type(srctype), destsize = tds_get_size_by_type(desttype);
+	CONV_RESULT cr;
+
+	if (srclen <= 0)
+		srclen = srcstride;
+
+	BATCH_LOOP {
+		if (desttype == TDS_CONVERT_CHAR || desttype == TDS_CONVERT_BINARY) {
+			cr.cc.c = dest;
+			cr.cc.len = deststride;
+		}
+		if (desttype == TDS_CONVERT_DATEREC)
+			len = tds_datecrack(srctype, src, (TDSDATEREC *) dest) == TDS_SUCCESS ? sizeof(TDSDATEREC) : TDS_CONVERT_NOAVAIL;
+		else
+			len = convert(context, srctype, src, srclens ? srclens[i] : srclen, desttype, &cr);
+		if (len < 0) {
+			if (res >= 0)
+				res = len;
+		} else if (destsize > 0) {
+			memcpy(dest, &cr, destsize);
+		}
+		BATCH_RESULT(len);
+	}
+	return res;
+}
+
+/**
+ * Convert an array of values of the same type.
+ * Value i is read from src + i * srcstride and written to
+ * dest + i * deststride, so both column arrays and arrays of structures
+ * can be used.
+ * Destination type can be a fixed size type (stored as is), TDS_CONVERT_CHAR
+ * or TDS_CONVERT_BINARY (at most deststride bytes are written, length
+ * returned is the full one) or TDS_CONVERT_DATEREC (a TDSDATEREC
+ * is stored).
+ * \param context   context, as for tds_convert()
+ * \param srctype   type of source
+ * \param src       first source value
+ * \param srcstride distance in bytes between source values
+ * \param srclens   length of source values, negative for NULL values.
+ *                  If NULL values are not NULL and have the size of srctype
+ *                  (srcstride bytes for variable types)
+ * \param desttype  type of destination
+ * \param dest      first destination value, untouched for NULL values
+ * \param deststride distance in bytes between destination values
+ * \param destlens  if not NULL filled with length of converted values,
+ *                  0 for NULL values, TDS_CONVERT_* error codes for failures
+ * \param nullind   if not NULL filled with -1 for NULL values, 0 otherwise
+ * \param count     number of values
+ * \return count or error code of the first failed conversion, values
+ *         after a failure are still converted
+ */
+TDS_INT
+tds_convert_batch(const TDSCONTEXT * context, int srctype, const TDS_CHAR * src, TDS_UINT srcstride, const TDS_INT * srclens,
+		  int desttype, TDS_CHAR * dest, TDS_UINT deststride, TDS_INT * destlens, TDS_SMALLINT * nullind, TDS_UINT count)
+{
+	TDS_UINT i;
+	int from, to;
+
+	switch (desttype) {
+	case TDS_CONVERT_CHAR:
+	case TDS_CONVERT_BINARY:
+	case TDS_CONVERT_DATEREC:
+	case SYBINT1:
+	case SYBINT2:
+	case SYBINT4:
+	case SYBINT8:
+	case SYBBIT:
+	case SYBREAL:
+	case SYBFLT8:
+	case SYBMONEY:
+	case SYBMONEY4:
+	case SYBDATETIME:
+	case SYBDATETIME4:
+	case SYBUNIQUE:
+		break;
+	default:
+		/* need allocation or precision */
+		return TDS_CONVERT_NOAVAIL;
+	}
+	for (i = 0; i < count; ++i) {
+		if (srclens && srclens[i] < 0) {
+			if (nullind)
+				nullind[i] = -1;
+			if (destlens)
+				destlens[i] = 0;
+		} else if (nullind) {
+			nullind[i] = 0;
+		}
+	}
+
+	from = batch_int_index(srctype);
+	to = batch_int_index(desttype);
+	if (from >= 0 && to >= from) {
+		batch_int_widen(from, to, src, srcstride, srclens, dest, deststride, destlens, count);
+		return (TDS_INT) count;
+	}
+
+	switch (srctype) {
+	case SYBREAL:
+	case SYBFLT8:
+		if (desttype == TDS_CONVERT_CHAR) {
+			batch_float_char(srctype, src, srcstride, srclens, dest, deststride, destlens, count);
+			return (TDS_INT) count;
+		}
+		break;
+	case SYBNUMERIC:
+	case SYBDECIMAL:
+		if (desttype == SYBFLT8)
+			return batch_numeric_flt8(src, srcstride, srclens, dest, deststride, destlens, count);
+		break;
+	case SYBDATETIME:
+		if (desttype == TDS_CONVERT_DATEREC) {
+			batch_datetime_daterec(src, srcstride, srclens, dest, deststride, destlens, count);
+			return (TDS_INT) count;
+		}
+		break;
+	}
+
+	return batch_generic(context, srctype, desttype, src, srcstride, srclens, dest, deststride, destlens, count);
+}
+
+/* return value of n digits, -1 if not all digits */
+static int
+parse_digits(const char *s, int n)
+{
+	int res = 0;
+
+	for (; n > 0; --n, ++s) {
+		if (*s < '0' || *s > '9')
+			return -1;
+		res = res * 10 + (*s - '0');
+	}
+	return res;
+}
+
+/**
+ * Parse common date formats without allocating memory.
+ * Accepted formats are YYYY-MM-DD and YYYYMMDD, followed optionally by
+ * a time hh:mm[:ss[.fffffffff]] separated by spaces or 'T' and by a
+ * time zone (Z, +hh:mm or -hh:mm).
+ * @return 1 if string was parsed, 0 if string should be handled by
+ *         the generic parser
+ */
+static int
+string_to_iso_datetime(const char *s, const char *end, struct tds_time *t)
+{
+	static const unsigned char days_in_month[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int year, month, mday, hour = 0, minute = 0, second = 0, ns = 0, offset = 0, has_offset = 0;
+	const char *p;
+
+	/* like strlen in generic parser */
+	if ((p = memchr(s, 0, end - s)) != NULL)
+		end = p;
+	while (s != end && *s == ' ')
+		++s;
+	while (end != s && end[-1] == ' ')
+		--end;
+
+	if (end - s < 8)
+		return 0;
+	year = parse_digits(s, 4);
+	if (s[4] == '-') {
+		if (end - s < 10 || s[7] != '-')
+			return 0;
+		month = parse_digits(s + 5, 2);
+		mday = parse_digits(s + 8, 2);
+		s += 10;
+	} else {
+		month = parse_digits(s + 4, 2);
+		mday = parse_digits(s + 6, 2);
+		s += 8;
+	}
+	if (year < 1 || month < 1 || month > 12 || mday < 1 || mday > days_in_month[month - 1])
+		return 0;
+	if (month == 2 && mday == 29 && (year % 4 != 0 || (year % 100 == 0 && year % 400 != 0)))
+		return 0;
+
+	if (s != end) {
+		if (*s == 'T') {
+			++s;
+		} else if (*s == ' ') {
+			while (*s == ' ')
+				++s;
+		} else {
+			return 0;
+		}
+
+		if (end - s < 5 || s[2] != ':')
+			return 0;
+		hour = parse_digits(s, 2);
+		minute = parse_digits(s + 3, 2);
+		s += 5;
+		if (s != end && *s == ':') {
+			if (end - s < 3)
+				return 0;
+			second = parse_digits(s + 1, 2);
+			s += 3;
+			if (s != end && *s == '.') {
+				unsigned int ns_div = 1;
+
+				for (++s; s != end && *s >= '0' && *s <= '9'; ++s) {
+					if (ns_div < 1000000000u) {
+						ns = ns * 10 + (*s - '0');
+						ns_div *= 10;
+					}
+				}
+				if (ns_div == 1)
+					return 0;
+				ns *= 1000000000u / ns_div;
+			}
+		}
+		if (hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59)
+			return 0;
+
+		if (s != end && (*s == '+' || *s == '-')) {
+			int n;
+
+			if (end - s < 6 || s[3] != ':')
+				return 0;
+			offset = parse_digits(s + 1, 2);
+			n = parse_digits(s + 4, 2);
+			if (offset < 0 || n < 0 || n > 59 || offset * 60 + n > 840)
+				return 0;
+			offset = offset * 60 + n;
+			if (*s == '-')
+				offset = -offset;
+			has_offset = 1;
+			s += 6;
+		} else if (s != end && *s == 'Z') {
+			has_offset = 1;
+			++s;
+		}
+	}
+	if (s != end)
+		return 0;
+
+	t->tm_year = year - 1900;
+	t->tm_mon = month - 1;
+	t->tm_mday = mday;
+	t->tm_hour = hour;
+	t->tm_min = minute;
+	t->tm_sec = second;
+	t->tm_ns = ns;
+	t->tm_offset = offset;
+	t->tm_has_offset = has_offset;
+	return 1;
+}
+
+static int
+string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT * cr)
 {
 	enum states
 	{ GOING_IN_BLIND,
@@ -1729,18 +2288,22 @@ string_to_datetime(const char *instr, int desttype, CONV_RESULT * cr)
 
 	struct tds_time t;
 
-	unsigned int dt_time;
-	TDS_INT dt_days;
-	int i;
-
 	int current_state;
 
 	memset(&t, '\0', sizeof(t));
 	t.tm_mday = 1;
 
-	in = (char *) malloc(strlen(instr) + 1);
+	/* fast path for most common formats, DATETIME and SMALLDATETIME start from 1753 */
+	if (string_to_iso_datetime(instr, instr + len, &t)
+	    && (t.tm_year >= 1753 - 1900 || (desttype != SYBDATETIME && desttype != SYBDATETIME4)))
+		return tds_time_to_datetime(&t, desttype, cr);
+	memset(&t, '\0', sizeof(t));
+	t.tm_mday = 1;
+
+	in = (char *) malloc(len + 1);
 	test_alloc(in);
-	strcpy(in, instr);
+	memcpy(in, instr, len);
+	in[len] = 0;
 
 	tok = strtok_r(in, " ,", &lasts);
 
@@ -1936,22 +2499,36 @@ string_to_datetime(const char *instr, int desttype, CONV_RESULT * cr)
 		tok = strtok_r(NULL, " ,", &lasts);
 	}
 
-	i = (t.tm_mon - 13) / 12;
-	dt_days = 1461 * (t.tm_year + 1900 + i) / 4 +
-		(367 * (t.tm_mon - 1 - 12 * i)) / 12 - (3 * ((t.tm_year + 2000 + i) / 100)) / 4 + t.tm_mday - 693932;
-
 	free(in);
 
+	return tds_time_to_datetime(&t, desttype, cr);
+}
+
+/**
+ * Store a parsed date into result of given type
+ * @return size of result
+ */
+static int
+tds_time_to_datetime(const struct tds_time *t, int desttype, CONV_RESULT * cr)
+{
+	unsigned int dt_time;
+	TDS_INT dt_days;
+	int i;
+
+	i = (t->tm_mon - 13) / 12;
+	dt_days = 1461 * (t->tm_year + 1900 + i) / 4 +
+		(367 * (t->tm_mon - 1 - 12 * i)) / 12 - (3 * ((t->tm_year + 2000 + i) / 100)) / 4 + t->tm_mday - 693932;
+
 	/* TODO check for overflow */
 	if (desttype == SYBDATETIME) {
 		cr->dt.dtdays = dt_days;
-		dt_time = (t.tm_hour * 60 + t.tm_min) * 60 + t.tm_sec;
-		cr->dt.dttime = dt_time * 300 + (t.tm_ns / 1000000u * 300 + 150) / 1000;
+		dt_time = (t->tm_hour * 60 + t->tm_min) * 60 + t->tm_sec;
+		cr->dt.dttime = dt_time * 300 + (t->tm_ns / 1000000u * 300 + 150) / 1000;
 		return sizeof(TDS_DATETIME);
 	}
 	if (desttype == SYBDATETIME4) {
 		cr->dt4.days = dt_days;
-		cr->dt4.minutes = t.tm_hour * 60 + t.tm_min;
+		cr->dt4.minutes = t->tm_hour * 60 + t->tm_min;
 		return sizeof(TDS_DATETIME4);
 	}
 
@@ -1961,8 +2538,24 @@ string_to_datetime(const char *instr, int desttype, CONV_RESULT * cr)
 	cr->dta.date = dt_days;
 	cr->dta.has_time = 1;
 	cr->dta.time_prec = 7; /* TODO correct value */
-	dt_time = (t.tm_hour * 60 + t.tm_min) * 60 + t.tm_sec;
-	cr->dta.time = dt_time * 10000000u + t.tm_ns / 100u;
+	dt_time = (t->tm_hour * 60 + t->tm_min) * 60 + t->tm_sec;
+	cr->dta.time = dt_time * ((TDS_UINT8) 10000000u) + t->tm_ns / 100u;
+
+	/* date and time are sent as UTC */
+	if (desttype == SYBMSDATETIMEOFFSET && t->tm_has_offset) {
+		TDS_INT8 utc = (TDS_INT8) cr->dta.time - (TDS_INT8) t->tm_offset * (60 * 10000000);
+
+		if (utc < 0) {
+			utc += ((TDS_INT8) 86400) * 10000000;
+			--cr->dta.date;
+		} else if (utc >= ((TDS_INT8) 86400) * 10000000) {
+			utc -= ((TDS_INT8) 86400) * 10000000;
+			++cr->dta.date;
+		}
+		cr->dta.time = utc;
+		cr->dta.has_offset = 1;
+		cr->dta.offset = t->tm_offset;
+	}
 	return sizeof(TDS_DATETIMEALL);
 }
 
@@ -1975,162 +2568,7 @@ stringz_to_numeric(const char *instr, CONV_RESULT * cr)
 static int
 string_to_numeric(const char *instr, const char *pend, CONV_RESULT * cr)
 {
-	char mynumber[(MAXPRECISION + 7) / 8 * 8 + 8];
-
-	/* num packaged 8 digit, see below for detail */
-	TDS_UINT packed_num[(MAXPRECISION + 7) / 8];
-
-	char *ptr;
-	const char *pstr;
-	int old_digits_left, digits_left, digit_found = 0;
-
-	int i = 0;
-	int j = 0;
-	int bytes, places;
-	unsigned char sign;
-
-	/* FIXME: application can pass invalid value for precision and scale ?? */
-	if (cr->n.precision > 77)
-		return TDS_CONVERT_FAIL;
-
-	if (cr->n.precision == 0)
-		cr->n.precision = 77;	/* assume max precision */
-
-	if (cr->n.scale > cr->n.precision)
-		return TDS_CONVERT_FAIL;
-
-
-	/* skip leading blanks */
-	for (pstr = instr;; ++pstr) {
-		if (pstr == pend)
-			return TDS_CONVERT_SYNTAX;
-		if (*pstr != ' ')
-			break;
-	}
-
-	sign = 0;
-	if (*pstr == '-' || *pstr == '+') {	/* deal with a leading sign */
-		if (*pstr == '-')
-			sign = 1;
-		pstr++;
-	}
-	cr->n.array[0] = sign;
-
-	/* 
-	 * skip leading zeroes 
-	 * Not skipping them cause numbers like "000000000000" to 
-	 * appear like overflow
-	 */
-	for (; pstr != pend && *pstr == '0'; ++pstr)
-		digit_found = 1;
-
-	/* 
-	 * Having disposed of any sign and leading blanks, 
-	 * vet the digit string, counting places before and after 
-	 * the decimal point.  Dispense with trailing blanks, if any.  
-	 */
-
-	ptr = mynumber;
-	for (i = 0; i < 8; ++i)
-		*ptr++ = '0';
-
-	places = 0;
-	old_digits_left = 0;
-	digits_left = cr->n.precision - cr->n.scale;
-
-	for (; pstr != pend; ++pstr) {			/* deal with the rest */
-		if (*pstr >= '0' && *pstr <= '9') {	/* it's a number */
-			/* copy digit to destination */
-			if (--digits_left >= 0)
-				*ptr++ = *pstr;
-			digit_found = 1;
-		} else if (*pstr == '.') {			/* found a decimal point */
-			if (places)				/* found a decimal point previously: return error */
-				return TDS_CONVERT_SYNTAX;
-			old_digits_left = digits_left;
-			digits_left = cr->n.scale;
-			places = 1;
-		} else if (*pstr == ' ') {
-			for (; pstr != pend && *pstr == ' '; ++pstr) ; /* skip contiguous blanks */
-			if (pstr == pend)
-				break;				/* success: found only trailing blanks */
-			return TDS_CONVERT_SYNTAX;		/* bzzt: found something after the blank(s) */
-		} else {         				/* first invalid character */
-			return TDS_CONVERT_SYNTAX;
-		}
-	}
-	/* no digits? no number! */
-	if (!digit_found)
-		return TDS_CONVERT_SYNTAX;
-
-	if (!places) {
-		old_digits_left = digits_left;
-		digits_left = cr->n.scale;
-	}
-
-	/* too many digits, error */
-	if (old_digits_left < 0)
-		return TDS_CONVERT_OVERFLOW;
-
-	/* fill up decimal digits */
-	while (--digits_left >= 0)
-		*ptr++ = '0';
-
-	/*
-	 * Packaged number explanation: 
-	 * We package 8 decimal digits in one number.  
-	 * Because 10^8 = 5^8 * 2^8 = 5^8 * 256, dividing 10^8 by 256 leaves no remainder.
-	 * We can thus split it into bytes in an optimized way.
-	 */
-
-	/* transform to packaged one */
-	j = -1;
-	ptr -= 8;
-	do {
-		TDS_UINT n = *ptr++;
-
-		for (i = 1; i < 8; ++i)
-			n = n * 10 + *ptr++;
-		/* fix packet number and store */
-		packed_num[++j] = n - ((TDS_UINT) '0' * 11111111lu);
-		ptr -= 16;
-	} while (ptr > mynumber);
-
-	memset(cr->n.array + 1, 0, sizeof(cr->n.array) - 1);
-	bytes = tds_numeric_bytes_per_prec[cr->n.precision];
-	while (j > 0 && !packed_num[j])
-		--j;
-
-	for (;;) {
-		char is_zero = 1;
-		TDS_UINT carry = 0;
-		i = j;
-		if (!packed_num[j])
-			--j;
-		do {
-			TDS_UINT tmp = packed_num[i];
-			if (tmp)
-				is_zero = 0;
-
-			/* divide for 256 for find another byte */
-			/*
-			 * carry * (25u*25u*25u*25u) = carry * 10^8 / 256u
-			 * using unsigned number is just an optimization
-			 * compiler can translate division to a shift and remainder 
-			 * to a binary AND
-			 */
-			packed_num[i] = carry * (25u * 25u * 25u * 25u) + tmp / 256u;
-			carry = tmp % 256u;
-		} while(--i >= 0);
-		if (is_zero)
-			break;
-		/*
-		 * source number is limited to 38 decimal digit
-		 * 10^39-1 < 2^128 (16 byte) so this cannot make an overflow
-		 */
-		cr->n.array[--bytes] = carry;
-	}
-	return sizeof(TDS_NUMERIC);
+	return tds_numeric_from_string(&cr->n, instr, pend);
 }
 
 static int
@@ -2714,16 +3152,325 @@ tds_get_null_type(int srctype)
 	return srctype;
 }
 
+/*
+ * Compiled date formats.
+ * A format is parsed once in a small program, a sequence of operations
+ * (byte codes), literal text is stored inline after a DATEFMT_LITERAL
+ * operation and its length. Names are the ones of the C locale.
+ */
+enum
+{
+	DATEFMT_LITERAL = 1,
+	DATEFMT_YEAR,		/* %Y */
+	DATEFMT_YEAR2,		/* %y */
+	DATEFMT_CENTURY,	/* %C */
+	DATEFMT_MONTH,		/* %m */
+	DATEFMT_MONTH_ABBR,	/* %b %h */
+	DATEFMT_MONTH_NAME,	/* %B */
+	DATEFMT_DAY,		/* %d */
+	DATEFMT_DAY_SPACE,	/* %e */
+	DATEFMT_YEAR_DAY,	/* %j */
+	DATEFMT_WEEKDAY,	/* %w */
+	DATEFMT_WEEKDAY_ABBR,	/* %a */
+	DATEFMT_WEEKDAY_NAME,	/* %A */
+	DATEFMT_HOUR,		/* %H */
+	DATEFMT_HOUR_SPACE,	/* %k */
+	DATEFMT_HOUR12,		/* %I */
+	DATEFMT_HOUR12_SPACE,	/* %l */
+	DATEFMT_MINUTE,		/* %M */
+	DATEFMT_SECOND,		/* %S */
+	DATEFMT_AMPM,		/* %p */
+	DATEFMT_FRACTION	/* %z, our extension */
+};
+
+static const char month_names[12][10] = {
+	"January", "February", "March", "April", "May", "June",
+	"July", "August", "September", "October", "November", "December"
+};
+
+static const char weekday_names[7][10] = {
+	"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+
+/**
+ * Compile a date format for tds_datefmt_format.
+ * Format is the same of tds_strftime.
+ * @param fmt     compiled format to fill
+ * @param format  format string; if some conversion is not supported
+ *                (or format is too long) this string is used directly
+ *                with strftime(3) so it must be kept while \a fmt is used.
+ * @return 1 if format was compiled, 0 if strftime(3) will be used
+ */
+int
+tds_datefmt_compile(TDSDATEFMT * fmt, const char *format)
+{
+	/* expansion of some composite conversions */
+	static const char expansions[][16] = {
+		"D%m/%d/%y", "F%Y-%m-%d", "R%H:%M", "T%H:%M:%S", "r%I:%M:%S %p"
+	};
+	unsigned char *p = fmt->prog, *const end = fmt->prog + sizeof(fmt->prog);
+	unsigned char *literal = NULL;
+	const char *s, *saved = NULL;
+	unsigned int i;
+
+	assert(format);
+	fmt->format = format;
+	fmt->prog_len = 0;
+
+	for (s = format;; ++s) {
+		unsigned char op = 0;
+		char c = *s;
+
+		if (!*s) {
+			/* end of an expansion, continue with format */
+			if (!saved)
+				break;
+			s = saved;
+			saved = NULL;
+			continue;
+		}
+		if (*s == '%') {
+			switch (*++s) {
+			case 'Y': op = DATEFMT_YEAR; break;
+			case 'y': op = DATEFMT_YEAR2; break;
+			case 'C': op = DATEFMT_CENTURY; break;
+			case 'm': op = DATEFMT_MONTH; break;
+			case 'b':
+			case 'h': op = DATEFMT_MONTH_ABBR; break;
+			case 'B': op = DATEFMT_MONTH_NAME; break;
+			case 'd': op = DATEFMT_DAY; break;
+			case 'e': op = DATEFMT_DAY_SPACE; break;
+			case 'j': op = DATEFMT_YEAR_DAY; break;
+			case 'w': op = DATEFMT_WEEKDAY; break;
+			case 'a': op = DATEFMT_WEEKDAY_ABBR; break;
+			case 'A': op = DATEFMT_WEEKDAY_NAME; break;
+			case 'H': op = DATEFMT_HOUR; break;
+			case 'k': op = DATEFMT_HOUR_SPACE; break;
+			case 'I': op = DATEFMT_HOUR12; break;
+			case 'l': op = DATEFMT_HOUR12_SPACE; break;
+			case 'M': op = DATEFMT_MINUTE; break;
+			case 'S': op = DATEFMT_SECOND; break;
+			case 'p': op = DATEFMT_AMPM; break;
+			case 'z': op = DATEFMT_FRACTION; break;
+			case '%':
+				c = '%';
+				break;
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			default:
+				for (i = 0; i < TDS_VECTOR_SIZE(expansions); ++i)
+					if (expansions[i][0] == *s)
+						break;
+				/* not supported, use strftime */
+				if (!*s || saved || i >= TDS_VECTOR_SIZE(expansions))
+					return 0;
+				saved = s;
+				s = expansions[i];
+				continue;
+			}
+		}
+
+		if (op) {
+			if (p >= end)
+				return 0;
+			*p++ = op;
+			literal = NULL;
+			continue;
+		}
+
+		/* literal character, append to last literal if possible */
+		if (!literal || *literal == 255) {
+			if (end - p < 3)
+				return 0;
+			*p++ = DATEFMT_LITERAL;
+			literal = p;
+			*p++ = 0;
+		} else if (p >= end) {
+			return 0;
+		}
+		*p++ = c;
+		++*literal;
+	}
+	fmt->prog_len = p - fmt->prog;
+	return 1;
+}
+
+/* write number with at least width digits, padded with pad character */
+static char *
+datefmt_num(char *p, unsigned int n, int width, char pad)
+{
+	char digits[12], *d = digits + sizeof(digits);
+
+	do {
+		*--d = '0' + n % 10u;
+		n /= 10u;
+		--width;
+	} while (n);
+	while (width-- > 0)
+		*p++ = pad;
+	while (d < digits + sizeof(digits))
+		*p++ = *d++;
+	return p;
+}
+
+static size_t tds_strftime_libc(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec);
+
+/**
+ * Format a date using a format compiled with tds_datefmt_compile.
+ * @param fmt     compiled format
+ * @param buf     output buffer
+ * @param maxsize size of buffer in bytes (space include terminator)
+ * @param dr      date to convert
+ * @param prec    digits for %z, 3 if out of range
+ * @return length of string returned, 0 for error
+ */
+size_t
+tds_datefmt_format(const TDSDATEFMT * fmt, char *buf, size_t maxsize, const TDSDATEREC * dr, int prec)
+{
+	const unsigned char *prog = fmt->prog, *const prog_end = fmt->prog + fmt->prog_len;
+	char *p = buf, *const end = buf + maxsize;
+	char tmp[16], *out, *q;
+	const char *name;
+	unsigned int n;
+
+	assert(buf);
+	assert(dr);
+	assert(0 <= dr->decimicrosecond && dr->decimicrosecond < 10000000);
+	if (prec < 0 || prec > 7)
+		prec = 3;
+
+	if (!fmt->prog_len)
+		return tds_strftime_libc(buf, maxsize, fmt->format, dr, prec);
+
+	while (prog < prog_end) {
+		if (*prog == DATEFMT_LITERAL) {
+			n = prog[1];
+			if ((size_t) (end - p) <= n)
+				return 0;
+			memcpy(p, prog + 2, n);
+			p += n;
+			prog += 2 + n;
+			continue;
+		}
+
+		/* every other operation writes less than 16 characters */
+		q = out = (size_t) (end - p) >= sizeof(tmp) ? p : tmp;
+		switch (*prog++) {
+		case DATEFMT_YEAR:
+			q = datefmt_num(q, dr->year, 1, '0');
+			break;
+		case DATEFMT_YEAR2:
+			q = datefmt_num(q, dr->year % 100u, 2, '0');
+			break;
+		case DATEFMT_CENTURY:
+			q = datefmt_num(q, dr->year / 100u, 2, '0');
+			break;
+		case DATEFMT_MONTH:
+			q = datefmt_num(q, dr->month + 1, 2, '0');
+			break;
+		case DATEFMT_MONTH_ABBR:
+			memcpy(q, month_names[dr->month], 3);
+			q += 3;
+			break;
+		case DATEFMT_MONTH_NAME:
+			name = month_names[dr->month];
+			goto copy_name;
+		case DATEFMT_DAY:
+			q = datefmt_num(q, dr->day, 2, '0');
+			break;
+		case DATEFMT_DAY_SPACE:
+			q = datefmt_num(q, dr->day, 2, ' ');
+			break;
+		case DATEFMT_YEAR_DAY:
+			q = datefmt_num(q, dr->dayofyear + 1, 3, '0');
+			break;
+		case DATEFMT_WEEKDAY:
+			*q++ = '0' + dr->weekday;
+			break;
+		case DATEFMT_WEEKDAY_ABBR:
+			memcpy(q, weekday_names[dr->weekday], 3);
+			q += 3;
+			break;
+		case DATEFMT_WEEKDAY_NAME:
+			name = weekday_names[dr->weekday];
+		copy_name:
+			n = (unsigned int) strlen(name);
+			memcpy(q, name, n);
+			q += n;
+			break;
+		case DATEFMT_HOUR:
+			q = datefmt_num(q, dr->hour, 2, '0');
+			break;
+		case DATEFMT_HOUR_SPACE:
+			q = datefmt_num(q, dr->hour, 2, ' ');
+			break;
+		case DATEFMT_HOUR12:
+			q = datefmt_num(q, (dr->hour + 11) % 12 + 1, 2, '0');
+			break;
+		case DATEFMT_HOUR12_SPACE:
+			q = datefmt_num(q, (dr->hour + 11) % 12 + 1, 2, ' ');
+			break;
+		case DATEFMT_MINUTE:
+			q = datefmt_num(q, dr->minute, 2, '0');
+			break;
+		case DATEFMT_SECOND:
+			q = datefmt_num(q, dr->second, 2, '0');
+			break;
+		case DATEFMT_AMPM:
+			*q++ = dr->hour < 12 ? 'A' : 'P';
+			*q++ = 'M';
+			break;
+		case DATEFMT_FRACTION:
+			/* first prec digits of 7 */
+			n = dr->decimicrosecond;
+			datefmt_num(q, n, 7, '0');
+			q += prec;
+			break;
+		}
+		n = (unsigned int) (q - out);
+		if (out == tmp) {
+			if ((size_t) (end - p) <= n)
+				return 0;
+			memcpy(p, tmp, n);
+		}
+		p += n;
+	}
+
+	if (p >= end)
+		return 0;
+	*p = 0;
+	return p - buf;
+}
+
 /**
  * format a date string according to an "extended" strftime(3) formatting definition.
  * @param buf     output buffer
  * @param maxsize size of buffer in bytes (space include terminator)
- * @param format  format string passed to strftime(3), except that %z represents milliseconds
+ * @param format  format string passed to strftime(3), except that %z represents fraction of seconds
  * @param dr      date to convert
+ * @param prec    digits for %z, 3 if out of range
  * @return length of string returned, 0 for error
+ * \remarks format is compiled at every call, use tds_datefmt_compile
+ *          and tds_datefmt_format to format many dates.
  */
 size_t
 tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
+{
+	TDSDATEFMT fmt;
+
+	tds_datefmt_compile(&fmt, format);
+	return tds_datefmt_format(&fmt, buf, maxsize, dr, prec);
+}
+
+/**
+ * format a date string using strftime(3), used for formats we can't compile.
+ */
+static size_t
+tds_strftime_libc(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
 {
 	struct tm tm;
 
@@ -2731,13 +3478,6 @@ tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * d
 	char *our_format;
 	char *pz = NULL;
 	
-	assert(buf);
-	assert(format);
-	assert(dr);
-	assert(0 <= dr->decimicrosecond && dr->decimicrosecond < 10000000);
-	if (prec < 0 || prec > 7)
-		prec = 3;
-
 	tm.tm_sec = dr->second;
 	tm.tm_min = dr->minute;
 	tm.tm_hour = dr->hour;
@@ -45,6 +45,7 @@ TDS_RCSID(var, "$Id: data.c,v 1.43 2011/08/10 07:47:19 freddy77 Exp $");
 
 int determine_adjusted_size(const TDSICONV * char_conv, int size);
 static const TDSCOLUMNFUNCS *tds_get_column_funcs(TDSSOCKET *tds, int type);
+static TDSRET tds_data_get(TDSSOCKET * tds, TDSCOLUMN * curcol);
 
 #undef MIN
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
@@ -116,7 +117,7 @@ tds_set_param_type(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_SERVER_TYPE type)
 	tds_set_column_type(tds, curcol, type);
 
 	if (is_collate_type(type)) {
-		curcol->char_conv = tds->char_convs[is_unicode_type(type) ? client2ucs2 : client2server_chardata];
+		curcol->char_conv = tds_conn(tds)->char_convs[is_unicode_type(type) ? client2ucs2 : client2server_chardata];
 		memcpy(curcol->column_collation, tds->collation, sizeof(tds->collation));
 	}
 
@@ -289,13 +290,16 @@ tds_data_row_len(TDSCOLUMN *col)
 	return col->column_size;
 }
 
+/**
+ * Read PLP data of a varchar(max)/varbinary(max) column.
+ * @param len total length as sent by server, -2 if unknown
+ */
 static TDSRET
-tds72_get_varmax(TDSSOCKET * tds, TDSCOLUMN * curcol)
+tds72_get_varmax_len(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_INT8 len)
 {
-	TDS_INT8 len = tds_get_int8(tds);
 	TDS_INT chunk_len;
 	TDS_CHAR **p;
-	size_t offset;
+	size_t offset, allocated;
 
 	/* NULL */
 	if (len == -1) {
@@ -305,28 +309,51 @@ tds72_get_varmax(TDSSOCKET * tds, TDSCOLUMN * curcol)
 
 	curcol->column_cur_size = 0;
 	offset = 0;
+	allocated = 0;
 	p = &(((TDSBLOB*) curcol->column_data)->textvalue);
-	for (;;) {
-		TDS_CHAR *tmp;
 
+	/* total length is known (-2 means unknown), allocate once */
+	if (len > 0 && len <= 0x7fffffff) {
+		TDS_CHAR *tmp = (TDS_CHAR *) realloc(*p, (size_t) len);
+
+		if (!tmp)
+			return TDS_FAIL;
+		*p = tmp;
+		allocated = (size_t) len;
+	}
+
+	for (;;) {
 		chunk_len = tds_get_int(tds);
 		if (chunk_len <= 0) {
 			curcol->column_cur_size = offset;
-			return TDS_SUCCESS;
+			return IS_TDSDEAD(tds) ? TDS_FAIL : TDS_SUCCESS;
 		}
-		if (*p == NULL)
-			tmp = (TDS_CHAR*) malloc(chunk_len);
-		else
-			tmp = (TDS_CHAR*) realloc(*p, offset + chunk_len);
-		if (!tmp)
+		if (offset + chunk_len > allocated) {
+			/* length unknown or wrong, grow geometrically */
+			TDS_CHAR *tmp;
+			size_t new_size = allocated < 4096 ? 4096 : allocated * 2;
+
+			if (new_size < offset + chunk_len)
+				new_size = offset + chunk_len;
+			tmp = (TDS_CHAR *) realloc(*p, new_size);
+			if (!tmp)
+				return TDS_FAIL;
+			*p = tmp;
+			allocated = new_size;
+		}
+		if (!tds_get_n(tds, *p + offset, chunk_len))
 			return TDS_FAIL;
-		*p = tmp;
-		tds_get_n(tds, *p + offset, chunk_len);
 		offset += chunk_len;
 	}
 	return TDS_SUCCESS;
 }
 
+static TDSRET
+tds72_get_varmax(TDSSOCKET * tds, TDSCOLUMN * curcol)
+{
+	return tds72_get_varmax_len(tds, curcol, tds_get_int8(tds));
+}
+
 #if ENABLE_EXTRA_CHECKS
 COMPILE_CHECK(tds_variant_size,  sizeof(((TDSVARIANT*)0)->data) == sizeof(((TDSBLOB*)0)->textvalue));
 COMPILE_CHECK(tds_variant_offset,TDS_OFFSET(TDSVARIANT, data) == TDS_OFFSET(TDSBLOB, textvalue));
@@ -366,7 +393,7 @@ tds_variant_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 		colsize -= sizeof(v->collation);
 		info_len -= sizeof(v->collation);
 		curcol->char_conv = is_unicode_type(type) ? 
-			tds->char_convs[client2ucs2] : tds_iconv_from_collate(tds, v->collation);
+			tds_conn(tds)->char_convs[client2ucs2] : tds_iconv_from_collate(tds, v->collation);
 	}
 	/* special case for numeric */
 	if (is_numeric_type(type)) {
@@ -1038,10 +1065,23 @@ tds_msdatetime_row_len(TDSCOLUMN *col)
 	return sizeof(TDS_DATETIMEALL);
 }
 
+/* get n little endian bytes, in place if possible */
+static const unsigned char *
+tds_msdatetime_bytes(TDSSOCKET * tds, unsigned char *buf, int n)
+{
+	const unsigned char *p = tds_get_span(tds, n);
+
+	if (p)
+		return p;
+	return tds_get_n(tds, buf, n) ? buf : NULL;
+}
+
 static TDSRET
 tds_msdatetime_get(TDSSOCKET * tds, TDSCOLUMN * col)
 {
 	TDS_DATETIMEALL *dt = (TDS_DATETIMEALL*) col->column_data;
+	const unsigned char *p;
+	unsigned char buf[5];
 	int size = tds_get_byte(tds);
 
 	if (size == 0) {
@@ -1068,11 +1108,11 @@ tds_msdatetime_get(TDSSOCKET * tds, TDSCOLUMN * col)
 		assert(size >= 3 && size <= 5);
 		if (size < 3 || size > 5)
 			return TDS_FAIL;
+		if (!(p = tds_msdatetime_bytes(tds, buf, size)))
+			return TDS_FAIL;
 		u8 = 0;
-		tds_get_n(tds, &u8, size);
-#ifdef WORDS_BIGENDIAN
-		tds_swap_bytes(&u8, 8);
-#endif
+		for (i = size; --i >= 0;)
+			u8 = (u8 << 8) | p[i];
 		for (i = col->column_prec; i < 7; ++i)
 			u8 *= 10;
 		dt->time = u8;
@@ -1081,15 +1121,10 @@ tds_msdatetime_get(TDSSOCKET * tds, TDSCOLUMN * col)
 
 	/* get date part */
 	if (col->column_type != SYBMSTIME) {
-		TDS_UINT ui;
-
-		ui = 0;
-		tds_get_n(tds, &ui, 3);
-#ifdef WORDS_BIGENDIAN
-		tds_swap_bytes(&ui, 4);
-#endif
+		if (!(p = tds_msdatetime_bytes(tds, buf, 3)))
+			return TDS_FAIL;
 		dt->has_date = 1;
-		dt->date = ui - 693595;
+		dt->date = (p[0] | (p[1] << 8) | ((TDS_UINT) p[2] << 16)) - 693595;
 	}
 
 	/* get time offset */
@@ -1147,6 +1182,412 @@ tds_msdatetime_put(TDSSOCKET *tds, TDSCOLUMN *col)
 
 DEFINE_FUNCS(msdatetime, msdatetime);
 
+/**
+ * Start reading a large column incrementally.
+ * Only length is read, data are left in the network buffer and
+ * must be read with tds_stream_chunks() or tds_stream_load().
+ * If column can't be streamed (converted or unknown length)
+ * data are read as usual.
+ * Must be called only for last column of a row.
+ * @param curcol column to read
+ */
+TDSRET
+tds_stream_start(TDSSOCKET * tds, TDSCOLUMN * curcol)
+{
+	TDSBLOB *blob = (TDSBLOB *) curcol->column_data;
+	TDS_INT8 len;
+
+	CHECK_TDS_EXTRA(tds);
+	CHECK_COLUMN_EXTRA(curcol);
+
+	if (curcol->funcs->get_data != tds_data_get
+	    || (curcol->char_conv && curcol->char_conv->flags != TDS_ENCODING_MEMCPY)
+	    || !(curcol->column_varint_size == 8 || (curcol->column_varint_size == 4 && is_blob_type(curcol->column_type))))
+		return curcol->funcs->get_data(tds, curcol);
+
+	if (curcol->column_varint_size == 8) {
+		len = tds_get_int8(tds);
+		if (len == -1) {
+			curcol->column_cur_size = -1;
+			return TDS_SUCCESS;
+		}
+		/* unknown length, read all data */
+		if (len < 0 || len > 0x7fffffff)
+			return tds72_get_varmax_len(tds, curcol, len);
+		tds->stream_plp = 1;
+		tds->stream_left = 0;
+	} else {
+		if (tds_get_byte(tds) != 16) {
+			curcol->column_cur_size = -1;
+			return TDS_SUCCESS;
+		}
+		tds_get_n(tds, blob->textptr, 16);
+		tds_get_n(tds, blob->timestamp, 8);
+		len = (TDS_UINT) tds_get_int(tds);
+		tds->stream_plp = 0;
+		tds->stream_left = (TDS_UINT) len;
+	}
+	if (IS_TDSDEAD(tds))
+		return TDS_FAIL;
+
+	/* old value is not valid anymore */
+	if (blob->textvalue)
+		TDS_ZERO_FREE(blob->textvalue);
+	curcol->column_cur_size = (TDS_INT) len;
+	tds->stream_col = curcol;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Read data of a streamed column passing them in chunks to a function.
+ * Chunks point directly to network buffer.
+ * Reading stops when data end or function consume less than passed.
+ * @param curcol streamed column
+ * @param func   function receiving data, return bytes consumed
+ * @param param  parameter passed to func
+ * @return 1 if data remain to be read, 0 at end of data, -1 on error
+ */
+int
+tds_stream_chunks(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_CHUNK_FUNC func, void *param)
+{
+	CHECK_TDS_EXTRA(tds);
+
+	if (tds->stream_col != curcol)
+		return 0;
+
+	for (;;) {
+		unsigned int avail;
+		size_t used;
+
+		if (!tds->stream_left) {
+			TDS_INT chunk_len;
+
+			if (!tds->stream_plp)
+				return 0;
+			chunk_len = tds_get_int(tds);
+			if (IS_TDSDEAD(tds))
+				goto error;
+			if (chunk_len <= 0) {
+				tds->stream_plp = 0;
+				return 0;
+			}
+			tds->stream_left = chunk_len;
+		}
+		if (tds->in_pos >= tds->in_len && tds_read_packet(tds) < 0)
+			goto error;
+
+		avail = MIN(tds->in_len - tds->in_pos, tds->stream_left);
+		used = func(param, tds->in_buf + tds->in_pos, avail);
+		if (used > avail)
+			used = avail;
+		tds->in_pos += used;
+		tds->stream_left -= used;
+		if (used < avail)
+			return 1;
+	}
+
+error:
+	tds->stream_col = NULL;
+	tds->stream_left = 0;
+	tds->stream_plp = 0;
+	return -1;
+}
+
+static size_t
+tds_stream_discard(void *param, const void *data, size_t len)
+{
+	return len;
+}
+
+/**
+ * Discard data not read of streamed column, if any.
+ */
+TDSRET
+tds_stream_skip(TDSSOCKET * tds)
+{
+	TDSCOLUMN *curcol = tds->stream_col;
+
+	if (!curcol)
+		return TDS_SUCCESS;
+	if (tds_stream_chunks(tds, curcol, tds_stream_discard, NULL) < 0)
+		return TDS_FAIL;
+	tds->stream_col = NULL;
+	return TDS_SUCCESS;
+}
+
+struct tds_stream_buf
+{
+	TDS_CHAR *p;
+	size_t left;
+};
+
+static size_t
+tds_stream_copy(void *param, const void *data, size_t len)
+{
+	struct tds_stream_buf *buf = (struct tds_stream_buf *) param;
+	size_t cplen = MIN(len, buf->left);
+
+	memcpy(buf->p, data, cplen);
+	buf->p += cplen;
+	buf->left -= cplen;
+	return cplen;
+}
+
+/**
+ * Copy data of a streamed column to a buffer.
+ * @param curcol streamed column
+ * @return bytes copied, less than len only at end of data, -1 on error
+ */
+int
+tds_stream_read(TDSSOCKET * tds, TDSCOLUMN * curcol, void *buf, size_t len)
+{
+	struct tds_stream_buf sbuf;
+
+	sbuf.p = (TDS_CHAR *) buf;
+	sbuf.left = len;
+	if (tds_stream_chunks(tds, curcol, tds_stream_copy, &sbuf) < 0)
+		return -1;
+	return len - sbuf.left;
+}
+
+/**
+ * Read data not read of streamed column into column buffer,
+ * column is then a normal not streamed column.
+ * @param curcol streamed column
+ * @param offset position in column of data not read
+ */
+TDSRET
+tds_stream_load(TDSSOCKET * tds, TDSCOLUMN * curcol, TDS_INT offset)
+{
+	TDSBLOB *blob = (TDSBLOB *) curcol->column_data;
+	struct tds_stream_buf sbuf;
+
+	if (tds->stream_col != curcol)
+		return TDS_SUCCESS;
+
+	if (offset < 0 || offset > curcol->column_cur_size)
+		offset = curcol->column_cur_size;
+	blob->textvalue = (TDS_CHAR *) calloc(curcol->column_cur_size ? curcol->column_cur_size : 1, 1);
+	if (!blob->textvalue)
+		return TDS_FAIL;
+	sbuf.p = blob->textvalue + offset;
+	sbuf.left = curcol->column_cur_size - offset;
+	if (tds_stream_chunks(tds, curcol, tds_stream_copy, &sbuf) < 0)
+		return TDS_FAIL;
+	/* discard data exceeding declared length */
+	return tds_stream_skip(tds);
+}
+
+/* operations of a row decode plan */
+enum {
+	TDS_DECODE_GENERIC = 0,	/* call column get_data function */
+	TDS_DECODE_FIXED,	/* fixed size, never NULL */
+	TDS_DECODE_VAR1,	/* 1 byte length, 0 for NULL */
+	TDS_DECODE_VAR2,	/* 2 bytes length, -1 for NULL */
+	TDS_DECODE_OP_MASK = 0x7f,
+	TDS_DECODE_BYTES = 0x80	/* flag, data can be used in place (zero-copy) */
+};
+
+/**
+ * Compute the operation used by tds_get_row_data() to decode a column.
+ * Only types read by tds_data_get() without padding or swapping get a
+ * specialized operation, all other columns use column functions.
+ */
+static unsigned char
+tds_decode_op(TDSSOCKET * tds, TDSCOLUMN * curcol)
+{
+	unsigned char op;
+
+	if (curcol->funcs->get_data != tds_data_get || is_blob_col(curcol))
+		return TDS_DECODE_GENERIC;
+#ifdef WORDS_BIGENDIAN
+	if (tds_conn(tds)->broken_dates || tds_conn(tds)->emul_little_endian)
+		return TDS_DECODE_GENERIC;
+#endif
+
+	/* these types are padded */
+	switch (curcol->column_type) {
+	case SYBCHAR:
+	case XSYBCHAR:
+	case SYBBINARY:
+	case XSYBBINARY:
+	case SYBLONGBINARY:
+		return TDS_DECODE_GENERIC;
+	}
+
+	switch (curcol->column_varint_size) {
+	case 0:
+		if (curcol->column_size != tds_get_size_by_type(curcol->on_server.column_type) || curcol->char_conv)
+			return TDS_DECODE_GENERIC;
+		return TDS_DECODE_FIXED;
+	case 1:
+		op = TDS_DECODE_VAR1;
+		break;
+	case 2:
+		op = TDS_DECODE_VAR2;
+		break;
+	default:
+		return TDS_DECODE_GENERIC;
+	}
+	/* other types are accessed using casts, pointers to network buffer could be unaligned */
+	if (is_char_type(curcol->column_type) || is_binary_type(curcol->column_type))
+		op |= TDS_DECODE_BYTES;
+	return op;
+}
+
+/**
+ * Build decode plan of a result, an operation for every column.
+ * \return TDS_SUCCESS or TDS_FAIL (out of memory)
+ */
+static TDSRET
+tds_build_decode_plan(TDSSOCKET * tds, TDSRESULTINFO * info)
+{
+	int i;
+
+	info->decode_plan = (unsigned char *) malloc(info->num_cols);
+	if (!info->decode_plan)
+		return TDS_FAIL;
+	for (i = 0; i < info->num_cols; ++i) {
+		info->decode_plan[i] = tds_decode_op(tds, info->columns[i]);
+		tdsdump_log(TDS_DBG_INFO1, "decode plan: column %d type %d op %d\n", i,
+			    info->columns[i]->column_type, info->decode_plan[i]);
+	}
+	return TDS_SUCCESS;
+}
+
+/**
+ * Make columns of current row which point into network buffer
+ * (zero-copy) point again to their row buffer.
+ * Called before network buffer is reused.
+ * \param tds  state information for the socket and the TDS protocol
+ * \param copy 1 to copy data to row buffer, 0 if data are not needed anymore
+ */
+void
+tds_detach_row_data(TDSSOCKET * tds, int copy)
+{
+	TDSRESULTINFO *info = tds->res_info;
+	TDSCOLUMN *curcol;
+	int i;
+
+	tds->wire_row = 0;
+	if (!info)
+		return;
+	for (i = 0; i < info->num_cols; ++i) {
+		curcol = info->columns[i];
+		if (!curcol->column_row_data)
+			continue;
+		if (copy && curcol->column_cur_size > 0)
+			memcpy(curcol->column_row_data, curcol->column_data, curcol->column_cur_size);
+		curcol->column_data = curcol->column_row_data;
+		curcol->column_row_data = NULL;
+	}
+}
+
+/**
+ * Read a row from wire into result columns.
+ * On first row a decode plan is computed for the result, simple types
+ * are then read directly from network buffer (see tds_get_span) without
+ * calling column functions.
+ * If tds->zero_copy is set character and binary data of normal rows
+ * are not copied, column_data points into network buffer till next
+ * packet is read (see tds_detach_row_data).
+ * \param tds     state information for the socket and the TDS protocol
+ * \param info    result to read
+ * \param nullmap bitmap of NULL columns (NBCROW token) or NULL
+ * \return TDS_SUCCESS or TDS_FAIL
+ */
+TDSRET
+tds_get_row_data(TDSSOCKET * tds, TDSRESULTINFO * info, const unsigned char *nullmap)
+{
+	const unsigned char *plan, *span;
+	TDSCOLUMN *curcol;
+	int i, colsize, discard_len, zero_copy;
+
+	CHECK_TDS_EXTRA(tds);
+
+	if (!info->decode_plan && tds_build_decode_plan(tds, info) != TDS_SUCCESS)
+		return TDS_FAIL;
+
+	zero_copy = tds->zero_copy && info == tds->res_info;
+
+	plan = info->decode_plan;
+	for (i = 0; i < info->num_cols; ++i) {
+		curcol = info->columns[i];
+		/* previous value was in network buffer, it's replaced */
+		if (curcol->column_row_data) {
+			curcol->column_data = curcol->column_row_data;
+			curcol->column_row_data = NULL;
+		}
+		if (nullmap && (nullmap[i / 8] & (1 << (i % 8)))) {
+			curcol->column_cur_size = -1;
+			continue;
+		}
+
+		switch (plan[i] & TDS_DECODE_OP_MASK) {
+		case TDS_DECODE_FIXED:
+			colsize = curcol->column_size;
+			if ((span = tds_get_span(tds, colsize)) != NULL)
+				memcpy(curcol->column_data, span, colsize);
+			else if (!tds_get_n(tds, curcol->column_data, colsize))
+				return TDS_FAIL;
+			curcol->column_cur_size = colsize;
+			continue;
+		case TDS_DECODE_VAR1:
+			if ((span = tds_get_span(tds, 1)) != NULL)
+				colsize = span[0];
+			else
+				colsize = tds_get_byte(tds);
+			if (colsize == 0)
+				colsize = -1;
+			break;
+		case TDS_DECODE_VAR2:
+			colsize = tds_get_smallint(tds);
+			break;
+		default:
+			/* client can read last column incrementally */
+			if (curcol->column_stream && i == info->num_cols - 1)
+				return tds_stream_start(tds, curcol);
+			if (curcol->funcs->get_data(tds, curcol) != TDS_SUCCESS)
+				return TDS_FAIL;
+			continue;
+		}
+
+		/* variable size data, same as tds_data_get() */
+		if (IS_TDSDEAD(tds))
+			return TDS_FAIL;
+		if (colsize < 0) {
+			curcol->column_cur_size = -1;
+			continue;
+		}
+		curcol->column_cur_size = colsize;
+		if (USE_ICONV && curcol->char_conv) {
+			if (tds_get_char_data(tds, (char *) curcol->column_data, colsize, curcol) == TDS_FAIL)
+				return TDS_FAIL;
+			continue;
+		}
+		discard_len = 0;
+		if (colsize > curcol->column_size) {
+			discard_len = colsize - curcol->column_size;
+			colsize = curcol->column_size;
+		}
+		/* truncated data are copied, discarding the rest can read next packet */
+		if ((span = tds_get_span(tds, colsize)) == NULL) {
+			if (!tds_get_n(tds, curcol->column_data, colsize))
+				return TDS_FAIL;
+		} else if (zero_copy && !discard_len && (plan[i] & TDS_DECODE_BYTES)) {
+			curcol->column_row_data = curcol->column_data;
+			curcol->column_data = (unsigned char *) span;
+			tds->wire_row = 1;
+		} else {
+			memcpy(curcol->column_data, span, colsize);
+		}
+		curcol->column_cur_size = colsize;
+		if (discard_len > 0)
+			tds_get_n(tds, NULL, discard_len);
+	}
+	return TDS_SUCCESS;
+}
+
 static const TDSCOLUMNFUNCS *
 tds_get_column_funcs(TDSSOCKET *tds, int type)
 {
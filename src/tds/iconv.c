@@ -33,6 +33,7 @@
 
 #include "tds.h"
 #include "tdsiconv.h"
+#include "tdsthread.h"
 #if HAVE_ICONV
 #include <iconv.h>
 #endif
@@ -49,6 +50,7 @@ TDS_RCSID(var, "$Id: iconv.c,v 1.150 2011/06/03 21:04:15 freddy77 Exp $");
 static int collate2charset(int sql_collate, int lcid);
 static size_t skip_one_input_sequence(iconv_t cd, const TDS_ENCODING * charset, const char **input, size_t * input_size);
 static int tds_iconv_info_init(TDSICONV * char_conv, int client_canonic, int server_canonic);
+static int tds_iconv_info_open(TDSICONV * char_conv, int client_canonic, int server_canonic);
 static int tds_iconv_init(void);
 static int tds_canonical_charset(const char *charset_name);
 static void _iconv_close(iconv_t * cd);
@@ -72,6 +74,42 @@ static const char *ucs2name;
 enum
 { POS_ISO1, POS_UTF8, POS_UCS2LE, POS_UCS2BE };
 
+/*
+ * Process wide cache of conversions.
+ * For every couple of charsets we store the result of the first
+ * initialization (if conversion is possible and how) and the iconv
+ * descriptors released by closed connections, so a new connection
+ * usually does not need to call iconv_open at all.
+ * Descriptors are not shared, iconv keeps state in them.
+ */
+#define TDS_ICONV_CACHE_SIZE 64
+#define TDS_ICONV_CACHE_IDLE 8
+
+typedef struct tds_iconv_descs
+{
+	iconv_t to_wire, from_wire, to_wire2, from_wire2;
+} TDS_ICONV_DESCS;
+
+struct tds_iconv_cache
+{
+	struct tds_iconv_cache *next;
+	unsigned char client, server;
+	/** conversion is possible */
+	unsigned char valid;
+	/** flags computed by tds_iconv_info_open */
+	unsigned int flags;
+	/** number of TDSICONV using this entry */
+	unsigned int ref_count;
+	unsigned int num_idle;
+	TDS_ICONV_DESCS idle[TDS_ICONV_CACHE_IDLE];
+};
+
+/* protect iconv_cache, iconv_names and iconv_initialized */
+static TDS_MUTEX_DEFINE(iconv_cache_mutex);
+static struct tds_iconv_cache *iconv_cache[TDS_ICONV_CACHE_SIZE];
+
+#define ICONV_HASH(client, server) ((client) * 31u + (server))
+
 /**
  * Initialize charset searching for UTF-8, UCS-2 and ISO8859-1
  */
@@ -257,6 +295,8 @@ tds_iconv_reset(TDSICONV *conv)
 	conv->to_wire2 = (iconv_t) -1;
 	conv->from_wire = (iconv_t) -1;
 	conv->from_wire2 = (iconv_t) -1;
+	conv->cache = NULL;
+	conv->hash_next = NULL;
 }
 
 /**
@@ -269,23 +309,24 @@ tds_iconv_alloc(TDSSOCKET * tds)
 	int i;
 	TDSICONV *char_conv;
 
-	assert(!tds->char_convs);
-	if (!(tds->char_convs = (TDSICONV **) malloc(sizeof(TDSICONV *) * (initial_char_conv_count + 1))))
+	assert(!tds_conn(tds)->char_convs);
+	if (!(tds_conn(tds)->char_convs = (TDSICONV **) malloc(sizeof(TDSICONV *) * (initial_char_conv_count + 1))))
 		return 1;
 	char_conv = (TDSICONV *) calloc(initial_char_conv_count, sizeof(TDSICONV));
 	if (!char_conv) {
-		TDS_ZERO_FREE(tds->char_convs);
+		TDS_ZERO_FREE(tds_conn(tds)->char_convs);
 		return 1;
 	}
-	tds->char_conv_count = initial_char_conv_count + 1;
+	tds_conn(tds)->char_conv_count = initial_char_conv_count + 1;
+	memset(tds_conn(tds)->char_conv_hash, 0, sizeof(tds_conn(tds)->char_conv_hash));
 
 	for (i = 0; i < initial_char_conv_count; ++i) {
-		tds->char_convs[i] = &char_conv[i];
+		tds_conn(tds)->char_convs[i] = &char_conv[i];
 		tds_iconv_reset(&char_conv[i]);
 	}
 
 	/* chardata is just a pointer to another iconv info */
-	tds->char_convs[initial_char_conv_count] = tds->char_convs[client2server_chardata];
+	tds_conn(tds)->char_convs[initial_char_conv_count] = tds_conn(tds)->char_convs[client2server_chardata];
 
 	return 0;
 }
@@ -322,15 +363,17 @@ tds_iconv_open(TDSSOCKET * tds, const char *charset)
 	int canonic_env_charset = tds->env.charset ? tds_canonical_charset(tds->env.charset) : -1;
 	int fOK, ret;
 
-	TDS_ENCODING *client = &tds->char_convs[client2ucs2]->client_charset;
-	TDS_ENCODING *server = &tds->char_convs[client2ucs2]->server_charset;
+	TDS_ENCODING *client = &tds_conn(tds)->char_convs[client2ucs2]->client_charset;
+	TDS_ENCODING *server = &tds_conn(tds)->char_convs[client2ucs2]->server_charset;
 
 	tdsdump_log(TDS_DBG_FUNC, "tds_iconv_open(%p, %s)\n", tds, charset);
 
 	/* initialize */
+	TDS_MUTEX_LOCK(&iconv_cache_mutex);
 	if (!iconv_initialized) {
 		if ((ret = tds_iconv_init()) > 0) {
 			static const char names[][12] = { "ISO 8859-1", "UTF-8" };
+			TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
 			assert(ret < 3);
 			tdsdump_log(TDS_DBG_FUNC, "error: tds_iconv_init() returned %d; "
 						  "could not find a name for %s that your iconv accepts.\n"
@@ -340,6 +383,7 @@ tds_iconv_open(TDSSOCKET * tds, const char *charset)
 		}
 		iconv_initialized = 1;
 	}
+	TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
 
 	/* 
 	 * Client <-> UCS-2 (client2ucs2)
@@ -348,7 +392,7 @@ tds_iconv_open(TDSSOCKET * tds, const char *charset)
 
 	tdsdump_log(TDS_DBG_FUNC, "preparing iconv for \"%s\" <-> \"%s\" conversion\n", charset, UCS_2LE);
 
-	fOK = tds_iconv_info_init(tds->char_convs[client2ucs2], canonic_charset, TDS_CHARSET_UCS_2LE);
+	fOK = tds_iconv_info_init(tds_conn(tds)->char_convs[client2ucs2], canonic_charset, TDS_CHARSET_UCS_2LE);
 	if (!fOK)
 		return;
 
@@ -366,15 +410,15 @@ tds_iconv_open(TDSSOCKET * tds, const char *charset)
 	 * TODO: the server hasn't reported its charset yet, so this logic can't work here.  
 	 *       not sure what to do about that yet.  
 	 */
-	tds->char_convs[client2server_chardata]->flags = TDS_ENCODING_MEMCPY;
+	tds_conn(tds)->char_convs[client2server_chardata]->flags = TDS_ENCODING_MEMCPY;
 	if (canonic_env_charset >= 0) {
 		tdsdump_log(TDS_DBG_FUNC, "preparing iconv for \"%s\" <-> \"%s\" conversion\n", charset, tds->env.charset);
-		fOK = tds_iconv_info_init(tds->char_convs[client2server_chardata], canonic_charset, canonic_env_charset);
+		fOK = tds_iconv_info_init(tds_conn(tds)->char_convs[client2server_chardata], canonic_charset, canonic_env_charset);
 		if (!fOK)
 			return;
 	} else {
-		tds->char_convs[client2server_chardata]->client_charset = canonic_charsets[canonic_charset];
-		tds->char_convs[client2server_chardata]->server_charset = canonic_charsets[canonic_charset];
+		tds_conn(tds)->char_convs[client2server_chardata]->client_charset = canonic_charsets[canonic_charset];
+		tds_conn(tds)->char_convs[client2server_chardata]->server_charset = canonic_charsets[canonic_charset];
 	}
 
 	/* 
@@ -387,30 +431,78 @@ tds_iconv_open(TDSSOCKET * tds, const char *charset)
 			canonic = canonic_env_charset;
 	}
 	tdsdump_log(TDS_DBG_FUNC, "preparing iconv for \"%s\" <-> \"%s\" conversion\n", "ISO-8859-1", canonic_charsets[canonic].name);
-	fOK = tds_iconv_info_init(tds->char_convs[iso2server_metadata], TDS_CHARSET_ISO_8859_1, canonic);
+	fOK = tds_iconv_info_init(tds_conn(tds)->char_convs[iso2server_metadata], TDS_CHARSET_ISO_8859_1, canonic);
 
 	tdsdump_log(TDS_DBG_FUNC, "tds_iconv_open: done\n");
 }
 
 /**
- * Open iconv descriptors to convert between character sets (both directions).
- * 1.  Look up the canonical names of the character sets.
- * 2.  Look up their widths.
- * 3.  Ask iconv to open a conversion descriptor.
- * 4.  Fail if any of the above offer any resistance.  
+ * Check if we can convert between two charsets using our own converters.
+ * One charset should be UCS-2LE, the other UTF-8, ISO-8859-1 or CP1252.
+ */
+static int
+tds_native_charset(int client_canonical, int server_canonical)
+{
+	int other;
+
+	if (server_canonical == TDS_CHARSET_UCS_2LE)
+		other = client_canonical;
+	else if (client_canonical == TDS_CHARSET_UCS_2LE)
+		other = server_canonical;
+	else
+		return 0;
+	return other == TDS_CHARSET_UTF_8 || other == TDS_CHARSET_ISO_8859_1 || other == TDS_CHARSET_CP1252;
+}
+
+/**
+ * Find or create the cache entry for a couple of charsets.
+ * Must be called with iconv_cache_mutex locked.
+ * A new entry is initialized using \a char_conv which keeps
+ * the descriptors opened.
+ * \return entry or NULL on memory error
+ */
+static struct tds_iconv_cache *
+tds_iconv_cache_get(TDSICONV * char_conv, int client_canonical, int server_canonical, int *opened)
+{
+	struct tds_iconv_cache **bucket = &iconv_cache[ICONV_HASH(client_canonical, server_canonical) % TDS_ICONV_CACHE_SIZE];
+	struct tds_iconv_cache *entry;
+
+	*opened = 0;
+	for (entry = *bucket; entry; entry = entry->next)
+		if (entry->client == client_canonical && entry->server == server_canonical)
+			return entry;
+
+	entry = (struct tds_iconv_cache *) calloc(1, sizeof(*entry));
+	if (!entry)
+		return NULL;
+	entry->client = client_canonical;
+	entry->server = server_canonical;
+	entry->valid = tds_iconv_info_open(char_conv, client_canonical, server_canonical);
+	entry->flags = char_conv->flags;
+	entry->next = *bucket;
+	*bucket = entry;
+	*opened = 1;
+	return entry;
+}
+
+/**
+ * Set up conversion between character sets (both directions).
+ * Conversion data are taken from process wide cache, iconv descriptors
+ * are opened only if no idle ones are available.
  * \remarks The charset names written to \a iconv will be the canonical names, 
  *          not necessarily the names passed in. 
  */
 static int
 tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canonical)
 {
-	TDS_ENCODING *client = &char_conv->client_charset;
-	TDS_ENCODING *server = &char_conv->server_charset;
+	struct tds_iconv_cache *entry;
+	int opened;
 
 	assert(char_conv->to_wire == (iconv_t) -1);
 	assert(char_conv->to_wire2 == (iconv_t) -1);
 	assert(char_conv->from_wire == (iconv_t) -1);
 	assert(char_conv->from_wire2 == (iconv_t) -1);
+	assert(char_conv->cache == NULL);
 
 	if (client_canonical < 0) {
 		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: client charset name \"%d\" invalid\n", client_canonical);
@@ -422,8 +514,52 @@ tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canon
 		return 0;
 	}
 
-	*client = canonic_charsets[client_canonical];
-	*server = canonic_charsets[server_canonical];
+	char_conv->client_charset = canonic_charsets[client_canonical];
+	char_conv->server_charset = canonic_charsets[server_canonical];
+
+	TDS_MUTEX_LOCK(&iconv_cache_mutex);
+	entry = tds_iconv_cache_get(char_conv, client_canonical, server_canonical, &opened);
+	if (!entry || !entry->valid) {
+		TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
+		return 0;
+	}
+
+	if (!opened) {
+		char_conv->flags = entry->flags;
+		if (entry->num_idle) {
+			TDS_ICONV_DESCS *descs = &entry->idle[--entry->num_idle];
+
+			char_conv->to_wire = descs->to_wire;
+			char_conv->from_wire = descs->from_wire;
+			char_conv->to_wire2 = descs->to_wire2;
+			char_conv->from_wire2 = descs->from_wire2;
+		} else if (!(entry->flags & TDS_ENCODING_MEMCPY)) {
+			/* more connections than idle descriptors, open new ones */
+			if (!tds_iconv_info_open(char_conv, client_canonical, server_canonical)) {
+				TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
+				return 0;
+			}
+		}
+	}
+	++entry->ref_count;
+	char_conv->cache = entry;
+	TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
+	return 1;
+}
+
+/**
+ * Open iconv descriptors to convert between character sets (both directions).
+ * 1.  Look up the canonical names of the character sets.
+ * 2.  Look up their widths.
+ * 3.  Ask iconv to open a conversion descriptor.
+ * 4.  Fail if any of the above offer any resistance.  
+ * Must be called with iconv_cache_mutex locked.
+ */
+static int
+tds_iconv_info_open(TDSICONV * char_conv, int client_canonical, int server_canonical)
+{
+	TDS_ENCODING *client = &char_conv->client_charset;
+	TDS_ENCODING *server = &char_conv->server_charset;
 
 	/* special case, same charset, no conversion */
 	if (client_canonical == server_canonical) {
@@ -464,12 +600,12 @@ tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canon
 
 	char_conv->to_wire = tds_sys_iconv_open(iconv_names[server_canonical], iconv_names[client_canonical]);
 	if (char_conv->to_wire == (iconv_t) -1) {
-		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: cannot convert \"%s\"->\"%s\"\n", client->name, server->name);
+		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_open: cannot convert \"%s\"->\"%s\"\n", client->name, server->name);
 	}
 
 	char_conv->from_wire = tds_sys_iconv_open(iconv_names[client_canonical], iconv_names[server_canonical]);
 	if (char_conv->from_wire == (iconv_t) -1) {
-		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: cannot convert \"%s\"->\"%s\"\n", server->name, client->name);
+		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_open: cannot convert \"%s\"->\"%s\"\n", server->name, client->name);
 	}
 
 	/* try indirect conversions */
@@ -486,7 +622,7 @@ tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canon
 		    || char_conv->from_wire == (iconv_t) -1 || char_conv->from_wire2 == (iconv_t) -1) {
 
 			tds_iconv_info_close(char_conv);
-			tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: cannot convert \"%s\"->\"%s\" indirectly\n",
+			tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_open: cannot convert \"%s\"->\"%s\" indirectly\n",
 				    server->name, client->name);
 			return 0;
 		}
@@ -494,9 +630,13 @@ tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canon
 		char_conv->flags |= TDS_ENCODING_INDIRECT;
 	}
 	
+	/* use our own converters for most common conversions */
+	if (tds_native_charset(client->canonic, server->canonic))
+		char_conv->flags |= TDS_ENCODING_NATIVE;
+
 	/* TODO, do some optimizations like UCS2 -> UTF8 min,max = 2,2 (UCS2) and 1,4 (UTF8) */
 
-	/* tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: converting \"%s\"->\"%s\"\n", client->name, server->name); */
+	/* tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_open: converting \"%s\"->\"%s\"\n", client->name, server->name); */
 
 	return 1;
 }
@@ -513,9 +653,40 @@ _iconv_close(iconv_t * cd)
 	}
 }
 
+/**
+ * Release conversion descriptors.
+ * Descriptors are given back to the process wide cache if possible.
+ */
 static void
 tds_iconv_info_close(TDSICONV * char_conv)
 {
+	struct tds_iconv_cache *entry = char_conv->cache;
+
+	if (entry) {
+		TDS_MUTEX_LOCK(&iconv_cache_mutex);
+		assert(entry->ref_count > 0);
+		--entry->ref_count;
+		if (!(entry->flags & TDS_ENCODING_MEMCPY) && entry->num_idle < TDS_ICONV_CACHE_IDLE) {
+			TDS_ICONV_DESCS *descs = &entry->idle[entry->num_idle++];
+
+			/* reset shift states */
+			tds_sys_iconv(char_conv->to_wire, NULL, NULL, NULL, NULL);
+			tds_sys_iconv(char_conv->from_wire, NULL, NULL, NULL, NULL);
+			if (char_conv->flags & TDS_ENCODING_INDIRECT) {
+				tds_sys_iconv(char_conv->to_wire2, NULL, NULL, NULL, NULL);
+				tds_sys_iconv(char_conv->from_wire2, NULL, NULL, NULL, NULL);
+			}
+			descs->to_wire = char_conv->to_wire;
+			descs->from_wire = char_conv->from_wire;
+			descs->to_wire2 = char_conv->to_wire2;
+			descs->from_wire2 = char_conv->from_wire2;
+			char_conv->to_wire = char_conv->from_wire = (iconv_t) -1;
+			char_conv->to_wire2 = char_conv->from_wire2 = (iconv_t) -1;
+		}
+		TDS_MUTEX_UNLOCK(&iconv_cache_mutex);
+		char_conv->cache = NULL;
+	}
+
 	_iconv_close(&char_conv->to_wire);
 	_iconv_close(&char_conv->to_wire2);
 	_iconv_close(&char_conv->from_wire);
@@ -527,8 +698,8 @@ tds_iconv_close(TDSSOCKET * tds)
 {
 	int i;
 
-	for (i = 0; i < tds->char_conv_count; ++i) {
-		tds_iconv_info_close(tds->char_convs[i]);
+	for (i = 0; i < tds_conn(tds)->char_conv_count; ++i) {
+		tds_iconv_info_close(tds_conn(tds)->char_convs[i]);
 	}
 }
 
@@ -539,15 +710,341 @@ tds_iconv_free(TDSSOCKET * tds)
 {
 	int i;
 
-	if (!tds->char_convs)
+	if (!tds_conn(tds)->char_convs)
 		return;
 	tds_iconv_close(tds);
 
-	free(tds->char_convs[0]);
-	for (i = initial_char_conv_count + 1; i < tds->char_conv_count; i += CHUNK_ALLOC)
-		free(tds->char_convs[i]);
-	TDS_ZERO_FREE(tds->char_convs);
-	tds->char_conv_count = 0;
+	free(tds_conn(tds)->char_convs[0]);
+	for (i = initial_char_conv_count + 1; i < tds_conn(tds)->char_conv_count; i += CHUNK_ALLOC)
+		free(tds_conn(tds)->char_convs[i]);
+	TDS_ZERO_FREE(tds_conn(tds)->char_convs);
+	tds_conn(tds)->char_conv_count = 0;
+	memset(tds_conn(tds)->char_conv_hash, 0, sizeof(tds_conn(tds)->char_conv_hash));
+}
+
+/*
+ * Native conversions between UCS-2LE and UTF-8, ISO-8859-1 or CP1252.
+ * These are by far the most common conversions (nvarchar/ntext data for
+ * most clients) so we do them by hand instead of calling iconv, checking
+ * whole words of plain ASCII at once.
+ */
+
+/** Unicode values for CP1252 0x80-0x9f, 0 for undefined characters */
+static const TDS_USMALLINT cp1252_high[32] = {
+	0x20ac, 0,      0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+	0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017d, 0,
+	0,      0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+	0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0,      0x017e, 0x0178
+};
+
+/* bits that must be zero in 4 UCS-2LE or 8 single byte ASCII characters */
+#ifdef WORDS_BIGENDIAN
+# define UCS2_ASCII_MASK ((((TDS_UINT8) 0x80ff80ffu) << 32) | 0x80ff80ffu)
+#else
+# define UCS2_ASCII_MASK ((((TDS_UINT8) 0xff80ff80u) << 32) | 0xff80ff80u)
+#endif
+#define BYTE_ASCII_MASK ((((TDS_UINT8) 0x80808080u) << 32) | 0x80808080u)
+
+/**
+ * Convert a Unicode character to a single byte charset.
+ * \return byte or -1 if character is not representable
+ */
+static int
+native_to_byte(int charset, unsigned int c)
+{
+	int i;
+
+	if (c < 0x80 || (c >= 0xa0 && c < 0x100))
+		return c;
+	if (charset == TDS_CHARSET_ISO_8859_1)
+		return c < 0x100 ? (int) c : -1;
+	for (i = 0; i < 32; ++i)
+		if (cp1252_high[i] == c)
+			return 0x80 + i;
+	return -1;
+}
+
+/**
+ * Convert UCS-2LE (UTF-16LE actually, surrogates are handled) to UTF-8, ISO-8859-1 or CP1252.
+ * \param substitute replace not convertible characters with '?' instead of failing
+ * \return number of substitutions or -1 on error (errno set like iconv)
+ */
+static size_t
+native_from_ucs2le(int charset, int substitute, const unsigned char **inbuf, size_t * inbytesleft,
+		   unsigned char **outbuf, size_t * outbytesleft, int *eilseq_raised)
+{
+	const unsigned char *in = *inbuf;
+	unsigned char *out = *outbuf;
+	size_t il = *inbytesleft, ol = *outbytesleft, irreversible = 0;
+	int err = 0;
+
+	for (;;) {
+		unsigned int c, n = 2;
+
+		/* fast path, 4 ASCII characters at a time */
+		while (il >= 8 && ol >= 4) {
+			TDS_UINT8 w;
+
+			memcpy(&w, in, 8);
+			if (w & UCS2_ASCII_MASK)
+				break;
+			out[0] = in[0];
+			out[1] = in[2];
+			out[2] = in[4];
+			out[3] = in[6];
+			in += 8;
+			il -= 8;
+			out += 4;
+			ol -= 4;
+		}
+
+		if (il < 2) {
+			if (il)
+				err = EINVAL;
+			break;
+		}
+		c = in[0] | (in[1] << 8);
+		if (c < 0x80) {
+			if (!ol) {
+				err = E2BIG;
+				break;
+			}
+			*out++ = c;
+			--ol;
+			in += 2;
+			il -= 2;
+			continue;
+		}
+
+		if (charset == TDS_CHARSET_UTF_8) {
+			unsigned int len = c < 0x800 ? 2 : 3;
+
+			if (c >= 0xd800 && c < 0xdc00) {
+				unsigned int c2;
+
+				if (il < 4) {
+					err = EINVAL;
+					break;
+				}
+				c2 = in[2] | (in[3] << 8);
+				if (c2 >= 0xdc00 && c2 < 0xe000) {
+					c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+					n = 4;
+					len = 4;
+				} else {
+					len = 0;
+				}
+			} else if (c >= 0xdc00 && c < 0xe000) {
+				len = 0;
+			}
+			if (len) {
+				if (ol < len) {
+					err = E2BIG;
+					break;
+				}
+				switch (len) {
+				case 2:
+					out[0] = 0xc0 | (c >> 6);
+					break;
+				case 3:
+					out[0] = 0xe0 | (c >> 12);
+					out[1] = 0x80 | ((c >> 6) & 0x3f);
+					break;
+				case 4:
+					out[0] = 0xf0 | (c >> 18);
+					out[1] = 0x80 | ((c >> 12) & 0x3f);
+					out[2] = 0x80 | ((c >> 6) & 0x3f);
+					break;
+				}
+				out[len - 1] = 0x80 | (c & 0x3f);
+				out += len;
+				ol -= len;
+				in += n;
+				il -= n;
+				continue;
+			}
+		} else {
+			int b = native_to_byte(charset, c);
+
+			if (b >= 0) {
+				if (!ol) {
+					err = E2BIG;
+					break;
+				}
+				*out++ = b;
+				--ol;
+				in += 2;
+				il -= 2;
+				continue;
+			}
+		}
+
+		/* not convertible */
+		*eilseq_raised = 1;
+		if (!substitute) {
+			err = EILSEQ;
+			break;
+		}
+		if (!ol) {
+			err = E2BIG;
+			break;
+		}
+		*out++ = '?';
+		--ol;
+		in += 2;
+		il -= 2;
+		++irreversible;
+	}
+
+	*inbuf = in;
+	*inbytesleft = il;
+	*outbuf = out;
+	*outbytesleft = ol;
+	errno = err;
+	return err ? (size_t) -1 : irreversible;
+}
+
+/**
+ * Convert UTF-8, ISO-8859-1 or CP1252 to UCS-2LE (characters outside BMP are encoded as surrogates).
+ * \param substitute replace invalid sequences with '?' instead of failing
+ * \return number of substitutions or -1 on error (errno set like iconv)
+ */
+static size_t
+native_to_ucs2le(int charset, int substitute, const unsigned char **inbuf, size_t * inbytesleft,
+		 unsigned char **outbuf, size_t * outbytesleft, int *eilseq_raised)
+{
+	const unsigned char *in = *inbuf;
+	unsigned char *out = *outbuf;
+	size_t il = *inbytesleft, ol = *outbytesleft, irreversible = 0;
+	int err = 0;
+
+	for (;;) {
+		unsigned int c, n = 1;
+
+		/* fast path, 8 ASCII characters at a time */
+		while (il >= 8 && ol >= 16) {
+			TDS_UINT8 w;
+			int i;
+
+			memcpy(&w, in, 8);
+			if (w & BYTE_ASCII_MASK)
+				break;
+			for (i = 0; i < 8; ++i) {
+				out[i * 2] = in[i];
+				out[i * 2 + 1] = 0;
+			}
+			in += 8;
+			il -= 8;
+			out += 16;
+			ol -= 16;
+		}
+
+		if (!il)
+			break;
+		c = in[0];
+		if (c >= 0x80) {
+			if (charset == TDS_CHARSET_CP1252) {
+				if (c < 0xa0)
+					c = cp1252_high[c - 0x80];
+			} else if (charset == TDS_CHARSET_UTF_8) {
+				unsigned int i, min;
+
+				if (c >= 0xc2 && c < 0xe0) {
+					n = 2;
+					c &= 0x1f;
+					min = 0x80;
+				} else if (c >= 0xe0 && c < 0xf0) {
+					n = 3;
+					c &= 0x0f;
+					min = 0x800;
+				} else if (c >= 0xf0 && c < 0xf5) {
+					n = 4;
+					c &= 0x07;
+					min = 0x10000;
+				} else {
+					n = 0;
+				}
+				for (i = 1; i < n; ++i) {
+					if (i >= il) {
+						err = EINVAL;
+						break;
+					}
+					if ((in[i] & 0xc0) != 0x80)
+						break;
+					c = (c << 6) | (in[i] & 0x3f);
+				}
+				if (err)
+					break;
+				if (i < n || c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+					n = 0;
+			}
+		}
+
+		if (!n || !c) {
+			/* invalid sequence, a NUL byte is fine */
+			if (!n || in[0]) {
+				*eilseq_raised = 1;
+				if (!substitute) {
+					err = EILSEQ;
+					break;
+				}
+				n = 1;
+				c = '?';
+				++irreversible;
+			}
+		}
+
+		if (c >= 0x10000) {
+			if (ol < 4) {
+				err = E2BIG;
+				break;
+			}
+			c -= 0x10000;
+			out[0] = (c >> 10) & 0xff;
+			out[1] = 0xd8 | (c >> 18);
+			out[2] = c & 0xff;
+			out[3] = 0xdc | ((c >> 8) & 0x03);
+			out += 4;
+			ol -= 4;
+		} else {
+			if (ol < 2) {
+				err = E2BIG;
+				break;
+			}
+			out[0] = c & 0xff;
+			out[1] = c >> 8;
+			out += 2;
+			ol -= 2;
+		}
+		in += n;
+		il -= n;
+	}
+
+	*inbuf = in;
+	*inbytesleft = il;
+	*outbuf = out;
+	*outbytesleft = ol;
+	errno = err;
+	return err ? (size_t) -1 : irreversible;
+}
+
+/**
+ * Do conversion for TDSICONV with TDS_ENCODING_NATIVE flag.
+ * Semantic is the same of iconv, on conversion to client not convertible
+ * characters are replaced with '?'.
+ */
+static size_t
+tds_native_iconv(const TDSICONV * conv, TDS_ICONV_DIRECTION io,
+		 const char **inbuf, size_t * inbytesleft, char **outbuf, size_t * outbytesleft, int *eilseq_raised)
+{
+	int server_ucs2 = conv->server_charset.canonic == TDS_CHARSET_UCS_2LE;
+	int charset = server_ucs2 ? conv->client_charset.canonic : conv->server_charset.canonic;
+
+	if ((io == to_client) == server_ucs2)
+		return native_from_ucs2le(charset, io == to_client, (const unsigned char **) inbuf, inbytesleft,
+					  (unsigned char **) outbuf, outbytesleft, eilseq_raised);
+	return native_to_ucs2le(charset, io == to_client, (const unsigned char **) inbuf, inbytesleft,
+				(unsigned char **) outbuf, outbytesleft, eilseq_raised);
 }
 
 /** 
@@ -636,6 +1133,12 @@ tds_iconv(TDSSOCKET * tds, const TDSICONV * conv, TDS_ICONV_DIRECTION io,
 		return 0;
 	}
 
+	if (conv->flags & TDS_ENCODING_NATIVE) {
+		irreversible = tds_native_iconv(conv, io, inbuf, inbytesleft, outbuf, outbytesleft, &eilseq_raised);
+		p = *outbuf;
+		goto end_loop;
+	}
+
 	/*
 	 * Call iconv() as many times as necessary, until we reach the end of input or exhaust output.  
 	 */
@@ -916,43 +1419,50 @@ tds_iconv_fread(iconv_t cd, FILE * stream, size_t field_len, size_t term_len, ch
 static TDSICONV *
 tds_iconv_get_info(TDSSOCKET * tds, int canonic_client, int canonic_server)
 {
-	TDSICONV *info;
+	TDSICONV *info, **bucket;
 	int i;
 
-	/* search a charset from already allocated charsets */
-	for (i = tds->char_conv_count; --i >= initial_char_conv_count;)
-		if (canonic_client == tds->char_convs[i]->client_charset.canonic
-		    && canonic_server == tds->char_convs[i]->server_charset.canonic)
-			return tds->char_convs[i];
+	/* search a charset from already allocated charsets, first initial single-byte one */
+	info = tds_conn(tds)->char_convs[initial_char_conv_count];
+	if (canonic_client == info->client_charset.canonic && canonic_server == info->server_charset.canonic)
+		return info;
+
+	bucket = &tds_conn(tds)->char_conv_hash[ICONV_HASH(canonic_client, canonic_server) % TDS_ICONV_HASH_SIZE];
+	for (info = *bucket; info; info = info->hash_next)
+		if (canonic_client == info->client_charset.canonic && canonic_server == info->server_charset.canonic)
+			return info;
 
 	/* allocate a new iconv structure */
-	if (tds->char_conv_count % CHUNK_ALLOC == ((initial_char_conv_count + 1) % CHUNK_ALLOC)) {
+	if (tds_conn(tds)->char_conv_count % CHUNK_ALLOC == ((initial_char_conv_count + 1) % CHUNK_ALLOC)) {
 		TDSICONV **p;
 		TDSICONV *infos;
 
 		infos = (TDSICONV *) malloc(sizeof(TDSICONV) * CHUNK_ALLOC);
 		if (!infos)
 			return NULL;
-		p = (TDSICONV **) realloc(tds->char_convs, sizeof(TDSICONV *) * (tds->char_conv_count + CHUNK_ALLOC));
+		p = (TDSICONV **) realloc(tds_conn(tds)->char_convs, sizeof(TDSICONV *) * (tds_conn(tds)->char_conv_count + CHUNK_ALLOC));
 		if (!p) {
 			free(infos);
 			return NULL;
 		}
-		tds->char_convs = p;
+		tds_conn(tds)->char_convs = p;
 		memset(infos, 0, sizeof(TDSICONV) * CHUNK_ALLOC);
 		for (i = 0; i < CHUNK_ALLOC; ++i) {
-			tds->char_convs[i + tds->char_conv_count] = &infos[i];
+			tds_conn(tds)->char_convs[i + tds_conn(tds)->char_conv_count] = &infos[i];
 			tds_iconv_reset(&infos[i]);
 		}
 	}
-	info = tds->char_convs[tds->char_conv_count++];
+	info = tds_conn(tds)->char_convs[tds_conn(tds)->char_conv_count++];
 
 	/* init */
-	if (tds_iconv_info_init(info, canonic_client, canonic_server))
+	if (tds_iconv_info_init(info, canonic_client, canonic_server)) {
+		info->hash_next = *bucket;
+		*bucket = info;
 		return info;
+	}
 
 	tds_iconv_info_close(info);
-	--tds->char_conv_count;
+	--tds_conn(tds)->char_conv_count;
 	return NULL;
 }
 
@@ -978,7 +1488,7 @@ tds_iconv_get(TDSSOCKET * tds, const char *client_charset, const char *server_ch
 static void
 tds_srv_charset_changed_num(TDSSOCKET * tds, int canonic_charset_num)
 {
-	TDSICONV *char_conv = tds->char_convs[client2server_chardata];
+	TDSICONV *char_conv = tds_conn(tds)->char_convs[client2server_chardata];
 
 	if (IS_TDS7_PLUS(tds) && canonic_charset_num == TDS_CHARSET_ISO_8859_1)
 		canonic_charset_num = TDS_CHARSET_CP1252;
@@ -989,15 +1499,15 @@ tds_srv_charset_changed_num(TDSSOCKET * tds, int canonic_charset_num)
 		return;
 
 	/* find and set conversion */
-	char_conv = tds_iconv_get_info(tds, tds->char_convs[client2ucs2]->client_charset.canonic, canonic_charset_num);
+	char_conv = tds_iconv_get_info(tds, tds_conn(tds)->char_convs[client2ucs2]->client_charset.canonic, canonic_charset_num);
 	if (char_conv)
-		tds->char_convs[client2server_chardata] = char_conv;
+		tds_conn(tds)->char_convs[client2server_chardata] = char_conv;
 
 	/* if sybase change also server conversions */
 	if (IS_TDS7_PLUS(tds))
 		return;
 
-	char_conv = tds->char_convs[iso2server_metadata];
+	char_conv = tds_conn(tds)->char_convs[iso2server_metadata];
 
 	tds_iconv_info_close(char_conv);
 
@@ -1430,10 +1940,10 @@ tds_iconv_from_collate(TDSSOCKET * tds, TDS_UCHAR collate[5])
 	int canonic_charset = collate2charset(sql_collate, lcid);
 
 	/* same as client (usually this is true, so this improve performance) ? */
-	if (tds->char_convs[client2server_chardata]->server_charset.canonic == canonic_charset)
-		return tds->char_convs[client2server_chardata];
+	if (tds_conn(tds)->char_convs[client2server_chardata]->server_charset.canonic == canonic_charset)
+		return tds_conn(tds)->char_convs[client2server_chardata];
 
-	return tds_iconv_get_info(tds, tds->char_convs[client2ucs2]->client_charset.canonic, canonic_charset);
+	return tds_iconv_get_info(tds, tds_conn(tds)->char_convs[client2ucs2]->client_charset.canonic, canonic_charset);
 }
 
 /** @} */
@@ -403,7 +403,7 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 #endif
 
 	/* set up iconv if not already initialized*/
-	if (tds->char_convs[client2ucs2]->to_wire == (iconv_t) -1) {
+	if (tds_conn(tds)->char_convs[client2ucs2]->to_wire == (iconv_t) -1) {
 		if (!tds_dstr_isempty(&login->client_charset)) {
 			tds_iconv_open(tds, tds_dstr_cstr(&login->client_charset));
 		}
@@ -493,6 +493,7 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	}
 
 	tds->query_timeout = login->query_timeout;
+	tds_conn(tds)->dyn_cache_max = login->prepared_cache_size;
 	tds->login = NULL;
 	return TDS_SUCCESS;
 }
@@ -697,11 +698,8 @@ tds7_send_login(TDSSOCKET * tds, TDSLOGIN * login)
 		tds70Version[] = { 0x00, 0x00, 0x00, 0x70 },
 		tds71Version[] = { 0x01, 0x00, 0x00, 0x71 },
 		tds72Version[] = { 0x02, 0x00, 0x09, 0x72 },
-#if SUPPORT_NBCROW
-		tds73Version[] = { 0x03, 0x00, 0x0B, 0x73 }, 
-#else
-		tds73Version[] = { 0x03, 0x00, 0x0A, 0x73 },	     /* 7.3.A, no NBCROW */
-#endif		
+		tds73Version[] = { 0x03, 0x00, 0x0B, 0x73 },	     /* 7.3.B, NBCROW */
+		tds74Version[] = { 0x04, 0x00, 0x00, 0x74 },
 		connection_id[] = { 0x00, 0x00, 0x00, 0x00 }, 
 		time_zone[] = { 0x88, 0xff, 0xff, 0xff }, 
 		collation[] = { 0x36, 0x04, 0x00, 0x00 }, 
@@ -802,8 +800,11 @@ tds7_send_login(TDSSOCKET * tds, TDSLOGIN * login)
 	case 0x703:
 		ptds7version = tds73Version;
 		break;
+	case 0x704:
+		ptds7version = tds74Version;
+		break;
 	default:
-		assert(0 && 0x700 <= login->tds_version && login->tds_version <= 0x703);
+		assert(0 && 0x700 <= login->tds_version && login->tds_version <= 0x704);
 	}
 	
 	tds_put_n(tds, ptds7version, sizeof(tds70Version));
@@ -908,14 +909,14 @@ tds7_send_login(TDSSOCKET * tds, TDSLOGIN * login)
 	if (!tds_conn(tds)->authentication) {
 		char unicode_string[256], *punicode = unicode_string;
 		const char *p;
-		TDSICONV *char_conv = tds->char_convs[client2ucs2];
+		TDSICONV *char_conv = tds_conn(tds)->char_convs[client2ucs2];
 
 		tds_put_string(tds, tds_dstr_cstr(&login->user_name), (int)user_name_len);
 		p = tds_dstr_cstr(&login->password);
 		unicode_left = sizeof(unicode_string);
 
 		memset(&char_conv->suppress, 0, sizeof(char_conv->suppress));
-		if (tds_iconv(tds, tds->char_convs[client2ucs2], to_server, &p, &password_len, &punicode, &unicode_left) ==
+		if (tds_iconv(tds, tds_conn(tds)->char_convs[client2ucs2], to_server, &p, &password_len, &punicode, &unicode_left) ==
 		    (size_t) - 1) {
 			tdsdump_log(TDS_DBG_INFO1, "password \"%s\" could not be converted to UCS-2\n", p);
 			assert(0);
@@ -961,6 +962,7 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 	const char *instance_name = tds_dstr_isempty(&login->instance_name) ? "MSSQLServer" : tds_dstr_cstr(&login->instance_name);
 	int instance_name_len = strlen(instance_name) + 1;
 	TDS_CHAR crypt_flag;
+	int mars = 0;
 	unsigned int start_pos = 21;
 #if defined(HAVE_GNUTLS) || defined(HAVE_OPENSSL)
 	TDSRET ret;
@@ -1032,7 +1034,7 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 	tds_put_int(tds, getpid());
 	/* MARS (1 enabled) */
 	if (IS_TDS72_PLUS(tds))
-		tds_put_byte(tds, 0);
+		tds_put_byte(tds, login->mars ? 1 : 0);
 	if (tds_flush_packet(tds) == TDS_FAIL)
 		return TDS_FAIL;
 
@@ -1065,12 +1067,15 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 		if (type == 1 && l >= 1) {
 			crypt_flag = p[off];
 		}
+		/* MARS accepted by server */
+		if (type == 4 && l >= 1 && login->mars && IS_TDS72_PLUS(tds))
+			mars = p[off] == 1;
 	}
 	/* we readed all packet */
 	tds->in_pos += len;
 	/* TODO some mssql version do not set last packet, update tds according */
 
-	tdsdump_log(TDS_DBG_INFO1, "detected flag %d\n", crypt_flag);
+	tdsdump_log(TDS_DBG_INFO1, "detected flag %d mars %d\n", crypt_flag, mars);
 
 	/* if server do not has certificate do normal login */
 	if (crypt_flag == 2) {
@@ -1078,6 +1083,9 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 		if (login->encryption_level >= TDS_ENCRYPTION_REQUIRE)
 			return TDS_FAIL;
 
+		/* with MARS login is sent in the first session */
+		if (mars && tds_mars_open_session(tds) != TDS_SUCCESS)
+			return TDS_FAIL;
 		return tds7_send_login(tds, login);
 	}
 #if !defined(HAVE_GNUTLS) && !defined(HAVE_OPENSSL)
@@ -1094,6 +1102,8 @@ tds71_do_login(TDSSOCKET * tds, TDSLOGIN* login)
 	if (tds_ssl_init(tds) != TDS_SUCCESS)
 		return TDS_FAIL;
 
+	if (mars && tds_mars_open_session(tds) != TDS_SUCCESS)
+		return TDS_FAIL;
 	ret = tds7_send_login(tds, login);
 
 	/* if flag is 0 it means that after login server continue not encrypted */
@@ -121,6 +121,140 @@ tds_get_dynid(TDSSOCKET * tds, char *id)
 }
 
 
+static TDS_UINT
+tds_name_hash(const char *name, size_t len)
+{
+	TDS_UINT h = 2166136261u;
+
+	/* FNV-1a */
+	while (len--) {
+		h ^= (unsigned char) *name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+tds_name_index_insert(TDSNAMEINDEX * idx, const char *name, void *item, TDS_UINT hash)
+{
+	unsigned int mask = idx->size - 1, i;
+
+	for (i = hash & mask; idx->slots[i].name; i = (i + 1) & mask)
+		continue;
+	idx->slots[i].name = name;
+	idx->slots[i].item = item;
+	idx->slots[i].hash = hash;
+	++idx->count;
+}
+
+/**
+ * Add an object to an index.
+ * \param idx  index to update
+ * \param name name of object, must stay valid until object is removed
+ * \param item object to add
+ * \return TDS_SUCCESS or TDS_FAIL if out of memory
+ */
+TDSRET
+tds_name_index_add(TDSNAMEINDEX * idx, const char *name, void *item)
+{
+	/* keep at least half slots free, probe sequences remain short */
+	if ((idx->count + 1) * 2 > idx->size) {
+		TDSNAMEINDEXSLOT *old_slots = idx->slots;
+		unsigned int i, old_size = idx->size;
+		unsigned int size = old_size ? old_size * 2 : 16;
+
+		idx->slots = (TDSNAMEINDEXSLOT *) calloc(size, sizeof(TDSNAMEINDEXSLOT));
+		if (!idx->slots) {
+			idx->slots = old_slots;
+			return TDS_FAIL;
+		}
+		idx->size = size;
+		idx->count = 0;
+		for (i = 0; i < old_size; ++i)
+			if (old_slots[i].name)
+				tds_name_index_insert(idx, old_slots[i].name, old_slots[i].item, old_slots[i].hash);
+		free(old_slots);
+	}
+
+	tds_name_index_insert(idx, name, item, tds_name_hash(name, strlen(name)));
+	return TDS_SUCCESS;
+}
+
+/**
+ * Find an object by name.
+ * \param idx  index to search
+ * \param name name to search, not necessarily NUL terminated
+ * \param len  length of name
+ * \return object or NULL if not found
+ */
+void *
+tds_name_index_find(const TDSNAMEINDEX * idx, const char *name, size_t len)
+{
+	const TDSNAMEINDEXSLOT *slot;
+	unsigned int mask = idx->size - 1, i;
+	TDS_UINT hash;
+
+	if (!idx->size)
+		return NULL;
+
+	hash = tds_name_hash(name, len);
+	for (i = hash & mask; (slot = &idx->slots[i])->name != NULL; i = (i + 1) & mask)
+		if (slot->hash == hash && strncmp(slot->name, name, len) == 0 && slot->name[len] == 0)
+			return slot->item;
+	return NULL;
+}
+
+/**
+ * Remove an object from an index.
+ * \param idx  index to update
+ * \param name name the object was added with
+ * \param item object to remove
+ */
+void
+tds_name_index_remove(TDSNAMEINDEX * idx, const char *name, void *item)
+{
+	TDSNAMEINDEXSLOT *slots = idx->slots;
+	unsigned int mask = idx->size - 1, i, j, k;
+
+	if (!idx->size)
+		return;
+
+	for (i = tds_name_hash(name, strlen(name)) & mask;; i = (i + 1) & mask) {
+		if (!slots[i].name)
+			return;
+		if (slots[i].item == item)
+			break;
+	}
+
+	/* move back following entries so no probe sequence is broken */
+	for (j = i;;) {
+		slots[i].name = NULL;
+		do {
+			j = (j + 1) & mask;
+			if (!slots[j].name) {
+				--idx->count;
+				return;
+			}
+			k = slots[j].hash & mask;
+			/* entry can stay if its home slot is cyclically in (i, j] */
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		slots[i] = slots[j];
+		i = j;
+	}
+}
+
+/**
+ * Free memory used by an index, objects are not freed.
+ */
+void
+tds_name_index_free(TDSNAMEINDEX * idx)
+{
+	free(idx->slots);
+	idx->slots = NULL;
+	idx->size = 0;
+	idx->count = 0;
+}
+
 /**
  * \fn TDSDYNAMIC *tds_alloc_dynamic(TDSSOCKET *tds, const char *id)
  * \brief Allocate a dynamic statement.
@@ -156,11 +290,15 @@ tds_alloc_dynamic(TDSSOCKET * tds, const char *id)
 	if (!dyn)
 		return NULL;
 
-	/* insert into list */
-	dyn->next = tds->dyns;
-	tds->dyns = dyn;
-
 	tds_strlcpy(dyn->id, id, TDS_MAX_DYNID_LEN);
+	if (tds_name_index_add(&tds_conn(tds)->dyn_index, dyn->id, dyn) != TDS_SUCCESS) {
+		free(dyn);
+		return NULL;
+	}
+
+	/* insert into list */
+	dyn->next = tds_conn(tds)->dyns;
+	tds_conn(tds)->dyns = dyn;
 
 	return dyn;
 }
@@ -203,12 +341,24 @@ tds_free_dynamic(TDSSOCKET * tds, TDSDYNAMIC * dyn)
 		tds->current_results = NULL;
 
 	/* free from tds */
-	for (pcurr = &tds->dyns; *pcurr != NULL; pcurr = &(*pcurr)->next)
+	tds_name_index_remove(&tds_conn(tds)->dyn_index, dyn->id, dyn);
+	for (pcurr = &tds_conn(tds)->dyns; *pcurr != NULL; pcurr = &(*pcurr)->next)
 		if (dyn == *pcurr) {
 			*pcurr = dyn->next;
 			break;
 		}
 
+	/* only statements with a key can be in the cache */
+	if (dyn->cache_key) {
+		for (pcurr = &tds_conn(tds)->dyn_cache; *pcurr != NULL; pcurr = &(*pcurr)->cache_next)
+			if (dyn == *pcurr) {
+				*pcurr = dyn->cache_next;
+				--tds_conn(tds)->dyn_cache_count;
+				break;
+			}
+		free(dyn->cache_key);
+	}
+
 	tds_free_results(dyn->res_info);
 	tds_free_input_params(dyn);
 	free(dyn->query);
@@ -259,6 +409,9 @@ tds_alloc_param_result(TDSPARAMINFO * old_param)
 	}
 	param_info->columns = cols;
 	param_info->columns[param_info->num_cols++] = colinfo;
+	/* columns changed, decode plan must be computed again */
+	if (param_info->decode_plan)
+		TDS_ZERO_FREE(param_info->decode_plan);
 	return param_info;
       Cleanup:
 	free(colinfo);
@@ -562,6 +715,9 @@ tds_free_results(TDSRESULTINFO * res_info)
 	if (res_info->num_cols && res_info->columns) {
 		for (i = 0; i < res_info->num_cols; i++)
 			if ((curcol = res_info->columns[i]) != NULL) {
+				/* column can point into network buffer */
+				if (curcol->column_row_data)
+					curcol->column_data = curcol->column_row_data;
 				if (curcol->bcp_terminator)
 					TDS_ZERO_FREE(curcol->bcp_terminator);
 				tds_free_bcp_column_data(curcol->bcp_column_data);
@@ -584,6 +740,7 @@ tds_free_results(TDSRESULTINFO * res_info)
 	}
 
 	free(res_info->bycolumns);
+	free(res_info->decode_plan);
 
 	free(res_info);
 }
@@ -592,6 +749,8 @@ void
 tds_free_all_results(TDSSOCKET * tds)
 {
 	tdsdump_log(TDS_DBG_FUNC, "tds_free_all_results()\n");
+	tds->stream_col = NULL;
+	tds->wire_row = 0;
 	if (tds->current_results == tds->res_info)
 		tds->current_results = NULL;
 	tds_free_results(tds->res_info);
@@ -891,10 +1050,10 @@ tds_alloc_cursor(TDSSOCKET *tds, const char *name, TDS_INT namelen, const char *
 	TEST_MALLOC(cursor, TDSCURSOR);
 	cursor->ref_count = 1;
 
-	if ( tds->cursors == NULL ) {
-		tds->cursors = cursor;
+	if ( tds_conn(tds)->cursors == NULL ) {
+		tds_conn(tds)->cursors = cursor;
 	} else {
-		pcursor = tds->cursors;
+		pcursor = tds_conn(tds)->cursors;
 		for (;;) {
 			tdsdump_log(TDS_DBG_FUNC, "tds_alloc_cursor() : stepping thru existing cursors\n");
 			if (pcursor->next == NULL)
@@ -938,7 +1097,7 @@ tds_cursor_deallocated(TDSSOCKET *tds, TDSCURSOR *cursor)
 		tds->cur_cursor = NULL;
 	}
 
-	victim = tds->cursors;
+	victim = tds_conn(tds)->cursors;
 
 	if (victim == NULL) {
 		tdsdump_log(TDS_DBG_FUNC, "tds_cursor_deallocated() : no allocated cursors %d\n", cursor->cursor_id);
@@ -965,7 +1124,7 @@ tds_cursor_deallocated(TDSSOCKET *tds, TDSCURSOR *cursor)
 	if (prev)
 		prev->next = next;
 	else
-		tds->cursors = next;
+		tds_conn(tds)->cursors = next;
 
 	tdsdump_log(TDS_DBG_FUNC, "tds_cursor_deallocated() : relinked list\n");
 
@@ -1066,15 +1225,32 @@ tds_free_login(TDSLOGIN * login)
 	free(login);
 }
 
+/**
+ * Compute space to allocate for sending packets.
+ * We queue packets up to 32 KB, at least 2.
+ */
+static unsigned int
+tds_send_buf_size(unsigned int bufsize)
+{
+	unsigned int packets = 32768u / bufsize;
+
+	if (packets < 2)
+		packets = 2;
+	return packets * bufsize + TDS_ADDITIONAL_SPACE;
+}
+
 TDSSOCKET *
 tds_alloc_socket(TDSCONTEXT * context, int bufsize)
 {
 	TDSSOCKET *tds_socket;
 
 	TEST_MALLOC(tds_socket, TDSSOCKET);
+	TEST_MALLOC(tds_socket->conn, TDSSOCKETCONN);
 	tds_set_ctx(tds_socket, context);
 	tds_socket->in_buf_max = 0;
-	TEST_CALLOC(tds_socket->out_buf, unsigned char, bufsize + TDS_ADDITIONAL_SPACE);
+	tds_socket->send_buf_size = tds_send_buf_size(bufsize);
+	TEST_CALLOC(tds_socket->send_buf, unsigned char, tds_socket->send_buf_size);
+	tds_socket->out_buf = tds_socket->send_buf;
 
 	tds_set_parent(tds_socket, NULL);
 	tds_socket->env.block_size = bufsize;
@@ -1095,48 +1271,126 @@ tds_alloc_socket(TDSCONTEXT * context, int bufsize)
 	return NULL;
 }
 
+/**
+ * Allocate a new MARS session on the connection of \a tds.
+ * Session shares connection state (network, conversions, dynamics and
+ * cursors) and start with the environment of \a tds.
+ * \return new session, NULL on error or if MARS is not enabled
+ */
+TDSSOCKET *
+tds_alloc_additional_socket(TDSSOCKET * tds)
+{
+	TDSSOCKET *tds_socket;
+
+	if (!tds_conn(tds)->mars || IS_TDSDEAD(tds))
+		return NULL;
+
+	TEST_MALLOC(tds_socket, TDSSOCKET);
+	tds_socket->conn = tds_conn(tds);
+	tds_socket->send_buf_size = tds_send_buf_size(tds->env.block_size);
+	TEST_CALLOC(tds_socket->send_buf, unsigned char, tds_socket->send_buf_size);
+	tds_socket->out_buf = tds_socket->send_buf;
+
+	tds_socket->tds_version = tds->tds_version;
+	tds_socket->env.block_size = tds->env.block_size;
+	if (tds->env.language && !(tds_socket->env.language = strdup(tds->env.language)))
+		goto Cleanup;
+	if (tds->env.charset && !(tds_socket->env.charset = strdup(tds->env.charset)))
+		goto Cleanup;
+	if (tds->env.database && !(tds_socket->env.database = strdup(tds->env.database)))
+		goto Cleanup;
+	tds_socket->spid = tds->spid;
+	memcpy(tds_socket->collation, tds->collation, sizeof(tds->collation));
+	tds_socket->env_chg_func = tds->env_chg_func;
+	tds_socket->query_timeout = tds->query_timeout;
+	tds_socket->option_value = tds->option_value;
+
+	tds_init_write_buf(tds_socket);
+	tds_socket->state = TDS_IDLE;
+	if (tds_mars_open_session(tds_socket) != TDS_SUCCESS)
+		goto Cleanup;
+	return tds_socket;
+      Cleanup:
+	tds_free_socket(tds_socket);
+	return NULL;
+}
+
 TDSSOCKET *
 tds_realloc_socket(TDSSOCKET * tds, size_t bufsize)
 {
-	unsigned char *new_out_buf;
+	unsigned char *new_send_buf;
+	unsigned int send_buf_size;
 
 	assert(tds && tds->out_buf);
 
 	if (tds->env.block_size == bufsize)
 		return tds;
 
-	if (tds->out_pos <= bufsize && bufsize > 0 && 
-	    (new_out_buf = (unsigned char *) realloc(tds->out_buf, bufsize + TDS_ADDITIONAL_SPACE)) != NULL) {
-		tds->out_buf = new_out_buf;
+	/* packets already queued use old size */
+	if (tds->out_buf != tds->send_buf || tds->out_pos > bufsize || bufsize <= 0)
+		return NULL;
+
+	send_buf_size = tds_send_buf_size(bufsize);
+	if ((new_send_buf = (unsigned char *) realloc(tds->send_buf, send_buf_size)) != NULL) {
+		tds->out_buf = tds->send_buf = new_send_buf;
+		tds->send_buf_size = send_buf_size;
 		tds->env.block_size = (int)bufsize;
 		return tds;
 	}
 	return NULL;
 }
 
+/**
+ * Free data of a query cache entry, entry is left free for reuse
+ */
+void
+tds_free_query_def(TDSQUERYDEF * def)
+{
+	free(def->query);
+	free(def->types);
+	free(def->ucs2_query);
+	free(def->param_def);
+	memset(def, 0, sizeof(*def));
+}
+
 void
 tds_free_socket(TDSSOCKET * tds)
 {
-	if (tds) {
-		if (tds_conn(tds)->authentication)
-			tds_conn(tds)->authentication->free(tds, tds_conn(tds)->authentication);
-		tds_conn(tds)->authentication = NULL;
-		tds_free_all_results(tds);
-		tds_free_env(tds);
-		while (tds->dyns)
-			tds_free_dynamic(tds, tds->dyns);
-		while (tds->cursors)
-			tds_cursor_deallocated(tds, tds->cursors);
-		free(tds->in_buf);
-		free(tds->out_buf);
+	TDSSOCKETCONN *conn;
+	int i;
+
+	if (!tds)
+		return;
+
+	conn = tds_conn(tds);
+	tds_free_all_results(tds);
+	tds_free_env(tds);
+	free(tds->send_buf);
+	free(tds->pipeline.sp_called);
+	for (i = 0; i < TDS_QUERY_CACHE_SIZE; ++i)
+		tds_free_query_def(&tds->query_cache[i]);
+
+	/* connection is freed with last session */
+	if (conn && (!conn->mars || tds_mars_close_session(tds) == 0)) {
+		if (conn->authentication)
+			conn->authentication->free(tds, conn->authentication);
+		conn->authentication = NULL;
+		while (conn->dyns)
+			tds_free_dynamic(tds, conn->dyns);
+		tds_name_index_free(&conn->dyn_index);
+		while (conn->cursors)
+			tds_cursor_deallocated(tds, conn->cursors);
+		free(conn->recv_buf);
 #if defined(HAVE_GNUTLS) || defined(HAVE_OPENSSL)
 		tds_ssl_deinit(tds);
 #endif
 		tds_close_socket(tds);
 		tds_iconv_free(tds);
-		free(tds_conn(tds)->product_name);
-		free(tds);
+		free(conn->product_name);
+		free(conn->sessions);
+		free(conn);
 	}
+	free(tds);
 }
 void
 tds_free_locale(TDSLOCALE * locale)
@@ -84,8 +84,17 @@
 #include <poll.h>
 #endif /* HAVE_POLL_H */
 
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif /* HAVE_SYS_UIO_H */
+
+#if HAVE_LIMITS_H
+#include <limits.h>
+#endif /* HAVE_LIMITS_H */
+
 #include "tds.h"
 #include "tdsstring.h"
+#include "tdsbytes.h"
 #include "replacements.h"
 
 #include <signal.h>
@@ -113,6 +122,9 @@ TDS_RCSID(var, "$Id: net.c,v 1.127 2011/08/18 11:42:05 freddy77 Exp $");
 #define TDSSELERR   0
 
 static int      tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds);
+static int tds_mars_read_packet(TDSSOCKET * tds);
+static int tds_mars_write(TDSSOCKET * tds, unsigned char *buf, unsigned int len, unsigned char final);
+static int tds_mars_response_ready(TDSSOCKET * tds);
 
 
 /**
@@ -176,6 +188,24 @@ typedef unsigned int ioctl_nonblocking_t;
 typedef u_long ioctl_nonblocking_t;
 #endif
 
+#ifdef _WIN32
+struct iovec
+{
+	void *iov_base;
+	size_t iov_len;
+};
+#endif
+
+/* we send at most this number of buffers with a single call */
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define TDS_MAX_IOV IOV_MAX
+#else
+#define TDS_MAX_IOV 256
+#endif
+
+/* TDS_MAX_IOV is at least 16, there are two buffers for each packet */
+#define TDS_MAX_DIRECT_PACKETS ((TDS_MAX_IOV - 2) / 2)
+
 TDSERRNO
 tds_open_socket(TDSSOCKET * tds, const char *ip_addr, unsigned int port, int timeout, int *p_oserr)
 {
@@ -483,6 +513,10 @@ tds_goodread(TDSSOCKET * tds, unsigned char *buf, int buflen, unsigned char unfi
 	return got;
 }
 
+/**
+ * Read as many bytes as are available (at least one, up to \a buflen)
+ * \return bytes read, <= 0 on failure
+ */
 static int
 goodread(TDSSOCKET * tds, unsigned char *buf, int buflen)
 {
@@ -493,153 +527,371 @@ goodread(TDSSOCKET * tds, unsigned char *buf, int buflen)
 	if (tds_conn(tds)->tls_session)
 		return SSL_read((SSL*) tds_conn(tds)->tls_session, buf, buflen);
 #endif
-	return tds_goodread(tds, buf, buflen, 0);
+	return tds_goodread(tds, buf, buflen, 1);
 }
 
+/** minimum size of receive buffer */
+#define TDS_RECV_BUF_MIN 16384u
+
 /**
- * Read in one 'packet' from the server.  This is a wrapped outer packet of
- * the protocol (they bundle result packets into chunks and wrap them at
- * what appears to be 512 bytes regardless of how that breaks internal packet
- * up.   (tetherow\@nol.org)
- * @return bytes read or -1 on failure
+ * Make sure receive buffer has room for at least \a need bytes
+ * starting from first unconsumed byte.
+ * Unconsumed data are moved to the start of the buffer only if
+ * packet would not fit otherwise, so usually only a partial packet is moved.
+ * Current packet is preserved if not completely processed.
+ * \return 0 on success, -1 on memory error
  */
-int
-tds_read_packet(TDSSOCKET * tds)
+static int
+tds_recv_buf_reserve(TDSSOCKET * tds, unsigned int need)
 {
-	unsigned char header[8];
-	int len, have;
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	unsigned int start = conn->recv_pos, have;
+	int keep_packet = 0;
+
+	/* received data can be moved or overwritten */
+	if (tds->wire_row)
+		tds_detach_row_data(tds, 1);
+
+	/* current packet can be still in use (reading ahead), it must not be overwritten */
+	if (tds->in_pos < tds->in_len && tds->in_buf >= conn->recv_buf && tds->in_buf < conn->recv_buf + conn->recv_pos) {
+		start = tds->in_buf - conn->recv_buf;
+		keep_packet = 1;
+	}
+	have = conn->recv_len - start;
 
-	if (IS_TDSDEAD(tds)) {
-		tdsdump_log(TDS_DBG_NETWORK, "Read attempt when state is TDS_DEAD");
-		return -1;
+	/* nothing pending, restart from the beginning for free */
+	if (!have)
+		conn->recv_pos = conn->recv_len = start = 0;
+
+	if (need <= conn->recv_buf_size - conn->recv_pos)
+		return 0;
+
+	need += conn->recv_pos - start;
+
+	/* moving data to start make realloc copy less data */
+	if (start) {
+		memmove(conn->recv_buf, conn->recv_buf + start, have);
+		conn->recv_pos -= start;
+		conn->recv_len = have;
+		if (keep_packet)
+			tds->in_buf = conn->recv_buf;
 	}
 
-	/*
-	 * Read in the packet header.  We use this to figure out our packet length. 
-	 * Cast to int are needed because some compiler seem to convert
-	 * len to unsigned (as FreeBSD 4.5 one)
-	 */
-	if ((len = goodread(tds, header, sizeof(header))) < (int) sizeof(header)) {
-		/* GW ADDED */
-		if (len < 0) {
-			/* not needed because goodread() already called:  tdserror(tds_get_ctx(tds), tds, TDSEREAD, 0); */
-			tds_close_socket(tds);
-			tds->in_len = 0;
-			tds->in_pos = 0;
-			return -1;
-		}
-		
-		/* GW ADDED */
-		/*
-		 * Not sure if this is the best way to do the error
-		 * handling here but this is the way it is currently
-		 * being done.
-		 */
+	if (need > conn->recv_buf_size) {
+		unsigned char *p;
+		unsigned int size = need * 2u;
 
-		tds->in_len = 0;
-		tds->in_pos = 0;
-		if (tds->state != TDS_IDLE && len == 0) {
-			tds_close_socket(tds);
-		}
-		return -1;
+		if (size < TDS_RECV_BUF_MIN)
+			size = TDS_RECV_BUF_MIN;
+		p = (unsigned char *) realloc(conn->recv_buf, size);
+		if (!p)
+			return -1;
+		conn->recv_buf = p;
+		conn->recv_buf_size = size;
+		if (keep_packet)
+			tds->in_buf = p;
 	}
+	return 0;
+}
 
-	tdsdump_dump_buf(TDS_DBG_HEADER, "Received header", header, sizeof(header));	
+/** SMP (MARS) frame header */
+#define TDS_SMP_SMID 0x53
+#define TDS_SMP_SYN  0x01
+#define TDS_SMP_ACK  0x02
+#define TDS_SMP_FIN  0x04
+#define TDS_SMP_DATA 0x08
+#define TDS_SMP_HEADER_LEN 16u
+/** initial receive window and window increment, in packets */
+#define TDS_SMP_WINDOW 16u
+
+/** length of frame (TDS packet or SMP frame) starting at \a p */
+static unsigned int
+tds_frame_len(const unsigned char *p, int mars)
+{
+	unsigned int len;
 
+	if (mars) {
+		len = TDS_GET_UA4LE(p + 4);
+		return len < TDS_SMP_HEADER_LEN ? TDS_SMP_HEADER_LEN : len;
+	}
 	/* Convert our packet length from network to host byte order */
-	len = (((unsigned int) header[2]) << 8) | header[3];
+	len = (((unsigned int) p[2]) << 8) | p[3];
+	return len < 8 ? 8 : len;
+}
 
-	/*
-	 * If this packet size is the largest we have gotten allocate space for it
-	 */
-	if ((unsigned int)len > tds->in_buf_max) {
-		unsigned char *p;
+/**
+ * Make sure a full frame is in the receive buffer, reading from
+ * the socket as much as available.
+ * \param tds the famous socket
+ * \param mars 1 to read a SMP frame, 0 to read a TDS packet
+ * \return frame length, frame starts at conn->recv_pos, -1 on failure
+ */
+static int
+tds_recv_frame(TDSSOCKET * tds, int mars)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	const unsigned int header_len = mars ? TDS_SMP_HEADER_LEN : 8u;
+	unsigned int have, len;
 
-		if (!tds->in_buf) {
-			p = (unsigned char *) malloc(len);
-		} else {
-			p = (unsigned char *) realloc(tds->in_buf, len);
+	for (;;) {
+		int nbytes;
+
+		/* we need at least the header to figure out our packet length */
+		len = header_len;
+		have = conn->recv_len - conn->recv_pos;
+		if (have >= header_len) {
+			len = tds_frame_len(conn->recv_buf + conn->recv_pos, mars);
+			/* SMP frames contain a single packet, do not allocate memory for garbage */
+			if (len > 65535u + TDS_SMP_HEADER_LEN) {
+				tdsdump_log(TDS_DBG_NETWORK, "Wrong frame length %u\n", len);
+				tds_close_socket(tds);
+				return -1;
+			}
+			if (have >= len)
+				return len;
 		}
-		if (!p) {
+
+		if (tds_recv_buf_reserve(tds, len) < 0) {
 			tds_close_socket(tds);
 			return -1;
 		}
-		tds->in_buf = p;
-		/* Set the new maximum packet size */
-		tds->in_buf_max = len;
-	}
-
-	/* Clean out the in_buf so we don't use old stuff by mistake */
-	memset(tds->in_buf, 0, tds->in_buf_max);
-	memcpy(tds->in_buf, header, 8);
 
-	/* Now get exactly how many bytes the server told us to get */
-	have = 8;
-	while (have < len) {
-		int nbytes = goodread(tds, tds->in_buf + have, len - have);
+		nbytes = goodread(tds, conn->recv_buf + conn->recv_len, conn->recv_buf_size - conn->recv_len);
 		if (nbytes < 1) {
 			/*
 			 * Not sure if this is the best way to do the error
 			 * handling here but this is the way it is currently
 			 * being done.
+			 * no need to call tdserror(), because goodread() already did
 			 */
-			/* no need to call tdserror(), because goodread() already did */
-			tds->in_len = 0;
-			tds->in_pos = 0;
-			tds_close_socket(tds);
+			if (nbytes < 0 || have || tds->state != TDS_IDLE)
+				tds_close_socket(tds);
 			return -1;
 		}
-		have += nbytes;
+		conn->recv_len += nbytes;
+	}
+}
+
+/**
+ * Read in one 'packet' from the server.  This is a wrapped outer packet of
+ * the protocol (they bundle result packets into chunks and wrap them at
+ * what appears to be 512 bytes regardless of how that breaks internal packet
+ * up.   (tetherow\@nol.org)
+ * Data are read from the socket in the connection receive buffer as much as
+ * available so usually a single system call returns many packets.
+ * Packets are not copied, on return in_buf points inside the receive buffer
+ * (unless MARS is used).
+ * @return bytes read or -1 on failure
+ */
+int
+tds_read_packet(TDSSOCKET * tds)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	unsigned char *pkt;
+	int len;
+
+	if (IS_TDSDEAD(tds)) {
+		tdsdump_log(TDS_DBG_NETWORK, "Read attempt when state is TDS_DEAD");
+		return -1;
 	}
 
+	/* current packet will be replaced */
+	if (tds->wire_row)
+		tds_detach_row_data(tds, 1);
+
+	if (conn->mars)
+		return tds_mars_read_packet(tds);
+
+	len = tds_recv_frame(tds, 0);
+	if (len < 0) {
+		tds->in_len = 0;
+		tds->in_pos = 0;
+		return -1;
+	}
+	pkt = conn->recv_buf + conn->recv_pos;
+
+	tdsdump_dump_buf(TDS_DBG_HEADER, "Received header", pkt, 8);
+
+	conn->recv_pos += len;
+	tds->in_buf = pkt;
+	tds->in_buf_max = len;
+
 	/* set the received packet type flag */
-	tds->in_flag = header[0];
+	tds->in_flag = pkt[0];
 
 	/* Set the length and pos (not sure what pos is used for now */
-	tds->in_len = have;
+	tds->in_len = len;
 	tds->in_pos = 8;
 	tdsdump_dump_buf(TDS_DBG_NETWORK, "Received packet", tds->in_buf, tds->in_len);
 
 	return (tds->in_len);
 }
 
+/** stop reading ahead from a socket when this amount of data is buffered */
+#define TDS_RECV_AHEAD_MAX (256u * 1024u)
+
+/**
+ * Read data already available from the socket into the receive buffer
+ * without waiting. Used when polling many connections: packets
+ * are then returned by tds_read_packet without system calls.
+ * Errors are not reported and the socket is not closed, next
+ * tds_read_packet will detect and handle the error.
+ * \return 1 if some data were read, 0 if no data available, -1 on error or connection closed
+ */
+int
+tds_read_available(TDSSOCKET * tds)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	int got = 0;
+
+	if (IS_TDSDEAD(tds))
+		return -1;
+
+#if defined(HAVE_GNUTLS) || defined(HAVE_OPENSSL)
+	/* encrypted data can't be read without blocking, leave them to tds_read_packet */
+	if (conn->tls_session)
+		return 0;
+#endif
+
+	while (conn->recv_len - conn->recv_pos < TDS_RECV_AHEAD_MAX) {
+		int len;
+		unsigned int room;
+
+		if (tds_recv_buf_reserve(tds, conn->recv_len - conn->recv_pos + tds->env.block_size) < 0)
+			return -1;
+
+		room = conn->recv_buf_size - conn->recv_len;
+		len = READSOCKET(tds_get_s(tds), conn->recv_buf + conn->recv_len, room);
+		if (len < 0 && TDSSOCK_WOULDBLOCK(sock_errno))
+			break;
+		if (len <= 0) {
+			tdsdump_log(TDS_DBG_NETWORK, "tds_read_available: %s\n", len == 0 ? "connection closed" : "read error");
+			return -1;
+		}
+		conn->recv_len += len;
+		got = 1;
+		/* socket drained, avoid a useless system call */
+		if ((unsigned int) len < room)
+			break;
+	}
+	return got;
+}
+
+/**
+ * Check if a complete response is in the receive buffer, that is
+ * if a packet marked as last was received and not processed yet.
+ * Very big responses are considered ready if many data are
+ * already buffered.
+ * \return 1 if ready, 0 otherwise
+ */
+int
+tds_response_ready(TDSSOCKET * tds)
+{
+	const TDSSOCKETCONN *conn = tds_conn(tds);
+	unsigned int pos = conn->recv_pos;
+
+	/* last packet already read but not processed */
+	if (tds->in_pos < tds->in_len && (tds->in_buf[1] & 1))
+		return 1;
+
+	if (conn->recv_len - pos >= TDS_RECV_AHEAD_MAX)
+		return 1;
+
+	if (conn->mars)
+		return tds_mars_response_ready(tds);
+
+	while (conn->recv_len - pos >= 8) {
+		const unsigned char *pkt = conn->recv_buf + pos;
+		unsigned int len = tds_frame_len(pkt, 0);
+
+		if (conn->recv_len - pos < len)
+			break;
+		/* last packet of the response */
+		if (pkt[1] & 1)
+			return 1;
+		pos += len;
+	}
+	return 0;
+}
+
 /**
  * \param tds the famous socket
- * \param buffer data to send
- * \param len bytes in buffer
+ * \param iov buffers to send, updated during sending
+ * \param iovcnt number of buffers
  * \param last 1 if this is the last packet, else 0
- * \return len on success, <0 on failure
+ * \return bytes sent on success, <0 on failure
  */
 static int
-tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t len, unsigned char last)
+tds_goodwritev(TDSSOCKET * tds, struct iovec *iov, int iovcnt, unsigned char last)
 {
-	const unsigned char *p = buffer;
 	int rc;
+	size_t len = 0;
 	TDS_SYS_SOCKET sock;
 
-	assert(tds && buffer);
+	assert(tds && iov);
 	sock = tds_get_s(tds);
 
 	/* Fix of SIGSEGV when FD_SET() called with negative fd (Sergey A. Cherukhin, 23/09/2005) */
 	if (TDS_IS_SOCKET_INVALID(sock))
 		return -1;
 
-	while (p - buffer < len) {
+	for (;;) {
+		ssize_t nput;
+		int err;
+
+		/* skip buffers already sent */
+		while (iovcnt && iov->iov_len == 0) {
+			++iov;
+			--iovcnt;
+		}
+		if (!iovcnt)
+			break;
+
 		if ((rc = tds_select(tds, TDSSELWRITE, tds->query_timeout)) > 0) {
-			int err;
-			size_t remaining = len - (p - buffer);
+#if HAVE_SENDMSG
+			struct msghdr msg;
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovcnt;
 #ifdef USE_MSGMORE
-			ssize_t nput = send(sock, p, remaining, last ? MSG_NOSIGNAL : MSG_NOSIGNAL|MSG_MORE);
+			nput = sendmsg(sock, &msg, last ? MSG_NOSIGNAL : MSG_NOSIGNAL|MSG_MORE);
 			/* In case the kernel does not support MSG_MORE, try again without it */
 			if (nput < 0 && errno == EINVAL && !last)
+				nput = sendmsg(sock, &msg, MSG_NOSIGNAL);
+#else
+			nput = sendmsg(sock, &msg, TDS_NOSIGNAL);
+#endif
+#else /* !HAVE_SENDMSG */
+			const unsigned char *p = (const unsigned char *) iov->iov_base;
+			size_t remaining = iov->iov_len;
+#ifdef USE_MSGMORE
+			int more = (!last || iovcnt > 1) ? MSG_MORE : 0;
+
+			nput = send(sock, p, remaining, MSG_NOSIGNAL|more);
+			/* In case the kernel does not support MSG_MORE, try again without it */
+			if (nput < 0 && errno == EINVAL && more)
 				nput = send(sock, p, remaining, MSG_NOSIGNAL);
 #elif defined(__APPLE__) && defined(SO_NOSIGPIPE)
-			ssize_t nput = send(sock, p, remaining, 0);
+			nput = send(sock, p, remaining, 0);
 #else
-			ssize_t nput = WRITESOCKET(sock, p, remaining);
+			nput = WRITESOCKET(sock, p, remaining);
 #endif
+#endif /* !HAVE_SENDMSG */
 			if (nput > 0) {
-				p += nput;
+				len += nput;
+				/* advance buffers */
+				while (nput > 0) {
+					if ((size_t) nput < iov->iov_len) {
+						iov->iov_base = (char *) iov->iov_base + nput;
+						iov->iov_len -= nput;
+						break;
+					}
+					nput -= iov->iov_len;
+					iov->iov_len = 0;
+					++iov;
+					--iovcnt;
+				}
 				continue;
 			}
 
@@ -658,7 +910,7 @@ tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t len, unsigned
 
 		/* error */
 		if (rc < 0) {
-			int err = sock_errno;
+			err = sock_errno;
 			if (TDSSOCK_WOULDBLOCK(err)) /* shouldn't happen, but OK, retry */
 				continue;
 			tdsdump_log(TDS_DBG_NETWORK, "select(2) failed: %d (%s)\n", err, sock_strerror(err));
@@ -690,68 +942,536 @@ tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t len, unsigned
 	}
 #endif
 
-	return len;
+	return (int) len;
 }
 
-TDSRET
-tds_write_packet(TDSSOCKET * tds, unsigned char final)
+#if defined(HAVE_GNUTLS) || defined(HAVE_OPENSSL)
+/**
+ * \param tds the famous socket
+ * \param buffer data to send
+ * \param len bytes in buffer
+ * \param last 1 if this is the last packet, else 0
+ * \return len on success, <0 on failure
+ */
+static int
+tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t len, unsigned char last)
 {
-	int sent;
-	unsigned int left = 0;
+	struct iovec iov;
 
-#if !defined(_WIN32) && !defined(MSG_NOSIGNAL) && !defined(DOS32X) && (!defined(__APPLE__) || !defined(SO_NOSIGPIPE))
-	void (*oldsig) (int);
-#endif
+	assert(tds && buffer);
 
-#if TDS_ADDITIONAL_SPACE != 0
-	if (tds->out_pos > tds->env.block_size) {
-		left = tds->out_pos - tds->env.block_size;
-		tds->out_pos = tds->env.block_size;
-	}
+	iov.iov_base = (void *) buffer;
+	iov.iov_len = len;
+	return tds_goodwritev(tds, &iov, 1, last);
+}
 #endif
 
-	tds->out_buf[0] = tds->out_flag;
-	tds->out_buf[1] = final;
-	tds->out_buf[2] = (tds->out_pos) / 256u;
-	tds->out_buf[3] = (tds->out_pos) % 256u;
-	if (IS_TDS7_PLUS(tds) && !tds->login)
-		tds->out_buf[6] = 0x01;
-
-	tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet", tds->out_buf, tds->out_pos);
+/**
+ * Send some buffers to server, handling encryption and SIGPIPE
+ * \return bytes sent on success, <=0 on failure
+ */
+static int
+tds_writev(TDSSOCKET * tds, struct iovec *iov, int iovcnt, unsigned char final)
+{
+	int sent;
 
 #if !defined(_WIN32) && !defined(MSG_NOSIGNAL) && !defined(DOS32X) && (!defined(__APPLE__) || !defined(SO_NOSIGPIPE))
+	void (*oldsig) (int);
+
 	oldsig = signal(SIGPIPE, SIG_IGN);
 	if (oldsig == SIG_ERR) {
 		tdsdump_log(TDS_DBG_WARN, "TDS: Warning: Couldn't set SIGPIPE signal to be ignored\n");
 	}
 #endif
 
+#if defined(HAVE_GNUTLS) || defined(HAVE_OPENSSL)
+	if (tds_conn(tds)->tls_session) {
+		int i;
+
+		/* encryption require a copy, just send one buffer at a time */
+		for (sent = 0, i = 0; i < iovcnt; ++i) {
+			int res;
 #ifdef HAVE_GNUTLS
-	if (tds_conn(tds)->tls_session)
-		sent = gnutls_record_send(tds_conn(tds)->tls_session, tds->out_buf, tds->out_pos);
-	else
-#elif defined(HAVE_OPENSSL)
-	if (tds_conn(tds)->tls_session)
-		sent = SSL_write((SSL*) tds_conn(tds)->tls_session, tds->out_buf, tds->out_pos);
-	else
+			res = gnutls_record_send(tds_conn(tds)->tls_session, iov[i].iov_base, iov[i].iov_len);
+#else
+			res = SSL_write((SSL*) tds_conn(tds)->tls_session, iov[i].iov_base, iov[i].iov_len);
 #endif
-		sent = tds_goodwrite(tds, tds->out_buf, tds->out_pos, final);
+			if (res <= 0) {
+				sent = res;
+				break;
+			}
+			sent += res;
+		}
+	} else
+#endif
+		sent = tds_goodwritev(tds, iov, iovcnt, final);
 
 #if !defined(_WIN32) && !defined(MSG_NOSIGNAL) && !defined(DOS32X) && (!defined(__APPLE__) || !defined(SO_NOSIGPIPE))
 	if (signal(SIGPIPE, oldsig) == SIG_ERR) {
 		tdsdump_log(TDS_DBG_WARN, "TDS: Warning: Couldn't reset SIGPIPE signal to previous value\n");
 	}
 #endif
+	return sent;
+}
+
+/** fill header of packet pointed by out_buf */
+static void
+tds_set_packet_header(TDSSOCKET * tds, unsigned char *pkt, unsigned int len, unsigned char final)
+{
+	pkt[0] = tds->out_flag;
+	pkt[1] = final;
+	pkt[2] = len / 256u;
+	pkt[3] = len % 256u;
+	pkt[4] = 0;
+	pkt[5] = 0;
+	pkt[6] = (IS_TDS7_PLUS(tds) && !tds->login) ? 0x01 : 0;
+	pkt[7] = 0;
+}
+
+/**
+ * Send current packet to server.
+ * Non final packets are queued in send_buf and sent all together when the
+ * queue is full or when the final packet is written.
+ */
+TDSRET
+tds_write_packet(TDSSOCKET * tds, unsigned char final)
+{
+	int sent;
+	unsigned int left = 0;
+	struct iovec iov;
+
+#if TDS_ADDITIONAL_SPACE != 0
+	if (tds->out_pos > tds->env.block_size) {
+		left = tds->out_pos - tds->env.block_size;
+		tds->out_pos = tds->env.block_size;
+	}
+#endif
+
+	tds_set_packet_header(tds, tds->out_buf, tds->out_pos, final);
+
+	tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet", tds->out_buf, tds->out_pos);
+
+#if TDS_ADDITIONAL_SPACE == 0
+	/* queue full packets if there is space for another one */
+	if (!final && tds->out_buf + 2u * tds->env.block_size <= tds->send_buf + tds->send_buf_size) {
+		tds->out_buf += tds->env.block_size;
+		tds->out_pos = 8;
+		return TDS_SUCCESS;
+	}
+#endif
+
+	if (tds_conn(tds)->mars) {
+		sent = tds_mars_write(tds, tds->send_buf, (tds->out_buf - tds->send_buf) + tds->out_pos, final);
+	} else {
+		iov.iov_base = tds->send_buf;
+		iov.iov_len = (tds->out_buf - tds->send_buf) + tds->out_pos;
+		sent = tds_writev(tds, &iov, 1, final);
+	}
 
 #if TDS_ADDITIONAL_SPACE != 0
 	memcpy(tds->out_buf + 8, tds->out_buf + tds->env.block_size, left);
 #endif
+	tds->out_buf = tds->send_buf;
 	tds->out_pos = left + 8;
 
 	/* GW added in check for write() returning <0 and SIGPIPE checking */
 	return sent <= 0 ? TDS_FAIL : TDS_SUCCESS;
 }
 
+/**
+ * Write data directly from caller buffer.
+ * Queued packets, current packet completed with initial data and following
+ * full packets are sent with a single system call, data is not copied
+ * into out_buf. Last part of the data (at least one byte) is not consumed,
+ * so current packet is never left empty.
+ * \param tds the famous socket
+ * \param buf data to send
+ * \param len bytes in buf
+ * \return bytes consumed from buf, <0 on failure
+ */
+int
+tds_write_direct(TDSSOCKET * tds, const unsigned char *buf, size_t len)
+{
+	struct iovec iov[2 + TDS_MAX_DIRECT_PACKETS * 2];
+	unsigned char headers[TDS_MAX_DIRECT_PACKETS][8];
+	const unsigned int block_size = tds->env.block_size;
+	const unsigned int payload = block_size - 8;
+	size_t done = 0;
+
+	assert(tds->out_pos <= block_size);
+
+	/* MARS packets need a SMP header, let caller copy data */
+	if (tds_conn(tds)->mars)
+		return 0;
+
+	/* to avoid copy we need at least a full packet after current one */
+	while (!TDS_ADDITIONAL_SPACE && len - done > (block_size - tds->out_pos) + payload) {
+		int iovcnt = 0, n;
+		size_t fill = block_size - tds->out_pos;
+		size_t sent_len;
+
+		/* queued packets and current one */
+		tds_set_packet_header(tds, tds->out_buf, block_size, 0);
+		tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet", tds->out_buf, tds->out_pos);
+		iov[iovcnt].iov_base = tds->send_buf;
+		iov[iovcnt++].iov_len = (tds->out_buf - tds->send_buf) + tds->out_pos;
+		iov[iovcnt].iov_base = (void *) (buf + done);
+		iov[iovcnt++].iov_len = fill;
+		tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet data", buf + done, fill);
+		sent_len = (tds->out_buf - tds->send_buf) + block_size;
+		done += fill;
+
+		/* following full packets, leave some data for current packet */
+		for (n = 0; n < TDS_MAX_DIRECT_PACKETS && len - done > payload; ++n) {
+			tds_set_packet_header(tds, headers[n], block_size, 0);
+			iov[iovcnt].iov_base = headers[n];
+			iov[iovcnt++].iov_len = 8;
+			iov[iovcnt].iov_base = (void *) (buf + done);
+			iov[iovcnt++].iov_len = payload;
+			tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet", headers[n], 8);
+			tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending packet data", buf + done, payload);
+			sent_len += block_size;
+			done += payload;
+		}
+
+		tds->out_buf = tds->send_buf;
+		tds->out_pos = 8;
+		if (tds_writev(tds, iov, iovcnt, 0) != (int) sent_len)
+			return -1;
+	}
+	return (int) done;
+}
+
+/*
+ * MARS support.
+ * With MARS every TDS packet is wrapped in a SMP DATA frame carrying the
+ * session id. Sessions are opened with SYN and closed with FIN frames;
+ * in each direction a window limits the packets in flight and is
+ * enlarged with ACK frames.
+ * Received packets are copied in per session queues so sessions can read
+ * their results in any order.
+ */
+
+/** initial window of the server, in packets */
+#define TDS_SMP_SERVER_WINDOW 4u
+
+/** find session with id \a sid, NULL if not found */
+static TDSSOCKET *
+tds_mars_find_session(const TDSSOCKETCONN * conn, unsigned int sid)
+{
+	unsigned int i;
+
+	for (i = 0; i < conn->num_sessions; ++i)
+		if (conn->sessions[i] && conn->sessions[i]->sid == sid)
+			return conn->sessions[i];
+	return NULL;
+}
+
+/** fill SMP header for session \a tds */
+static void
+tds_mars_header(TDSSOCKET * tds, unsigned char *hdr, unsigned char flags, unsigned int len)
+{
+	hdr[0] = TDS_SMP_SMID;
+	hdr[1] = flags;
+	TDS_PUT_UA2LE(hdr + 2, tds->sid);
+	TDS_PUT_UA4LE(hdr + 4, len);
+	TDS_PUT_UA4LE(hdr + 8, tds->send_seq);
+	TDS_PUT_UA4LE(hdr + 12, tds->recv_wnd);
+}
+
+/** send a control frame (SYN, ACK or FIN) for session \a tds */
+static TDSRET
+tds_mars_send_control(TDSSOCKET * tds, unsigned char flags)
+{
+	unsigned char hdr[TDS_SMP_HEADER_LEN];
+	struct iovec iov;
+
+	tds_mars_header(tds, hdr, flags, TDS_SMP_HEADER_LEN);
+	tdsdump_dump_buf(TDS_DBG_NETWORK, "Sending SMP frame", hdr, TDS_SMP_HEADER_LEN);
+
+	iov.iov_base = (void *) hdr;
+	iov.iov_len = TDS_SMP_HEADER_LEN;
+	return tds_writev(tds, &iov, 1, 1) == (int) TDS_SMP_HEADER_LEN ? TDS_SUCCESS : TDS_FAIL;
+}
+
+/**
+ * Read a SMP frame from the connection and dispatch it to its session.
+ * \return 0 on success, -1 on failure (connection closed)
+ */
+static int
+tds_mars_process_frame(TDSSOCKET * tds)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	const unsigned char *frame;
+	TDSSOCKET *session;
+	TDSPACKET *packet, **tail;
+	unsigned int len;
+	int rc;
+
+	if ((rc = tds_recv_frame(tds, 1)) < 0)
+		return -1;
+	len = rc;
+	frame = conn->recv_buf + conn->recv_pos;
+	conn->recv_pos += len;
+
+	tdsdump_dump_buf(TDS_DBG_HEADER, "Received SMP header", frame, TDS_SMP_HEADER_LEN);
+
+	if (frame[0] != TDS_SMP_SMID) {
+		tdsdump_log(TDS_DBG_ERROR, "Wrong SMP frame received\n");
+		tds_close_socket(tds);
+		return -1;
+	}
+
+	/* data for closed sessions can still arrive, just discard them */
+	session = tds_mars_find_session(conn, TDS_GET_UA2LE(frame + 2));
+	if (!session) {
+		tdsdump_log(TDS_DBG_NETWORK, "SMP frame for unknown session %u\n", (unsigned int) TDS_GET_UA2LE(frame + 2));
+		return 0;
+	}
+
+	switch (frame[1]) {
+	case TDS_SMP_ACK:
+		session->send_wnd = TDS_GET_UA4LE(frame + 12);
+		break;
+	case TDS_SMP_FIN:
+		tdsdump_log(TDS_DBG_NETWORK, "Session %u closed by server\n", (unsigned int) session->sid);
+		tds_set_state(session, TDS_DEAD);
+		break;
+	case TDS_SMP_DATA:
+		session->send_wnd = TDS_GET_UA4LE(frame + 12);
+		len -= TDS_SMP_HEADER_LEN;
+		if (len < 8) {
+			tdsdump_log(TDS_DBG_ERROR, "Wrong SMP data frame received\n");
+			tds_close_socket(tds);
+			return -1;
+		}
+		packet = (TDSPACKET *) malloc(TDS_OFFSET(TDSPACKET, buf) + len);
+		if (!packet) {
+			tds_close_socket(tds);
+			return -1;
+		}
+		packet->next = NULL;
+		packet->len = len;
+		memcpy(packet->buf, frame + TDS_SMP_HEADER_LEN, len);
+		for (tail = &session->packet_queue; *tail; tail = &(*tail)->next)
+			continue;
+		*tail = packet;
+		break;
+	default:
+		tdsdump_log(TDS_DBG_NETWORK, "Unexpected SMP frame type %u\n", frame[1]);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * Read next packet of a MARS session.
+ * Packets of other sessions read meanwhile are queued.
+ * \return bytes read or -1 on failure
+ */
+static int
+tds_mars_read_packet(TDSSOCKET * tds)
+{
+	TDSPACKET *packet;
+
+	/* previous packet is not needed anymore */
+	free(tds->recv_packet);
+	tds->recv_packet = NULL;
+
+	while (!tds->packet_queue) {
+		if (tds->state == TDS_DEAD || tds_mars_process_frame(tds) < 0) {
+			tds->in_len = 0;
+			tds->in_pos = 0;
+			return -1;
+		}
+	}
+
+	packet = tds->packet_queue;
+	tds->packet_queue = packet->next;
+	tds->recv_packet = packet;
+
+	/* packet consumed, allow server to send more */
+	if (++tds->recv_seq + TDS_SMP_WINDOW / 2u >= tds->recv_wnd) {
+		tds->recv_wnd = tds->recv_seq + TDS_SMP_WINDOW;
+		if (tds_mars_send_control(tds, TDS_SMP_ACK) != TDS_SUCCESS) {
+			tds->in_len = 0;
+			tds->in_pos = 0;
+			return -1;
+		}
+	}
+
+	tds->in_buf = packet->buf;
+	tds->in_buf_max = packet->len;
+	tds->in_flag = packet->buf[0];
+	tds->in_len = packet->len;
+	tds->in_pos = 8;
+	tdsdump_dump_buf(TDS_DBG_NETWORK, "Received packet", tds->in_buf, tds->in_len);
+
+	return tds->in_len;
+}
+
+/**
+ * Send packets wrapping them in SMP DATA frames.
+ * If server window is full we wait for an ACK, packets of other
+ * sessions received meanwhile are queued.
+ * \param tds the famous socket
+ * \param buf packets to send, with TDS headers already filled
+ * \param len bytes in buf
+ * \param final 1 if last packet is the last of the request
+ * \return bytes sent on success (SMP headers excluded), <=0 on failure
+ */
+static int
+tds_mars_write(TDSSOCKET * tds, unsigned char *buf, unsigned int len, unsigned char final)
+{
+	struct iovec iov[TDS_MAX_IOV];
+	unsigned char headers[TDS_MAX_IOV / 2][TDS_SMP_HEADER_LEN];
+	unsigned int done = 0;
+
+	while (done < len) {
+		int iovcnt = 0;
+		unsigned int chunk = 0;
+
+		/* sequence numbers can wrap */
+		while ((TDS_INT) (tds->send_wnd - tds->send_seq) <= 0)
+			if (tds_mars_process_frame(tds) < 0)
+				return -1;
+
+		while (done < len && iovcnt + 2 <= TDS_MAX_IOV && (TDS_INT) (tds->send_wnd - tds->send_seq) > 0) {
+			unsigned char *pkt = buf + done;
+			unsigned int pkt_len = tds_frame_len(pkt, 0);
+
+			if (pkt_len > len - done)
+				pkt_len = len - done;
+			++tds->send_seq;
+			tds_mars_header(tds, headers[iovcnt / 2], TDS_SMP_DATA, pkt_len + TDS_SMP_HEADER_LEN);
+			tdsdump_dump_buf(TDS_DBG_HEADER, "Sending SMP header", headers[iovcnt / 2], TDS_SMP_HEADER_LEN);
+			iov[iovcnt].iov_base = (void *) headers[iovcnt / 2];
+			iov[iovcnt++].iov_len = TDS_SMP_HEADER_LEN;
+			iov[iovcnt].iov_base = (void *) pkt;
+			iov[iovcnt++].iov_len = pkt_len;
+			chunk += pkt_len + TDS_SMP_HEADER_LEN;
+			done += pkt_len;
+		}
+
+		if (tds_writev(tds, iov, iovcnt, final && done >= len) != (int) chunk)
+			return -1;
+	}
+	return (int) done;
+}
+
+/** check if a full response for a MARS session was received */
+static int
+tds_mars_response_ready(TDSSOCKET * tds)
+{
+	const TDSSOCKETCONN *conn = tds_conn(tds);
+	const TDSPACKET *packet;
+	unsigned int pos = conn->recv_pos;
+
+	/* reading would fail immediately */
+	if (tds->state == TDS_DEAD)
+		return 1;
+
+	for (packet = tds->packet_queue; packet; packet = packet->next)
+		if (packet->buf[1] & 1)
+			return 1;
+
+	/* frames not dispatched yet */
+	while (conn->recv_len - pos >= TDS_SMP_HEADER_LEN) {
+		const unsigned char *frame = conn->recv_buf + pos;
+		unsigned int len = tds_frame_len(frame, 1);
+
+		if (conn->recv_len - pos < len)
+			break;
+		if (frame[1] == TDS_SMP_DATA && TDS_GET_UA2LE(frame + 2) == tds->sid
+		    && len >= TDS_SMP_HEADER_LEN + 8 && (frame[TDS_SMP_HEADER_LEN + 1] & 1))
+			return 1;
+		pos += len;
+	}
+	return 0;
+}
+
+/**
+ * Open a MARS session sending a SYN frame.
+ * The first session opened on a connection enables MARS, after that
+ * all packets are wrapped in SMP frames.
+ */
+TDSRET
+tds_mars_open_session(TDSSOCKET * tds)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	unsigned int i;
+
+	/* find a free slot */
+	for (i = 0; i < conn->num_sessions && conn->sessions[i]; ++i)
+		continue;
+	if (i >= conn->num_sessions) {
+		unsigned int num = conn->num_sessions ? conn->num_sessions * 2u : 4u;
+		TDSSOCKET **sessions = (TDSSOCKET **) realloc(conn->sessions, num * sizeof(TDSSOCKET *));
+
+		if (!sessions)
+			return TDS_FAIL;
+		memset(sessions + conn->num_sessions, 0, (num - conn->num_sessions) * sizeof(TDSSOCKET *));
+		conn->sessions = sessions;
+		conn->num_sessions = num;
+	}
+
+	/*
+	 * Do not reuse ids of sessions just closed, server could
+	 * still send frames for them.
+	 */
+	while (tds_mars_find_session(conn, conn->next_sid))
+		++conn->next_sid;
+	tds->sid = conn->next_sid++;
+
+	tds->send_seq = 0;
+	tds->send_wnd = TDS_SMP_SERVER_WINDOW;
+	tds->recv_seq = 0;
+	tds->recv_wnd = TDS_SMP_WINDOW;
+	conn->sessions[i] = tds;
+	conn->mars = 1;
+
+	tdsdump_log(TDS_DBG_NETWORK, "Opening MARS session %u\n", (unsigned int) tds->sid);
+	if (tds_mars_send_control(tds, TDS_SMP_SYN) != TDS_SUCCESS) {
+		conn->sessions[i] = NULL;
+		return TDS_FAIL;
+	}
+	return TDS_SUCCESS;
+}
+
+/**
+ * Close a MARS session sending a FIN frame.
+ * Packets received and not read are discarded.
+ * \return number of sessions still open on the connection
+ */
+unsigned int
+tds_mars_close_session(TDSSOCKET * tds)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	TDSPACKET *packet;
+	unsigned int i, num_open = 0;
+
+	free(tds->recv_packet);
+	tds->recv_packet = NULL;
+	tds->in_len = tds->in_pos = 0;
+	while ((packet = tds->packet_queue) != NULL) {
+		tds->packet_queue = packet->next;
+		free(packet);
+	}
+
+	for (i = 0; i < conn->num_sessions; ++i) {
+		if (conn->sessions[i] != tds) {
+			if (conn->sessions[i])
+				++num_open;
+			continue;
+		}
+		tdsdump_log(TDS_DBG_NETWORK, "Closing MARS session %u\n", (unsigned int) tds->sid);
+		if (!IS_TDSDEAD(tds) && tds->state != TDS_DEAD)
+			tds_mars_send_control(tds, TDS_SMP_FIN);
+		conn->sessions[i] = NULL;
+	}
+	return num_open;
+}
+
 /**
  * Get port of all instances
  * @return default port number or 0 if error
@@ -1178,7 +1898,7 @@ tds_ssl_read(BIO *b, char* data, int len)
 	tdsdump_log(TDS_DBG_INFO1, "in tds_pull_func\n");
 	
 	/* if we have some data send it */
-	if (tds->out_pos > 8)
+	if (tds->out_pos > 8 || tds->out_buf != tds->send_buf)
 		tds_flush_packet(tds);
 
 	if (tds_conn(tds)->tls_session) {
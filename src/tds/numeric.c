@@ -86,6 +86,48 @@ COMPILE_CHECK(maxprecision,
 
 #endif
 
+/* all numbers from 00 to 99 */
+static const char digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * Write a number in decimal without using printf.
+ * @param s output buffer, up to 20 digits are written
+ * @param n number to write
+ * @return pointer after last digit written, string is not terminated
+ */
+char *
+tds_format_uint8(char *s, TDS_UINT8 n)
+{
+	char buf[20], *p = buf + sizeof(buf);
+	unsigned int n32, i;
+
+	/* use 32 bit arithmetic as soon as possible */
+	while (n > 0xffffffffu) {
+		i = (unsigned int) (n % 100u) * 2u;
+		n /= 100u;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+	for (n32 = (unsigned int) n; n32 >= 100; n32 /= 100) {
+		i = (n32 % 100) * 2;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+	if (n32 >= 10) {
+		*--p = digit_pairs[n32 * 2 + 1];
+		*--p = digit_pairs[n32 * 2];
+	} else {
+		*--p = '0' + n32;
+	}
+
+	i = (unsigned int) (buf + sizeof(buf) - p);
+	memcpy(s, p, i);
+	return s + i;
+}
+
 /*
  * money is a special case of numeric really...that why its here
  */
@@ -112,9 +154,11 @@ tds_money_to_string(const TDS_MONEY * money, char *s)
 	}
 	n = (n + 50) / 100;
 	frac = (int) (n % 100);
-	n /= 100;
-	/* if machine is 64 bit you do not need to split n */
-	sprintf(p, "%" PRId64 ".%02d", n, frac);
+	p = tds_format_uint8(p, n / 100);
+	*p++ = '.';
+	*p++ = '0' + frac / 10;
+	*p++ = '0' + frac % 10;
+	*p = 0;
 	return s;
 #else
 	unsigned char multiplier[MAXPRECISION], temp[MAXPRECISION];
@@ -180,6 +224,438 @@ tds_money_to_string(const TDS_MONEY * money, char *s)
 #endif
 }
 
+#ifdef HAVE_INT64
+/*
+ * Shortest representation of floating point numbers.
+ * This is the Ryu algorithm (Ulf Adams, "Ryu: fast float-to-string
+ * conversion", PLDI 2018): the interval of decimal numbers that read back
+ * as the same binary value is computed multiplying by a power of 5 with
+ * 128 bit precision, then digits are removed while the interval allows it.
+ */
+#include "tds_pow5_table.h"
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_BIAS 1023
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_BIAS 127
+
+/* log2(5^e) rounded up, for 0 <= e <= 3528 */
+#define pow5bits(e) ((int) ((((unsigned int) (e)) * 1217359u) >> 19) + 1)
+/* log10(2^e) rounded down, for 0 <= e <= 1650 */
+#define log10pow2(e) ((unsigned int) (((unsigned int) (e)) * 78913u) >> 18)
+/* log10(5^e) rounded down, for 0 <= e <= 2620 */
+#define log10pow5(e) ((unsigned int) (((unsigned int) (e)) * 732923u) >> 20)
+
+#define TABLE64(t, i, n) ((((TDS_UINT8) (t)[i][2*(n)+1]) << 32) | (t)[i][2*(n)])
+
+static int
+pow5_factor(TDS_UINT8 value)
+{
+	int count = 0;
+
+	while (value % 5u == 0) {
+		value /= 5u;
+		++count;
+	}
+	return count;
+}
+
+#define multiple_of_pow5(value, p) (pow5_factor(value) >= (int) (p))
+#define multiple_of_pow2(value, p) (((value) & ((((TDS_UINT8) 1) << (p)) - 1)) == 0)
+
+/* 64x64 bit multiplication, return high 64 bits of result */
+static TDS_UINT8
+umul128_high(TDS_UINT8 a, TDS_UINT8 b, TDS_UINT8 * low)
+{
+	TDS_UINT a_lo = (TDS_UINT) a, a_hi = (TDS_UINT) (a >> 32);
+	TDS_UINT b_lo = (TDS_UINT) b, b_hi = (TDS_UINT) (b >> 32);
+	TDS_UINT8 b00 = (TDS_UINT8) a_lo * b_lo;
+	TDS_UINT8 b01 = (TDS_UINT8) a_lo * b_hi;
+	TDS_UINT8 b10 = (TDS_UINT8) a_hi * b_lo;
+	TDS_UINT8 b11 = (TDS_UINT8) a_hi * b_hi;
+	TDS_UINT8 mid1 = b10 + (b00 >> 32);
+	TDS_UINT8 mid2 = b01 + (TDS_UINT) mid1;
+
+	*low = (mid2 << 32) | (TDS_UINT) b00;
+	return b11 + (mid1 >> 32) + (mid2 >> 32);
+}
+
+/* (m * table value) >> j, 64 < j < 128 */
+static TDS_UINT8
+mul_shift64(TDS_UINT8 m, const TDS_UINT * mul, int j)
+{
+	TDS_UINT8 low0, low1, high0, high1, sum;
+
+	high0 = umul128_high(m, (((TDS_UINT8) mul[1]) << 32) | mul[0], &low0);
+	high1 = umul128_high(m, (((TDS_UINT8) mul[3]) << 32) | mul[2], &low1);
+	sum = high0 + low1;
+	if (sum < high0)
+		++high1;
+	j -= 64;
+	return (high1 << (64 - j)) | (sum >> j);
+}
+
+/* (m * factor) >> shift, 32 <= shift < 96 */
+static TDS_UINT
+mul_shift32(TDS_UINT m, TDS_UINT8 factor, int shift)
+{
+	TDS_UINT8 bits0 = (TDS_UINT8) m * (TDS_UINT) factor;
+	TDS_UINT8 bits1 = (TDS_UINT8) m * (TDS_UINT) (factor >> 32);
+
+	return (TDS_UINT) ((((bits0 >> 32) + bits1)) >> (shift - 32));
+}
+
+/**
+ * Compute shortest decimal digits of a finite, not zero double.
+ * @return digits, *pexp is set to the decimal exponent
+ */
+static TDS_UINT8
+double_digits(TDS_UINT8 mantissa, int exponent, int *pexp)
+{
+	int e2, e10, removed = 0, accept_bounds;
+	TDS_UINT8 m2, mv, vr, vp, vm, output;
+	unsigned int mm_shift, q;
+	int i, j, k, vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+	unsigned int last_removed = 0;
+
+	if (exponent == 0) {
+		e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = mantissa;
+	} else {
+		e2 = exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = (((TDS_UINT8) 1) << DOUBLE_MANTISSA_BITS) | mantissa;
+	}
+	accept_bounds = (m2 & 1) == 0;
+
+	/* interval of valid representations is (mv - 1 - mm_shift, mv + 2) / 4 */
+	mv = 4 * m2;
+	mm_shift = mantissa != 0 || exponent <= 1;
+
+	/* convert to decimal, vr = mv * 2^e2 / 10^e10 */
+	if (e2 >= 0) {
+		q = log10pow2(e2) - (e2 > 3);
+		e10 = (int) q;
+		k = POW5_INV_BITCOUNT + pow5bits(q) - 1;
+		i = -e2 + (int) q + k;
+		vr = mul_shift64(4 * m2, tds_pow5_inv[q], i);
+		vp = mul_shift64(4 * m2 + 2, tds_pow5_inv[q], i);
+		vm = mul_shift64(4 * m2 - 1 - mm_shift, tds_pow5_inv[q], i);
+		if (q <= 21) {
+			/* only one of mp, mv, and mm can be a multiple of 5, if any */
+			if (mv % 5u == 0)
+				vr_trailing_zeros = multiple_of_pow5(mv, q);
+			else if (accept_bounds)
+				vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				vp -= multiple_of_pow5(mv + 2, q);
+		}
+	} else {
+		q = log10pow5(-e2) - (-e2 > 1);
+		e10 = (int) q + e2;
+		i = -e2 - (int) q;
+		k = pow5bits(i) - POW5_BITCOUNT;
+		j = (int) q - k;
+		vr = mul_shift64(4 * m2, tds_pow5[i], j);
+		vp = mul_shift64(4 * m2 + 2, tds_pow5[i], j);
+		vm = mul_shift64(4 * m2 - 1 - mm_shift, tds_pow5[i], j);
+		if (q <= 1) {
+			/* mv = 4 * m2 so it has always at least 2 trailing 0 bits */
+			vr_trailing_zeros = 1;
+			if (accept_bounds)
+				vm_trailing_zeros = mm_shift == 1;
+			else
+				--vp;
+		} else if (q < 63) {
+			vr_trailing_zeros = multiple_of_pow2(mv, q);
+		}
+	}
+
+	/* remove digits while interval allows it */
+	if (vm_trailing_zeros || vr_trailing_zeros) {
+		/* rare case, rounding depends on removed digits */
+		while (vp / 10u > vm / 10u) {
+			vm_trailing_zeros &= vm % 10u == 0;
+			vr_trailing_zeros &= last_removed == 0;
+			last_removed = (unsigned int) (vr % 10u);
+			vr /= 10u;
+			vp /= 10u;
+			vm /= 10u;
+			++removed;
+		}
+		if (vm_trailing_zeros) {
+			while (vm % 10u == 0) {
+				vr_trailing_zeros &= last_removed == 0;
+				last_removed = (unsigned int) (vr % 10u);
+				vr /= 10u;
+				vp /= 10u;
+				vm /= 10u;
+				++removed;
+			}
+		}
+		/* exactly .5, round to even */
+		if (vr_trailing_zeros && last_removed == 5 && vr % 2u == 0)
+			last_removed = 4;
+		output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+	} else {
+		while (vp / 10u > vm / 10u) {
+			last_removed = (unsigned int) (vr % 10u);
+			vr /= 10u;
+			vp /= 10u;
+			vm /= 10u;
+			++removed;
+		}
+		output = vr + (vr == vm || last_removed >= 5);
+	}
+	*pexp = e10 + removed;
+	return output;
+}
+
+/* (m * 2^k / 5^q) >> j using high bits of double tables */
+#define mul_pow5_inv(m, q, j) mul_shift32(m, TABLE64(tds_pow5_inv, q, 1) + 1, j)
+#define mul_pow5(m, i, j) mul_shift32(m, TABLE64(tds_pow5, i, 1), j)
+
+/**
+ * Compute shortest decimal digits of a finite, not zero float.
+ * Same as double_digits but with a 32 bit mantissa.
+ */
+static TDS_UINT
+float_digits(TDS_UINT mantissa, int exponent, int *pexp)
+{
+	int e2, e10, removed = 0, accept_bounds;
+	TDS_UINT m2, mv, mp, mm, vr, vp, vm, output;
+	unsigned int mm_shift, q;
+	int i, j, k, vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+	unsigned int last_removed = 0;
+
+	if (exponent == 0) {
+		e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = mantissa;
+	} else {
+		e2 = exponent - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = (1u << FLOAT_MANTISSA_BITS) | mantissa;
+	}
+	accept_bounds = (m2 & 1) == 0;
+
+	mv = 4 * m2;
+	mp = 4 * m2 + 2;
+	mm_shift = mantissa != 0 || exponent <= 1;
+	mm = 4 * m2 - 1 - mm_shift;
+
+	if (e2 >= 0) {
+		q = log10pow2(e2);
+		e10 = (int) q;
+		k = POW5_INV_BITCOUNT - 64 + pow5bits(q) - 1;
+		i = -e2 + (int) q + k;
+		vr = mul_pow5_inv(mv, q, i);
+		vp = mul_pow5_inv(mp, q, i);
+		vm = mul_pow5_inv(mm, q, i);
+		if (q != 0 && (vp - 1) / 10u <= vm / 10u) {
+			/* we need to know one removed digit even if we are not going to loop below */
+			k = POW5_INV_BITCOUNT - 64 + pow5bits(q - 1) - 1;
+			last_removed = mul_pow5_inv(mv, q - 1, -e2 + (int) q - 1 + k) % 10u;
+		}
+		if (q <= 9) {
+			if (mv % 5u == 0)
+				vr_trailing_zeros = multiple_of_pow5(mv, q);
+			else if (accept_bounds)
+				vm_trailing_zeros = multiple_of_pow5(mm, q);
+			else
+				vp -= multiple_of_pow5(mp, q);
+		}
+	} else {
+		q = log10pow5(-e2);
+		e10 = (int) q + e2;
+		i = -e2 - (int) q;
+		k = pow5bits(i) - (POW5_BITCOUNT - 64);
+		j = (int) q - k;
+		vr = mul_pow5(mv, i, j);
+		vp = mul_pow5(mp, i, j);
+		vm = mul_pow5(mm, i, j);
+		if (q != 0 && (vp - 1) / 10u <= vm / 10u) {
+			j = (int) q - 1 - (pow5bits(i + 1) - (POW5_BITCOUNT - 64));
+			last_removed = mul_pow5(mv, i + 1, j) % 10u;
+		}
+		if (q <= 1) {
+			vr_trailing_zeros = 1;
+			if (accept_bounds)
+				vm_trailing_zeros = mm_shift == 1;
+			else
+				--vp;
+		} else if (q < 31) {
+			vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+		}
+	}
+
+	if (vm_trailing_zeros || vr_trailing_zeros) {
+		while (vp / 10u > vm / 10u) {
+			vm_trailing_zeros &= vm % 10u == 0;
+			vr_trailing_zeros &= last_removed == 0;
+			last_removed = vr % 10u;
+			vr /= 10u;
+			vp /= 10u;
+			vm /= 10u;
+			++removed;
+		}
+		if (vm_trailing_zeros) {
+			while (vm % 10u == 0) {
+				vr_trailing_zeros &= last_removed == 0;
+				last_removed = vr % 10u;
+				vr /= 10u;
+				vp /= 10u;
+				vm /= 10u;
+				++removed;
+			}
+		}
+		if (vr_trailing_zeros && last_removed == 5 && vr % 2u == 0)
+			last_removed = 4;
+		output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+	} else {
+		while (vp / 10u > vm / 10u) {
+			last_removed = vr % 10u;
+			vr /= 10u;
+			vp /= 10u;
+			vm /= 10u;
+			++removed;
+		}
+		output = vr + (vr == vm || last_removed >= 5);
+	}
+	*pexp = e10 + removed;
+	return output;
+}
+
+/**
+ * Write digits like printf %g.
+ * Scientific notation is used if exponent is less than -4 or greater
+ * or equal to prec, all digits are written.
+ */
+static char *
+format_digits(char *s, TDS_UINT8 digits, int exp, int prec)
+{
+	char buf[20];
+	int len, x;
+
+	/* %g does not write trailing zeros */
+	while (digits % 10u == 0) {
+		digits /= 10u;
+		++exp;
+	}
+	len = (int) (tds_format_uint8(buf, digits) - buf);
+	x = exp + len - 1;
+
+	if (x < -4 || x >= prec) {
+		*s++ = buf[0];
+		if (len > 1) {
+			*s++ = '.';
+			memcpy(s, buf + 1, len - 1);
+			s += len - 1;
+		}
+		*s++ = 'e';
+		*s++ = x < 0 ? '-' : '+';
+		if (x < 0)
+			x = -x;
+		if (x < 10)
+			*s++ = '0';
+		s = tds_format_uint8(s, x);
+	} else if (x < 0) {
+		*s++ = '0';
+		*s++ = '.';
+		for (; ++x < 0;)
+			*s++ = '0';
+		memcpy(s, buf, len);
+		s += len;
+	} else if (len <= x + 1) {
+		memcpy(s, buf, len);
+		s += len;
+		for (; len <= x; ++len)
+			*s++ = '0';
+	} else {
+		memcpy(s, buf, x + 1);
+		s += x + 1;
+		*s++ = '.';
+		memcpy(s, buf + x + 1, len - x - 1);
+		s += len - x - 1;
+	}
+	*s = 0;
+	return s;
+}
+#endif
+
+/**
+ * Format a float with the shortest representation that reads back as the
+ * same value. The format is the one of printf %.16g (only more digits
+ * are used when needed).
+ * @param value number to format
+ * @param s output buffer, at least 25 characters
+ * @return s
+ */
+char *
+tds_flt8_to_string(TDS_FLOAT value, char *s)
+{
+#ifdef HAVE_INT64
+	TDS_UINT8 bits;
+	int exp, exponent;
+	char *p = s;
+
+	memcpy(&bits, &value, sizeof(bits));
+	exponent = (int) (bits >> DOUBLE_MANTISSA_BITS) & 0x7ff;
+
+	/* infinite and NaN */
+	if (exponent == 0x7ff) {
+		sprintf(s, "%.16g", value);
+		return s;
+	}
+	if ((bits >> 63) != 0)
+		*p++ = '-';
+	bits &= (((TDS_UINT8) 1) << DOUBLE_MANTISSA_BITS) - 1;
+	if (exponent == 0 && bits == 0) {
+		strcpy(p, "0");
+		return s;
+	}
+	bits = double_digits(bits, exponent, &exp);
+	format_digits(p, bits, exp, 16);
+#else
+	sprintf(s, "%.17g", value);
+#endif
+	return s;
+}
+
+/**
+ * Format a real with the shortest representation that reads back as the
+ * same value, see tds_flt8_to_string. The format is the one of printf %.7g.
+ * @param value number to format
+ * @param s output buffer, at least 16 characters
+ * @return s
+ */
+char *
+tds_real_to_string(TDS_REAL value, char *s)
+{
+#ifdef HAVE_INT64
+	TDS_UINT bits;
+	int exp, exponent;
+	char *p = s;
+
+	memcpy(&bits, &value, sizeof(bits));
+	exponent = (int) (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+
+	if (exponent == 0xff) {
+		sprintf(s, "%.7g", value);
+		return s;
+	}
+	if ((bits >> 31) != 0)
+		*p++ = '-';
+	bits &= (1u << FLOAT_MANTISSA_BITS) - 1;
+	if (exponent == 0 && bits == 0) {
+		strcpy(p, "0");
+		return s;
+	}
+	bits = float_digits(bits, exponent, &exp);
+	format_digits(p, bits, exp, 7);
+#else
+	sprintf(s, "%.9g", value);
+#endif
+	return s;
+}
+
 #ifndef HAVE_INT64
 static int
 multiply_byte(unsigned char *product, int num, unsigned char *multiplier)
@@ -241,121 +717,34 @@ array_to_string(unsigned char *array, int scale, char *s)
 }
 #endif
 
-/**
- * @return <0 if error
+/*
+ * Numbers are handled as arrays of limbs (TDS_WORD), least significant
+ * first. Wire format (TDS_NUMERIC, big endian bytes) is converted to
+ * limbs when entering these functions and back when leaving.
  */
-TDS_INT
-tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s)
-{
-	const unsigned char *number;
-
-	unsigned int packet[sizeof(numeric->array) / 2];
-	unsigned int *pnum, *packet_start;
-	unsigned int *const packet_end = packet + TDS_VECTOR_SIZE(packet);
-
-	unsigned int packet10k[(MAXPRECISION + 3) / 4];
-	unsigned int *p;
-
-	int num_bytes;
-	unsigned int remainder, n, i, m;
-
-	/* a bit of debug */
-#if ENABLE_EXTRA_CHECKS
-	memset(packet, 0x55, sizeof(packet));
-	memset(packet10k, 0x55, sizeof(packet10k));
-#endif
-
-	if (numeric->precision < 1 || numeric->precision > MAXPRECISION || numeric->scale > numeric->precision)
-		return TDS_CONVERT_FAIL;
-
-	/* set sign */
-	if (numeric->array[0] == 1)
-		*s++ = '-';
-
-	/* put number in a 16bit array */
-	number = numeric->array;
-	num_bytes = tds_numeric_bytes_per_prec[numeric->precision];
-
-	n = num_bytes - 1;
-	pnum = packet_end;
-	for (; n > 1; n -= 2)
-		*--pnum = TDS_GET_UA2BE(&number[n - 1]);
-	if (n == 1)
-		*--pnum = number[n];
-	while (!*pnum) {
-		++pnum;
-		if (pnum == packet_end) {
-			*s++ = '0';
-			if (numeric->scale) {
-				*s++ = '.';
-				i = numeric->scale;
-				do {
-					*s++ = '0';
-				} while (--i);
-			}
-			*s++ = 0;
-			return 1;
-		}
-	}
-	packet_start = pnum;
-
-	/* transform 2^16 base number in 10^4 base number */
-	for (p = packet10k + TDS_VECTOR_SIZE(packet10k); packet_start != packet_end;) {
-		pnum = packet_start;
-		n = *pnum;
-		remainder = n % 10000u;
-		if (!(*pnum++ = (n / 10000u)))
-			packet_start = pnum;
-		for (; pnum != packet_end; ++pnum) {
-			n = remainder * (256u * 256u) + *pnum;
-			remainder = n % 10000u;
-			*pnum = n / 10000u;
-		}
-		*--p = remainder;
-	}
-
-	/* transform to 10 base number and output */
-	i = 4 * (unsigned int)((packet10k + TDS_VECTOR_SIZE(packet10k)) - p);	/* current digit */
-	/* skip leading zeroes */
-	n = 1000;
-	remainder = *p;
-	while (remainder < n)
-		n /= 10, --i;
-	if (i <= numeric->scale) {
-		*s++ = '0';
-		*s++ = '.';
-		m = i;
-		while (m < numeric->scale)
-			*s++ = '0', ++m;
-	}
-	for (;;) {
-		*s++ = (remainder / n) + '0';
-		--i;
-		remainder %= n;
-		n /= 10;
-		if (!n) {
-			n = 1000;
-			if (++p == packet10k + TDS_VECTOR_SIZE(packet10k))
-				break;
-			remainder = *p;
-		}
-		if (i == numeric->scale)
-			*s++ = '.';
-	}
-	*s++ = 0;
-
-	return 1;
-}
-
 #ifndef HAVE_INT64
 #define TDS_WORD  TDS_USMALLINT
 #define TDS_DWORD TDS_UINT
 #define TDS_WORD_DDIGIT 4
+#define TDS_WORD_DBASE 10000u
 #else
 #define TDS_WORD  TDS_UINT
 #define TDS_DWORD TDS_UINT8
 #define TDS_WORD_DDIGIT 9
+#define TDS_WORD_DBASE 1000000000u
+#endif
+#define TDS_WORD_BITS (8 * sizeof(TDS_WORD))
+#define TDS_WORD_BASE ((double) (((TDS_DWORD) 1) << TDS_WORD_BITS))
+
+/* 10^77 < 2^256, one more limb to multiply before checking overflow */
+#define NUM_LIMBS (256 / TDS_WORD_BITS + 1)
+
+static const TDS_WORD factors[] = {
+	1, 10, 100, 1000, 10000,
+#ifdef HAVE_INT64
+	100000, 1000000, 10000000, 100000000, 1000000000
 #endif
+};
 
 /* include to check limits */
 
@@ -397,20 +786,394 @@ tds_packet_check_overflow(TDS_WORD *packet, unsigned int packet_len, unsigned in
 	return 0;
 }
 
+/**
+ * Extract the absolute value of a numeric.
+ * @return number of limbs, 0 if value is zero
+ */
+static unsigned int
+numeric_unpack(const TDS_NUMERIC * numeric, TDS_WORD * limbs)
+{
+	int bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
+	const unsigned char *p = numeric->array + 1 + bytes;
+	unsigned int i = 0, len = 0;
+	TDS_WORD n;
+
+	for (; bytes >= (int) sizeof(TDS_WORD); bytes -= sizeof(TDS_WORD)) {
+		p -= sizeof(TDS_WORD);
+#ifndef HAVE_INT64
+		n = TDS_GET_UA2BE(p);
+#else
+		n = TDS_GET_UA4BE(p);
+#endif
+		limbs[i++] = n;
+		if (n)
+			len = i;
+	}
+	if (bytes > 0) {
+		p = numeric->array + 1;
+		n = 0;
+		do {
+			n = (n << 8) | *p++;
+		} while (--bytes);
+		limbs[i++] = n;
+		if (n)
+			len = i;
+	}
+	return len;
+}
+
+/**
+ * Store limbs into a numeric, numeric precision must be already set and
+ * able to contain the value.
+ */
+static void
+numeric_pack(TDS_NUMERIC * numeric, const TDS_WORD * limbs, unsigned int len)
+{
+	int bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
+	unsigned char *p = numeric->array + 1 + bytes;
+	unsigned int i, j;
+	TDS_WORD n;
+
+	memset(numeric->array + 1, 0, sizeof(numeric->array) - 1);
+	for (i = 0; i < len; ++i) {
+		n = limbs[i];
+		for (j = 0; j < sizeof(TDS_WORD) && bytes > 0; ++j, --bytes) {
+			*--p = (unsigned char) n;
+			n >>= 8;
+		}
+	}
+}
+
+/**
+ * Compute limbs * factor + add.
+ * @return new number of limbs
+ */
+static unsigned int
+limbs_mul_add(TDS_WORD * limbs, unsigned int len, TDS_WORD factor, TDS_WORD add)
+{
+	unsigned int i;
+	TDS_DWORD n;
+
+	for (i = 0; i < len; ++i) {
+		n = limbs[i] * ((TDS_DWORD) factor) + add;
+		limbs[i] = (TDS_WORD) n;
+		add = (TDS_WORD) (n >> TDS_WORD_BITS);
+	}
+	if (add)
+		limbs[len++] = add;
+	return len;
+}
+
+/**
+ * Divide limbs by divisor, number of limbs is updated.
+ * @return remainder
+ */
+static TDS_WORD
+limbs_div(TDS_WORD * limbs, unsigned int *plen, TDS_WORD divisor)
+{
+	unsigned int i;
+	TDS_WORD borrow = 0;
+
+	for (i = *plen; i > 0; ) {
+#if defined(__GNUC__) && __GNUC__ >= 3 && defined(__i386__) && defined(HAVE_INT64)
+		--i;
+		__asm__ __volatile__ ("divl %4": "=a"(limbs[i]), "=d"(borrow): "0"(limbs[i]), "1"(borrow), "r"(divisor));
+#elif defined(__WATCOMC__) && defined(DOS32X)
+		TDS_WORD Int64div32(TDS_WORD* low,TDS_WORD high,TDS_WORD factor);
+		#pragma aux Int64div32 = "mov eax, dword ptr[esi]" \
+			"div ecx" \
+			"mov dword ptr[esi], eax" \
+			parm [ESI] [EDX] [ECX] value [EDX] modify [EAX EDX];
+		borrow = Int64div32(&limbs[i], borrow, divisor);
+#else
+		TDS_DWORD n = (((TDS_DWORD) borrow) << TDS_WORD_BITS) + limbs[--i];
+		limbs[i] = (TDS_WORD) (n / divisor);
+		borrow = (TDS_WORD) (n % divisor);
+#endif
+	}
+	while (*plen > 0 && limbs[*plen - 1] == 0)
+		--*plen;
+	return borrow;
+}
+
+/**
+ * Divide limbs by 10^TDS_WORD_DDIGIT, number of limbs is updated.
+ * Same as limbs_div but dividing by a constant compilers can avoid
+ * division instructions.
+ * @return remainder
+ */
+static TDS_WORD
+limbs_div_dbase(TDS_WORD * limbs, unsigned int *plen)
+{
+	unsigned int i;
+	TDS_DWORD n = 0;
+
+	for (i = *plen; i > 0; ) {
+		n = ((n % TDS_WORD_DBASE) << TDS_WORD_BITS) + limbs[--i];
+		limbs[i] = (TDS_WORD) (n / TDS_WORD_DBASE);
+	}
+	while (*plen > 0 && limbs[*plen - 1] == 0)
+		--*plen;
+	return (TDS_WORD) (n % TDS_WORD_DBASE);
+}
+
+#define NUMERIC_VALID(numeric) \
+	((numeric)->precision >= 1 && (numeric)->precision <= MAXPRECISION && (numeric)->scale <= (numeric)->precision)
+
+/**
+ * Format a numeric in decimal.
+ * @param numeric number to format
+ * @param s output buffer, at least MAXPRECISION + 4 characters
+ * @return <0 if error
+ */
 TDS_INT
-tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, unsigned char new_scale)
+tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s)
 {
-	static const TDS_WORD factors[] = {
-		1, 10, 100, 1000, 10000,
-#ifdef HAVE_INT64
-		100000, 1000000, 10000000, 100000000, 1000000000
+	TDS_WORD limbs[NUM_LIMBS];
+	char digits[(MAXPRECISION + 2 * TDS_WORD_DDIGIT) / TDS_WORD_DDIGIT * TDS_WORD_DDIGIT];
+	char *const digits_end = digits + sizeof(digits);
+	char *p = digits_end;
+	unsigned int len, i, num_digits, scale = numeric->scale;
+	TDS_WORD part;
+
+	if (!NUMERIC_VALID(numeric))
+		return TDS_CONVERT_FAIL;
+
+	/* set sign */
+	if (numeric->array[0] == 1)
+		*s++ = '-';
+
+	/* split in groups of TDS_WORD_DDIGIT digits, from less significant */
+	len = numeric_unpack(numeric, limbs);
+	while (len) {
+		part = limbs_div_dbase(limbs, &len);
+		for (i = 0; i < TDS_WORD_DDIGIT / 2; ++i) {
+			p -= 2;
+			memcpy(p, digit_pairs + (part % 100u) * 2u, 2);
+			part /= 100u;
+		}
+#if TDS_WORD_DDIGIT % 2
+		*--p = '0' + (char) part;
 #endif
+	}
+	while (p != digits_end && *p == '0')
+		++p;
+	num_digits = (unsigned int) (digits_end - p);
+
+	if (num_digits <= scale) {
+		*s++ = '0';
+		if (scale) {
+			*s++ = '.';
+			for (i = num_digits; i < scale; ++i)
+				*s++ = '0';
+		}
+	} else {
+		i = num_digits - scale;
+		memcpy(s, p, i);
+		s += i;
+		p += i;
+		num_digits = scale;
+		if (scale)
+			*s++ = '.';
+	}
+	memcpy(s, p, num_digits);
+	s[num_digits] = 0;
+
+	return 1;
+}
+
+/**
+ * Parse a decimal number into a numeric.
+ * Precision and scale of numeric are used as destination ones (precision 0
+ * means maximum precision). Decimals exceeding scale are truncated.
+ * @param numeric destination
+ * @param s string to parse, blanks around number are accepted
+ * @param end end of string
+ * @return sizeof(TDS_NUMERIC) or <0 if error
+ */
+TDS_INT
+tds_numeric_from_string(TDS_NUMERIC * numeric, const char *s, const char *end)
+{
+	TDS_WORD limbs[NUM_LIMBS];
+	TDS_WORD chunk = 0;
+	unsigned int len = 0, chunk_digits = 0, n;
+	int old_digits_left = 0, digits_left, digit_found = 0, places = 0;
+
+	/* FIXME: application can pass invalid value for precision and scale ?? */
+	if (numeric->precision > MAXPRECISION)
+		return TDS_CONVERT_FAIL;
+
+	if (numeric->precision == 0)
+		numeric->precision = MAXPRECISION;	/* assume max precision */
+
+	if (numeric->scale > numeric->precision)
+		return TDS_CONVERT_FAIL;
+
+	/* skip leading blanks */
+	for (;; ++s) {
+		if (s == end)
+			return TDS_CONVERT_SYNTAX;
+		if (*s != ' ')
+			break;
+	}
+
+	numeric->array[0] = 0;
+	if (*s == '-' || *s == '+') {	/* deal with a leading sign */
+		if (*s == '-')
+			numeric->array[0] = 1;
+		s++;
+	}
+
+	/* 
+	 * skip leading zeroes 
+	 * Not skipping them cause numbers like "000000000000" to 
+	 * appear like overflow
+	 */
+	for (; s != end && *s == '0'; ++s)
+		digit_found = 1;
+
+	/* 
+	 * Having disposed of any sign and leading blanks, 
+	 * vet the digit string, counting places before and after 
+	 * the decimal point.  Dispense with trailing blanks, if any.  
+	 * Digits are collected in chunks of TDS_WORD_DDIGIT then
+	 * added to limbs.
+	 */
+	digits_left = numeric->precision - numeric->scale;
+	for (; s != end; ++s) {
+		if (*s >= '0' && *s <= '9') {
+			if (--digits_left >= 0) {
+				chunk = chunk * 10u + (*s - '0');
+				if (++chunk_digits == TDS_WORD_DDIGIT) {
+					len = limbs_mul_add(limbs, len, factors[TDS_WORD_DDIGIT], chunk);
+					chunk = 0;
+					chunk_digits = 0;
+				}
+			}
+			digit_found = 1;
+		} else if (*s == '.') {			/* found a decimal point */
+			if (places)				/* found a decimal point previously: return error */
+				return TDS_CONVERT_SYNTAX;
+			old_digits_left = digits_left;
+			digits_left = numeric->scale;
+			places = 1;
+		} else if (*s == ' ') {
+			for (; s != end && *s == ' '; ++s) ; /* skip contiguous blanks */
+			if (s == end)
+				break;				/* success: found only trailing blanks */
+			return TDS_CONVERT_SYNTAX;		/* bzzt: found something after the blank(s) */
+		} else {         				/* first invalid character */
+			return TDS_CONVERT_SYNTAX;
+		}
+	}
+	/* no digits? no number! */
+	if (!digit_found)
+		return TDS_CONVERT_SYNTAX;
+
+	if (!places) {
+		old_digits_left = digits_left;
+		digits_left = numeric->scale;
+	}
+
+	/* too many digits, error */
+	if (old_digits_left < 0)
+		return TDS_CONVERT_OVERFLOW;
+
+	len = limbs_mul_add(limbs, len, factors[chunk_digits], chunk);
+
+	/* fill up decimal digits */
+	for (; digits_left > 0; digits_left -= n) {
+		n = digits_left > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : digits_left;
+		len = limbs_mul_add(limbs, len, factors[n], 0);
+	}
+
+	numeric_pack(numeric, limbs, len);
+	return sizeof(TDS_NUMERIC);
+}
+
+/**
+ * Convert a numeric to a 64 bit integer, decimals are truncated.
+ * @param numeric number to convert
+ * @param value where to store result
+ * @return 0 on success, <0 if error (TDS_CONVERT_OVERFLOW if value does not fit)
+ */
+TDS_INT
+tds_numeric_to_int8(const TDS_NUMERIC * numeric, TDS_INT8 * value)
+{
+	TDS_WORD limbs[NUM_LIMBS];
+	unsigned int len, n, i;
+	int scale;
+	TDS_UINT8 abs_value = 0;
+
+	if (!NUMERIC_VALID(numeric))
+		return TDS_CONVERT_FAIL;
+
+	len = numeric_unpack(numeric, limbs);
+	for (scale = numeric->scale; scale > 0 && len; scale -= n) {
+		n = scale > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : scale;
+		limbs_div(limbs, &len, factors[n]);
+	}
+
+	if (len * TDS_WORD_BITS > 64)
+		return TDS_CONVERT_OVERFLOW;
+	for (i = len; i > 0; )
+		abs_value = (abs_value << TDS_WORD_BITS) | limbs[--i];
+
+	/* 2^63 is fine only if negative */
+	if (abs_value >> 63) {
+		if (numeric->array[0] != 1 || (abs_value << 1) != 0)
+			return TDS_CONVERT_OVERFLOW;
+	}
+	*value = numeric->array[0] == 1 ? -(TDS_INT8) abs_value : (TDS_INT8) abs_value;
+	return 0;
+}
+
+/**
+ * Convert a numeric to a double, result is correctly rounded.
+ * @param numeric number to convert
+ * @param value where to store result
+ * @return 0 on success, <0 if error
+ */
+TDS_INT
+tds_numeric_to_flt8(const TDS_NUMERIC * numeric, TDS_FLOAT * value)
+{
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
 	};
+	TDS_WORD limbs[NUM_LIMBS];
+	unsigned int len;
+	double f = 0;
+	char buf[MAXPRECISION + 4];
 
-	TDS_WORD packet[(sizeof(numeric->array) - 1) / sizeof(TDS_WORD)];
+	if (!NUMERIC_VALID(numeric))
+		return TDS_CONVERT_FAIL;
 
-	unsigned int i, packet_len;
-	int scale_diff, bytes;
+	/*
+	 * If both integer value and 10^scale are exact in a double
+	 * (less than 2^53) a single division gives the correctly
+	 * rounded result, otherwise use strtod.
+	 */
+	len = numeric_unpack(numeric, limbs);
+	while (len)
+		f = f * TDS_WORD_BASE + limbs[--len];
+	if (f < 9007199254740992.0 && numeric->scale < TDS_VECTOR_SIZE(pow10)) {
+		f /= pow10[numeric->scale];
+		*value = numeric->array[0] == 1 ? -f : f;
+		return 0;
+	}
+
+	tds_numeric_to_string(numeric, buf);
+	*value = strtod(buf, NULL);
+	return 0;
+}
+
+TDS_INT
+tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, unsigned char new_scale)
+{
+	TDS_WORD limbs[NUM_LIMBS];
+	unsigned int i, len, n;
+	int scale_diff;
 
 	if (numeric->precision < 1 || numeric->precision > 77 || numeric->scale > numeric->precision)
 		return TDS_CONVERT_FAIL;
@@ -429,32 +1192,11 @@ tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, uns
 		return sizeof(TDS_NUMERIC);
 	}
 
-	/* package number */
-	bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
-	i = 0;
-	do {
-		/*
-		 * note that if bytes are smaller we have a small buffer
-		 * overflow in numeric->array however is not a problem
-		 * cause overflow occurs in numeric and number is fixed below
-		 */
-#ifndef HAVE_INT64
-		packet[i] = TDS_GET_UA2BE(&numeric->array[bytes-1]);
-#else
-		packet[i] = TDS_GET_UA4BE(&numeric->array[bytes-3]);
-#endif
-		++i;
-	} while ( (bytes -= sizeof(TDS_WORD)) > 0);
-	/* fix last packet */
-	if (bytes < 0)
-		packet[i-1] &= 0xffffffffu >> (8 * -bytes);
-	while (i > 1 && packet[i-1] == 0)
-		--i;
-	packet_len = i;
+	len = numeric_unpack(numeric, limbs);
 
 	if (scale_diff >= 0) {
 		/* check overflow before multiply */
-		if (tds_packet_check_overflow(packet, packet_len, new_prec - scale_diff))
+		if (tds_packet_check_overflow(limbs, len, new_prec - scale_diff))
 			return TDS_CONVERT_OVERFLOW;
 
 		if (scale_diff == 0) {
@@ -465,77 +1207,28 @@ tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, uns
 			return sizeof(TDS_NUMERIC);
 		}
 
-		/* multiply */
-		do {
-			/* multiply by at maximun TDS_WORD_DDIGIT */
-			unsigned int n = scale_diff > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : scale_diff;
-			TDS_WORD factor = factors[n];
-			TDS_WORD carry = 0;
-			scale_diff -= n; 
-			for (i = 0; i < packet_len; ++i) {
-				TDS_DWORD n = packet[i] * ((TDS_DWORD) factor) + carry;
-				packet[i] = (TDS_WORD) n;
-				carry = n >> (8 * sizeof(TDS_WORD));
-			}
-			/* here we can expand number safely cause we know that it can't overflow */
-			if (carry)
-				packet[packet_len++] = carry;
-		} while (scale_diff > 0);
+		/* multiply, we know that it can't overflow */
+		for (; scale_diff > 0; scale_diff -= n) {
+			n = scale_diff > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : scale_diff;
+			len = limbs_mul_add(limbs, len, factors[n], 0);
+		}
 	} else {
 		/* check overflow */
 		if (new_prec - scale_diff < numeric->precision)
-			if (tds_packet_check_overflow(packet, packet_len, new_prec - scale_diff))
+			if (tds_packet_check_overflow(limbs, len, new_prec - scale_diff))
 				return TDS_CONVERT_OVERFLOW;
 
 		/* divide */
-		scale_diff = -scale_diff;
-		do {
-			unsigned int n = scale_diff > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : scale_diff;
-			TDS_WORD factor = factors[n];
-			TDS_WORD borrow = 0;
-			scale_diff -= n;
-			for (i = packet_len; i > 0; ) {
-#if defined(__GNUC__) && __GNUC__ >= 3 && defined(__i386__) && defined(HAVE_INT64)
-				--i;
-				__asm__ __volatile__ ("divl %4": "=a"(packet[i]), "=d"(borrow): "0"(packet[i]), "1"(borrow), "r"(factor));
-#elif defined(__WATCOMC__) && defined(DOS32X)
-				TDS_WORD Int64div32(TDS_WORD* low,TDS_WORD high,TDS_WORD factor);
-				#pragma aux Int64div32 = "mov eax, dword ptr[esi]" \
-					"div ecx" \
-					"mov dword ptr[esi], eax" \
-					parm [ESI] [EDX] [ECX] value [EDX] modify [EAX EDX];
-				borrow = Int64div32(&packet[i], borrow, factor);
-#else
-				TDS_DWORD n = (((TDS_DWORD) borrow) << (8 * sizeof(TDS_WORD))) + packet[--i];
-				packet[i] = n / factor;
-				borrow = n % factor;
-#endif
-			}
-		} while (scale_diff > 0);
+		for (scale_diff = -scale_diff; scale_diff > 0 && len; scale_diff -= n) {
+			n = scale_diff > TDS_WORD_DDIGIT ? TDS_WORD_DDIGIT : scale_diff;
+			limbs_div(limbs, &len, factors[n]);
+		}
 	}
 
 	/* back to our format */
 	numeric->precision = new_prec;
 	numeric->scale = new_scale;
-	bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
-	for (i = bytes / sizeof(TDS_WORD); i >= packet_len; --i)
-		packet[i] = 0;
-	for (i = 0; bytes >= sizeof(TDS_WORD); bytes -= sizeof(TDS_WORD), ++i) {
-#ifndef HAVE_INT64
-		TDS_PUT_UA2BE(&numeric->array[bytes-1], packet[i]);
-#else
-		TDS_PUT_UA4BE(&numeric->array[bytes-3], packet[i]);
-#endif
-	}
-
-	if (bytes) {
-		TDS_WORD remainder = packet[i];
-		do {
-			numeric->array[bytes] = (TDS_UCHAR) remainder;
-			remainder >>= 8;
-		} while (--bytes);
-	}
+	numeric_pack(numeric, limbs, len);
 
 	return sizeof(TDS_NUMERIC);
 }
-
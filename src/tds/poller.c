@@ -0,0 +1,429 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <assert.h>
+
+#if HAVE_ERRNO_H
+#include <errno.h>
+#endif /* HAVE_ERRNO_H */
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_POLL_H
+#include <poll.h>
+#endif /* HAVE_POLL_H */
+
+#if HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+
+#include "tds.h"
+#include "replacements.h"
+
+#ifdef DMALLOC
+#include <dmalloc.h>
+#endif
+
+TDS_RCSID(var, "$Id: poller.c,v 1.1 2011/08/29 09:41:12 freddy77 Exp $");
+
+/**
+ * \addtogroup network
+ * @{
+ */
+
+/*
+ * A poller waits for responses on many connections at once.
+ * Every socket registered is in one of these states:
+ * - waiting: the poller is waiting data from the server;
+ * - queued: a complete response is buffered, socket is in the ready queue;
+ * - reported: socket was returned to the caller, it's not checked until
+ *   the next tds_poller_wait call when, if the response was not read, it's
+ *   reported again.
+ * Sockets with a response ready are not polled so a response not yet
+ * consumed does not make the poller spin.
+ */
+enum
+{
+	TDS_POLL_FREE = 0,
+	TDS_POLL_WAITING,
+	TDS_POLL_QUEUED,
+	TDS_POLL_REPORTED
+};
+
+struct tds_poller
+{
+	/** registered sockets, indexed by slot */
+	TDSSOCKET **sockets;
+	/** state of every slot */
+	unsigned char *states;
+	/** number of slots used (including free ones in the middle) */
+	int num_slots;
+	/** number of slots allocated */
+	int max_slots;
+	/** slots with a response ready, in arrival order */
+	int *ready;
+	int num_ready;
+#if USE_EPOLL
+	int epoll_fd;
+	struct epoll_event *events;
+#else
+	struct pollfd *fds;
+#endif
+};
+
+/**
+ * Allocate a new poller
+ * \return poller or NULL on failure
+ */
+TDSPOLLER *
+tds_alloc_poller(void)
+{
+	TDSPOLLER *poller = (TDSPOLLER *) calloc(1, sizeof(TDSPOLLER));
+
+	if (!poller)
+		return NULL;
+#if USE_EPOLL
+	poller->epoll_fd = epoll_create(64);
+	if (poller->epoll_fd < 0) {
+		free(poller);
+		return NULL;
+	}
+#endif
+	return poller;
+}
+
+/**
+ * Free a poller. Sockets registered are not touched.
+ */
+void
+tds_free_poller(TDSPOLLER * poller)
+{
+	if (!poller)
+		return;
+#if USE_EPOLL
+	close(poller->epoll_fd);
+	free(poller->events);
+#else
+	free(poller->fds);
+#endif
+	free(poller->sockets);
+	free(poller->states);
+	free(poller->ready);
+	free(poller);
+}
+
+static int
+tds_poller_find(TDSPOLLER * poller, TDSSOCKET * tds)
+{
+	int i;
+
+	for (i = 0; i < poller->num_slots; ++i)
+		if (poller->states[i] != TDS_POLL_FREE && poller->sockets[i] == tds)
+			return i;
+	return -1;
+}
+
+static void
+tds_poller_queue(TDSPOLLER * poller, int slot)
+{
+	poller->states[slot] = TDS_POLL_QUEUED;
+	poller->ready[poller->num_ready++] = slot;
+}
+
+/**
+ * Wait for data from a socket.
+ * \return 0 on success, -1 if socket can't be polled
+ */
+static int
+tds_poller_arm(TDSPOLLER * poller, int slot)
+{
+	TDS_SYS_SOCKET s = tds_get_s(poller->sockets[slot]);
+#if USE_EPOLL
+	struct epoll_event ev;
+
+	if (TDS_IS_SOCKET_INVALID(s))
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u32 = slot;
+	if (epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, s, &ev) < 0
+	    && (errno != ENOENT || epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, s, &ev) < 0))
+		return -1;
+#else
+	if (TDS_IS_SOCKET_INVALID(s))
+		return -1;
+
+	poller->fds[slot].fd = s;
+	poller->fds[slot].events = POLLIN;
+	poller->fds[slot].revents = 0;
+#endif
+	poller->states[slot] = TDS_POLL_WAITING;
+	return 0;
+}
+
+/**
+ * Update state of a socket, queue it if a response is ready
+ * otherwise start waiting data again.
+ * \param readable 1 if socket was reported readable
+ */
+static void
+tds_poller_check(TDSPOLLER * poller, int slot, int readable)
+{
+	TDSSOCKET *tds = poller->sockets[slot];
+
+#if !USE_EPOLL
+	poller->fds[slot].fd = -1;
+#endif
+
+	if (readable) {
+		/* on error queue the socket, the caller will get the error reading */
+		if (tds_read_available(tds) < 0 || tds_conn(tds)->tls_session) {
+			tds_poller_queue(poller, slot);
+			return;
+		}
+	}
+
+	if (IS_TDSDEAD(tds) || tds_response_ready(tds) || tds_poller_arm(poller, slot) < 0)
+		tds_poller_queue(poller, slot);
+}
+
+static int
+tds_poller_grow(TDSPOLLER * poller)
+{
+	int n = poller->max_slots ? poller->max_slots * 2 : 16;
+	void *p;
+
+	if (!(p = realloc(poller->sockets, n * sizeof(TDSSOCKET *))))
+		return -1;
+	poller->sockets = (TDSSOCKET **) p;
+	if (!(p = realloc(poller->states, n)))
+		return -1;
+	poller->states = (unsigned char *) p;
+	if (!(p = realloc(poller->ready, n * sizeof(int))))
+		return -1;
+	poller->ready = (int *) p;
+#if USE_EPOLL
+	if (!(p = realloc(poller->events, n * sizeof(struct epoll_event))))
+		return -1;
+	poller->events = (struct epoll_event *) p;
+#else
+	if (!(p = realloc(poller->fds, n * sizeof(struct pollfd))))
+		return -1;
+	poller->fds = (struct pollfd *) p;
+#endif
+	poller->max_slots = n;
+	return 0;
+}
+
+/**
+ * Register a socket in the poller.
+ * \return 0 on success, -1 on memory error
+ */
+int
+tds_poller_add(TDSPOLLER * poller, TDSSOCKET * tds)
+{
+	int slot;
+
+	if (tds_poller_find(poller, tds) >= 0)
+		return 0;
+
+	for (slot = 0; slot < poller->num_slots; ++slot)
+		if (poller->states[slot] == TDS_POLL_FREE)
+			break;
+
+	if (slot >= poller->max_slots && tds_poller_grow(poller) < 0)
+		return -1;
+	if (slot >= poller->num_slots)
+		poller->num_slots = slot + 1;
+
+	poller->sockets[slot] = tds;
+	tds_poller_check(poller, slot, 0);
+	return 0;
+}
+
+/**
+ * Remove a socket from the poller.
+ * Must be called before closing the socket.
+ */
+void
+tds_poller_remove(TDSPOLLER * poller, TDSSOCKET * tds)
+{
+	int i, slot = tds_poller_find(poller, tds);
+
+	if (slot < 0)
+		return;
+
+#if USE_EPOLL
+	if (!TDS_IS_SOCKET_INVALID(tds_get_s(tds))) {
+		struct epoll_event ev;
+
+		/* event is ignored but old kernels require a not NULL pointer */
+		epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, tds_get_s(tds), &ev);
+	}
+#else
+	poller->fds[slot].fd = -1;
+#endif
+
+	for (i = 0; i < poller->num_ready; ++i)
+		if (poller->ready[i] == slot) {
+			memmove(poller->ready + i, poller->ready + i + 1, (poller->num_ready - i - 1) * sizeof(int));
+			--poller->num_ready;
+			break;
+		}
+
+	poller->states[slot] = TDS_POLL_FREE;
+	poller->sockets[slot] = NULL;
+	while (poller->num_slots > 0 && poller->states[poller->num_slots - 1] == TDS_POLL_FREE)
+		--poller->num_slots;
+}
+
+/**
+ * Wait for a socket with a complete response.
+ * Sockets are returned in the order responses arrived.
+ * A socket is returned again on next call, before the others, if
+ * response was not read.
+ * Sockets closed or with network errors are returned as ready,
+ * reading from them returns the error.
+ * \param timeout_ms milliseconds to wait, -1 to wait forever, 0 to not wait
+ * \param ready returned socket, NULL if none
+ * \return 1 if a socket is ready, 0 on timeout, -1 on error (errno EINTR if interrupted)
+ */
+int
+tds_poller_wait(TDSPOLLER * poller, int timeout_ms, TDSSOCKET ** ready)
+{
+	const unsigned int start = tds_gettime_ms();
+	int i;
+
+	*ready = NULL;
+
+	/* the caller could have read responses reported, wait again for them */
+	for (i = 0; i < poller->num_slots; ++i) {
+		if (poller->states[i] != TDS_POLL_REPORTED)
+			continue;
+		tds_poller_check(poller, i, 0);
+		/* response not read, return it again before the others */
+		if (poller->states[i] == TDS_POLL_QUEUED) {
+			memmove(poller->ready + 1, poller->ready, (poller->num_ready - 1) * sizeof(int));
+			poller->ready[0] = i;
+		}
+	}
+
+	for (;;) {
+		int n, wait_ms = -1;
+
+		if (poller->num_ready) {
+			i = poller->ready[0];
+			--poller->num_ready;
+			memmove(poller->ready, poller->ready + 1, poller->num_ready * sizeof(int));
+			poller->states[i] = TDS_POLL_REPORTED;
+			*ready = poller->sockets[i];
+			return 1;
+		}
+
+		if (timeout_ms >= 0) {
+			unsigned int elapsed = tds_gettime_ms() - start;
+
+			wait_ms = elapsed >= (unsigned int) timeout_ms ? 0 : timeout_ms - (int) elapsed;
+		}
+
+#if USE_EPOLL
+		n = epoll_wait(poller->epoll_fd, poller->events, poller->max_slots ? poller->max_slots : 1, wait_ms);
+		if (n < 0)
+			return -1;
+		for (i = 0; i < n; ++i) {
+			int slot = poller->events[i].data.u32;
+
+			if (slot < poller->num_slots && poller->states[slot] == TDS_POLL_WAITING)
+				tds_poller_check(poller, slot, 1);
+		}
+#else
+		n = poll(poller->fds, poller->num_slots, wait_ms);
+		if (n < 0)
+			return -1;
+		for (i = 0; n > 0 && i < poller->num_slots; ++i) {
+			if (poller->fds[i].fd < 0 || !poller->fds[i].revents)
+				continue;
+			--n;
+			poller->fds[i].revents = 0;
+			tds_poller_check(poller, i, 1);
+		}
+#endif
+
+		if (!poller->num_ready && wait_ms == 0)
+			return 0;
+	}
+}
+
+/**
+ * Wait for a complete response from a single socket.
+ * Data are read into the receive buffer as they arrive.
+ * \param timeout_ms milliseconds to wait, -1 to wait forever, 0 to not wait
+ * \return 1 if response is ready (or socket got an error), 0 on timeout, -1 on error (errno EINTR if interrupted)
+ */
+int
+tds_wait_response(TDSSOCKET * tds, int timeout_ms)
+{
+	const unsigned int start = tds_gettime_ms();
+
+	for (;;) {
+		struct pollfd fd;
+		int rc, wait_ms = -1;
+
+		if (IS_TDSDEAD(tds) || tds_response_ready(tds))
+			return 1;
+
+		if (timeout_ms >= 0) {
+			unsigned int elapsed = tds_gettime_ms() - start;
+
+			wait_ms = elapsed >= (unsigned int) timeout_ms ? 0 : timeout_ms - (int) elapsed;
+		}
+
+		fd.fd = tds_get_s(tds);
+		fd.events = POLLIN;
+		fd.revents = 0;
+		rc = poll(&fd, 1, wait_ms);
+		if (rc < 0)
+			return -1;
+		if (rc > 0) {
+			if (tds_read_available(tds) < 0 || tds_conn(tds)->tls_session)
+				return 1;
+			continue;
+		}
+		if (wait_ms == 0)
+			return 0;
+	}
+}
+
+/** @} */
@@ -58,6 +58,9 @@ static TDSRET tds_put_param_as_string(TDSSOCKET * tds, TDSPARAMINFO * params, in
 static TDSRET tds_send_emulated_execute(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params);
 static const char *tds_skip_comment(const char *s);
 static int tds_count_placeholders_ucs2le(const char *query, const char *query_end);
+static char *tds_dynamic_cache_key(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDS_UINT * hash);
+static const TDSQUERYDEF *tds7_get_query_def(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params);
+static void tds7_put_converted_query(TDSSOCKET * tds, const char *query, size_t query_len);
 
 #define TDS_PUT_DATA_USE_NAME 1
 #define TDS_PUT_DATA_PREFIX_NAME 2
@@ -264,10 +267,34 @@ static void
 tds_start_query(TDSSOCKET *tds)
 {
 	tds_put_n(tds, tds72_query_start, 10);
-	tds_put_n(tds, tds->tds72_transaction, 8);
+	tds_put_n(tds, tds_conn(tds)->tds72_transaction, 8);
 	tds_put_n(tds, tds72_query_start + 10 + 8, 4);
 }
 
+enum { MUL_STARTED = 1 };
+
+/**
+ * Start a RPC. A single RPC begins a new request, inside a multiple
+ * request RPCs after the first are preceded by the batch separator.
+ * \param tds      state information for the socket and the TDS protocol
+ * \param multiple multiple request or NULL for a single RPC
+ */
+static void
+tds7_start_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple)
+{
+	if (!multiple) {
+		tds->out_flag = TDS_RPC;
+		START_QUERY;
+		return;
+	}
+
+	if (multiple->flags & MUL_STARTED) {
+		/* TODO define constant */
+		tds_put_byte(tds, IS_TDS72_PLUS(tds) ? 0xff : 0x80);
+	}
+	multiple->flags |= MUL_STARTED;
+}
+
 /**
  * tds_submit_query_params() sends a language string to the database server for
  * processing.  TDS 4.2 is a plain text message with a packet type of 0x01,
@@ -330,7 +357,7 @@ tds_submit_query_params(TDSSOCKET * tds, const char *query, TDSPARAMINFO * param
 		size_t converted_query_len;
 		const char *converted_query;
  
-		converted_query = tds_convert_string(tds, tds->char_convs[client2ucs2], query, (int)query_len, &converted_query_len);
+		converted_query = tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2], query, (int)query_len, &converted_query_len);
 		if (!converted_query) {
 			tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
@@ -917,8 +944,8 @@ tds7_build_param_def_from_params(TDSSOCKET * tds, const char* query, size_t quer
 			il = params->columns[i]->column_namelen;
 			ob = param_str + l;
 			ol = size - l;
-			memset(&tds->char_convs[iso2server_metadata]->suppress, 0, sizeof(tds->char_convs[iso2server_metadata]->suppress));
-			if (tds_iconv(tds, tds->char_convs[iso2server_metadata], to_server, &ib, &il, &ob, &ol) == (size_t) - 1)
+			memset(&tds_conn(tds)->char_convs[iso2server_metadata]->suppress, 0, sizeof(tds_conn(tds)->char_convs[iso2server_metadata]->suppress));
+			if (tds_iconv(tds, tds_conn(tds)->char_convs[iso2server_metadata], to_server, &ib, &il, &ob, &ol) == (size_t) - 1)
 				goto Cleanup;
 			l = size - ol;
 		}
@@ -1014,6 +1041,188 @@ tds7_put_params_definition(TDSSOCKET * tds, const char *param_definition, size_t
 	tds_put_n(tds, param_definition, param_length);
 }
 
+/**
+ * Output a query already converted to ucs2le (required by sp_prepare/sp_executesql/sp_prepexec)
+ * \param tds       state information for the socket and the TDS protocol
+ * \param query     query (in ucs2le codings)
+ * \param query_len query length in bytes
+ */
+static void
+tds7_put_converted_query(TDSSOCKET * tds, const char *query, size_t query_len)
+{
+	CHECK_TDS_EXTRA(tds);
+
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, 0);
+	tds_put_byte(tds, SYBNTEXT);	/* must be Ntype */
+	TDS_PUT_INT(tds, query_len);
+	if (IS_TDS71_PLUS(tds))
+		tds_put_n(tds, tds->collation, 5);
+	TDS_PUT_INT(tds, query_len);
+	tds_put_n(tds, query, query_len);
+}
+
+/**
+ * Replace placeholders in a query with "@PX" names as tds7_put_query_params do
+ * \param query     query (in ucs2le codings)
+ * \param query_len query length in bytes
+ * \param out_len   length of returned query in bytes
+ * \return allocated query (in ucs2le codings) or NULL on failure
+ */
+static char *
+tds7_replace_placeholders(const char *query, size_t query_len, size_t *out_len)
+{
+	size_t len;
+	int i, num_placeholders;
+	const char *s, *e;
+	char *out, *p;
+	char buf[24];
+	const char *const query_end = query + query_len;
+
+	num_placeholders = tds_count_placeholders_ucs2le(query, query_end);
+	len = num_placeholders * 2;
+	/* adjust for the length of X */
+	for (i = 10; i <= num_placeholders; i *= 10) {
+		len += num_placeholders - i + 1;
+	}
+	len = 2u * len + query_len;
+
+	/* +1 is to exclude 0 case */
+	if (!(out = (char *) malloc(len + 1)))
+		return NULL;
+
+	p = out;
+	s = query;
+	for (i = 1;; ++i) {
+		e = tds_next_placeholder_ucs2le(s, query_end, 0);
+		assert(e && query <= e && e <= query_end);
+		memcpy(p, s, e - s);
+		p += e - s;
+		if (e == query_end)
+			break;
+		sprintf(buf, "@P%d", i);
+		p += tds_ascii_to_ucs2(p, buf);
+		s = e + 2;
+	}
+	assert(p == out + len);
+	*out_len = len;
+	return out;
+}
+
+/** number of TDS_UINT describing a parameter type in a query cache entry */
+#define TDS_QUERY_DEF_TYPE_LEN 4
+
+/**
+ * Fill what tds_get_column_declaration uses to declare a parameter
+ */
+static void
+tds7_query_def_type(const TDSCOLUMN * curcol, TDS_UINT * type)
+{
+	type[0] = ((TDS_UINT) curcol->on_server.column_type << 8) | (TDS_UINT) curcol->column_varint_size;
+	type[1] = (TDS_UINT) curcol->on_server.column_size;
+	type[2] = (TDS_UINT) curcol->column_size;
+	type[3] = ((TDS_UINT) curcol->column_prec << 8) | (TDS_UINT) curcol->column_scale;
+}
+
+static TDS_UINT
+tds7_query_def_hash(const char *query, TDSPARAMINFO * params)
+{
+	const unsigned char *p;
+	TDS_UINT h = 0, type[TDS_QUERY_DEF_TYPE_LEN];
+	int i, j;
+
+	for (p = (const unsigned char *) query; *p; ++p)
+		h = h * 31u + *p;
+	for (i = 0; params && i < params->num_cols; ++i) {
+		tds7_query_def_type(params->columns[i], type);
+		for (j = 0; j < TDS_QUERY_DEF_TYPE_LEN; ++j)
+			h = h * 31u + type[j];
+	}
+	return h;
+}
+
+static int
+tds7_query_def_match(const TDSQUERYDEF * def, TDS_UINT hash, const char *query, TDSPARAMINFO * params)
+{
+	TDS_UINT type[TDS_QUERY_DEF_TYPE_LEN];
+	unsigned int num_types = params ? params->num_cols * TDS_QUERY_DEF_TYPE_LEN : 0;
+	int i;
+
+	if (!def->query || def->hash != hash || def->num_types != num_types || strcmp(def->query, query) != 0)
+		return 0;
+	for (i = 0; params && i < params->num_cols; ++i) {
+		tds7_query_def_type(params->columns[i], type);
+		if (memcmp(type, def->types + i * TDS_QUERY_DEF_TYPE_LEN, sizeof(type)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Get query and parameters declaration to send to sp_executesql,
+ * sp_prepare or sp_prepexec. Last queries are kept converted in a small
+ * cache so executing again a query with the same parameter types does not
+ * convert and parse it again.
+ * \param tds    state information for the socket and the TDS protocol
+ * \param query  language query with given placeholders (?)
+ * \param params parameters to declare, can be NULL
+ * \return entry valid until next call or NULL on failure
+ */
+static const TDSQUERYDEF *
+tds7_get_query_def(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
+{
+	TDSQUERYDEF *def;
+	TDS_UINT hash;
+	const char *converted_query;
+	size_t converted_query_len;
+	unsigned int i;
+
+	CHECK_TDS_EXTRA(tds);
+
+	hash = tds7_query_def_hash(query, params);
+	for (i = 0; i < TDS_QUERY_CACHE_SIZE; ++i) {
+		def = &tds->query_cache[i];
+		/* big queries are kept only until next call */
+		if (def->ucs2_query_len > TDS_QUERY_CACHE_MAX_LEN) {
+			tds_free_query_def(def);
+			continue;
+		}
+		if (tds7_query_def_match(def, hash, query, params))
+			return def;
+	}
+
+	/* replace entries in turn */
+	def = &tds->query_cache[tds->query_cache_next];
+	tds->query_cache_next = (tds->query_cache_next + 1) % TDS_QUERY_CACHE_SIZE;
+	tds_free_query_def(def);
+
+	if (!(def->query = strdup(query)))
+		goto Cleanup;
+	def->num_types = params ? params->num_cols * TDS_QUERY_DEF_TYPE_LEN : 0;
+	if (def->num_types) {
+		if (!(def->types = (TDS_UINT *) malloc(def->num_types * sizeof(TDS_UINT))))
+			goto Cleanup;
+		for (i = 0; i < (unsigned int) params->num_cols; ++i)
+			tds7_query_def_type(params->columns[i], def->types + i * TDS_QUERY_DEF_TYPE_LEN);
+	}
+
+	converted_query = tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2], query, (int)strlen(query), &converted_query_len);
+	if (!converted_query)
+		goto Cleanup;
+	def->param_def = tds7_build_param_def_from_query(tds, converted_query, converted_query_len, params, &def->param_def_len);
+	def->ucs2_query = tds7_replace_placeholders(converted_query, converted_query_len, &def->ucs2_query_len);
+	tds_convert_string_free(query, converted_query);
+	if (!def->param_def || !def->ucs2_query)
+		goto Cleanup;
+
+	def->hash = hash;
+	return def;
+
+      Cleanup:
+	tds_free_query_def(def);
+	return NULL;
+}
+
 /**
  * tds_submit_prepare() creates a temporary stored procedure in the server.
  * Under TDS 4.2 dynamic statements are emulated building sql command
@@ -1043,6 +1252,10 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 	dyn = tds_alloc_dynamic(tds, id);
 	if (!dyn)
 		return TDS_FAIL;
+
+	/* statement can be reused by tds_dynamic_cache_get when released */
+	if (tds_conn(tds)->dyn_cache_max)
+		dyn->cache_key = tds_dynamic_cache_key(tds, query, params, &dyn->cache_hash);
 	
 	/* TDS5 sometimes cannot accept prepare so we need to store query */
 	if (!IS_TDS7_PLUS(tds)) {
@@ -1069,20 +1282,11 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 	query_len = (int)strlen(query);
 
 	if (IS_TDS7_PLUS(tds)) {
-		size_t definition_len = 0;
-		char *param_definition = NULL;
-		size_t converted_query_len;
-		const char *converted_query;
-
-		converted_query = tds_convert_string(tds, tds->char_convs[client2ucs2], query, query_len, &converted_query_len);
-		if (!converted_query)
-			goto failure;
+		const TDSQUERYDEF *def;
 
-		param_definition = tds7_build_param_def_from_query(tds, converted_query, converted_query_len, params, &definition_len);
-		if (!param_definition) {
-			tds_convert_string_free(query, converted_query);
+		def = tds7_get_query_def(tds, query, params);
+		if (!def)
 			goto failure;
-		}
 
 		tds->out_flag = TDS_RPC;
 		START_QUERY;
@@ -1103,10 +1307,8 @@ tds_submit_prepare(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMI
 		tds_put_byte(tds, 4);
 		tds_put_byte(tds, 0);
 
-		tds7_put_params_definition(tds, param_definition, definition_len);
-		tds7_put_query_params(tds, converted_query, converted_query_len);
-		tds_convert_string_free(query, converted_query);
-		free(param_definition);
+		tds7_put_params_definition(tds, def->param_def, def->param_def_len);
+		tds7_put_converted_query(tds, def->ucs2_query, def->ucs2_query_len);
 
 		/* 1 param ?? why ? flags ?? */
 		tds_put_byte(tds, 0);
@@ -1153,6 +1355,50 @@ failure_nostate:
 	return TDS_FAIL;
 }
 
+/**
+ * Send a query with parameters using sp_executesql (TDS7+)
+ * \param tds      state information for the socket and the TDS protocol
+ * \param query    language query with given placeholders (?)
+ * \param params   parameters to send, can be NULL
+ * \param multiple multiple request or NULL for a single RPC
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+static TDSRET
+tds7_send_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSMULTIPLE * multiple)
+{
+	int i;
+	const TDSQUERYDEF *def;
+
+	def = tds7_get_query_def(tds, query, params);
+	if (!def)
+		return TDS_FAIL;
+
+	tds7_start_rpc(tds, multiple);
+	/* procedure name */
+	if (IS_TDS71_PLUS(tds)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_EXECUTESQL);
+	} else {
+		tds_put_smallint(tds, 13);
+		TDS_PUT_N_AS_UCS2(tds, "sp_executesql");
+	}
+	tds_put_smallint(tds, 0);
+
+	tds7_put_converted_query(tds, def->ucs2_query, def->ucs2_query_len);
+	tds7_put_params_definition(tds, def->param_def, def->param_def_len);
+
+	for (i = 0; params && i < params->num_cols; i++) {
+		TDSCOLUMN *param = params->columns[i];
+		/* TODO check error */
+		tds_put_data_info(tds, param, 0);
+		if (tds_put_data(tds, param) != TDS_SUCCESS)
+			return TDS_FAIL;
+	}
+
+	tds->internal_sp_called = TDS_SP_EXECUTESQL;
+	return TDS_SUCCESS;
+}
+
 /**
  * Submit a prepared query with parameters
  * \param tds     state information for the socket and the TDS protocol
@@ -1164,7 +1410,6 @@ TDSRET
 tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
 {
 	size_t query_len;
-	TDSCOLUMN *param;
 	TDSDYNAMIC *dyn;
 	size_t id_len;
 
@@ -1176,54 +1421,13 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
 	query_len = strlen(query);
 
 	if (IS_TDS7_PLUS(tds)) {
-		size_t definition_len = 0;
-		int i;
-		char *param_definition = NULL;
-		size_t converted_query_len;
-		const char *converted_query;
-
 		if (tds_set_state(tds, TDS_QUERYING) != TDS_QUERYING)
 			return TDS_FAIL;
 
-		converted_query = tds_convert_string(tds, tds->char_convs[client2ucs2], query, (int)query_len, &converted_query_len);
-		if (!converted_query) {
+		if (tds7_send_execdirect(tds, query, params, NULL) != TDS_SUCCESS) {
 			tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
 		}
-
-		param_definition = tds7_build_param_def_from_query(tds, converted_query, converted_query_len, params, &definition_len);
-		if (!param_definition) {
-			tds_convert_string_free(query, converted_query);
-			tds_set_state(tds, TDS_IDLE);
-			return TDS_FAIL;
-		}
-
-		tds->out_flag = TDS_RPC;
-		START_QUERY;
-		/* procedure name */
-		if (IS_TDS71_PLUS(tds)) {
-			tds_put_smallint(tds, -1);
-			tds_put_smallint(tds, TDS_SP_EXECUTESQL);
-		} else {
-			tds_put_smallint(tds, 13);
-			TDS_PUT_N_AS_UCS2(tds, "sp_executesql");
-		}
-		tds_put_smallint(tds, 0);
-
-		tds7_put_query_params(tds, converted_query, converted_query_len);
-		tds7_put_params_definition(tds, param_definition, definition_len);
-		tds_convert_string_free(query, converted_query);
-		free(param_definition);
-
-		for (i = 0; i < params->num_cols; i++) {
-			param = params->columns[i];
-			/* TODO check error */
-			tds_put_data_info(tds, param, 0);
-			if (tds_put_data(tds, param) != TDS_SUCCESS)
-				return TDS_FAIL;
-		}
-
-		tds->internal_sp_called = TDS_SP_EXECUTESQL;
 		return tds_query_flush_packet(tds);
 	}
 
@@ -1303,13 +1507,9 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
 TDSRET
 tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYNAMIC ** dyn_out, TDSPARAMINFO * params)
 {
-	int query_len;
 	TDSRET rc;
 	TDSDYNAMIC *dyn;
-	size_t definition_len = 0;
-	char *param_definition = NULL;
-	size_t converted_query_len;
-	const char *converted_query;
+	const TDSQUERYDEF *def;
 
 	CHECK_TDS_EXTRA(tds);
 	if (params)
@@ -1323,6 +1523,9 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 	if (!dyn)
 		return TDS_FAIL;
 
+	if (tds_conn(tds)->dyn_cache_max)
+		dyn->cache_key = tds_dynamic_cache_key(tds, query, params, &dyn->cache_hash);
+
 	tds->cur_dyn = dyn;
 
 	if (dyn_out)
@@ -1331,18 +1534,10 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 	if (tds_set_state(tds, TDS_QUERYING) != TDS_QUERYING)
 		goto failure_nostate;
 
-	query_len = (int)strlen(query);
-
-	converted_query = tds_convert_string(tds, tds->char_convs[client2ucs2], query, query_len, &converted_query_len);
-	if (!converted_query)
+	def = tds7_get_query_def(tds, query, params);
+	if (!def)
 		goto failure;
 
-	param_definition = tds7_build_param_def_from_query(tds, converted_query, converted_query_len, params, &definition_len);
-	if (!param_definition) {
-		tds_convert_string_free(query, converted_query);
-		goto failure;
-	}
-
 	tds->out_flag = TDS_RPC;
 	START_QUERY;
 	/* procedure name */
@@ -1362,10 +1557,8 @@ tds71_submit_prepexec(TDSSOCKET * tds, const char *query, const char *id, TDSDYN
 	tds_put_byte(tds, 4);
 	tds_put_byte(tds, 0);
 
-	tds7_put_params_definition(tds, param_definition, definition_len);
-	tds7_put_query_params(tds, converted_query, converted_query_len);
-	tds_convert_string_free(query, converted_query);
-	free(param_definition);
+	tds7_put_params_definition(tds, def->param_def, def->param_def_len);
+	tds7_put_converted_query(tds, def->ucs2_query, def->ucs2_query_len);
 
 	if (params) {
 		int i;
@@ -1461,7 +1654,7 @@ tds_put_data_info(TDSSOCKET * tds, TDSCOLUMN * curcol, int flags)
 
 			/* TODO use a fixed buffer to avoid error ? */
 			converted_param =
-				tds_convert_string(tds, tds->char_convs[client2ucs2], curcol->column_name, len,
+				tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2], curcol->column_name, len,
 						   &converted_param_len);
 			if (!converted_param)
 				return TDS_FAIL;
@@ -1758,6 +1951,169 @@ tds_submit_unprepare(TDSSOCKET * tds, TDSDYNAMIC * dyn)
 	return tds_query_flush_packet(tds);
 }
 
+/**
+ * Build the key used to find a statement in the prepared statements cache.
+ * Spaces outside quoted strings and comments are collapsed so queries
+ * differing only in layout share the same server handle. Under TDS7+ the
+ * declaration of the parameters is part of the key, the server compiled
+ * the statement for these types.
+ * \param tds    state information for the socket and the TDS protocol
+ * \param query  language query with given placeholders (?)
+ * \param params parameters used to prepare, can be NULL
+ * \param hash   will receive hash of the key
+ * \return allocated key or NULL on failure
+ */
+static char *
+tds_dynamic_cache_key(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDS_UINT * hash)
+{
+	size_t len = strlen(query) + 2;
+	const char *p, *end;
+	char *key, *out;
+	TDS_UINT h = 0;
+	int i;
+
+	/* see tds7_build_param_def_from_query, every declaration fit in 40 bytes */
+	if (!IS_TDS7_PLUS(tds))
+		params = NULL;
+	if (params)
+		len += params->num_cols * 40u;
+
+	if (!(key = (char *) malloc(len)))
+		return NULL;
+
+	out = key;
+	for (i = 0; params && i < params->num_cols; ++i) {
+		if (tds_get_column_declaration(tds, params->columns[i], out) == TDS_FAIL) {
+			free(key);
+			return NULL;
+		}
+		out = strchr(out, 0);
+		*out++ = ',';
+	}
+	*out++ = '|';
+
+	for (p = query; isspace((unsigned char) *p); ++p)
+		continue;
+	while (*p) {
+		switch (*p) {
+		case '\'':
+		case '\"':
+		case '[':
+			end = tds_skip_quoted(p);
+			break;
+		case '-':
+		case '/':
+			end = tds_skip_comment(p);
+			/* keep new line terminating the comment */
+			if (*end == '\n')
+				++end;
+			break;
+		default:
+			if (!isspace((unsigned char) *p)) {
+				end = p + 1;
+				break;
+			}
+			while (isspace((unsigned char) *p))
+				++p;
+			if (*p)
+				*out++ = ' ';
+			continue;
+		}
+		memcpy(out, p, end - p);
+		out += end - p;
+		p = end;
+	}
+	*out = 0;
+
+	for (p = key; *p; ++p)
+		h = h * 31u + (unsigned char) *p;
+	*hash = h;
+	return key;
+}
+
+/**
+ * Get a prepared statement from the connection cache.
+ * The statement is removed from the cache and can be executed directly,
+ * give it back with tds_dynamic_cache_put when done.
+ * \param tds    state information for the socket and the TDS protocol
+ * \param query  language query with given placeholders (?)
+ * \param params parameters to use, can be NULL
+ * \return statement or NULL if not found (query must be prepared)
+ */
+TDSDYNAMIC *
+tds_dynamic_cache_get(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	TDSDYNAMIC *dyn, **pcurr;
+	TDS_UINT hash;
+	char *key;
+
+	CHECK_TDS_EXTRA(tds);
+
+	if (!conn->dyn_cache_max || !query)
+		return NULL;
+
+	if (!(key = tds_dynamic_cache_key(tds, query, params, &hash)))
+		return NULL;
+
+	for (pcurr = &conn->dyn_cache; (dyn = *pcurr) != NULL; pcurr = &dyn->cache_next) {
+		if (dyn->cache_hash != hash || strcmp(dyn->cache_key, key) != 0)
+			continue;
+		*pcurr = dyn->cache_next;
+		dyn->cache_next = NULL;
+		--conn->dyn_cache_count;
+		++conn->dyn_cache_hits;
+		free(key);
+		tdsdump_log(TDS_DBG_INFO1, "tds_dynamic_cache_get() reusing %s\n", dyn->id);
+		return dyn;
+	}
+
+	++conn->dyn_cache_misses;
+	free(key);
+	return NULL;
+}
+
+/**
+ * Release a prepared statement to the connection cache.
+ * If cache is full the least recently used statement is evicted.
+ * \param tds state information for the socket and the TDS protocol
+ * \param dyn statement no more used by caller
+ * \return statement to unprepare and free (\a dyn itself if it cannot
+ *         be cached or an evicted one) or NULL if nothing is left to do
+ */
+TDSDYNAMIC *
+tds_dynamic_cache_put(TDSSOCKET * tds, TDSDYNAMIC * dyn)
+{
+	TDSSOCKETCONN *conn = tds_conn(tds);
+	TDSDYNAMIC *curr, **pcurr;
+
+	CHECK_TDS_EXTRA(tds);
+
+	/* only statements really prepared on server can be reused */
+	if (!dyn || !conn->dyn_cache_max || !dyn->cache_key || !tds_needs_unprepare(tds, dyn))
+		return dyn;
+
+	/* keep a single handle for every statement */
+	for (curr = conn->dyn_cache; curr; curr = curr->cache_next)
+		if (curr->cache_hash == dyn->cache_hash && strcmp(curr->cache_key, dyn->cache_key) == 0)
+			return dyn;
+
+	tds_free_input_params(dyn);
+	dyn->cache_next = conn->dyn_cache;
+	conn->dyn_cache = dyn;
+	if (++conn->dyn_cache_count <= conn->dyn_cache_max)
+		return NULL;
+
+	/* evict least recently used */
+	for (pcurr = &conn->dyn_cache; (*pcurr)->cache_next; pcurr = &(*pcurr)->cache_next)
+		continue;
+	curr = *pcurr;
+	*pcurr = NULL;
+	--conn->dyn_cache_count;
+	tdsdump_log(TDS_DBG_INFO1, "tds_dynamic_cache_put() evicting %s\n", curr->id);
+	return curr;
+}
+
 static TDSRET
 tds_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
 {
@@ -1805,7 +2161,52 @@ tds_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * para
 		sep = ",";
 	}
 
-	return tds_query_flush_packet(tds);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send a RPC (TDS7+)
+ * \param tds      state information for the socket and the TDS protocol
+ * \param rpc_name name of RPC
+ * \param params   parameters informations. NULL for no parameters
+ * \param multiple multiple request or NULL for a single RPC
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+static TDSRET
+tds7_send_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDSMULTIPLE * multiple)
+{
+	TDSCOLUMN *param;
+	int i;
+	int num_params = params ? params->num_cols : 0;
+	const char *converted_name;
+	size_t converted_name_len;
+
+	/* procedure name */
+	converted_name = tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2], rpc_name, (int)strlen(rpc_name), &converted_name_len);
+	if (!converted_name)
+		return TDS_FAIL;
+	tds7_start_rpc(tds, multiple);
+	TDS_PUT_SMALLINT(tds, converted_name_len / 2);
+	tds_put_n(tds, converted_name, (int)converted_name_len);
+	tds_convert_string_free(rpc_name, converted_name);
+
+	/*
+	 * TODO support flags
+	 * bit 0 (1 as flag) in TDS7/TDS5 is "recompile"
+	 * bit 1 (2 as flag) in TDS7+ is "no metadata" bit 
+	 * (I don't know meaning of "no metadata")
+	 */
+	tds_put_smallint(tds, 0);
+
+	for (i = 0; i < num_params; i++) {
+		param = params->columns[i];
+		/* TODO check error */
+		tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME);
+		/* FIXME handle error */
+		tds_put_data(tds, param);
+	}
+
+	return TDS_SUCCESS;
 }
 
 /**
@@ -1817,8 +2218,7 @@ tds_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * para
 TDSRET
 tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
 {
-	TDSCOLUMN *param;
-	int rpc_name_len, i;
+	int rpc_name_len;
 	int num_params = params ? params->num_cols : 0;
 
 	CHECK_TDS_EXTRA(tds);
@@ -1836,37 +2236,10 @@ tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
 
 	rpc_name_len = (int)strlen(rpc_name);
 	if (IS_TDS7_PLUS(tds)) {
-		const char *converted_name;
-		size_t converted_name_len;
-
-		tds->out_flag = TDS_RPC;
-		/* procedure name */
-		converted_name = tds_convert_string(tds, tds->char_convs[client2ucs2], rpc_name, rpc_name_len, &converted_name_len);
-		if (!converted_name) {
+		if (tds7_send_rpc(tds, rpc_name, params, NULL) != TDS_SUCCESS) {
 			tds_set_state(tds, TDS_IDLE);
 			return TDS_FAIL;
 		}
-		START_QUERY;
-		TDS_PUT_SMALLINT(tds, converted_name_len / 2);
-		tds_put_n(tds, converted_name, (int)converted_name_len);
-		tds_convert_string_free(rpc_name, converted_name);
-
-		/*
-		 * TODO support flags
-		 * bit 0 (1 as flag) in TDS7/TDS5 is "recompile"
-		 * bit 1 (2 as flag) in TDS7+ is "no metadata" bit 
-		 * (I don't know meaning of "no metadata")
-		 */
-		tds_put_smallint(tds, 0);
-
-		for (i = 0; i < num_params; i++) {
-			param = params->columns[i];
-			/* TODO check error */
-			tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME);
-			/* FIXME handle error */
-			tds_put_data(tds, param);
-		}
-
 		return tds_query_flush_packet(tds);
 	}
 
@@ -1890,8 +2263,11 @@ tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
 	}
 
 	/* emulate it for TDS4.x, send RPC for mssql */
-	if (tds->tds_version < 0x500)
-		return tds_send_emulated_rpc(tds, rpc_name, params);
+	if (tds->tds_version < 0x500) {
+		if (tds_send_emulated_rpc(tds, rpc_name, params) != TDS_SUCCESS)
+			return TDS_FAIL;
+		return tds_query_flush_packet(tds);
+	}
 
 	/* TODO continue, support for TDS4?? */
 	tds_set_state(tds, TDS_IDLE);
@@ -2122,7 +2498,7 @@ tds_cursor_open(TDSSOCKET * tds, TDSCURSOR * cursor, TDSPARAMINFO *params, int *
 		int num_params = params ? params->num_cols : 0;
 
 		/* cursor statement */
-		converted_query = tds_convert_string(tds, tds->char_convs[client2ucs2],
+		converted_query = tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2],
 						     cursor->query, (int)strlen(cursor->query), &converted_query_len);
 		if (!converted_query) {
 			if (!*something_to_send)
@@ -2748,7 +3124,7 @@ tds_cursor_update(TDSSOCKET * tds, TDSCURSOR * cursor, TDS_CURSOR_OPERATION op,
 			}
 			if (table_name) {
 				converted_table =
-					tds_convert_string(tds, tds->char_convs[client2ucs2], 
+					tds_convert_string(tds, tds_conn(tds)->char_convs[client2ucs2], 
 							   table_name, (int)strlen(table_name), &converted_table_len);
 				if (!converted_table) {
 					/* FIXME not here, in the middle of a packet */
@@ -3004,8 +3380,6 @@ tds_send_emulated_execute(TDSSOCKET * tds, const char *query, TDSPARAMINFO * par
 	return TDS_SUCCESS;
 }
 
-enum { MUL_STARTED = 1 };
-
 TDSRET
 tds_multiple_init(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDS_MULTIPLE_TYPE type)
 {
@@ -3015,16 +3389,13 @@ tds_multiple_init(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDS_MULTIPLE_TYPE type)
 	if (tds_set_state(tds, TDS_QUERYING) != TDS_QUERYING)
 		return TDS_FAIL;
 
+	/*
+	 * TDS7+ send every statement as a RPC (sp_executesql for queries),
+	 * older protocols pack them in a language batch
+	 */
 	tds->out_flag = TDS_QUERY;
-	switch (type) {
-	case TDS_MULTIPLE_QUERY:
-		break;
-	case TDS_MULTIPLE_EXECUTE:
-	case TDS_MULTIPLE_RPC:
-		if (IS_TDS7_PLUS(tds))
-			tds->out_flag = TDS_RPC;
-		break;
-	}
+	if (IS_TDS7_PLUS(tds))
+		tds->out_flag = TDS_RPC;
 	START_QUERY;
 
 	return TDS_SUCCESS;
@@ -3035,6 +3406,10 @@ tds_multiple_done(TDSSOCKET *tds, TDSMULTIPLE *multiple)
 {
 	assert(tds && multiple);
 
+	if (multiple->type == TDS_MULTIPLE_QUERY && IS_TDS7_PLUS(tds)) {
+		tds->multiple_query = 1;
+		tds->multiple_stmt_done = 0;
+	}
 	return tds_query_flush_packet(tds);
 }
 
@@ -3043,6 +3418,9 @@ tds_multiple_query(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDS
 {
 	assert(multiple->type == TDS_MULTIPLE_QUERY);
 
+	if (IS_TDS7_PLUS(tds))
+		return tds7_send_execdirect(tds, query, params, multiple);
+
 	if (multiple->flags & MUL_STARTED)
 		tds_put_string(tds, " ", 1);
 	multiple->flags |= MUL_STARTED;
@@ -3056,12 +3434,7 @@ tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn)
 	assert(multiple->type == TDS_MULTIPLE_EXECUTE);
 
 	if (IS_TDS7_PLUS(tds)) {
-		if (multiple->flags & MUL_STARTED) {
-			/* TODO define constant */
-			tds_put_byte(tds, IS_TDS72_PLUS(tds) ? 0xff : 0x80);
-		}
-		multiple->flags |= MUL_STARTED;
-
+		tds7_start_rpc(tds, multiple);
 		tds7_send_execute(tds, dyn);
 
 		return TDS_SUCCESS;
@@ -3074,6 +3447,248 @@ tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn)
 	return tds_send_emulated_execute(tds, dyn->query, dyn->params);
 }
 
+TDSRET
+tds_multiple_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *rpc_name, TDSPARAMINFO * params)
+{
+	assert(multiple->type == TDS_MULTIPLE_RPC);
+
+	/* distinguish from dynamic query  */
+	tds->cur_dyn = NULL;
+
+	if (IS_TDS7_PLUS(tds))
+		return tds7_send_rpc(tds, rpc_name, params, multiple);
+
+	if (multiple->flags & MUL_STARTED) {
+		int i;
+
+		/* emulation declares output parameters, cannot declare them twice in a batch */
+		for (i = 0; params && i < params->num_cols; ++i)
+			if (params->columns[i]->column_output)
+				return TDS_FAIL;
+		tds_put_string(tds, " ", 1);
+	}
+	multiple->flags |= MUL_STARTED;
+
+	return tds_send_emulated_rpc(tds, rpc_name, params);
+}
+
+/**
+ * Put the mark call separating two pipelined requests.
+ * The mark is a sp_executesql of an empty query with a TDS_PIPELINE_MARK
+ * output parameter. Only a RPC sends output parameters back, the DONEPROC
+ * following it ends the response of previous request.
+ * \param tds      state information for the socket and the TDS protocol
+ * \param multiple pipeline multiple request
+ */
+static void
+tds7_put_pipeline_mark(TDSSOCKET * tds, TDSMULTIPLE * multiple)
+{
+	static const char def[] = TDS_PIPELINE_MARK " int OUTPUT";
+	char buf[sizeof(def) * 2 - 2];
+
+	tds7_start_rpc(tds, multiple);
+	if (IS_TDS71_PLUS(tds)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_EXECUTESQL);
+	} else {
+		tds_put_smallint(tds, 13);
+		TDS_PUT_N_AS_UCS2(tds, "sp_executesql");
+	}
+	tds_put_smallint(tds, 0);
+
+	/* empty query */
+	tds7_put_converted_query(tds, "", 0);
+
+	/* parameters definition */
+	tds7_put_converted_query(tds, buf, tds_ascii_to_ucs2(buf, def));
+
+	/* NULL int output parameter */
+	tds_put_byte(tds, sizeof(TDS_PIPELINE_MARK) - 1);
+	TDS_PUT_N_AS_UCS2(tds, TDS_PIPELINE_MARK);
+	tds_put_byte(tds, 1);
+	tds_put_byte(tds, SYBINTN);
+	tds_put_byte(tds, 4);
+	tds_put_byte(tds, 0);
+}
+
+/**
+ * Prepare a new pipelined request. First request starts the multiple
+ * RPC which will contain all requests.
+ * \param tds state information for the socket and the TDS protocol
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+static TDSRET
+tds_pipeline_start(TDSSOCKET * tds)
+{
+	TDSPIPELINE *pipeline = &tds->pipeline;
+
+	/* requests are packed in a multiple RPC, not available before TDS7 */
+	if (!IS_TDS7_PLUS(tds))
+		return TDS_FAIL;
+
+	if (pipeline->num_requests >= pipeline->sp_called_size) {
+		unsigned int size = pipeline->sp_called_size ? pipeline->sp_called_size * 2 : 16;
+		TDS_TINYINT *p = (TDS_TINYINT *) realloc(pipeline->sp_called, size);
+
+		if (!p)
+			return TDS_FAIL;
+		pipeline->sp_called = p;
+		pipeline->sp_called_size = size;
+	}
+
+	if (pipeline->num_requests == 0) {
+		if (tds_set_state(tds, TDS_QUERYING) != TDS_QUERYING)
+			return TDS_FAIL;
+		pipeline->multiple.type = TDS_MULTIPLE_RPC;
+		pipeline->multiple.flags = 0;
+		pipeline->current = 0;
+		pipeline->boundary = 0;
+		pipeline->held_status = 0;
+		pipeline->mark = 0;
+		pipeline->param_pending = 0;
+		tds->out_flag = TDS_RPC;
+		START_QUERY;
+	} else if (tds->state != TDS_QUERYING) {
+		/* pipeline already sent */
+		tdserror(tds_get_ctx(tds), tds, TDSERPND, 0);
+		return TDS_FAIL;
+	} else {
+		tds7_put_pipeline_mark(tds, &pipeline->multiple);
+	}
+
+	tds->cur_dyn = NULL;
+	tds->internal_sp_called = 0;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Complete a pipelined request.
+ * \param tds state information for the socket and the TDS protocol
+ * \param rc  result of the request
+ * \return rc
+ */
+static TDSRET
+tds_pipeline_end(TDSSOCKET * tds, TDSRET rc)
+{
+	TDSPIPELINE *pipeline = &tds->pipeline;
+
+	/* request can be partially written, discard the whole pipeline */
+	if (rc != TDS_SUCCESS) {
+		tds_set_state(tds, TDS_IDLE);
+		return rc;
+	}
+
+	/* processing tokens of every response depends on RPC sent */
+	pipeline->sp_called[pipeline->num_requests++] = (TDS_TINYINT) tds->internal_sp_called;
+	tds->internal_sp_called = 0;
+	return rc;
+}
+
+/**
+ * Queue a query in the connection pipeline (TDS7+). Queued requests
+ * are sent all together by tds_pipeline_send().
+ * \param tds    state information for the socket and the TDS protocol
+ * \param query  language query with given placeholders (?)
+ * \param params parameters of query, can be NULL
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_pipeline_query(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params)
+{
+	CHECK_TDS_EXTRA(tds);
+
+	if (!query || tds_pipeline_start(tds) != TDS_SUCCESS)
+		return TDS_FAIL;
+
+	return tds_pipeline_end(tds, tds7_send_execdirect(tds, query, params, &tds->pipeline.multiple));
+}
+
+/**
+ * Queue a RPC in the connection pipeline (TDS7+).
+ * \param tds      state information for the socket and the TDS protocol
+ * \param rpc_name name of RPC
+ * \param params   parameters informations. NULL for no parameters
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_pipeline_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
+{
+	CHECK_TDS_EXTRA(tds);
+
+	if (!rpc_name || tds_pipeline_start(tds) != TDS_SUCCESS)
+		return TDS_FAIL;
+
+	return tds_pipeline_end(tds, tds7_send_rpc(tds, rpc_name, params, &tds->pipeline.multiple));
+}
+
+/**
+ * Queue the execution of a prepared statement in the connection pipeline (TDS7+).
+ * \param tds state information for the socket and the TDS protocol
+ * \param dyn dynamic statement to execute, parameters are taken from dyn->params
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_pipeline_execute(TDSSOCKET * tds, TDSDYNAMIC * dyn)
+{
+	CHECK_TDS_EXTRA(tds);
+	CHECK_DYNAMIC_EXTRA(dyn);
+
+	if (dyn->num_id == 0 || tds_pipeline_start(tds) != TDS_SUCCESS)
+		return TDS_FAIL;
+
+	tds7_start_rpc(tds, &tds->pipeline.multiple);
+	tds7_send_execute(tds, dyn);
+	return tds_pipeline_end(tds, TDS_SUCCESS);
+}
+
+/**
+ * Send all requests queued in the connection pipeline.
+ * Responses are read in order with tds_process_tokens(). At the end of
+ * every response but the last tds_process_tokens() returns
+ * TDS_NO_MORE_RESULTS and keeps doing it till tds_pipeline_next() is called.
+ * \param tds state information for the socket and the TDS protocol
+ * \return TDS_FAIL or TDS_SUCCESS
+ */
+TDSRET
+tds_pipeline_send(TDSSOCKET * tds)
+{
+	TDSPIPELINE *pipeline = &tds->pipeline;
+
+	CHECK_TDS_EXTRA(tds);
+
+	if (!pipeline->num_requests || tds->state != TDS_QUERYING)
+		return TDS_FAIL;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_pipeline_send() %u requests\n", pipeline->num_requests);
+
+	tds->internal_sp_called = pipeline->sp_called[0];
+	return tds_query_flush_packet(tds);
+}
+
+/**
+ * Move to the response of next pipelined request.
+ * Results of previous request are freed.
+ * \param tds state information for the socket and the TDS protocol
+ * \return TDS_SUCCESS, TDS_FAIL if current response is not complete or was the last one
+ */
+TDSRET
+tds_pipeline_next(TDSSOCKET * tds)
+{
+	TDSPIPELINE *pipeline = &tds->pipeline;
+
+	if (!pipeline->boundary)
+		return TDS_FAIL;
+
+	pipeline->boundary = 0;
+	++pipeline->current;
+	tdsdump_log(TDS_DBG_FUNC, "tds_pipeline_next() reading response %u\n", pipeline->current);
+
+	tds_free_all_results(tds);
+	tds->rows_affected = TDS_NO_COUNT;
+	tds->internal_sp_called = pipeline->sp_called[pipeline->current];
+	return TDS_SUCCESS;
+}
+
 TDSRET
 tds_submit_optioncmd(TDSSOCKET * tds, TDS_OPTION_CMD command, TDS_OPTION option, TDS_OPTION_ARG *param, TDS_INT param_size)
 {
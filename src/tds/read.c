@@ -98,10 +98,11 @@ tds_peek(TDSSOCKET * tds)
 
 
 /**
- * Get an int16 from the server.
+ * Get an int16 from the server, data can cross packets.
+ * Called by tds_get_smallint if bytes are not all in buffer.
  */
 TDS_SMALLINT
-tds_get_smallint(TDSSOCKET * tds)
+tds_get_smallint_slow(TDSSOCKET * tds)
 {
 	unsigned char bytes[2];
 
@@ -115,10 +116,11 @@ tds_get_smallint(TDSSOCKET * tds)
 
 
 /**
- * Get an int32 from the server.
+ * Get an int32 from the server, data can cross packets.
+ * Called by tds_get_int if bytes are not all in buffer.
  */
 TDS_INT
-tds_get_int(TDSSOCKET * tds)
+tds_get_int_slow(TDSSOCKET * tds)
 {
 	unsigned char bytes[4];
 
@@ -130,8 +132,12 @@ tds_get_int(TDSSOCKET * tds)
 	return (TDS_INT) TDS_GET_A4(bytes);
 }
 
+/**
+ * Get an int64 from the server, data can cross packets.
+ * Called by tds_get_int8 if bytes are not all in buffer.
+ */
 TDS_INT8
-tds_get_int8(TDSSOCKET * tds)
+tds_get_int8_slow(TDSSOCKET * tds)
 {
 	TDS_INT h;
 	TDS_UINT l;
@@ -153,6 +159,27 @@ tds_get_int8(TDSSOCKET * tds)
 	return (((TDS_INT8) h) << 32) | l;
 }
 
+/**
+ * Called by tds_get_span if not enough data are in buffer.
+ * Reads a new packet if all current one was consumed.
+ * \return pointer to data or NULL if data are split among packets
+ */
+const unsigned char *
+tds_get_span_slow(TDSSOCKET * tds, unsigned int n)
+{
+	const unsigned char *p;
+
+	while (tds->in_pos >= tds->in_len) {
+		if (tds_read_packet(tds) < 0)
+			return NULL;
+	}
+	if (tds->in_len - tds->in_pos < n)
+		return NULL;
+	p = tds->in_buf + tds->in_pos;
+	tds->in_pos += n;
+	return p;
+}
+
 #if ENABLE_EXTRA_CHECKS
 # define TEMP_INIT(s) char* temp = (char*)malloc(32); const size_t temp_size = 32
 # define TEMP_FREE free(temp);
@@ -199,7 +226,7 @@ tds_get_string(TDSSOCKET * tds, int string_len, char *dest, size_t dest_size)
 			return string_len;
 		}
 
-		return read_and_convert(tds, tds->char_convs[client2ucs2], &wire_bytes, &dest, &dest_size);
+		return read_and_convert(tds, tds_conn(tds)->char_convs[client2ucs2], &wire_bytes, &dest, &dest_size);
 	} else {
 		/* FIXME convert to client charset */
 		assert(dest_size >= (size_t) string_len);
@@ -337,6 +364,25 @@ read_and_convert(TDSSOCKET * tds, const TDSICONV * char_conv, size_t * wire_size
 	
 	for (bufp = temp; *wire_size > 0 && *outbytesleft > 0; bufp = temp + bufleft) {
 		assert(bufp >= temp);
+
+		/* built-in converters are fast, convert straight from packet avoiding the copy */
+		if (!bufleft && (char_conv->flags & TDS_ENCODING_NATIVE)
+		    && (tds->in_pos < tds->in_len || tds_read_packet(tds) >= 0) && tds->in_pos < tds->in_len) {
+			const char *ib = (const char *) tds->in_buf + tds->in_pos;
+			size_t avail = tds->in_len - tds->in_pos, il;
+
+			if (avail > *wire_size)
+				avail = *wire_size;
+			il = avail;
+			/* a character split between packets is handled below */
+			suppress->einval = 1;
+			tds_iconv(tds, char_conv, to_client, &ib, &il, outbuf, outbytesleft);
+			tds->in_pos += avail - il;
+			*wire_size -= avail - il;
+			if (il != avail)
+				continue;
+		}
+
 		/* read a chunk of data */
 		bufleft = TEMP_SIZE - bufleft;
 		if (bufleft > *wire_size)
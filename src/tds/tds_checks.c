@@ -109,7 +109,7 @@ tds_check_tds_extra(const TDSSOCKET * tds)
 
 	/* test cursors */
 	found = 0;
-	for (cur_cursor = tds->cursors; cur_cursor != NULL; cur_cursor = cur_cursor->next) {
+	for (cur_cursor = tds_conn(tds)->cursors; cur_cursor != NULL; cur_cursor = cur_cursor->next) {
 		tds_check_cursor_extra(cur_cursor);
 		if (tds->current_results == cur_cursor->res_info)
 			result_found = 1;
@@ -120,12 +120,13 @@ tds_check_tds_extra(const TDSSOCKET * tds)
 
 	/* test num_dyms, cur_dyn, dyns */
 	found = 0;
-	for (cur_dyn = tds->dyns; cur_dyn != NULL; cur_dyn = cur_dyn->next) {
+	for (cur_dyn = tds_conn(tds)->dyns; cur_dyn != NULL; cur_dyn = cur_dyn->next) {
 		if (cur_dyn == tds->cur_dyn)
 			found = 1;
 		tds_check_dynamic_extra(cur_dyn);
 		if (tds->current_results == cur_dyn->res_info)
 			result_found = 1;
+		assert(tds_name_index_find(&tds_conn(tds)->dyn_index, cur_dyn->id, strlen(cur_dyn->id)) == cur_dyn);
 	}
 	assert(found || tds->cur_dyn == NULL);
 
@@ -0,0 +1,111 @@
+#!/usr/bin/perl
+
+#
+# $Id: tds_convert_table.pl,v 1.1 2011/09/08 11:05:37 freddy77 Exp $
+# Build table of converters used by tds_get_converter.
+# Conversions not listed in __DATA__ use tds_convert.
+#
+
+use strict;
+
+# groups of types
+my %groups = (
+	'CHAR'   => [qw(SYBCHAR SYBVARCHAR SYBTEXT XSYBCHAR XSYBVARCHAR)],
+	'CHARS'  => [qw(SYBCHAR SYBVARCHAR SYBTEXT XSYBCHAR XSYBVARCHAR TDS_CONVERT_CHAR)],
+	'DATES'  => [qw(SYBDATETIME SYBDATETIME4 SYBMSTIME SYBMSDATE SYBMSDATETIME2 SYBMSDATETIMEOFFSET)],
+);
+
+sub expand($)
+{
+	my $name = shift;
+	return @{$groups{$name}} if exists $groups{$name};
+	return ($name);
+}
+
+my @types;
+my %index;
+my %converters;
+
+sub add_type($)
+{
+	my $type = shift;
+	return if exists $index{$type};
+	push @types, $type;
+	$index{$type} = scalar(@types);
+}
+
+while (<DATA>) {
+	s/#.*//;
+	next if /^\s*$/;
+	my ($from, $to, $func) = split;
+	foreach my $f (expand($from)) {
+		add_type($f);
+		foreach my $t (expand($to)) {
+			add_type($t);
+			$converters{"$f,$t"} = $func;
+		}
+	}
+}
+
+my $id = '$Id: tds_convert_table.pl,v 1.1 2011/09/08 11:05:37 freddy77 Exp $';
+$id =~ s/\$Id/CVS Id/;
+$id =~ s/\$\s*$//;
+print qq|/*
+ * This file produced from $0
+ * $id
+ */
+
+|;
+
+my $num = scalar(@types) + 1;
+
+print qq|/** Return index of type in tds_converters, 0 for types without specialized converters */
+static int
+tds_convert_type_index(int type)
+{
+	switch (type) {
+|;
+foreach my $type (@types) {
+	print qq|	case $type:
+		return $index{$type};
+|;
+}
+print qq|	}
+	return 0;
+}
+
+/** Converters by source and destination type index */
+static const TDS_CONVERT_FUNC tds_converters[$num][$num] = {
+|;
+foreach my $from ('', @types) {
+	my @row = map { $converters{"$from,$_"} || 'tds_convert' } ('', @types);
+	print "\t/* " . ($from || 'other types') . " */\n";
+	print "\t{ " . join(",\n\t  ", @row) . " },\n";
+}
+print "};\n";
+
+__DATA__
+# source	destination	converter
+CHAR		SYBINT4		tds_conv_char_int4
+CHAR		SYBINT8		tds_conv_char_int8
+CHAR		DATES		tds_conv_char_datetime
+SYBINT1		CHARS		tds_conv_int1_char
+SYBINT2		CHARS		tds_conv_int2_char
+SYBINT4		CHARS		tds_conv_int4_char
+SYBINT8		CHARS		tds_conv_int8_char
+SYBMONEY	CHARS		tds_conv_money_char
+SYBMONEY4	CHARS		tds_conv_money4_char
+SYBINT1		SYBINT4		tds_conv_int1_int4
+SYBINT2		SYBINT4		tds_conv_int2_int4
+SYBINT4		SYBINT8		tds_conv_int4_int8
+# same type, just copy
+SYBINT1		SYBINT1		tds_conv_copy1
+SYBINT2		SYBINT2		tds_conv_copy2
+SYBINT4		SYBINT4		tds_conv_copy4
+SYBREAL		SYBREAL		tds_conv_copy4
+SYBMONEY4	SYBMONEY4	tds_conv_copy4
+SYBDATETIME4	SYBDATETIME4	tds_conv_copy4
+SYBINT8		SYBINT8		tds_conv_copy8
+SYBFLT8		SYBFLT8		tds_conv_copy8
+SYBMONEY	SYBMONEY	tds_conv_copy8
+SYBDATETIME	SYBDATETIME	tds_conv_copy8
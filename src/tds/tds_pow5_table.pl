@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+
+#
+# $Id: tds_pow5_table.pl,v 1.1 2011/09/12 14:48:03 freddy77 Exp $
+# Build tables of powers of 5 used to format floating point numbers
+# (see tds_flt8_to_string in numeric.c).
+# Every value is a 128 bit number written as 4 32 bit words, least
+# significant first.
+#
+
+use strict;
+use Math::BigInt;
+
+my $bits = 125;
+
+sub bit_length($)
+{
+	my $n = shift;
+	return length($n->as_bin()) - 2;
+}
+
+sub words($)
+{
+	my $n = shift->copy();
+	my @w;
+	for (1..4) {
+		push @w, sprintf('0x%08xu', $n->copy()->band(0xffffffff)->numify());
+		$n->brsft(32);
+	}
+	die "value too big" unless $n->is_zero();
+	return '{ ' . join(', ', @w) . ' }';
+}
+
+my $id = '$Id: tds_pow5_table.pl,v 1.1 2011/09/12 14:48:03 freddy77 Exp $';
+$id =~ s/\$Id/CVS Id/;
+$id =~ s/\$\s*$//;
+print qq|/*
+ * This file produced from $0
+ * $id
+ */
+
+#define POW5_BITCOUNT $bits
+#define POW5_INV_BITCOUNT $bits
+
+|;
+
+# 2^k / 5^i + 1, with k = bits + length(5^i) - 1
+print "/** inverse of powers of 5 */\n";
+print "static const TDS_UINT tds_pow5_inv[342][4] = {\n";
+for my $i (0..341) {
+	my $pow = Math::BigInt->new(5)->bpow($i);
+	my $k = bit_length($pow) - 1 + $bits;
+	my $inv = Math::BigInt->new(1)->blsft($k)->bdiv($pow)->badd(1);
+	print "\t" . words($inv) . ",\n";
+}
+print "};\n\n";
+
+# 5^i normalized to bits bits
+print "/** powers of 5 */\n";
+print "static const TDS_UINT tds_pow5[326][4] = {\n";
+for my $i (0..325) {
+	my $pow = Math::BigInt->new(5)->bpow($i);
+	my $shift = bit_length($pow) - $bits;
+	if ($shift > 0) {
+		$pow->brsft($shift);
+	} else {
+		$pow->blsft(-$shift);
+	}
+	print "\t" . words($pow) . ",\n";
+}
+print "};\n";
@@ -57,6 +57,7 @@ static TDSRET tds_process_colinfo(TDSSOCKET * tds, char **names, int num_names);
 static TDSRET tds_process_compute(TDSSOCKET * tds, TDS_INT * computeid);
 static TDSRET tds_process_cursor_tokens(TDSSOCKET * tds);
 static TDSRET tds_process_row(TDSSOCKET * tds);
+static TDSRET tds_process_nbcrow(TDSSOCKET * tds);
 static TDSRET tds_process_param_result(TDSSOCKET * tds, TDSPARAMINFO ** info);
 static TDSRET tds7_process_result(TDSSOCKET * tds);
 static TDSDYNAMIC *tds_process_dynamic(TDSSOCKET * tds);
@@ -199,6 +200,9 @@ tds_process_default_tokens(TDSSOCKET * tds, int marker)
 	case TDS_ROW_TOKEN:
 		return tds_process_row(tds);
 		break;
+	case TDS_NBC_ROW_TOKEN:
+		return tds_process_nbcrow(tds);
+		break;
 	case TDS5_PARAMFMT_TOKEN:
 		/* store discarded parameters in param_info, not in old dynamic */
 		tds->cur_dyn = NULL;
@@ -232,9 +236,6 @@ tds_process_default_tokens(TDSSOCKET * tds, int marker)
 		tdsdump_log(TDS_DBG_WARN, "Eating %s token\n", tds_token_name(marker));
 		tds_get_n(tds, NULL, tds_get_int(tds));
 		break;
-	case TDS_NBC_ROW_TOKEN:
-		tdsdump_log(TDS_DBG_ERROR, "error: cannot process TDS_NBC_ROW_TOKEN %d(%x)!\n", marker, (unsigned char) marker);
-		/* fall out */
 	default: 
 		tds_close_socket(tds);
 		tdserror(tds_get_ctx(tds), tds, TDSEBTOK, 0);
@@ -351,6 +352,8 @@ tds_process_login_tokens(TDSSOCKET * tds)
 				ver.name = "2008 (no NBCROW or fSparseColumnSet)"; break;
 			case 0x730B0003: 
 				ver.name = "2008"; break;
+			case 0x74000004: 
+				ver.name = "Denali"; break;
 			default:
 				ver.name = "unknown"; break;
 			}
@@ -358,7 +361,24 @@ tds_process_login_tokens(TDSSOCKET * tds)
 			tdsdump_log(TDS_DBG_FUNC, "server reports TDS version %x.%x.%x.%x\n", 
 							ver.major, ver.minor, ver.tiny[0], ver.tiny[1]);
 			tdsdump_log(TDS_DBG_FUNC, "Product name for 0x%x is %s\n", ver.reported, ver.name);
-			
+
+			/*
+			 * server can reply with a lower version than requested
+			 * (for instance a mssql2005 getting a 7.4 login), use it
+			 */
+			if (IS_TDS7_PLUS(tds)) {
+				TDS_USMALLINT negotiated = 0x700;
+
+				if (ver.major > 7u && ver.major <= 0x7fu)
+					negotiated = 0x700 | (ver.major & 0xf);
+				else if (ver.major == 7u)
+					negotiated = 0x700 | ver.minor;
+				if (negotiated < tds->tds_version) {
+					tdsdump_log(TDS_DBG_FUNC, "Downgrading TDS version to 0x%x\n", negotiated);
+					tds->tds_version = negotiated;
+				}
+			}
+
 			/* Get server product name. */
 			/* Ignore product name length; some servers seem to set it incorrectly.  */
 			tds_get_byte(tds);
@@ -511,6 +531,7 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 	TDS_INT ret_status;
 	int cancel_seen = 0;
 	unsigned return_flag = 0;
+	int end_flags;
 
 #define SET_RETURN(ret, f) \
 	*result_type = ret; \
@@ -531,9 +552,32 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 		return TDS_NO_MORE_RESULTS;
 	}
 
+	/* parameters read with the status of a pipelined request */
+	if (tds->pipeline.param_pending) {
+		tds->pipeline.param_pending = 0;
+		if (flag & TDS_RETURN_PROC) {
+			*result_type = TDS_PARAM_RESULT;
+			return TDS_SUCCESS;
+		}
+	}
+
+	/* response of current pipelined request is complete, see tds_pipeline_next() */
+	if (tds->pipeline.boundary) {
+		if (!tds->in_cancel) {
+			tdsdump_log(TDS_DBG_FUNC, "tds_process_tokens() pipelined response %u completed\n", tds->pipeline.current);
+			*result_type = TDS_DONE_RESULT;
+			return TDS_NO_MORE_RESULTS;
+		}
+		tds->pipeline.boundary = 0;
+	}
+
 	if (tds_set_state(tds, TDS_READING) != TDS_READING)
 		return TDS_FAIL;
 
+	/* discard data of last row not read by client */
+	if (tds->stream_col && tds_stream_skip(tds) != TDS_SUCCESS)
+		return TDS_FAIL;
+
 	rc = TDS_SUCCESS;
 	for (;;) {
 
@@ -594,6 +638,34 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 			break;
 		case TDS_PARAM_TOKEN:
 			tds_unget_byte(tds);
+			if (tds->pipeline.held_status) {
+				tds->pipeline.held_status = 0;
+				while ((marker = tds_get_byte(tds)) == TDS_PARAM_TOKEN)
+					tds_process_param_result(tds, &pinfo);
+				tds_unget_byte(tds);
+				/* mark call packed after the request, its DONEPROC ends the response */
+				if (pinfo && pinfo->num_cols == 1 && strcmp(pinfo->columns[0]->column_name, TDS_PIPELINE_MARK) == 0) {
+					tds_free_param_results(pinfo);
+					pinfo = NULL;
+					tds->pipeline.mark = 1;
+					break;
+				}
+				/* status and parameters of the request, parameters are returned by next call */
+				if (!tds->internal_sp_called) {
+					tds_free_param_results(tds->param_info);
+					tds->param_info = pinfo;
+					tds->current_results = pinfo;
+					pinfo = NULL;
+					flag &= ~TDS_STOPAT_PROC;
+					SET_RETURN(TDS_STATUS_RESULT, PROC);
+					tds->has_status = 1;
+					tds->ret_status = tds->pipeline.ret_status;
+					tds->pipeline.param_pending = (flag & TDS_RETURN_PROC) != 0;
+					rc = TDS_SUCCESS;
+					break;
+				}
+				/* hidden parameters already read, processed below */
+			}
 			if (tds->internal_sp_called) {
 				tdsdump_log(TDS_DBG_FUNC, "processing parameters for sp %d\n", tds->internal_sp_called);
 				while ((marker = tds_get_byte(tds)) == TDS_PARAM_TOKEN) {
@@ -635,6 +707,7 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 			rc = tds7_process_compute_result(tds);
 			break;
 		case TDS_ROW_TOKEN:
+		case TDS_NBC_ROW_TOKEN:
 			/* overstepped the mark... */
 			if (tds->cur_cursor) {
 				TDSCURSOR  *cursor = tds->cur_cursor; 
@@ -651,7 +724,10 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 				tds->current_results->rows_exist = 1;
 			SET_RETURN(TDS_ROW_RESULT, ROW);
 
-			rc = tds_process_row(tds);
+			if (marker == TDS_NBC_ROW_TOKEN)
+				rc = tds_process_nbcrow(tds);
+			else
+				rc = tds_process_row(tds);
 			break;
 		case TDS_CMP_ROW_TOKEN:
 			/* I don't know when this it's false but it happened, also server can send garbage... */
@@ -665,6 +741,12 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 			marker = tds_peek(tds);
 			if (marker != TDS_PARAM_TOKEN && marker != TDS_DONEPROC_TOKEN && marker != TDS_DONE_TOKEN && marker != TDS5_PARAMFMT_TOKEN && marker != TDS5_PARAMFMT2_TOKEN)
 				break;
+			/* status of a pipelined request or of the mark call following it, see TDS_PARAM_TOKEN */
+			if (marker == TDS_PARAM_TOKEN && tds->pipeline.current + 1 < tds->pipeline.num_requests) {
+				tds->pipeline.held_status = 1;
+				tds->pipeline.ret_status = ret_status;
+				break;
+			}
 			if (tds->internal_sp_called) {
 				/* TODO perhaps we should use ret_status ?? */
 			} else {
@@ -722,15 +804,38 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 			rc = tds_process_end(tds, marker, done_flags);
 			break;
 		case TDS_DONEPROC_TOKEN:
+			/* DONEPROC of the mark call ends the pipelined response, it's not reported */
+			if (tds->pipeline.mark) {
+				tds->pipeline.mark = 0;
+				rc = tds_process_end(tds, marker, NULL);
+				tds->rows_affected = saved_rows_affected;
+				if (tds->state != TDS_IDLE && !tds->in_cancel)
+					tds->pipeline.boundary = 1;
+				break;
+			}
 			SET_RETURN(TDS_DONEPROC_RESULT, DONE);
-			rc = tds_process_end(tds, marker, done_flags);
+			rc = tds_process_end(tds, marker, &end_flags);
+			if (done_flags)
+				*done_flags = end_flags;
 			switch (tds->internal_sp_called) {
 			case 0: 
 			case TDS_SP_PREPARE: 
 			case TDS_SP_PREPEXEC:
 			case TDS_SP_EXECUTE: 
 			case TDS_SP_UNPREPARE: 
+				break;
 			case TDS_SP_EXECUTESQL:
+				if (!tds->multiple_query)
+					break;
+				/*
+				 * end of a call of a multiple query, reported only if the call
+				 * failed before completing any statement
+				 */
+				if (!tds->multiple_stmt_done && (end_flags & TDS_DONE_ERROR))
+					*result_type = TDS_DONE_RESULT;
+				else
+					return_flag = 0;
+				tds->multiple_stmt_done = 0;
 				break;
 			case TDS_SP_CURSOROPEN: 
 				*result_type       = TDS_DONE_RESULT;
@@ -768,6 +873,15 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 					saved_rows_affected = tds->rows_affected;
 				}
 				break;
+			case TDS_SP_EXECUTESQL:
+				/* statements of a multiple query end like in a language batch */
+				if (tds->multiple_query) {
+					SET_RETURN(TDS_DONE_RESULT, DONE);
+					rc = tds_process_end(tds, marker, done_flags);
+					tds->multiple_stmt_done = 1;
+					break;
+				}
+				/* fall through */
 			default:
 				SET_RETURN(TDS_DONEINPROC_RESULT, DONE);
 				rc = tds_process_end(tds, marker, done_flags);
@@ -802,6 +916,11 @@ tds_process_tokens(TDSSOCKET *tds, TDS_INT *result_type, int *done_flags, unsign
 			return rc;
 		}
 
+		if (tds->pipeline.boundary) {
+			tds_set_state(tds, TDS_PENDING);
+			return TDS_NO_MORE_RESULTS;
+		}
+
 		if (tds->state == TDS_IDLE)
 			return cancel_seen ? TDS_CANCELLED : TDS_NO_MORE_RESULTS;
 
@@ -1169,7 +1288,8 @@ tds_process_colinfo(TDSSOCKET * tds, char **names, int num_names)
 	TDSCOLUMN *curcol;
 	TDSRESULTINFO *info;
 	int bytes_read = 0;
-	unsigned char col_info[3], l;
+	unsigned char col_buf[3], l;
+	const unsigned char *col_info;
 
 	CHECK_TDS_EXTRA(tds);
 
@@ -1179,7 +1299,12 @@ tds_process_colinfo(TDSSOCKET * tds, char **names, int num_names)
 
 	while (bytes_read < hdrsize) {
 
-		tds_get_n(tds, col_info, 3);
+		col_info = tds_get_span(tds, 3);
+		if (!col_info) {
+			if (!tds_get_n(tds, col_buf, 3))
+				return TDS_FAIL;
+			col_info = col_buf;
+		}
 		bytes_read += 3;
 
 		curcol = NULL;
@@ -1317,6 +1442,9 @@ tds_process_params_result_token(TDSSOCKET * tds)
 
 	for (i = 0; i < info->num_cols; i++) {
 		curcol = info->columns[i];
+		/* client can read last column incrementally */
+		if (curcol->column_stream && i == info->num_cols - 1)
+			return tds_stream_start(tds, curcol);
 		if (curcol->funcs->get_data(tds, curcol) != TDS_SUCCESS)
 			return TDS_FAIL;
 	}
@@ -1884,8 +2012,6 @@ tds_process_compute(TDSSOCKET * tds, TDS_INT * pcomputeid)
 static TDSRET
 tds_process_row(TDSSOCKET * tds)
 {
-	int i;
-	TDSCOLUMN *curcol;
 	TDSRESULTINFO *info;
 
 	CHECK_TDS_EXTRA(tds);
@@ -1897,13 +2023,47 @@ tds_process_row(TDSSOCKET * tds)
 	assert(info->num_cols > 0);
 	
 	info->row_count++;
-	for (i = 0; i < info->num_cols; i++) {
-		tdsdump_log(TDS_DBG_INFO1, "tds_process_row(): reading column %d \n", i);
-		curcol = info->columns[i];
-		if (curcol->funcs->get_data(tds, curcol) != TDS_SUCCESS)
-			return TDS_FAIL;
+	return tds_get_row_data(tds, info, NULL);
+}
+
+/**
+ * tds_process_nbcrow() processes rows in null bitmap compressed format
+ * (TDS 7.3B+) and places them in the row buffer.
+ * A bitmap with a bit for every column precedes data, data are sent
+ * only for not NULL columns.
+ */
+static TDSRET
+tds_process_nbcrow(TDSSOCKET * tds)
+{
+	TDSRESULTINFO *info;
+	unsigned char nbc_buf[512], *nbcbuf = nbc_buf;
+	unsigned int nbc_len;
+	TDSRET rc;
+
+	CHECK_TDS_EXTRA(tds);
+
+	info = tds->current_results;
+	if (!info)
+		return TDS_FAIL;
+
+	assert(info->num_cols > 0);
+
+	/* 512 bytes are enough for the 4096 columns a result can have */
+	nbc_len = (info->num_cols + 7u) / 8u;
+	if (nbc_len > sizeof(nbc_buf) && !(nbcbuf = (unsigned char *) malloc(nbc_len)))
+		return TDS_FAIL;
+	if (!tds_get_n(tds, nbcbuf, nbc_len)) {
+		rc = TDS_FAIL;
+		goto Cleanup;
 	}
-	return TDS_SUCCESS;
+
+	info->row_count++;
+	rc = tds_get_row_data(tds, info, nbcbuf);
+
+Cleanup:
+	if (nbcbuf != nbc_buf)
+		free(nbcbuf);
+	return rc;
 }
 
 /**
@@ -2032,13 +2192,13 @@ tds_process_env_chg(TDSSOCKET * tds)
 
 	if (type == TDS_ENV_BEGINTRANS) {
 		size = tds_get_byte(tds);
-		tds_get_n(tds, tds->tds72_transaction, 8);
+		tds_get_n(tds, tds_conn(tds)->tds72_transaction, 8);
 		tds_get_n(tds, NULL, tds_get_byte(tds));
 		return TDS_SUCCESS;
 	}
 
 	if (type == TDS_ENV_COMMITTRANS || type == TDS_ENV_ROLLBACKTRANS) {
-		memset(tds->tds72_transaction, 0, 8);
+		memset(tds_conn(tds)->tds72_transaction, 0, 8);
 		tds_get_n(tds, NULL, tds_get_byte(tds));
 		tds_get_n(tds, NULL, tds_get_byte(tds));
 		return TDS_SUCCESS;
@@ -2345,15 +2505,9 @@ tds_process_cancel(TDSSOCKET * tds)
 TDSDYNAMIC *
 tds_lookup_dynamic(TDSSOCKET * tds, const char *id)
 {
-	TDSDYNAMIC *curr;
-
 	CHECK_TDS_EXTRA(tds);
-	
-	for (curr = tds->dyns; curr != NULL; curr = curr->next) {
-		if (!strcmp(curr->id, id))
-			return curr;
-	}
-	return NULL;
+
+	return (TDSDYNAMIC *) tds_name_index_find(&tds_conn(tds)->dyn_index, id, strlen(id));
 }
 
 /**
@@ -2942,6 +3096,8 @@ tds_token_name(unsigned char marker)
 		return "CONTROL";
 	case 0xD1:
 		return "ROW";
+	case 0xD2:
+		return "NBCROW";
 	case 0xD3:
 		return "CMP_ROW";
 	case 0xD7:
@@ -2986,7 +3142,7 @@ adjust_character_column_size(TDSSOCKET * tds, TDSCOLUMN * curcol)
 	CHECK_COLUMN_EXTRA(curcol);
 
 	if (is_unicode_type(curcol->on_server.column_type))
-		curcol->char_conv = tds->char_convs[client2ucs2];
+		curcol->char_conv = tds_conn(tds)->char_convs[client2ucs2];
 
 	/* Sybase UNI(VAR)CHAR fields are transmitted via SYBLONGBINARY and in UTF-16 */
 	if (curcol->on_server.column_type == SYBLONGBINARY && (
@@ -2998,17 +3154,17 @@ adjust_character_column_size(TDSSOCKET * tds, TDSCOLUMN * curcol)
 		static const char sybase_utf[] = "UTF-16LE";
 #endif
 
-		curcol->char_conv = tds_iconv_get(tds, tds->char_convs[client2ucs2]->client_charset.name, sybase_utf);
+		curcol->char_conv = tds_iconv_get(tds, tds_conn(tds)->char_convs[client2ucs2]->client_charset.name, sybase_utf);
 
 		/* fallback to UCS-2LE */
 		/* FIXME should be useless. Does not works always */
 		if (!curcol->char_conv)
-			curcol->char_conv = tds->char_convs[client2ucs2];
+			curcol->char_conv = tds_conn(tds)->char_convs[client2ucs2];
 	}
 
 	/* FIXME: and sybase ?? */
 	if (!curcol->char_conv && IS_TDS7_PLUS(tds) && is_ascii_type(curcol->on_server.column_type))
-		curcol->char_conv = tds->char_convs[client2server_chardata];
+		curcol->char_conv = tds_conn(tds)->char_convs[client2server_chardata];
 
 	if (!USE_ICONV || !curcol->char_conv)
 		return;
@@ -0,0 +1,280 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test tds_convert_batch.
+ * Arrays are converted with tds_convert_batch and results are compared
+ * with the ones of tds_convert for every value.
+ * To test performance pass the number of values to convert, like
+ * $ ./convbatch 10000000
+ * It prints values/s converted by tds_convert_batch and by tds_convert.
+ */
+#include "common.h"
+#include <assert.h>
+#include <tdsconvert.h>
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+static char software_version[] = "$Id: convbatch.c,v 1.1 2011/09/09 17:22:51 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#define NUM 1000
+
+static TDSCONTEXT *ctx;
+
+/* source values, room for the biggest type (numeric) */
+static union
+{
+	TDS_CHAR c[sizeof(TDS_NUMERIC)];
+	TDS_INT8 align;
+} src[NUM];
+static TDS_INT srclens[NUM];
+
+static union
+{
+	TDS_CHAR c[sizeof(TDSDATEREC)];
+	TDS_INT8 align;
+} dest[NUM];
+static TDS_INT destlens[NUM];
+static TDS_SMALLINT nullind[NUM];
+
+static void
+fill(int type, unsigned int n)
+{
+	unsigned int i;
+	TDS_UINT8 v;
+	TDS_DATETIME dt;
+	TDS_NUMERIC num;
+	TDS_FLOAT f;
+	TDS_REAL r;
+
+	memset(src, 0, sizeof(src));
+	for (i = 0; i < NUM; ++i) {
+		v = (TDS_UINT8) (i + n) * 0x9E3779B97F4A7C15u;
+		v ^= v >> 29;
+		srclens[i] = tds_get_size_by_type(type);
+		switch (type) {
+		case SYBINT1:
+		case SYBINT2:
+		case SYBINT4:
+		case SYBINT8:
+		case SYBMONEY:
+			memcpy(src[i].c, &v, srclens[i]);
+			break;
+		case SYBFLT8:
+			f = ((TDS_INT8) v) / 1e6;
+			if (i % 5 == 0)
+				f = 1.0 / (i + 3);
+			memcpy(src[i].c, &f, sizeof(f));
+			break;
+		case SYBREAL:
+			r = (TDS_REAL) ((TDS_INT) v / 1e3);
+			memcpy(src[i].c, &r, sizeof(r));
+			break;
+		case SYBNUMERIC:
+			memset(&num, 0, sizeof(num));
+			/* precision from 1 to 20 to test both fast path and fallback */
+			num.precision = 1 + i % 20;
+			num.scale = i % (num.precision + 1);
+			num.array[0] = (v & 1);
+			/* not always a valid number, tds_convert handles it anyway */
+			memcpy(num.array + 1, &v, tds_numeric_bytes_per_prec[num.precision] > 9 ? 8 : tds_numeric_bytes_per_prec[num.precision] - 1);
+			memcpy(src[i].c, &num, sizeof(num));
+			srclens[i] = sizeof(num);
+			break;
+		case SYBDATETIME:
+			/* groups of rows with same day */
+			dt.dtdays = -53690 + (int) (((i + n) / 7 * 7919u) % 2000000u);
+			dt.dttime = (TDS_INT) (v % (300u * 86400u));
+			memcpy(src[i].c, &dt, sizeof(dt));
+			break;
+		}
+		/* some NULLs */
+		if (i % 13 == 5)
+			srclens[i] = -1;
+	}
+}
+
+static int
+test(int srctype, int desttype, unsigned int deststride)
+{
+	unsigned int i;
+	TDS_INT res, len, first_err = NUM;
+	CONV_RESULT cr;
+	TDS_CHAR buf[64];
+	int destsize = tds_get_size_by_type(desttype);
+
+	memset(dest, 0, sizeof(dest));
+	res = tds_convert_batch(ctx, srctype, src[0].c, sizeof(src[0]), srclens, desttype, dest[0].c, deststride,
+				destlens, nullind, NUM);
+
+	for (i = 0; i < NUM; ++i) {
+		const TDS_CHAR *out = dest[0].c + i * deststride;
+
+		if (srclens[i] < 0) {
+			if (nullind[i] != -1 || destlens[i] != 0)
+				goto wrong;
+			continue;
+		}
+		if (nullind[i] != 0)
+			goto wrong;
+		if (desttype == TDS_CONVERT_DATEREC) {
+			TDSDATEREC dr;
+
+			tds_datecrack(srctype, src[i].c, &dr);
+			if (destlens[i] != sizeof(dr) || memcmp(&dr, out, sizeof(dr)) != 0)
+				goto wrong;
+			continue;
+		}
+		cr.cc.c = buf;
+		cr.cc.len = deststride;
+		len = tds_convert(ctx, srctype, src[i].c, srclens[i], desttype, &cr);
+		if (len != destlens[i])
+			goto wrong;
+		if (len < 0) {
+			if (first_err == NUM)
+				first_err = i;
+			continue;
+		}
+		if (desttype == TDS_CONVERT_CHAR) {
+			if (memcmp(buf, out, len < deststride ? len : deststride) != 0)
+				goto wrong;
+		} else if (memcmp(&cr, out, destsize) != 0) {
+			goto wrong;
+		}
+	}
+	if (first_err == NUM ? res != NUM : res != destlens[first_err]) {
+		fprintf(stderr, "wrong result %d converting %s to %d\n", (int) res, tds_prtype(srctype), desttype);
+		return 1;
+	}
+	return 0;
+
+      wrong:
+	fprintf(stderr, "wrong conversion %u from %s to %d\n", i, tds_prtype(srctype), desttype);
+	return 1;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static void
+bench(int srctype, int desttype, unsigned int num)
+{
+	double start;
+	unsigned int n, i;
+	CONV_RESULT cr;
+	TDS_CHAR buf[64];
+	const char *destname = desttype == TDS_CONVERT_DATEREC ? "daterec" : desttype == TDS_CONVERT_CHAR ? "char" : tds_prtype(desttype);
+
+	fill(srctype, 0);
+	start = now();
+	for (n = 0; n < num; n += NUM)
+		tds_convert_batch(ctx, srctype, src[0].c, sizeof(src[0]), srclens, desttype, dest[0].c, sizeof(dest[0]),
+				  destlens, nullind, NUM);
+	printf("%-8s => %-8s batch %10.0f values/s\n", tds_prtype(srctype), destname, n / (now() - start));
+
+	start = now();
+	for (n = 0; n < num; n += NUM) {
+		for (i = 0; i < NUM; ++i) {
+			if (srclens[i] < 0)
+				continue;
+			if (desttype == TDS_CONVERT_DATEREC) {
+				tds_datecrack(srctype, src[i].c, (TDSDATEREC *) dest[i].c);
+			} else {
+				cr.cc.c = buf;
+				cr.cc.len = sizeof(buf);
+				destlens[i] = tds_convert(ctx, srctype, src[i].c, srclens[i], desttype, &cr);
+				memcpy(dest[i].c, &cr, 8);
+			}
+		}
+	}
+	printf("%-8s => %-8s single%10.0f values/s\n", tds_prtype(srctype), destname, n / (now() - start));
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int ints[] = { SYBINT1, SYBINT2, SYBINT4, SYBINT8 };
+	unsigned int n, num = 0;
+	int i, j, res = 0;
+
+	if (argc > 1)
+		num = atoi(argv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+
+	for (n = 0; n < 5; ++n) {
+		/* widening and narrowing (with overflows) */
+		for (i = 0; i < 4; ++i) {
+			fill(ints[i], n * NUM);
+			for (j = 0; j < 4; ++j)
+				res |= test(ints[i], ints[j], sizeof(dest[0]));
+			res |= test(ints[i], SYBFLT8, sizeof(dest[0]));
+			res |= test(ints[i], TDS_CONVERT_CHAR, sizeof(dest[0]));
+		}
+
+		fill(SYBFLT8, n * NUM);
+		res |= test(SYBFLT8, TDS_CONVERT_CHAR, sizeof(dest[0]));
+		res |= test(SYBFLT8, TDS_CONVERT_CHAR, 5);
+		res |= test(SYBFLT8, SYBINT4, sizeof(dest[0]));
+		fill(SYBREAL, n * NUM);
+		res |= test(SYBREAL, TDS_CONVERT_CHAR, sizeof(dest[0]));
+		res |= test(SYBREAL, SYBFLT8, sizeof(dest[0]));
+
+		fill(SYBNUMERIC, n * NUM);
+		res |= test(SYBNUMERIC, SYBFLT8, sizeof(dest[0]));
+		res |= test(SYBNUMERIC, TDS_CONVERT_CHAR, sizeof(dest[0]));
+
+		fill(SYBDATETIME, n * NUM);
+		res |= test(SYBDATETIME, TDS_CONVERT_DATEREC, sizeof(dest[0]));
+		res |= test(SYBDATETIME, SYBDATETIME4, sizeof(dest[0]));
+
+		fill(SYBMONEY, n * NUM);
+		res |= test(SYBMONEY, TDS_CONVERT_CHAR, 8);
+		res |= test(SYBMONEY, SYBINT4, sizeof(dest[0]));
+		if (res)
+			return res;
+	}
+
+	/* types needing allocation are not supported */
+	if (tds_convert_batch(ctx, SYBINT4, src[0].c, sizeof(src[0]), NULL, SYBVARCHAR, dest[0].c, sizeof(dest[0]),
+			      NULL, NULL, NUM) != TDS_CONVERT_NOAVAIL) {
+		fprintf(stderr, "conversion to varchar should fail\n");
+		return 1;
+	}
+
+	if (num) {
+		bench(SYBINT4, SYBINT8, num);
+		bench(SYBNUMERIC, SYBFLT8, num);
+		bench(SYBDATETIME, TDS_CONVERT_DATEREC, num);
+		bench(SYBFLT8, TDS_CONVERT_CHAR, num);
+	}
+
+	tds_free_context(ctx);
+	return 0;
+}
@@ -22,9 +22,12 @@
  * To test performance, call this program with an iteration count (10 is probably fine).
  * The following shows performance converting to varchar:
  * $ make convert && ./convert 1 |grep iterations |grep 'varchar\.' |sort -n 
+ * Float and real formatting is checked to give the shortest string converting
+ * back to the same value, with an iteration count speed is compared with sprintf.
  */
 #include "common.h"
 #include <assert.h>
+#include <math.h>
 #include <tdsconvert.h>
 #include "replacements.h"
 
@@ -32,7 +35,7 @@
 #include <sys/time.h>
 #endif
 
-static char software_version[] = "$Id: convert.c,v 1.26 2009/02/06 14:26:54 freddy77 Exp $";
+static char software_version[] = "$Id: convert.c,v 1.28 2011/09/12 14:48:03 freddy77 Exp $";
 static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
 
 int g_result = 0;
@@ -50,6 +53,277 @@ free_convert(int type, CONV_RESULT *cr)
 	}
 }
 
+/* check converter from tds_get_converter gives same result of tds_convert */
+static void
+test_converter(int srctype, const TDS_CHAR * src, TDS_UINT srclen, int desttype, const CONV_RESULT * cr_init)
+{
+	CONV_RESULT cr1, cr2;
+	char buf1[64], buf2[64];
+	int len1, len2, same;
+
+	cr1 = *cr_init;
+	cr2 = *cr_init;
+	if (desttype == TDS_CONVERT_CHAR) {
+		cr1.cc.c = buf1;
+		cr1.cc.len = sizeof(buf1);
+		cr2.cc.c = buf2;
+		cr2.cc.len = sizeof(buf2);
+	}
+	len1 = tds_convert(ctx, srctype, src, srclen, desttype, &cr1);
+	len2 = tds_get_converter(srctype, desttype)(ctx, srctype, src, srclen, desttype, &cr2);
+
+	switch (desttype) {
+	case TDS_CONVERT_CHAR:
+		same = len1 < 0 || memcmp(buf1, buf2, len1 < sizeof(buf1) ? len1 : sizeof(buf1)) == 0;
+		break;
+	case SYBCHAR: case SYBVARCHAR: case SYBTEXT: case XSYBCHAR: case XSYBVARCHAR:
+	case SYBBINARY: case SYBVARBINARY: case SYBIMAGE: case XSYBBINARY: case XSYBVARBINARY:
+		same = len1 < 0 || memcmp(cr1.c, cr2.c, len1) == 0;
+		break;
+	default:
+		same = memcmp(&cr1, &cr2, sizeof(cr1)) == 0;
+		break;
+	}
+	if (len1 != len2 || !same) {
+		fprintf(stderr, "converter for %s => %s gives different result\n", tds_prtype(srctype), tds_prtype(desttype));
+		g_result = 1;
+	}
+	if (len1 >= 0)
+		free_convert(desttype, &cr1);
+	if (len2 >= 0)
+		free_convert(desttype, &cr2);
+}
+
+/* number of significant digits of a number formatted by tds_flt8_to_string or sprintf */
+static int
+count_digits(const char *s)
+{
+	int n = 0, zeros = 0;
+
+	for (; *s && *s != 'e'; ++s) {
+		if (*s < '0' || *s > '9')
+			continue;
+		if (*s == '0') {
+			/* leading zeros never count, trailing ones only if followed by other digits */
+			if (n)
+				++zeros;
+			continue;
+		}
+		n += zeros + 1;
+		zeros = 0;
+	}
+	return n;
+}
+
+static TDS_UINT8
+random_bits(TDS_UINT8 n)
+{
+	n *= 0x9E3779B97F4A7C15u;
+	n ^= n >> 29;
+	n *= 0xBF58476D1CE4E5B9u;
+	return n ^ (n >> 32);
+}
+
+/* convert back a string as double or real */
+static int
+same_float(const char *s, double value, int is_real)
+{
+	if (is_real)
+		return strtof(s, NULL) == (float) value;
+	return strtod(s, NULL) == value;
+}
+
+/*
+ * check if a number with given significant digits converts back to value.
+ * Besides the rounded number the two near ones are tested as the shortest
+ * representation is not always the rounded one.
+ */
+static int
+digits_enough(double value, int digits, int is_real)
+{
+	char buf[40], num[40], cand[48];
+	char *p, *e;
+	int i, j, exp, len = 0;
+
+	value = fabs(value);
+	sprintf(buf, "%.*e", digits - 1, value);
+	e = strchr(buf, 'e');
+	exp = atoi(e + 1) - (digits - 1);
+	for (p = buf; p < e; ++p)
+		if (*p >= '0' && *p <= '9')
+			num[len++] = *p;
+	num[len] = 0;
+
+	for (i = -1; i <= 1; ++i) {
+		cand[0] = '0';
+		strcpy(cand + 1, num);
+		j = len;
+		if (i < 0) {
+			while (cand[j] == '0')
+				cand[j--] = '9';
+			--cand[j];
+		} else if (i > 0) {
+			while (j > 0 && cand[j] == '9')
+				cand[j--] = '0';
+			if (j == 0)
+				cand[0] = '1';
+			else
+				++cand[j];
+		}
+		sprintf(cand + len + 1, "e%d", exp);
+		if (same_float(cand[0] == '1' ? cand : cand + 1, value, is_real))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * check a float is formatted with the shortest digits which convert back to the same value.
+ * If sprintf("%.16g") (or "%.7g" for reals) gives a string with the same digits the output must be the same.
+ */
+static void
+check_float(double value, int is_real)
+{
+	char buf[32], old[32];
+	union { TDS_FLOAT f; TDS_UINT8 i; } in, out;
+	int digits;
+
+	if (is_real) {
+		tds_real_to_string((TDS_REAL) value, buf);
+		sprintf(old, "%.7g", value);
+	} else {
+		tds_flt8_to_string(value, buf);
+		sprintf(old, "%.16g", value);
+	}
+
+	/* check sign of zero too */
+	in.f = value;
+	out.f = is_real ? (double) strtof(buf, NULL) : strtod(buf, NULL);
+	if (in.i != out.i) {
+		fprintf(stderr, "%.17g formatted as %s does not convert back\n", value, buf);
+		g_result = 1;
+		return;
+	}
+
+	digits = count_digits(buf);
+	if (same_float(old, value, is_real) && count_digits(old) == digits && strcmp(old, buf) != 0) {
+		fprintf(stderr, "%.17g formatted as %s instead of %s\n", value, buf, old);
+		g_result = 1;
+		return;
+	}
+
+	if (digits > 1 && digits_enough(value, digits - 1, is_real)) {
+		fprintf(stderr, "%.17g formatted as %s, a shorter representation exists\n", value, buf);
+		g_result = 1;
+	}
+}
+
+#define check_flt8(value) check_float(value, 0)
+#define check_real(value) check_float((TDS_REAL) (value), 1)
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+/* test float/real formatting, with iterations > 0 compare speed with sprintf */
+static void
+test_float_format(int iterations)
+{
+	static const char *const specials[] = {
+		"0", "-0", "1", "-1", "0.1", "0.3", "1e23", "5e-324", "2.2250738585072014e-308",
+		"2.2250738585072009e-308", "1.7976931348623157e308", "9007199254740993", "123456789012345678",
+		"1e15", "1e16", "1e17", "0.0001", "0.00001", "123456.7", "1234567", "12345678", "3.4028235e38",
+		"1.17549435e-38", "1.4e-45", "-4.5e-44", "299792458", "2.718281828459045", "3.141592653589793",
+		NULL
+	};
+	const char *const *sp;
+	union { TDS_FLOAT f; TDS_UINT8 i; } d;
+	union { TDS_REAL f; TDS_UINT i; } r;
+	char buf[32];
+	TDS_UINT8 n;
+	TDS_UINT u;
+	int e, i;
+	double start;
+
+	for (sp = specials; *sp; ++sp) {
+		check_flt8(strtod(*sp, NULL));
+		check_real(strtof(*sp, NULL));
+	}
+
+	/* powers of 2 and 10, with neighbours */
+	for (e = -1074; e <= 1023; ++e) {
+		d.f = ldexp(1.0, e);
+		check_flt8(d.f);
+		--d.i;
+		check_flt8(d.f);
+		d.i += 2;
+		check_flt8(d.f);
+		if (e >= -149 && e <= 127)
+			check_real((TDS_REAL) ldexp(1.0, e));
+	}
+	for (e = -323; e <= 308; ++e) {
+		sprintf(buf, "1e%d", e);
+		check_flt8(strtod(buf, NULL));
+		check_real(strtof(buf, NULL));
+	}
+
+	/* random bit patterns and values with few decimals as usually found in databases */
+	for (n = 0; n < 100000 && !g_result; ++n) {
+		d.i = random_bits(n);
+		if ((d.i >> 52 & 0x7ff) != 0x7ff)
+			check_flt8(d.f);
+		d.f = (double) (TDS_INT8) (random_bits(n) >> (n % 50)) / 1e4;
+		check_flt8(d.f);
+		r.f = (TDS_REAL) ((TDS_INT) random_bits(n) >> (n % 24)) / 100.0f;
+		check_real(r.f);
+	}
+
+	/* all reals with a stride, excluding infinity and nan */
+	for (u = 0; u < 0x7f800000u && !g_result; u += 4093) {
+		r.i = u;
+		check_real(r.f);
+		r.i = u | 0x80000000u;
+		check_real(r.f);
+	}
+
+	if (g_result || iterations <= 0)
+		return;
+
+	for (i = 0; i < 5; ++i) {
+		static const char *const names[] = {
+			"tds_flt8_to_string", "sprintf %.16g", "sprintf %.17g", "tds_real_to_string", "sprintf %.7g"
+		};
+
+		start = now();
+		for (n = 0; n < (TDS_UINT8) iterations * 100000u; ++n) {
+			d.f = (double) (TDS_INT8) (random_bits(n) >> (n % 50)) / 1e4;
+			switch (i) {
+			case 0:
+				tds_flt8_to_string(d.f, buf);
+				break;
+			case 1:
+				sprintf(buf, "%.16g", d.f);
+				break;
+			case 2:
+				sprintf(buf, "%.17g", d.f);
+				break;
+			case 3:
+				tds_real_to_string((TDS_REAL) d.f, buf);
+				break;
+			case 4:
+				sprintf(buf, "%.7g", (TDS_REAL) d.f);
+				break;
+			}
+		}
+		printf("%9.0f values/second formatted with %s.\n", n / (now() - start), names[i]);
+	}
+}
+
 int
 main(int argc, char **argv)
 {
@@ -77,6 +351,7 @@ main(int argc, char **argv)
 	TDS_CHAR *src = NULL;
 	TDS_UINT srclen;
 	CONV_RESULT cr;
+	TDS_CONVERT_FUNC convert;
 
 	TDS_NUMERIC numeric;
 	TDS_MONEY money;
@@ -117,6 +392,7 @@ main(int argc, char **argv)
 		if (answers[i].srctype == answers[i].desttype)
 			continue;	/* don't attempt same types */
 
+		memset(&cr, 0, sizeof(cr));
 		cr.n.precision = 8;
 		cr.n.scale = 2;
 
@@ -238,6 +514,10 @@ main(int argc, char **argv)
 		 * Now at last do the conversion
 		 */
 
+		test_converter(answers[i].srctype, src, srclen, answers[i].desttype, &cr);
+		if (answers[i].desttype == SYBVARCHAR)
+			test_converter(answers[i].srctype, src, srclen, TDS_CONVERT_CHAR, &cr);
+
 		result = tds_convert(ctx, answers[i].srctype, src, srclen, answers[i].desttype, &cr);
 		free_convert(answers[i].desttype, &cr);
 
@@ -306,8 +586,9 @@ main(int argc, char **argv)
 		result = gettimeofday(&start, NULL);
 		starttime = (double) start.tv_sec + (double) start.tv_usec * 0.000001;
 
+		convert = tds_get_converter(answers[i].srctype, answers[i].desttype);
 		for (j = 0; result >= 0 && j < iterations; j++) {
-			result = tds_convert(ctx, answers[i].srctype, src, srclen, answers[i].desttype, &cr);
+			result = convert(ctx, answers[i].srctype, src, srclen, answers[i].desttype, &cr);
 			free_convert(answers[i].desttype, &cr);
 		}
 		if (result < 0)
@@ -322,6 +603,8 @@ main(int argc, char **argv)
 		}
 
 	}
+	test_float_format(iterations);
+
 	tds_free_context(ctx);
 
 	return g_result;
@@ -0,0 +1,168 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test compiled date formats.
+ * Dates are formatted with tds_datefmt_format and compared with
+ * strftime(3) results.
+ * To test performance pass the number of dates to format, like
+ * $ ./datefmt 5000000
+ * It prints dates/s formatting with a compiled format, with tds_strftime
+ * and with strftime(3).
+ */
+#include "common.h"
+#include <assert.h>
+#include <tdsconvert.h>
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include <time.h>
+
+static char software_version[] = "$Id: datefmt.c,v 1.1 2011/09/05 10:12:44 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static const char *const formats[] = {
+	"%Y-%m-%d %H:%M:%S",
+	"%b %e %Y %I:%M%p",
+	"%b %d %Y %I:%M%p",
+	"%A %B %d %Y, day %j (%a %h %w)",
+	"%D %T %R %F %r %C %y",
+	"%k %l 100%% %n%t",
+	/* not compiled, strftime(3) is used */
+	"%c week %U",
+	NULL
+};
+
+static void
+make_date(TDS_DATETIME * dt, unsigned int n)
+{
+	/* from 1753 to 9999 */
+	dt->dtdays = -53690 + (int) ((n * 7919u) % 3012153u);
+	dt->dttime = (n * 104729u) % (300u * 86400u);
+}
+
+static void
+date2tm(const TDSDATEREC * dr, struct tm *tm)
+{
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec = dr->second;
+	tm->tm_min = dr->minute;
+	tm->tm_hour = dr->hour;
+	tm->tm_mday = dr->day;
+	tm->tm_mon = dr->month;
+	tm->tm_year = dr->year - 1900;
+	tm->tm_wday = dr->weekday;
+	tm->tm_yday = dr->dayofyear;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *const *format;
+	TDSDATEFMT fmt;
+	TDSDATEREC dr;
+	TDS_DATETIME dt;
+	struct tm tm;
+	char buf[256], expected[256];
+	unsigned int n, num = 0;
+	size_t len;
+	double start;
+
+	if (argc > 1)
+		num = atoi(argv[1]);
+
+	for (format = formats; *format; ++format) {
+		int compiled = tds_datefmt_compile(&fmt, *format);
+
+		if (compiled != (format[1] != NULL)) {
+			fprintf(stderr, "format \"%s\" %scompiled\n", *format, compiled ? "" : "not ");
+			return 1;
+		}
+		for (n = 0; n < 20000; ++n) {
+			make_date(&dt, n);
+			tds_datecrack(SYBDATETIME, &dt, &dr);
+			date2tm(&dr, &tm);
+			strftime(expected, sizeof(expected), *format, &tm);
+			len = tds_datefmt_format(&fmt, buf, sizeof(buf), &dr, 3);
+			if (len != strlen(expected) || strcmp(buf, expected) != 0) {
+				fprintf(stderr, "format \"%s\": got \"%s\" expected \"%s\"\n", *format, buf, expected);
+				return 1;
+			}
+			/* buffer too small */
+			if (tds_datefmt_format(&fmt, buf, len, &dr, 3) != 0) {
+				fprintf(stderr, "format \"%s\": small buffer not detected\n", *format);
+				return 1;
+			}
+		}
+	}
+
+	/* fraction of seconds */
+	make_date(&dt, 1);
+	dt.dttime = 300 * 3600 + 299;
+	tds_datecrack(SYBDATETIME, &dt, &dr);
+	tds_datefmt_compile(&fmt, "%H:%M:%S.%z");
+	if (tds_datefmt_format(&fmt, buf, sizeof(buf), &dr, 3) != 12 || strcmp(buf, "01:00:00.997") != 0
+	    || tds_datefmt_format(&fmt, buf, sizeof(buf), &dr, 7) != 16 || strcmp(buf, "01:00:00.9970000") != 0
+	    || tds_datefmt_format(&fmt, buf, sizeof(buf), &dr, 0) != 9 || strcmp(buf, "01:00:00.") != 0
+	    || tds_strftime(buf, sizeof(buf), "%z%%z", &dr, 2) != 4 || strcmp(buf, "99%z") != 0) {
+		fprintf(stderr, "wrong fraction \"%s\"\n", buf);
+		return 1;
+	}
+
+	if (!num)
+		return 0;
+
+	tds_datefmt_compile(&fmt, formats[0]);
+	start = now();
+	for (n = 0; n < num; ++n) {
+		make_date(&dt, n);
+		tds_datecrack(SYBDATETIME, &dt, &dr);
+		tds_datefmt_format(&fmt, buf, sizeof(buf), &dr, 3);
+	}
+	printf("compiled     %10.0f dates/s\n", num / (now() - start));
+
+	start = now();
+	for (n = 0; n < num; ++n) {
+		make_date(&dt, n);
+		tds_datecrack(SYBDATETIME, &dt, &dr);
+		tds_strftime(buf, sizeof(buf), formats[0], &dr, 3);
+	}
+	printf("tds_strftime %10.0f dates/s\n", num / (now() - start));
+
+	start = now();
+	for (n = 0; n < num; ++n) {
+		make_date(&dt, n);
+		tds_datecrack(SYBDATETIME, &dt, &dr);
+		date2tm(&dr, &tm);
+		strftime(buf, sizeof(buf), formats[0], &tm);
+	}
+	printf("strftime     %10.0f dates/s\n", num / (now() - start));
+	return 0;
+}
@@ -0,0 +1,157 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test prepared statements cache.
+ * Check queries differing only in spaces share statements, cache
+ * eviction order and counters. Prepare requests are sent to the other
+ * end of a socket pair and discarded.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+static char software_version[] = "$Id: dyncache.c,v 1.1 2011/09/19 10:21:36 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32)
+
+static TDSSOCKET *tds;
+static int sv[2];
+
+static TDSDYNAMIC *
+prepare(const char *query)
+{
+	TDSDYNAMIC *dyn = NULL;
+	char buf[1024];
+
+	if (tds_submit_prepare(tds, query, NULL, &dyn, NULL) != TDS_SUCCESS || !dyn) {
+		fprintf(stderr, "error preparing %s\n", query);
+		exit(1);
+	}
+	/* no server, discard request */
+	if (read(sv[1], buf, sizeof(buf)) <= 0)
+		exit(1);
+	tds->state = TDS_IDLE;
+	return dyn;
+}
+
+static void
+check(const char *query, TDSDYNAMIC * expected, int line)
+{
+	TDSDYNAMIC *dyn = tds_dynamic_cache_get(tds, query, NULL);
+
+	if (dyn != expected) {
+		fprintf(stderr, "line %d: wrong statement for %s\n", line, query);
+		exit(1);
+	}
+}
+#define CHECK(query, dyn) check(query, dyn, __LINE__)
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSDYNAMIC *dyn1, *dyn2, *dyn3;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->tds_version = 0x500;
+	tds->state = TDS_IDLE;
+	tds_conn(tds)->dyn_cache_max = 2;
+
+	/* statements in use cannot be shared */
+	dyn1 = prepare("select * from t where a = ?");
+	CHECK("select * from t where a = ?", NULL);
+
+	/* spaces outside quotes do not matter */
+	assert(tds_dynamic_cache_put(tds, dyn1) == NULL);
+	CHECK("select * from t where a=?", NULL);
+	CHECK("  select *\tfrom t\r\n where   a = ?  ", dyn1);
+	CHECK("select * from t where a = ?", NULL);
+	assert(tds_dynamic_cache_put(tds, dyn1) == NULL);
+
+	/* spaces inside quotes and new lines after comments do */
+	dyn2 = prepare("select 'a  b', [x  y] -- comment\n from t");
+	assert(tds_dynamic_cache_put(tds, dyn2) == NULL);
+	CHECK("select 'a b', [x  y] -- comment\n from t", NULL);
+	CHECK("select 'a  b', [x y] -- comment\n from t", NULL);
+	CHECK("select 'a  b', [x  y] -- comment from t", NULL);
+	CHECK("select 'a  b',\t[x  y]  -- comment\n\t from t", dyn2);
+
+	/* only one handle for every statement */
+	dyn3 = prepare("select * from t where a = ?");
+	assert(tds_dynamic_cache_put(tds, dyn3) == dyn3);
+	tds_free_dynamic(tds, dyn3);
+
+	/* least recently used statement is evicted */
+	assert(tds_dynamic_cache_put(tds, dyn2) == NULL);
+	dyn3 = prepare("select 1");
+	assert(tds_dynamic_cache_put(tds, dyn3) == dyn1);
+	tds_free_dynamic(tds, dyn1);
+	assert(tds_conn(tds)->dyn_cache_count == 2);
+	CHECK("select * from t where a = ?", NULL);
+	CHECK("select 1", dyn3);
+	assert(tds_dynamic_cache_put(tds, dyn3) == NULL);
+
+	/* emulated statements are never cached */
+	dyn1 = prepare("select 2");
+	dyn1->emulated = 1;
+	assert(tds_dynamic_cache_put(tds, dyn1) == dyn1);
+	tds_free_dynamic(tds, dyn1);
+
+	/* freeing cached statements keep cache consistent */
+	tds_free_dynamic(tds, dyn2);
+	assert(tds_conn(tds)->dyn_cache_count == 1 && tds_conn(tds)->dyn_cache == dyn3);
+
+	if (tds_conn(tds)->dyn_cache_hits != 3 || tds_conn(tds)->dyn_cache_misses != 7) {
+		fprintf(stderr, "wrong counters %lu hits %lu misses\n", tds_conn(tds)->dyn_cache_hits,
+			tds_conn(tds)->dyn_cache_misses);
+		return 1;
+	}
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	close(sv[1]);
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
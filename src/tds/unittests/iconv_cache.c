@@ -0,0 +1,101 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test process wide conversion cache.
+ * Descriptors released by a connection should be reused by the next
+ * one, connections alive at the same time should get different ones
+ * and conversions looked up by collation should be found again.
+ */
+#include "common.h"
+#include <tdsiconv.h>
+#include <assert.h>
+
+static char software_version[] = "$Id: iconv_cache.c,v 1.1 2011/09/01 11:20:05 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static TDSSOCKET *
+new_socket(TDSCONTEXT * ctx)
+{
+	TDSSOCKET *tds = tds_alloc_socket(ctx, 512);
+
+	assert(tds);
+	tds->tds_version = 0x702;
+	tds_iconv_open(tds, "UTF-8");
+	return tds;
+}
+
+int
+main(int argc, char **argv)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds, *tds2;
+	TDSICONV *conv, *conv2;
+	iconv_t cd, cd2;
+	/* Latin1_General (CP1252) and Cyrillic_General (CP1251) collations */
+	TDS_UCHAR collate1[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+	TDS_UCHAR collate2[5] = { 0x19, 0x04, 0xd0, 0x00, 0x00 };
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+
+	tds = new_socket(ctx);
+	conv = tds_iconv_from_collate(tds, collate2);
+	if (!conv || strcmp(conv->server_charset.name, "CP1251") != 0) {
+		fprintf(stderr, "Wrong conversion from collation\n");
+		return 1;
+	}
+	if (tds_iconv_from_collate(tds, collate2) != conv || tds_iconv_get(tds, "UTF-8", "CP1251") != conv) {
+		fprintf(stderr, "Conversion not found again\n");
+		return 1;
+	}
+	conv2 = tds_iconv_from_collate(tds, collate1);
+	if (!conv2 || conv2 == conv || strcmp(conv2->server_charset.name, "CP1252") != 0) {
+		fprintf(stderr, "Wrong second conversion from collation\n");
+		return 1;
+	}
+	cd = conv->to_wire;
+	if (cd == (iconv_t) -1) {
+		fprintf(stderr, "Conversion not opened\n");
+		return 1;
+	}
+
+	/* another connection at the same time needs its own descriptors */
+	tds2 = new_socket(ctx);
+	conv2 = tds_iconv_from_collate(tds2, collate2);
+	if (!conv2 || conv2->to_wire == (iconv_t) -1 || conv2->to_wire == cd) {
+		fprintf(stderr, "Descriptors shared between connections\n");
+		return 1;
+	}
+	cd2 = conv2->to_wire;
+	tds_free_socket(tds2);
+
+	/* closed connection descriptors are reused */
+	tds2 = new_socket(ctx);
+	conv2 = tds_iconv_from_collate(tds2, collate2);
+	if (!conv2 || conv2->to_wire != cd2) {
+		fprintf(stderr, "Descriptors not reused\n");
+		return 1;
+	}
+
+	tds_free_socket(tds2);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
@@ -0,0 +1,173 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test built-in UCS-2LE converters.
+ * Every UCS-2 character is converted to UTF-8, ISO-8859-1 and CP1252
+ * and compared with what iconv does, then converted back.
+ * Some error conditions (invalid and truncated sequences, small output
+ * buffer) are checked too.
+ */
+#include "common.h"
+#include <tdsiconv.h>
+#include <assert.h>
+
+static char software_version[] = "$Id: iconv_native.c,v 1.1 2011/08/31 09:58:40 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static TDSSOCKET *tds;
+
+/* convert a buffer, return -1 on error and output length in *out_len */
+static int
+convert(TDSICONV * conv, TDS_ICONV_DIRECTION io, const char *in, size_t in_len, char *out, size_t * out_len)
+{
+	const char *ib = in;
+	char *ob = out;
+	size_t il = in_len, ol = *out_len;
+
+	memset(&conv->suppress, 0, sizeof(conv->suppress));
+	if (tds_iconv(tds, conv, io, &ib, &il, &ob, &ol) == (size_t) -1)
+		return -1;
+	*out_len = ob - out;
+	return il ? -1 : 0;
+}
+
+static int
+test_charset(const char *charset)
+{
+	TDSICONV *conv = tds_iconv_get(tds, charset, "UCS-2LE");
+	iconv_t cd = tds_sys_iconv_open(charset, "UCS-2LE");
+	unsigned int c;
+
+	if (!conv || cd == (iconv_t) -1) {
+		fprintf(stderr, "Cannot convert %s\n", charset);
+		return 1;
+	}
+	if (!(conv->flags & TDS_ENCODING_NATIVE)) {
+		fprintf(stderr, "Conversion for %s is not native\n", charset);
+		return 1;
+	}
+
+	for (c = 1; c < 0x10000; ++c) {
+		char in[2], out[8], exp[8], back[4];
+		const char *ib = in;
+		char *ob = exp;
+		size_t il = 2, ol = sizeof(exp), out_len = sizeof(out), exp_len, back_len = sizeof(back);
+
+		/* skip surrogates */
+		if (c >= 0xd800 && c < 0xe000)
+			continue;
+		in[0] = c & 0xff;
+		in[1] = c >> 8;
+		if (tds_sys_iconv(cd, (ICONV_CONST char **) &ib, &il, &ob, &ol) == (size_t) -1) {
+			exp[0] = '?';
+			exp_len = 1;
+		} else {
+			exp_len = ob - exp;
+		}
+		if (convert(conv, to_client, in, 2, out, &out_len) || out_len != exp_len || memcmp(out, exp, exp_len) != 0) {
+			fprintf(stderr, "Wrong conversion of %04x to %s\n", c, charset);
+			return 1;
+		}
+		if (exp[0] == '?' && c != '?')
+			continue;
+		if (convert(conv, to_server, out, out_len, back, &back_len) || back_len != 2 || memcmp(back, in, 2) != 0) {
+			fprintf(stderr, "Wrong conversion of %04x from %s\n", c, charset);
+			return 1;
+		}
+	}
+	tds_sys_iconv_close(cd);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	TDSCONTEXT *ctx;
+	TDSICONV *conv;
+	char buf[256], out[512];
+	size_t out_len, i;
+	int res = 0;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds_iconv_open(tds, "ISO-8859-1");
+
+	res = test_charset("ISO-8859-1") || test_charset("CP1252") || test_charset("UTF-8");
+	if (res)
+		return res;
+
+	conv = tds_iconv_get(tds, "UTF-8", "UCS-2LE");
+
+	/* long ASCII string with some characters outside ASCII */
+	for (i = 0; i < 200; ++i)
+		buf[i] = 'a' + i % 26;
+	memcpy(buf + 77, "\xc3\xa8\xe2\x82\xac\xf0\x9f\x98\x80", 9);
+	out_len = sizeof(out);
+	if (convert(conv, to_server, buf, 200, out, &out_len) || out_len != 2 * (200 - 9 + 4)
+	    || memcmp(out + 154, "\xe8\x00\xac\x20\x3d\xd8\x00\xde", 8) != 0 || memcmp(out + 162, "i\0", 2) != 0) {
+		fprintf(stderr, "Wrong UTF-8 to UCS-2 conversion\n");
+		return 1;
+	}
+	i = out_len;
+	out_len = sizeof(buf);
+	memset(buf + 77, 0, 9);
+	if (convert(conv, to_client, out, i, buf, &out_len) || out_len != 200
+	    || memcmp(buf + 77, "\xc3\xa8\xe2\x82\xac\xf0\x9f\x98\x80", 9) != 0) {
+		fprintf(stderr, "Wrong UCS-2 to UTF-8 conversion\n");
+		return 1;
+	}
+
+	/* invalid sequences are errors going to server, replaced with '?' going to client */
+	out_len = sizeof(out);
+	if (convert(conv, to_server, "a\xc0\x80", 3, out, &out_len) != -1 || errno != EILSEQ) {
+		fprintf(stderr, "Overlong sequence accepted\n");
+		return 1;
+	}
+	out_len = sizeof(out);
+	if (convert(conv, to_client, "a\0\x00\xdc", 4, out, &out_len) || out_len != 2 || memcmp(out, "a?", 2) != 0) {
+		fprintf(stderr, "Wrong invalid surrogate conversion\n");
+		return 1;
+	}
+
+	/* truncated input */
+	out_len = sizeof(out);
+	if (convert(conv, to_server, "a\xe2\x82", 3, out, &out_len) != -1 || errno != EINVAL) {
+		fprintf(stderr, "Truncated sequence accepted\n");
+		return 1;
+	}
+	out_len = sizeof(out);
+	if (convert(conv, to_client, "a\0b", 3, out, &out_len) != -1 || errno != EINVAL) {
+		fprintf(stderr, "Truncated UCS-2 accepted\n");
+		return 1;
+	}
+
+	/* output too small */
+	out_len = 2;
+	if (convert(conv, to_client, "a\0\xac\x20", 4, out, &out_len) != -1 || errno != E2BIG) {
+		fprintf(stderr, "Output overflow not detected\n");
+		return 1;
+	}
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: stress dynamic lookup with a lot of prepared statements.
+ * Statements are allocated and freed in mixed order, every statement
+ * must be found by id as long as it exists.
+ */
+#include "common.h"
+#include <time.h>
+
+static char software_version[] = "$Id: manydyn.c,v 1.1 2011/09/21 16:45:09 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#define NUM_DYNS 10000
+
+static TDSDYNAMIC *dyns[NUM_DYNS * 2];
+
+static void
+fatal_error(const char *msg, unsigned int n)
+{
+	fprintf(stderr, "%s (%u)\n", msg, n);
+	exit(1);
+}
+
+static void
+check_all(TDSSOCKET * tds)
+{
+	unsigned int n;
+
+	for (n = 0; n < NUM_DYNS * 2; ++n) {
+		if (!dyns[n])
+			continue;
+		if (tds_lookup_dynamic(tds, dyns[n]->id) != dyns[n])
+			fatal_error("dynamic not found", n);
+	}
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	char id[32], freed_id[32];
+	unsigned int n, round;
+	clock_t start;
+
+	ctx = tds_alloc_context(NULL);
+	tds = tds_alloc_socket(ctx, 512);
+	if (!ctx || !tds)
+		fatal_error("out of memory", 0);
+
+	start = clock();
+
+	/* half with generated ids, half with user ids */
+	for (n = 0; n < NUM_DYNS; ++n) {
+		if (!(dyns[n] = tds_alloc_dynamic(tds, NULL)))
+			fatal_error("error allocating dynamic", n);
+		sprintf(id, "stmt%u", n);
+		if (!(dyns[NUM_DYNS + n] = tds_alloc_dynamic(tds, id)))
+			fatal_error("error allocating dynamic", NUM_DYNS + n);
+	}
+	if (tds_alloc_dynamic(tds, "stmt1234"))
+		fatal_error("duplicate id accepted", 1234);
+	check_all(tds);
+
+	/* free with a stride so removals hit all parts of the index */
+	for (round = 0; round < 3; ++round) {
+		for (n = round; n < NUM_DYNS * 2; n += 7) {
+			if (!dyns[n])
+				continue;
+			strcpy(freed_id, dyns[n]->id);
+			tds_free_dynamic(tds, dyns[n]);
+			dyns[n] = NULL;
+		}
+		if (tds_lookup_dynamic(tds, freed_id))
+			fatal_error("freed dynamic found", round);
+		check_all(tds);
+
+		/* reuse some freed slots */
+		for (n = round; n < NUM_DYNS * 2; n += 14)
+			if (!(dyns[n] = tds_alloc_dynamic(tds, NULL)))
+				fatal_error("error allocating dynamic", n);
+		check_all(tds);
+	}
+
+	if (tds_lookup_dynamic(tds, "stmt") || tds_lookup_dynamic(tds, "stmt100000"))
+		fatal_error("wrong dynamic found", 0);
+
+	printf("%u dynamics checked in %.3f seconds\n", NUM_DYNS * 2, (double) (clock() - start) / CLOCKS_PER_SEC);
+
+	/* socket free all remaining dynamics */
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
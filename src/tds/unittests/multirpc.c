@@ -0,0 +1,317 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test multiple requests under TDS7+.
+ * Every call packed in a multiple request must be encoded like the same
+ * call sent alone, calls are separated by the batch separator and the
+ * request starts with a single ALL_HEADERS. Requests are sent to the
+ * other end of a socket pair and compared.
+ * Results of a multiple query must be like a language batch even if a
+ * call fails without executing any statement.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+static char software_version[] = "$Id: multirpc.c,v 1.1 2011/09/23 14:12:51 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32)
+
+static TDSSOCKET *tds;
+static int sv[2];
+
+typedef struct
+{
+	unsigned char data[1024];
+	size_t len;
+} request;
+
+static void
+read_request(request * req, unsigned char type)
+{
+	unsigned char header[8];
+	size_t len;
+
+	if (read(sv[1], header, 8) != 8 || header[0] != type || header[1] != 1) {
+		fprintf(stderr, "wrong packet header\n");
+		exit(1);
+	}
+	len = header[2] * 256u + header[3] - 8;
+	assert(len <= sizeof(req->data));
+	if (read(sv[1], req->data, len) != (ssize_t) len) {
+		fprintf(stderr, "short packet\n");
+		exit(1);
+	}
+	req->len = len;
+	tds->state = TDS_IDLE;
+}
+
+static TDSPARAMINFO *
+int_param(TDSPARAMINFO * params, const char *name, TDS_INT value)
+{
+	TDSCOLUMN *curcol;
+
+	params = tds_alloc_param_result(params);
+	assert(params);
+	curcol = params->columns[params->num_cols - 1];
+	tds_set_param_type(tds, curcol, SYBINT4);
+	strcpy(curcol->column_name, name);
+	curcol->column_namelen = (TDS_SMALLINT) strlen(name);
+	assert(tds_alloc_param_data(curcol));
+	curcol->column_cur_size = sizeof(TDS_INT);
+	memcpy(curcol->column_data, &value, sizeof(value));
+	return params;
+}
+
+/* compare a multiple request with the single requests */
+static void
+check(const char *what, const request * multiple, const request * single1, const request * single2)
+{
+	size_t headers = IS_TDS72_PLUS(tds) ? 22 : 0;
+	unsigned char sep = IS_TDS72_PLUS(tds) ? 0xff : 0x80;
+	size_t len2 = single2->len - headers;
+
+	if (multiple->len != single1->len + 1 + len2
+	    || memcmp(multiple->data, single1->data, single1->len) != 0
+	    || multiple->data[single1->len] != sep
+	    || memcmp(multiple->data + single1->len + 1, single2->data + headers, len2) != 0) {
+		fprintf(stderr, "wrong multiple %s for version 0x%x\n", what, (unsigned int) tds->tds_version);
+		exit(1);
+	}
+}
+
+/* append a DONE, DONEPROC or DONEINPROC token */
+static unsigned char *
+put_done(unsigned char *p, unsigned char token, unsigned int status, unsigned int count)
+{
+	unsigned int i, count_len = IS_TDS72_PLUS(tds) ? 8 : 4;
+
+	*p++ = token;
+	*p++ = status & 0xff;
+	*p++ = status >> 8;
+	*p++ = 0xc1;
+	*p++ = 0;
+	for (i = 0; i < count_len; ++i) {
+		*p++ = count & 0xff;
+		count >>= 8;
+	}
+	return p;
+}
+
+static unsigned char *
+put_status(unsigned char *p)
+{
+	*p++ = TDS_RETURNSTATUS_TOKEN;
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = 0;
+	*p++ = 0;
+	return p;
+}
+
+static void
+send_reply(const unsigned char *start, unsigned char *end)
+{
+	unsigned char header[8];
+	size_t len = end - start + 8;
+
+	header[0] = TDS_REPLY;
+	header[1] = 1;
+	header[2] = (unsigned char) (len >> 8);
+	header[3] = (unsigned char) len;
+	header[4] = header[5] = header[6] = header[7] = 0;
+	if (write(sv[1], header, 8) != 8 || write(sv[1], start, len - 8) != (ssize_t) (len - 8)) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/* check next results are the given DONE results */
+static void
+check_results(const char *what, const TDS_INT *types, const int *flags, int num)
+{
+	TDS_INT result_type;
+	int done_flags, i;
+
+	for (i = 0; i < num; ++i) {
+		if (tds_process_tokens(tds, &result_type, &done_flags, TDS_RETURN_DONE) != TDS_SUCCESS
+		    || result_type != types[i] || (done_flags & (TDS_DONE_COUNT|TDS_DONE_ERROR)) != flags[i]) {
+			fprintf(stderr, "wrong result %d of %s for version 0x%x\n", i, what, (unsigned int) tds->tds_version);
+			exit(1);
+		}
+	}
+	if (tds_process_tokens(tds, &result_type, &done_flags, TDS_RETURN_DONE) != TDS_NO_MORE_RESULTS || tds->state != TDS_IDLE) {
+		fprintf(stderr, "%s not completed for version 0x%x\n", what, (unsigned int) tds->tds_version);
+		exit(1);
+	}
+}
+
+static void
+test_results(TDSPARAMINFO * params)
+{
+	static const TDS_INT multiple_types[] = { TDS_DONE_RESULT, TDS_DONE_RESULT, TDS_DONE_RESULT };
+	static const int multiple_flags[] = { TDS_DONE_COUNT, TDS_DONE_ERROR, TDS_DONE_COUNT };
+	static const TDS_INT single_types[] = { TDS_DONEINPROC_RESULT, TDS_DONEPROC_RESULT };
+	static const int single_flags[] = { TDS_DONE_COUNT, 0 };
+	unsigned char reply[128], *p;
+	TDSMULTIPLE multiple;
+	request req;
+	int i;
+
+	assert(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY) == TDS_SUCCESS);
+	for (i = 0; i < 3; ++i)
+		assert(tds_multiple_query(tds, &multiple, "insert into t values(?, ?)", params) == TDS_SUCCESS);
+	assert(tds_multiple_done(tds, &multiple) == TDS_SUCCESS);
+	read_request(&req, TDS_RPC);
+	tds->state = TDS_PENDING;
+
+	/* second call fails, for instance on compile, ending only with an error DONEPROC */
+	p = put_done(reply, TDS_DONEINPROC_TOKEN, TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 1);
+	p = put_status(p);
+	p = put_done(p, TDS_DONEPROC_TOKEN, TDS_DONE_MORE_RESULTS, 0);
+	p = put_done(p, TDS_DONEPROC_TOKEN, TDS_DONE_ERROR | TDS_DONE_MORE_RESULTS, 0);
+	p = put_done(p, TDS_DONEINPROC_TOKEN, TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 1);
+	p = put_status(p);
+	p = put_done(p, TDS_DONEPROC_TOKEN, 0, 0);
+	send_reply(reply, p);
+	check_results("multiple query", multiple_types, multiple_flags, 3);
+
+	/* a single call is not changed */
+	assert(tds_submit_execdirect(tds, "insert into t values(?, ?)", params) == TDS_SUCCESS);
+	read_request(&req, TDS_RPC);
+	tds->state = TDS_PENDING;
+
+	p = put_done(reply, TDS_DONEINPROC_TOKEN, TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 1);
+	p = put_status(p);
+	p = put_done(p, TDS_DONEPROC_TOKEN, 0, 0);
+	send_reply(reply, p);
+	check_results("single query", single_types, single_flags, 2);
+}
+
+static void
+test(TDS_USMALLINT version)
+{
+	TDSPARAMINFO *params1, *params2;
+	TDSMULTIPLE multiple;
+	TDSDYNAMIC *dyn;
+	request mul, req1, req2;
+
+	tds->tds_version = version;
+
+	params1 = int_param(int_param(NULL, "@a", 1), "@b", 0x1234);
+	params2 = int_param(int_param(NULL, "@a", 2), "@b", -1);
+
+	/* stored procedures */
+	assert(tds_submit_rpc(tds, "sp_x", params1) == TDS_SUCCESS);
+	read_request(&req1, TDS_RPC);
+	assert(tds_submit_rpc(tds, "sp_x", params2) == TDS_SUCCESS);
+	read_request(&req2, TDS_RPC);
+
+	assert(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_RPC) == TDS_SUCCESS);
+	assert(tds_multiple_rpc(tds, &multiple, "sp_x", params1) == TDS_SUCCESS);
+	assert(tds_multiple_rpc(tds, &multiple, "sp_x", params2) == TDS_SUCCESS);
+	assert(tds_multiple_done(tds, &multiple) == TDS_SUCCESS);
+	read_request(&mul, TDS_RPC);
+	check("rpc", &mul, &req1, &req2);
+
+	/* queries go through sp_executesql */
+	assert(tds_submit_execdirect(tds, "select ?, ?", params1) == TDS_SUCCESS);
+	read_request(&req1, TDS_RPC);
+	assert(tds_submit_execdirect(tds, "select ?, ?", params2) == TDS_SUCCESS);
+	read_request(&req2, TDS_RPC);
+
+	assert(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY) == TDS_SUCCESS);
+	assert(tds_multiple_query(tds, &multiple, "select ?, ?", params1) == TDS_SUCCESS);
+	assert(tds_multiple_query(tds, &multiple, "select ?, ?", params2) == TDS_SUCCESS);
+	assert(tds_multiple_done(tds, &multiple) == TDS_SUCCESS);
+	read_request(&mul, TDS_RPC);
+	check("query", &mul, &req1, &req2);
+
+	/* prepared statements */
+	dyn = tds_alloc_dynamic(tds, NULL);
+	assert(dyn);
+	dyn->num_id = 17;
+	dyn->params = params1;
+	assert(tds_submit_execute(tds, dyn) == TDS_SUCCESS);
+	read_request(&req1, TDS_RPC);
+	dyn->params = params2;
+	assert(tds_submit_execute(tds, dyn) == TDS_SUCCESS);
+	read_request(&req2, TDS_RPC);
+
+	assert(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_EXECUTE) == TDS_SUCCESS);
+	dyn->params = params1;
+	assert(tds_multiple_execute(tds, &multiple, dyn) == TDS_SUCCESS);
+	dyn->params = params2;
+	assert(tds_multiple_execute(tds, &multiple, dyn) == TDS_SUCCESS);
+	assert(tds_multiple_done(tds, &multiple) == TDS_SUCCESS);
+	read_request(&mul, TDS_RPC);
+	check("execute", &mul, &req1, &req2);
+
+	test_results(params1);
+
+	dyn->params = NULL;
+	tds_free_dynamic(tds, dyn);
+	tds_free_param_results(params1);
+	tds_free_param_results(params2);
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->state = TDS_IDLE;
+	tds_iconv_open(tds, "ISO-8859-1");
+
+	test(0x701);
+	test(0x702);
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	close(sv[1]);
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,347 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test decoding of NBCROW (null bitmap compressed) rows.
+ * A child process sends a wide result set with mostly NULL columns
+ * encoded using ROW or NBCROW tokens, we read them with
+ * tds_process_tokens and check content.
+ * To compare the two encodings pass the number of rows, like
+ * $ ./nbcrow 100000
+ * It prints bytes received and rows/s for each encoding.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+static char software_version[] = "$Id: nbcrow.c,v 1.1 2011/08/31 08:57:12 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK
+
+#define NUM_COLS 200
+#define BLOCK_SIZE 4096
+
+/* even columns are INTN, odd ones VARBINARY */
+static int
+is_null(unsigned int row, unsigned int col)
+{
+	return (row * 7u + col * 13u) % 10u != 0;
+}
+
+static TDS_INT
+int_value(unsigned int row, unsigned int col)
+{
+	return (TDS_INT) (row * 1000u + col);
+}
+
+static unsigned int
+bin_len(unsigned int row, unsigned int col)
+{
+	return (row + col) % 8u + 1u;
+}
+
+/* buffer which is sent in packets when full */
+typedef struct
+{
+	int s;
+	unsigned int len;
+	unsigned long total;
+	unsigned char buf[BLOCK_SIZE];
+} OUTPKT;
+
+static void
+write_all(int s, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = write(s, buf, len);
+		if (res <= 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+static void
+flush_pkt(OUTPKT * out, int last)
+{
+	out->buf[0] = TDS_REPLY;
+	out->buf[1] = last ? 1 : 0;
+	out->buf[2] = out->len >> 8;
+	out->buf[3] = out->len & 0xff;
+	out->buf[4] = out->buf[5] = out->buf[6] = out->buf[7] = 0;
+	write_all(out->s, out->buf, out->len);
+	out->total += out->len;
+	out->len = 8;
+}
+
+static void
+put_byte(OUTPKT * out, unsigned char c)
+{
+	if (out->len >= BLOCK_SIZE)
+		flush_pkt(out, 0);
+	out->buf[out->len++] = c;
+}
+
+static void
+put_le(OUTPKT * out, TDS_UINT8 n, unsigned int len)
+{
+	while (len--) {
+		put_byte(out, (unsigned char) (n & 0xff));
+		n >>= 8;
+	}
+}
+
+static void
+sender(int s, int res_fd, unsigned int num_rows, int nbc)
+{
+	OUTPKT out;
+	unsigned int row, col;
+	unsigned char bitmap[(NUM_COLS + 7) / 8];
+
+	out.s = s;
+	out.len = 8;
+	out.total = 0;
+
+	/* COLMETADATA */
+	put_byte(&out, TDS7_RESULT_TOKEN);
+	put_le(&out, NUM_COLS, 2);
+	for (col = 0; col < NUM_COLS; ++col) {
+		put_le(&out, 0, 4);		/* usertype */
+		put_le(&out, 1, 2);		/* flags, nullable */
+		if (col % 2u == 0) {
+			put_byte(&out, SYBINTN);
+			put_byte(&out, 4);
+		} else {
+			put_byte(&out, XSYBVARBINARY);
+			put_le(&out, 16, 2);
+		}
+		put_byte(&out, 0);		/* no name */
+	}
+
+	for (row = 0; row < num_rows; ++row) {
+		if (nbc) {
+			put_byte(&out, TDS_NBC_ROW_TOKEN);
+			memset(bitmap, 0, sizeof(bitmap));
+			for (col = 0; col < NUM_COLS; ++col)
+				if (is_null(row, col))
+					bitmap[col / 8u] |= 1u << (col % 8u);
+			for (col = 0; col < sizeof(bitmap); ++col)
+				put_byte(&out, bitmap[col]);
+		} else {
+			put_byte(&out, TDS_ROW_TOKEN);
+		}
+		for (col = 0; col < NUM_COLS; ++col) {
+			unsigned int i, len;
+
+			if (is_null(row, col)) {
+				if (nbc)
+					continue;
+				if (col % 2u == 0)
+					put_byte(&out, 0);
+				else
+					put_le(&out, 0xffff, 2);
+				continue;
+			}
+			if (col % 2u == 0) {
+				put_byte(&out, 4);
+				put_le(&out, (TDS_UINT) int_value(row, col), 4);
+				continue;
+			}
+			len = bin_len(row, col);
+			put_le(&out, len, 2);
+			for (i = 0; i < len; ++i)
+				put_byte(&out, (unsigned char) (row + col + i));
+		}
+	}
+
+	/* DONE with row count */
+	put_byte(&out, TDS_DONE_TOKEN);
+	put_le(&out, TDS_DONE_COUNT, 2);
+	put_le(&out, 0xc1, 2);
+	put_le(&out, num_rows, 8);
+	flush_pkt(&out, 1);
+
+	/* tell parent how many bytes we sent */
+	write_all(res_fd, (unsigned char *) &out.total, sizeof(out.total));
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static int
+check_row(TDSRESULTINFO * info, unsigned int row)
+{
+	unsigned int col, i;
+
+	for (col = 0; col < NUM_COLS; ++col) {
+		TDSCOLUMN *curcol = info->columns[col];
+		TDS_INT n;
+
+		if (is_null(row, col)) {
+			if (curcol->column_cur_size >= 0)
+				return 1;
+			continue;
+		}
+		if (col % 2u == 0) {
+			memcpy(&n, curcol->column_data, sizeof(n));
+			if (curcol->column_cur_size != 4 || n != int_value(row, col))
+				return 1;
+			continue;
+		}
+		if (curcol->column_cur_size != (TDS_INT) bin_len(row, col))
+			return 1;
+		for (i = 0; i < bin_len(row, col); ++i)
+			if (curcol->column_data[i] != (unsigned char) (row + col + i))
+				return 1;
+	}
+	return 0;
+}
+
+static int
+test(unsigned int num_rows, int nbc, int verbose)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	int sv[2], res_fds[2], status, done_flags;
+	pid_t pid;
+	unsigned int row = 0;
+	unsigned long total;
+	TDS_INT result_type;
+	TDSRET rc;
+	double start, end;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	if (pipe(res_fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		close(res_fds[0]);
+		sender(sv[1], res_fds[1], num_rows, nbc);
+		close(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+	close(res_fds[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, BLOCK_SIZE);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->tds_version = 0x703;
+	tds->state = TDS_PENDING;
+
+	start = now();
+	while ((rc = tds_process_tokens(tds, &result_type, &done_flags, TDS_RETURN_ROW)) == TDS_SUCCESS) {
+		if (result_type != TDS_ROW_RESULT)
+			continue;
+		if (tds->current_results->num_cols != NUM_COLS || check_row(tds->current_results, row)) {
+			fprintf(stderr, "wrong row %u (%s)\n", row, nbc ? "NBCROW" : "ROW");
+			return 1;
+		}
+		++row;
+	}
+	end = now();
+
+	if (rc != TDS_NO_MORE_RESULTS || row != num_rows || tds->rows_affected != num_rows) {
+		fprintf(stderr, "wrong result %d, %u rows (%s)\n", (int) rc, row, nbc ? "NBCROW" : "ROW");
+		return 1;
+	}
+
+	if (read(res_fds[0], &total, sizeof(total)) != sizeof(total)) {
+		fprintf(stderr, "error reading bytes sent\n");
+		return 1;
+	}
+	close(res_fds[0]);
+	if (verbose && end > start)
+		printf("%-6s %10lu bytes %10.1f bytes/row %10.0f rows/s\n", nbc ? "NBCROW" : "ROW",
+		       total, (double) total / num_rows, num_rows / (end - start));
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "sender failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int num_rows = 500;
+	int verbose = 0;
+
+	if (argc > 1) {
+		num_rows = atoi(argv[1]);
+		verbose = 1;
+	}
+	if (num_rows < 1)
+		num_rows = 1;
+
+	if (test(num_rows, 0, verbose) || test(num_rows, 1, verbose))
+		return 1;
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
@@ -21,9 +21,17 @@
 #include <tdsconvert.h>
 #include <assert.h>
 
-/* test numeric scale */
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/*
+ * test numeric scale and conversions.
+ * To test performance pass the number of values to convert, like
+ * $ ./numeric 1000000
+ */
 
-static char software_version[] = "$Id: numeric.c,v 1.5 2009/01/16 20:27:59 jklowden Exp $";
+static char software_version[] = "$Id: numeric.c,v 1.6 2011/09/14 09:37:15 freddy77 Exp $";
 static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
 
 static int g_result = 0;
@@ -93,6 +101,148 @@ test(const char *src, int prec, int scale, int scale2)
 	test0(src, prec, scale, prec, scale2);
 }
 
+static unsigned int rand_state = 1;
+
+static unsigned int
+rand_next(void)
+{
+	rand_state = rand_state * 1103515245u + 12345u;
+	return rand_state >> 8;
+}
+
+/* build a random number with given precision and scale, return numeric and normalized string */
+static void
+random_numeric(int prec, int scale, TDS_NUMERIC * num, char *s)
+{
+	char *p = s;
+	int i, digits = 1 + rand_next() % prec;
+	CONV_RESULT cr;
+
+	if (rand_next() % 2)
+		*p++ = '-';
+	/* no leading zeroes, unless the integer part is zero */
+	for (i = digits; i > scale; --i)
+		*p++ = (char) ((i == digits ? '1' : '0') + rand_next() % (i == digits ? 9 : 10));
+	if (digits <= scale)
+		*p++ = '0';
+	if (scale)
+		*p++ = '.';
+	for (i = scale; i > 0; --i)
+		*p++ = i > digits ? '0' : (char) ('0' + rand_next() % 10);
+	*p = 0;
+
+	memset(&cr.n, 0, sizeof(cr.n));
+	cr.n.precision = prec;
+	cr.n.scale = scale;
+	if (tds_convert(&ctx, SYBVARCHAR, s, (TDS_UINT) strlen(s), SYBNUMERIC, &cr) < 0) {
+		fprintf(stderr, "Error converting %s to numeric(%d,%d)\n", s, prec, scale);
+		exit(1);
+	}
+	*num = cr.n;
+}
+
+/* compare conversions to string, integer and float with the ones done from string */
+static void
+test_random(void)
+{
+	char s[MAXPRECISION + 4], buf[MAXPRECISION + 4], *p, *digits;
+	TDS_NUMERIC num;
+	TDS_INT8 bi;
+	TDS_FLOAT f;
+	int n, prec, scale, ret;
+
+	for (n = 0; n < 100000; ++n) {
+		prec = 1 + rand_next() % (n % 4 ? 38 : MAXPRECISION);
+		scale = rand_next() % (prec + 1);
+		random_numeric(prec, scale, &num, s);
+
+		if (tds_numeric_to_string(&num, buf) < 0 || strcmp(s, buf) != 0) {
+			fprintf(stderr, "Failed! %s (%d,%d) formatted as %s\n", s, prec, scale, buf);
+			exit(1);
+		}
+
+		if (tds_numeric_to_flt8(&num, &f) < 0 || f != strtod(s, NULL)) {
+			fprintf(stderr, "Failed! %s (%d,%d) converted to float as %.17g\n", s, prec, scale, f);
+			exit(1);
+		}
+
+		/* integer part, tests 64 bit limits too */
+		ret = tds_numeric_to_int8(&num, &bi);
+		if ((p = strchr(s, '.')) != NULL)
+			*p = 0;
+		digits = s[0] == '-' ? s + 1 : s;
+		if (strlen(digits) > 19
+		    || (strlen(digits) == 19 && strcmp(digits, s[0] == '-' ? "9223372036854775808" : "9223372036854775807") > 0)) {
+			if (ret != TDS_CONVERT_OVERFLOW) {
+				fprintf(stderr, "Failed! %s (%d,%d) should overflow\n", s, prec, scale);
+				exit(1);
+			}
+			continue;
+		}
+		p = buf;
+		if (bi < 0)
+			*p++ = '-';
+		*tds_format_uint8(p, bi < 0 ? -(TDS_UINT8) bi : (TDS_UINT8) bi) = 0;
+		if (ret < 0 || strcmp(buf, strcmp(digits, "0") == 0 ? digits : s) != 0) {
+			fprintf(stderr, "Failed! %s (%d,%d) converted to integer as %s\n", s, prec, scale, buf);
+			exit(1);
+		}
+	}
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+#define BENCH_NUM 1024
+
+/* speed of common conversions, for decimal(38,10) and decimal(18,4) */
+static void
+bench(unsigned int num)
+{
+	static char strings[BENCH_NUM][MAXPRECISION + 4];
+	static TDS_NUMERIC nums[BENCH_NUM];
+	static const int desttypes[] = { SYBNUMERIC, TDS_CONVERT_CHAR, SYBINT8, SYBFLT8, SYBNUMERIC };
+	static const char *const names[] = { "parse", "to string", "to bigint", "to float", "rescale" };
+	char buf[MAXPRECISION + 4];
+	CONV_RESULT cr;
+	int prec, i, t;
+	unsigned int n;
+	double start;
+
+	for (prec = 38; prec >= 18; prec -= 20) {
+		int scale = prec == 38 ? 10 : 4;
+
+		for (i = 0; i < BENCH_NUM; ++i)
+			random_numeric(prec, scale, &nums[i], strings[i]);
+
+		for (t = 0; t < 5; ++t) {
+			start = now();
+			for (n = 0; n < num; ++n) {
+				i = n % BENCH_NUM;
+				if (t == 1) {
+					cr.cc.c = buf;
+					cr.cc.len = sizeof(buf);
+				} else {
+					cr.n.precision = prec;
+					cr.n.scale = t == 4 ? scale / 2 : scale;
+				}
+				if (t == 0)
+					tds_convert(&ctx, SYBVARCHAR, strings[i], (TDS_UINT) strlen(strings[i]), SYBNUMERIC, &cr);
+				else
+					tds_convert(&ctx, SYBNUMERIC, (const TDS_CHAR *) &nums[i], sizeof(nums[i]),
+						    desttypes[t], &cr);
+			}
+			printf("decimal(%d,%d) %-9s %10.0f values/s\n", prec, scale, names[t], num / (now() - start));
+		}
+	}
+}
+
 int
 main(int argc, char **argv)
 {
@@ -141,6 +291,11 @@ main(int argc, char **argv)
 	}
 #endif
 
+	test_random();
+
+	if (argc > 1)
+		bench(atoi(argv[1]));
+
 	if (!g_result)
 		printf("All passed!\n");
 
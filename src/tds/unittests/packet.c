@@ -0,0 +1,401 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test packet reading and writing from/to network.
+ * A child process sends packets splitting them randomly, we read
+ * them back with tds_read_packet and check content.
+ * Then we write data with tds_put_n and a child process checks packets.
+ * To test performance pass the number of megabytes to transfer, like
+ * $ ./packet 200
+ * It prints MB/s and the number of system calls per MB.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+#ifdef __GLIBC__
+#include <sys/syscall.h>
+#endif
+
+static char software_version[] = "$Id: packet.c,v 1.1 2011/08/26 10:15:32 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK
+
+static unsigned int recv_calls = 0, send_calls = 0;
+
+#ifdef __GLIBC__
+/* count system calls done by libtds */
+ssize_t
+recv(int s, void *buf, size_t len, int flags)
+{
+	++recv_calls;
+	return recvfrom(s, buf, len, flags, NULL, NULL);
+}
+
+ssize_t
+send(int s, const void *buf, size_t len, int flags)
+{
+	++send_calls;
+	return sendto(s, buf, len, flags, NULL, 0);
+}
+
+ssize_t
+sendmsg(int s, const struct msghdr *msg, int flags)
+{
+	++send_calls;
+	return syscall(SYS_sendmsg, s, msg, flags);
+}
+#endif
+
+static unsigned int seed, chunk_seed;
+
+static unsigned int
+rnd(unsigned int *p_seed)
+{
+	*p_seed = *p_seed * 1103515245u + 12345u;
+	return (*p_seed >> 16) & 0x7fff;
+}
+
+static void
+write_all(int s, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = write(s, buf, len);
+		if (res <= 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+/* fill packet, both sender and receiver use this to compute content */
+static unsigned int
+make_packet(unsigned char *pkt, unsigned int num, unsigned int block_size, int last)
+{
+	unsigned int i, len = 8 + rnd(&seed) % (block_size - 7);
+
+	pkt[0] = 4;
+	pkt[1] = last ? 1 : 0;
+	pkt[2] = len >> 8;
+	pkt[3] = len & 0xff;
+	pkt[4] = pkt[5] = 0;
+	pkt[6] = num & 0xff;
+	pkt[7] = 0;
+	for (i = 8; i < len; ++i)
+		pkt[i] = (unsigned char) (num + i);
+	return len;
+}
+
+static void
+sender(int s, unsigned int num_packets, unsigned int block_size, int fragment)
+{
+	unsigned char *buf = (unsigned char *) malloc(65536 + block_size);
+	unsigned int n, pos = 0;
+
+	for (n = 0; n < num_packets; ++n) {
+		pos += make_packet(buf + pos, n, block_size, n + 1 == num_packets);
+		if (fragment) {
+			/* send in random chunks to split headers and data */
+			unsigned int sent = 0;
+
+			while (sent < pos) {
+				unsigned int chunk = 1 + rnd(&chunk_seed) % 3000;
+
+				if (chunk > pos - sent)
+					chunk = pos - sent;
+				write_all(s, buf + sent, chunk);
+				sent += chunk;
+			}
+			pos = 0;
+		} else if (pos >= 65536 || n + 1 == num_packets) {
+			write_all(s, buf, pos);
+			pos = 0;
+		}
+	}
+	free(buf);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static int
+test_read(unsigned int num_packets, unsigned int block_size, int fragment, int verbose)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	int sv[2], status;
+	pid_t pid;
+	unsigned char *expected;
+	unsigned int n, recv_start;
+	double bytes = 0, start, end;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	seed = block_size;
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		sender(sv[1], num_packets, block_size, fragment);
+		close(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, block_size);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->state = TDS_PENDING;
+
+	expected = (unsigned char *) malloc(block_size);
+	assert(expected);
+
+	start = now();
+	recv_start = recv_calls;
+
+	/* random sequence is the same of sender */
+	seed = block_size;
+	for (n = 0; n < num_packets; ++n) {
+		unsigned int len = make_packet(expected, n, block_size, n + 1 == num_packets);
+
+		if (tds_read_packet(tds) != (int) len || tds->in_len != len || tds->in_pos != 8
+		    || tds->in_flag != expected[0] || memcmp(tds->in_buf, expected, len) != 0) {
+			fprintf(stderr, "wrong packet %u (len %u) block size %u\n", n, len, block_size);
+			return 1;
+		}
+		bytes += len;
+	}
+
+	end = now();
+
+	/* no more data, connection should be closed */
+	if (tds_read_packet(tds) >= 0) {
+		fprintf(stderr, "packet read after end of data\n");
+		return 1;
+	}
+
+	if (verbose && end > start)
+		printf("read  block %5u: %8.1f MB/s %8.1f recv/MB\n", block_size,
+		       bytes / (1024.0 * 1024.0) / (end - start),
+		       (recv_calls - recv_start) * 1024.0 * 1024.0 / bytes);
+
+	free(expected);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "sender failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+/* read a request checking packets, return payload bytes or -1 on error */
+static long
+check_request(int s, unsigned int block_size, unsigned long *pos)
+{
+	unsigned char *pkt = (unsigned char *) malloc(block_size);
+	long total = 0;
+
+	for (;;) {
+		unsigned int i, len, got;
+		ssize_t res;
+
+		for (got = 0; got < 8; got += res)
+			if ((res = read(s, pkt + got, 8 - got)) <= 0) {
+				free(pkt);
+				return got ? -1 : -2;
+			}
+		len = pkt[2] * 256u + pkt[3];
+		if (pkt[0] != TDS_QUERY || len < 8 || len > block_size || (pkt[1] == 0 && len != block_size)) {
+			fprintf(stderr, "wrong header\n");
+			break;
+		}
+		for (; got < len; got += res)
+			if ((res = read(s, pkt + got, len - got)) <= 0)
+				break;
+		if (got < len)
+			break;
+		for (i = 8; i < len; ++i, ++*pos)
+			if (pkt[i] != (unsigned char) (*pos * 7u + (*pos >> 8)))
+				break;
+		if (i < len) {
+			fprintf(stderr, "wrong data\n");
+			break;
+		}
+		total += len - 8;
+		if (pkt[1]) {
+			free(pkt);
+			return total;
+		}
+	}
+	free(pkt);
+	return -1;
+}
+
+static int
+test_write(unsigned int num_requests, unsigned int block_size, unsigned int max_chunk, int verbose)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	int sv[2], status;
+	pid_t pid;
+	unsigned char *data;
+	unsigned int n, send_start;
+	unsigned long pos = 0;
+	double bytes = 0, start, end;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	/* data to send, follow the pattern checked by check_request */
+	data = (unsigned char *) malloc(max_chunk + 65536);
+	assert(data);
+	for (n = 0; n < max_chunk + 65536; ++n)
+		data[n] = (unsigned char) (n * 7u + (n >> 8));
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		while (check_request(sv[1], block_size, &pos) >= 0)
+			continue;
+		exit(check_request(sv[1], block_size, &pos) == -2 ? 0 : 1);
+	}
+	close(sv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, block_size);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->state = TDS_IDLE;
+	tds->out_flag = TDS_QUERY;
+
+	seed = block_size;
+	start = now();
+	send_start = send_calls;
+	for (n = 0; n < num_requests; ++n) {
+		unsigned int i, parts = 1 + rnd(&seed) % 16;
+
+		for (i = 0; i < parts; ++i) {
+			/* pattern is periodic on 65536 bytes */
+			unsigned int len = 1 + (rnd(&seed) * 32768u + rnd(&seed)) % max_chunk;
+
+			tds_put_n(tds, data + (pos & 0xffff), len);
+			pos += len;
+			bytes += len;
+		}
+		if (tds_flush_packet(tds) != TDS_SUCCESS) {
+			fprintf(stderr, "error sending data\n");
+			return 1;
+		}
+	}
+	end = now();
+
+	if (verbose && end > start)
+		printf("write block %5u chunk %6u: %8.1f MB/s %8.1f send/MB\n", block_size, max_chunk,
+		       bytes / (1024.0 * 1024.0) / (end - start),
+		       (send_calls - send_start) * 1024.0 * 1024.0 / bytes);
+
+	free(data);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "receiver failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned int sizes[] = { 512, 4096, 32767, 0 };
+	const unsigned int *size;
+	unsigned int mb = 0;
+
+	if (argc > 1)
+		mb = atoi(argv[1]);
+
+	for (size = sizes; *size; ++size) {
+		if (test_read(2000, *size, 1, 0))
+			return 1;
+		if (mb && test_read((unsigned int) (mb * 1024.0 * 1024.0 / (*size / 2 + 4)), *size, 0, 1))
+			return 1;
+	}
+	for (size = sizes; *size; ++size) {
+		if (test_write(200, *size, 100, 0) || test_write(20, *size, 200000, 0))
+			return 1;
+		if (mb && (test_write(mb * 1024u * 1024u / (8 * 50), *size, 100, 1)
+			   || test_write(mb * 1024u * 1024u / (8 * 100000), *size, 200000, 1)))
+			return 1;
+	}
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
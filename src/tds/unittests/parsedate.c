@@ -0,0 +1,192 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test conversion from strings to dates.
+ * ISO 8601 dates are parsed by a fast path, results are compared with
+ * the ones of the generic parser (used if a comma precedes the date).
+ * To test performance pass the number of dates to convert, like
+ * $ ./parsedate 3000000
+ * It prints dates/s converted with both parsers, this is the conversion
+ * done for every date column reading a character file with bcp.
+ */
+#include "common.h"
+#include <assert.h>
+#include <tdsconvert.h>
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+static char software_version[] = "$Id: parsedate.c,v 1.1 2011/09/06 16:41:08 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+static TDSCONTEXT *ctx;
+
+static void
+make_date(TDS_DATETIMEALL * dta, unsigned int n, int min_year)
+{
+	/* from min_year to 9999 */
+	int first = min_year == 1 ? -693595 : -53690;
+
+	memset(dta, 0, sizeof(*dta));
+	dta->date = first + (int) ((n * 7919u) % (unsigned) (2958463 - first + 1));
+	dta->time = ((TDS_UINT8) ((n * 104729u) % 86400u)) * 10000000u + (n * 7u) % 10000000u;
+	dta->time_prec = 7;
+	dta->has_date = 1;
+	dta->has_time = 1;
+}
+
+static int
+convert(const char *s, int len, int desttype, CONV_RESULT * cr)
+{
+	int res = tds_convert(ctx, SYBVARCHAR, s, len < 0 ? (TDS_UINT) strlen(s) : (TDS_UINT) len, desttype, cr);
+
+	if (res < 0) {
+		fprintf(stderr, "error %d converting \"%s\"\n", res, s);
+		exit(1);
+	}
+	return res;
+}
+
+static int
+same_date(int desttype, const CONV_RESULT * a, const CONV_RESULT * b)
+{
+	if (desttype == SYBDATETIME)
+		return a->dt.dtdays == b->dt.dtdays && a->dt.dttime == b->dt.dttime;
+	return a->dta.date == b->dta.date && a->dta.time == b->dta.time && a->dta.has_offset == b->dta.has_offset
+		&& a->dta.offset == b->dta.offset;
+}
+
+static int
+check(const char *s, int len, int desttype, int days, TDS_UINT8 time, int offset)
+{
+	CONV_RESULT cr;
+
+	convert(s, len, desttype, &cr);
+	if (desttype == SYBDATETIME) {
+		if (cr.dt.dtdays == days && cr.dt.dttime == time)
+			return 0;
+	} else if (cr.dta.date == days && cr.dta.time == time && cr.dta.has_offset == (offset != -1)
+		   && (offset == -1 || cr.dta.offset == offset)) {
+		return 0;
+	}
+	fprintf(stderr, "wrong conversion of \"%s\"\n", s);
+	return 1;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int types[] = { SYBDATETIME, SYBMSDATETIME2 };
+	TDS_DATETIMEALL dta;
+	TDSDATEREC dr;
+	CONV_RESULT cr, cr2;
+	char buf[64];
+	static char dates[1024][32];
+	unsigned int n, num = 0;
+	int t, res = 0;
+	double start;
+
+	if (argc > 1)
+		num = atoi(argv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+
+	/* fast path must give same results as generic parser */
+	for (t = 0; t < 2; ++t) {
+		for (n = 0; n < 20000; ++n) {
+			make_date(&dta, n, 1753);
+			tds_datecrack(SYBMSDATETIME2, &dta, &dr);
+			sprintf(buf, ",%04d-%02d-%02d %02d:%02d:%02d.%07d", dr.year, dr.month + 1, dr.day, dr.hour, dr.minute,
+				dr.second, dr.decimicrosecond);
+			convert(buf, -1, types[t], &cr);
+			convert(buf + 1, -1, types[t], &cr2);
+			if (!same_date(types[t], &cr, &cr2)) {
+				fprintf(stderr, "different results for \"%s\"\n", buf + 1);
+				return 1;
+			}
+			/* DATETIME2 must be converted back exactly */
+			if (types[t] == SYBMSDATETIME2 && (cr2.dta.date != dta.date || cr2.dta.time != dta.time)) {
+				fprintf(stderr, "wrong conversion of \"%s\"\n", buf + 1);
+				return 1;
+			}
+		}
+	}
+
+	/* years before 1753 for new types */
+	for (n = 0; n < 20000; ++n) {
+		make_date(&dta, n, 1);
+		tds_datecrack(SYBMSDATETIME2, &dta, &dr);
+		sprintf(buf, "%04d%02d%02dT%02d:%02d:%02d.%07d", dr.year, dr.month + 1, dr.day, dr.hour, dr.minute,
+			dr.second, dr.decimicrosecond);
+		res |= check(buf, -1, SYBMSDATETIME2, dta.date, dta.time, -1);
+		if (res)
+			return res;
+	}
+
+	/* separators, blanks and length */
+	res |= check("  2011-09-05 10:12  ", -1, SYBMSDATETIME2, 40789, 367200000000u, -1);
+	res |= check("20110905   10:12:00", -1, SYBMSDATETIME2, 40789, 367200000000u, -1);
+	res |= check("2011-09-05 10:12:44.123not a date", 23, SYBDATETIME, 40789, 11029237, -1);
+	res |= check("2011-09-05", -1, SYBDATETIME, 40789, 0, -1);
+	res |= check("2000-02-29", -1, SYBMSDATETIME2, 36583, 0, -1);
+
+	/* offsets, time is stored as UTC */
+	res |= check("2011-09-05T01:00:00+02:00", -1, SYBMSDATETIMEOFFSET, 40788, 23 * 36000000000u, 120);
+	res |= check("2011-09-05T23:00:00-01:30", -1, SYBMSDATETIMEOFFSET, 40790, 18000000000u, -90);
+	res |= check("2011-09-05T10:00:00Z", -1, SYBMSDATETIMEOFFSET, 40789, 10 * 36000000000u, 0);
+	res |= check("2011-09-05T01:00:00+02:00", -1, SYBMSDATETIME2, 40789, 36000000000u, -1);
+
+	/* other formats still handled by generic parser */
+	res |= check("Sep  5 2011 10:12AM", -1, SYBMSDATETIME2, 40789, 367200000000u, -1);
+	res |= check("09/05/2011", -1, SYBDATETIME, 40789, 0, -1);
+	res |= check("2011-02-30", -1, SYBDATETIME, 40602, 0, -1);
+	if (res)
+		return res;
+
+	if (!num)
+		return 0;
+
+	for (n = 0; n < 1024; ++n) {
+		make_date(&dta, n, 1753);
+		tds_datecrack(SYBMSDATETIME2, &dta, &dr);
+		sprintf(dates[n], ",%04d-%02d-%02d %02d:%02d:%02d.%03d", dr.year, dr.month + 1, dr.day, dr.hour, dr.minute,
+			dr.second, dr.decimicrosecond / 10000);
+	}
+	for (t = 0; t < 2; ++t) {
+		start = now();
+		for (n = 0; n < num; ++n)
+			convert(dates[n % 1024u] + 1 - t, 24 + t, SYBDATETIME, &cr);
+		printf("%s %10.0f dates/s\n", t ? "generic" : "iso    ", num / (now() - start));
+	}
+
+	tds_free_context(ctx);
+	return 0;
+}
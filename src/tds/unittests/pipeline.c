@@ -0,0 +1,477 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test pipelined requests and compare latency with serial ones.
+ * A child process acts as server, it waits a bit for every request it
+ * receives (simulating network latency) then answers every RPC with
+ * a row and a return status containing a sequence number. Some RPCs call
+ * a nested procedure first (which returns a status too), some return an
+ * output parameter, some others fail. The mark calls packed between
+ * requests are answered like a server would. Responses must be assigned
+ * to requests in order.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif /* HAVE_SYS_TIME_H */
+
+static char software_version[] = "$Id: pipeline.c,v 1.1 2011/09/26 11:37:02 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK && HAVE_GETTIMEOFDAY
+
+#define NUM_REQUESTS 40
+#define BLOCK_SIZE 512
+/* microseconds the server waits for every request */
+#define LATENCY 2000
+/* requests calling a procedure before returning their row */
+#define NESTED(n) ((n) % 4 == 1)
+/* requests failing, without rows and return status */
+#define FAILING(n) ((n) % 7 == 5)
+/* requests returning an output parameter */
+#define OUTPUT(n) ((n) % 5 == 3)
+
+typedef struct
+{
+	int s;
+	unsigned int len;
+	unsigned char buf[BLOCK_SIZE];
+} OUTPKT;
+
+static void
+write_all(int s, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = write(s, buf, len);
+		if (res <= 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+static int
+read_all(int s, unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = read(s, buf, len);
+		if (res <= 0)
+			return 0;
+		buf += res;
+		len -= res;
+	}
+	return 1;
+}
+
+static void
+flush_pkt(OUTPKT * out, int last)
+{
+	out->buf[0] = TDS_REPLY;
+	out->buf[1] = last ? 1 : 0;
+	out->buf[2] = out->len >> 8;
+	out->buf[3] = out->len & 0xff;
+	out->buf[4] = out->buf[5] = out->buf[6] = out->buf[7] = 0;
+	write_all(out->s, out->buf, out->len);
+	out->len = 8;
+}
+
+static void
+put_byte(OUTPKT * out, unsigned char c)
+{
+	if (out->len >= BLOCK_SIZE)
+		flush_pkt(out, 0);
+	out->buf[out->len++] = c;
+}
+
+static void
+put_le(OUTPKT * out, TDS_UINT8 n, unsigned int len)
+{
+	while (len--) {
+		put_byte(out, (unsigned char) (n & 0xff));
+		n >>= 8;
+	}
+}
+
+static void
+put_done(OUTPKT * out, unsigned char token, unsigned int status, unsigned int cmd, unsigned int rows)
+{
+	put_byte(out, token);
+	put_le(out, status, 2);
+	put_le(out, cmd, 2);
+	put_le(out, rows, 8);
+}
+
+static void
+put_status(OUTPKT * out, TDS_INT status)
+{
+	put_byte(out, TDS_RETURNSTATUS_TOKEN);
+	put_le(out, (TDS_UINT) status, 4);
+}
+
+/* output parameter, an int, NULL if value is negative */
+static void
+put_param(OUTPKT * out, const char *name, TDS_INT value)
+{
+	put_byte(out, TDS_PARAM_TOKEN);
+	put_le(out, 0, 2);
+	put_byte(out, (unsigned char) strlen(name));
+	for (; *name; ++name)
+		put_le(out, (unsigned char) *name, 2);
+	put_byte(out, 1);
+	put_le(out, 0, 2);
+	put_le(out, 0, 4);
+	put_byte(out, SYBINTN);
+	put_byte(out, 4);
+	if (value < 0) {
+		put_byte(out, 0);
+	} else {
+		put_byte(out, 4);
+		put_le(out, value, 4);
+	}
+}
+
+static unsigned int
+get_le(const unsigned char *p, unsigned int len)
+{
+	unsigned int n = 0;
+
+	while (len--)
+		n = (n << 8) | p[len];
+	return n;
+}
+
+/* skip a NTEXT parameter of sp_executesql */
+static unsigned int
+skip_ntext(const unsigned char *buf, unsigned int pos)
+{
+	assert(buf[pos] == 0 && buf[pos + 1] == 0 && buf[pos + 2] == SYBNTEXT);
+	pos += 3 + 4 + 5;
+	return pos + 4 + get_le(buf + pos, 4);
+}
+
+/* RPCs of last request, 1 if mark call */
+static unsigned char marks[NUM_REQUESTS * 2];
+
+/* read a whole request, return number of RPCs in it, 0 at end */
+static unsigned int
+read_request(int s)
+{
+	static unsigned char buf[16384];
+	unsigned char header[8];
+	unsigned int len = 0, pos, num_rpcs = 0;
+
+	do {
+		unsigned int pkt_len;
+
+		if (!read_all(s, header, 8))
+			return 0;
+		pkt_len = header[2] * 256u + header[3] - 8;
+		assert(header[0] == TDS_RPC && len + pkt_len <= sizeof(buf));
+		if (!read_all(s, buf + len, pkt_len))
+			return 0;
+		len += pkt_len;
+	} while (!(header[1] & 1));
+
+	/* skip ALL_HEADERS, then RPCs separated by batch separators */
+	pos = get_le(buf, 4);
+	while (pos < len) {
+		unsigned int name_len = get_le(buf + pos, 2);
+
+		assert(num_rpcs < sizeof(marks));
+		marks[num_rpcs] = name_len == 0xffff;
+		if (marks[num_rpcs]) {
+			/* mark call, sp_executesql with an output parameter */
+			assert(get_le(buf + pos + 2, 2) == TDS_SP_EXECUTESQL);
+			pos = skip_ntext(buf, skip_ntext(buf, pos + 6));
+			name_len = buf[pos];
+			pos += 1 + name_len * 2;
+			assert(buf[pos] == 1 && buf[pos + 1] == SYBINTN && buf[pos + 3] == 0);
+			pos += 4;
+			++num_rpcs;
+			assert(pos < len);
+			assert(buf[pos++] == 0xff);
+			continue;
+		}
+		assert(name_len == 7 || name_len == 10);
+		pos += 2 + name_len * 2 + 2;
+		/* sp_execute has the statement id */
+		if (name_len == 10)
+			pos += 9;
+		++num_rpcs;
+		if (pos < len)
+			assert(buf[pos++] == 0xff);
+	}
+	assert(pos == len);
+	return num_rpcs;
+}
+
+static void
+server(int s)
+{
+	OUTPKT out;
+	unsigned int num_rpcs, seq = 0;
+
+	out.s = s;
+	out.len = 8;
+
+	while ((num_rpcs = read_request(s)) != 0) {
+		unsigned int i;
+
+		usleep(LATENCY);
+		for (i = 0; i < num_rpcs; ++i) {
+			unsigned int more = i + 1 < num_rpcs ? TDS_DONE_MORE_RESULTS : 0;
+
+			if (marks[i]) {
+				put_status(&out, 0);
+				put_param(&out, TDS_PIPELINE_MARK, -1);
+				put_done(&out, TDS_DONEPROC_TOKEN, more, 0xe0, 0);
+				continue;
+			}
+
+			if (FAILING(seq)) {
+				put_done(&out, TDS_DONEPROC_TOKEN, TDS_DONE_ERROR | more, 0xe0, 0);
+				++seq;
+				continue;
+			}
+
+			if (NESTED(seq)) {
+				/* a statement of the nested procedure, then its end */
+				put_done(&out, TDS_DONEINPROC_TOKEN, TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 0xc3, 1);
+				put_status(&out, 1000 + seq);
+				put_done(&out, TDS_DONEPROC_TOKEN, TDS_DONE_MORE_RESULTS, 0xe0, 0);
+			}
+
+			/* COLMETADATA, an int */
+			put_byte(&out, TDS7_RESULT_TOKEN);
+			put_le(&out, 1, 2);
+			put_le(&out, 0, 4);
+			put_le(&out, 1, 2);
+			put_byte(&out, SYBINTN);
+			put_byte(&out, 4);
+			put_byte(&out, 0);
+
+			put_byte(&out, TDS_ROW_TOKEN);
+			put_byte(&out, 4);
+			put_le(&out, seq, 4);
+
+			put_done(&out, TDS_DONEINPROC_TOKEN, TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 0xc1, 1);
+
+			put_status(&out, seq);
+			if (OUTPUT(seq))
+				put_param(&out, "@out", seq);
+			put_done(&out, TDS_DONEPROC_TOKEN, more, 0xe0, 0);
+			++seq;
+		}
+		flush_pkt(&out, 1);
+	}
+}
+
+static TDSSOCKET *tds;
+static TDS_INT seq = 0;
+
+/* status and parameters of sp_execute are not returned */
+static void
+read_response(int execute)
+{
+	TDS_INT result_type;
+	TDSRESULTINFO *info;
+	TDSRET rc;
+	int rows = 0, statuses = 0, params = 0;
+	TDS_INT last_status = -1;
+
+	while ((rc = tds_process_tokens(tds, &result_type, NULL, TDS_RETURN_ROWFMT|TDS_RETURN_ROW|TDS_RETURN_DONE|TDS_RETURN_PROC)) == TDS_SUCCESS) {
+		switch (result_type) {
+		case TDS_STATUS_RESULT:
+			++statuses;
+			last_status = tds->ret_status;
+			continue;
+		case TDS_PARAM_RESULT:
+			/* parameters follow the status of the request */
+			info = tds->current_results;
+			if (last_status != seq || info->num_cols != 1 || strcmp(info->columns[0]->column_name, "@out") != 0
+			    || *(TDS_INT *) info->columns[0]->column_data != seq) {
+				fprintf(stderr, "wrong parameter, expected %d\n", (int) seq);
+				exit(1);
+			}
+			++params;
+			continue;
+		case TDS_ROW_RESULT:
+			break;
+		default:
+			continue;
+		}
+		info = tds->current_results;
+		if (info->num_cols != 1 || *(TDS_INT *) info->columns[0]->column_data != seq) {
+			fprintf(stderr, "wrong row, expected %d\n", (int) seq);
+			exit(1);
+		}
+		++rows;
+	}
+	if (FAILING(seq) || execute ? (rows != (FAILING(seq) ? 0 : 1) || statuses != 0)
+	    : (rows != 1 || statuses != (NESTED(seq) ? 2 : 1) || last_status != seq)) {
+		fprintf(stderr, "wrong response %d\n", (int) seq);
+		exit(1);
+	}
+	if (rc != TDS_NO_MORE_RESULTS || params != (!FAILING(seq) && !execute && OUTPUT(seq) ? 1 : 0)) {
+		fprintf(stderr, "wrong response %d\n", (int) seq);
+		exit(1);
+	}
+	++seq;
+}
+
+static double
+elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSDYNAMIC *dyn;
+	TDSMULTIPLE multiple;
+	int sv[2], status, i;
+	pid_t pid;
+	struct timeval start;
+	double serial, pipelined;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		server(sv[1]);
+		close(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, BLOCK_SIZE);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->state = TDS_IDLE;
+	tds_iconv_open(tds, "ISO-8859-1");
+
+	/* requests are packed in a RPC, not possible before TDS7 */
+	tds->tds_version = 0x500;
+	assert(tds_pipeline_rpc(tds, "sp_pipe", NULL) == TDS_FAIL && tds->state == TDS_IDLE);
+	tds->tds_version = 0x702;
+
+	dyn = tds_alloc_dynamic(tds, NULL);
+	assert(dyn);
+	dyn->num_id = 1;
+
+	/* a round trip for every request */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_REQUESTS; ++i) {
+		assert(tds_submit_rpc(tds, "sp_pipe", NULL) == TDS_SUCCESS);
+		read_response(0);
+		assert(tds->state == TDS_IDLE);
+	}
+	serial = elapsed(&start);
+
+	/* all requests together */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NUM_REQUESTS; ++i) {
+		if (i % 3 == 2)
+			assert(tds_pipeline_execute(tds, dyn) == TDS_SUCCESS);
+		else
+			assert(tds_pipeline_rpc(tds, "sp_pipe", NULL) == TDS_SUCCESS);
+	}
+	assert(tds_pipeline_send(tds) == TDS_SUCCESS);
+	for (i = 0; i < NUM_REQUESTS; ++i) {
+		if (i > 0)
+			assert(tds_pipeline_next(tds) == TDS_SUCCESS);
+		read_response(i % 3 == 2);
+		if (i == NUM_REQUESTS - 1)
+			break;
+
+		/* stay at boundary, no other requests allowed */
+		assert(tds->state == TDS_PENDING && tds->pipeline.boundary);
+		assert(tds_submit_rpc(tds, "sp_pipe", NULL) == TDS_FAIL);
+		assert(tds_pipeline_rpc(tds, "sp_pipe", NULL) == TDS_FAIL);
+	}
+	pipelined = elapsed(&start);
+	assert(tds->state == TDS_IDLE && tds_pipeline_next(tds) == TDS_FAIL);
+
+	/* connection is usable again */
+	assert(tds_pipeline_rpc(tds, "sp_pipe", NULL) == TDS_SUCCESS);
+
+	/* other requests cannot be mixed with queued ones */
+	assert(tds_submit_query(tds, "select 2") == TDS_FAIL);
+	assert(tds_submit_rpc(tds, "sp_pipe", NULL) == TDS_FAIL);
+	assert(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_QUERY) == TDS_FAIL);
+	assert(tds->state == TDS_QUERYING && tds->pipeline.num_requests == 1);
+
+	assert(tds_pipeline_send(tds) == TDS_SUCCESS);
+	read_response(0);
+	assert(tds->state == TDS_IDLE);
+
+	printf("%d requests: serial %.1f ms, pipelined %.1f ms\n", NUM_REQUESTS, serial, pipelined);
+
+	tds_free_dynamic(tds, dyn);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "server failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,331 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test reading varbinary(max) (PLP) data.
+ * A child process sends rows with an int and a varbinary(max) column,
+ * values are split in chunks of different sizes, with total length
+ * known or not. We read them as usual, then incrementally with
+ * tds_stream_read, also leaving some data unread.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+static char software_version[] = "$Id: plp.c,v 1.1 2011/09/01 10:04:21 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK
+
+#define NUM_ROWS 12
+#define BLOCK_SIZE 4096
+
+/* length of value in row, -1 for NULL */
+static int
+value_len(unsigned int row)
+{
+	static const int lens[NUM_ROWS] = { 0, 1, -1, 4095, 4096, 100000, 3, -1, 250000, 17, 65536, 9000 };
+
+	return lens[row];
+}
+
+static unsigned char
+value_byte(unsigned int row, unsigned int pos)
+{
+	return (unsigned char) (row * 31u + pos * 7u + (pos >> 8));
+}
+
+typedef struct
+{
+	int s;
+	unsigned int len;
+	unsigned char buf[BLOCK_SIZE];
+} OUTPKT;
+
+static void
+write_all(int s, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = write(s, buf, len);
+		if (res <= 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+static void
+flush_pkt(OUTPKT * out, int last)
+{
+	out->buf[0] = TDS_REPLY;
+	out->buf[1] = last ? 1 : 0;
+	out->buf[2] = out->len >> 8;
+	out->buf[3] = out->len & 0xff;
+	out->buf[4] = out->buf[5] = out->buf[6] = out->buf[7] = 0;
+	write_all(out->s, out->buf, out->len);
+	out->len = 8;
+}
+
+static void
+put_byte(OUTPKT * out, unsigned char c)
+{
+	if (out->len >= BLOCK_SIZE)
+		flush_pkt(out, 0);
+	out->buf[out->len++] = c;
+}
+
+static void
+put_le(OUTPKT * out, TDS_UINT8 n, unsigned int len)
+{
+	while (len--) {
+		put_byte(out, (unsigned char) (n & 0xff));
+		n >>= 8;
+	}
+}
+
+static void
+sender(int s)
+{
+	OUTPKT out;
+	unsigned int row, pos;
+
+	out.s = s;
+	out.len = 8;
+
+	/* two result sets with same data */
+	for (pos = 0; pos < 2; ++pos) {
+		/* COLMETADATA, int and varbinary(max) */
+		put_byte(&out, TDS7_RESULT_TOKEN);
+		put_le(&out, 2, 2);
+		put_le(&out, 0, 4);
+		put_le(&out, 1, 2);
+		put_byte(&out, SYBINTN);
+		put_byte(&out, 4);
+		put_byte(&out, 0);
+		put_le(&out, 0, 4);
+		put_le(&out, 1, 2);
+		put_byte(&out, XSYBVARBINARY);
+		put_le(&out, 0xffff, 2);
+		put_byte(&out, 0);
+
+		for (row = 0; row < NUM_ROWS; ++row) {
+			int len = value_len(row);
+			unsigned int sent = 0, chunk = 1 + row * 997u;
+
+			put_byte(&out, TDS_ROW_TOKEN);
+			put_byte(&out, 4);
+			put_le(&out, row, 4);
+			if (len < 0) {
+				put_le(&out, ~(TDS_UINT8) 0, 8);
+				continue;
+			}
+			/* odd rows don't tell total length */
+			put_le(&out, row % 2u ? ~(TDS_UINT8) 1 : (TDS_UINT8) len, 8);
+			while (sent < (unsigned int) len) {
+				unsigned int n = (unsigned int) len - sent;
+
+				if (n > chunk)
+					n = chunk;
+				put_le(&out, n, 4);
+				for (; n; --n, ++sent)
+					put_byte(&out, value_byte(row, sent));
+			}
+			put_le(&out, 0, 4);
+		}
+
+		put_byte(&out, TDS_DONE_TOKEN);
+		put_le(&out, pos ? TDS_DONE_COUNT : TDS_DONE_COUNT | TDS_DONE_MORE_RESULTS, 2);
+		put_le(&out, 0xc1, 2);
+		put_le(&out, NUM_ROWS, 8);
+	}
+	flush_pkt(&out, 1);
+}
+
+static int
+check_value(const unsigned char *data, int len, unsigned int row, unsigned int start)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		if (data[i] != value_byte(row, start + i))
+			return 1;
+	return 0;
+}
+
+static int
+next_row(TDSSOCKET * tds, unsigned int row)
+{
+	TDS_INT result_type;
+	int done_flags;
+	TDSRESULTINFO *info;
+
+	for (;;) {
+		if (tds_process_tokens(tds, &result_type, &done_flags, TDS_RETURN_ROWFMT|TDS_RETURN_ROW|TDS_RETURN_DONE) != TDS_SUCCESS)
+			return 1;
+		if (result_type == TDS_ROW_RESULT)
+			break;
+	}
+	info = tds->current_results;
+	if (info->num_cols != 2 || info->columns[0]->column_cur_size != 4
+	    || *(TDS_INT *) info->columns[0]->column_data != (TDS_INT) row)
+		return 1;
+	return 0;
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSCOLUMN *curcol;
+	int sv[2], status;
+	pid_t pid;
+	unsigned int row;
+	TDS_INT result_type;
+	TDSRET rc;
+	unsigned char buf[1000];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		sender(sv[1]);
+		close(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, BLOCK_SIZE);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->tds_version = 0x702;
+	tds->state = TDS_PENDING;
+
+	/* read values as usual */
+	for (row = 0; row < NUM_ROWS; ++row) {
+		if (next_row(tds, row)) {
+			fprintf(stderr, "error reading row %u\n", row);
+			return 1;
+		}
+		curcol = tds->current_results->columns[1];
+		if (curcol->column_cur_size != value_len(row) || tds->stream_col
+		    || (value_len(row) > 0 && check_value((unsigned char *) ((TDSBLOB *) curcol->column_data)->textvalue,
+							 value_len(row), row, 0))) {
+			fprintf(stderr, "wrong value in row %u\n", row);
+			return 1;
+		}
+	}
+
+	/* read values incrementally, skip part of them */
+	for (row = 0; row < NUM_ROWS; ++row) {
+		int len = value_len(row), pos = 0, n;
+
+		if (row == 0) {
+			if (tds_process_tokens(tds, &result_type, NULL, TDS_STOPAT_ROWFMT|TDS_RETURN_DONE) != TDS_SUCCESS
+			    || tds_process_tokens(tds, &result_type, NULL, TDS_STOPAT_ROW|TDS_RETURN_ROWFMT) != TDS_SUCCESS
+			    || result_type != TDS_ROWFMT_RESULT) {
+				fprintf(stderr, "second result not found\n");
+				return 1;
+			}
+		}
+		tds->current_results->columns[1]->column_stream = 1;
+		if (next_row(tds, row)) {
+			fprintf(stderr, "error reading row %u\n", row);
+			return 1;
+		}
+		curcol = tds->current_results->columns[1];
+
+		/* values without length are not streamed */
+		if (len < 0 || row % 2u) {
+			if (tds->stream_col || curcol->column_cur_size != len) {
+				fprintf(stderr, "wrong not streamed value in row %u\n", row);
+				return 1;
+			}
+			continue;
+		}
+		if (tds->stream_col != curcol || curcol->column_cur_size != len) {
+			fprintf(stderr, "value not streamed in row %u\n", row);
+			return 1;
+		}
+		/* read a part of some values, rest is discarded reading next row */
+		if (row % 4u == 0)
+			len /= 3;
+		while (pos < len) {
+			n = tds_stream_read(tds, curcol, buf, len - pos > (int) sizeof(buf) ? sizeof(buf) : (size_t) (len - pos));
+			if (n <= 0 || check_value(buf, n, row, pos)) {
+				fprintf(stderr, "wrong streamed data in row %u\n", row);
+				return 1;
+			}
+			pos += n;
+		}
+		if (row % 4u != 0 && tds_stream_read(tds, curcol, buf, sizeof(buf)) != 0) {
+			fprintf(stderr, "data after end in row %u\n", row);
+			return 1;
+		}
+	}
+
+	while ((rc = tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS)) == TDS_SUCCESS)
+		continue;
+	if (rc != TDS_NO_MORE_RESULTS || tds->stream_col) {
+		fprintf(stderr, "wrong end of data\n");
+		return 1;
+	}
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "sender failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
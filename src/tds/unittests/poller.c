@@ -0,0 +1,306 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test waiting responses from many connections with a poller.
+ * A child process sends responses to many sockets in random order
+ * splitting them in many writes, we check every connection is reported
+ * once and only when its response is complete.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+static char software_version[] = "$Id: poller.c,v 1.1 2011/08/29 09:41:12 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK
+
+#include <fcntl.h>
+
+#define NUM_CONN 40
+#define BLOCK_SIZE 512
+
+static unsigned int seed = 1;
+
+static unsigned int
+rnd(void)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (seed >> 16) & 0x7fff;
+}
+
+static void
+write_all(int s, const unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = write(s, buf, len);
+		if (res <= 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+/* response for connection n, num_packets packets, last one is marked as such */
+static unsigned int
+num_packets(unsigned int n)
+{
+	return 1 + n % 5;
+}
+
+static unsigned int
+make_response(unsigned char *buf, unsigned int n)
+{
+	unsigned int i, p, pos = 0;
+
+	for (p = 0; p < num_packets(n); ++p) {
+		unsigned int len = 8 + (n * 37 + p * 101) % (BLOCK_SIZE - 7);
+		unsigned char *pkt = buf + pos;
+
+		pkt[0] = TDS_REPLY;
+		pkt[1] = p + 1 == num_packets(n) ? 1 : 0;
+		pkt[2] = len >> 8;
+		pkt[3] = len & 0xff;
+		pkt[4] = pkt[5] = pkt[6] = pkt[7] = 0;
+		for (i = 8; i < len; ++i)
+			pkt[i] = (unsigned char) (n + p + i);
+		pos += len;
+	}
+	return pos;
+}
+
+static void
+server(int *socks)
+{
+	unsigned char buf[BLOCK_SIZE * 5];
+	unsigned int order[NUM_CONN], i;
+
+	for (i = 0; i < NUM_CONN; ++i)
+		order[i] = i;
+	for (i = NUM_CONN - 1; i > 0; --i) {
+		unsigned int j = rnd() % (i + 1), t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	for (i = 0; i < NUM_CONN; ++i) {
+		unsigned int n = order[i], len = make_response(buf, n), sent = 0;
+
+		/* send in chunks, sleep to give reader a chance to see partial responses */
+		while (sent < len) {
+			unsigned int chunk = 1 + rnd() % 300;
+
+			if (chunk > len - sent)
+				chunk = len - sent;
+			write_all(socks[n], buf + sent, chunk);
+			sent += chunk;
+			if (rnd() % 4 == 0)
+				usleep(1000);
+		}
+	}
+
+	/* wait for reader to signal end, then close one connection */
+	if (read(socks[0], buf, 1) != 1)
+		exit(1);
+	close(socks[1]);
+}
+
+/* read a full response checking it, return 0 on success */
+static int
+check_response(TDSSOCKET * tds, unsigned int n)
+{
+	unsigned char expected[BLOCK_SIZE * 5];
+	unsigned int len = make_response(expected, n), pos = 0;
+
+	while (pos < len) {
+		if (tds_read_packet(tds) < 8 || pos + tds->in_len > len || memcmp(tds->in_buf, expected + pos, tds->in_len) != 0)
+			return 1;
+		pos += tds->in_len;
+		/* mark packet as consumed, a not processed last packet is a pending response */
+		tds->in_pos = tds->in_len;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds[NUM_CONN], *ready;
+	TDSPOLLER *poller;
+	int socks[NUM_CONN], i, status, done[NUM_CONN], num_done = 0;
+	int start_pipe[2];
+	char c;
+	unsigned int start;
+	pid_t pid;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	poller = tds_alloc_poller();
+	assert(poller);
+
+	for (i = 0; i < NUM_CONN; ++i) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+		/* libtds sockets are always not blocking */
+		fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+		tds[i] = tds_alloc_socket(ctx, BLOCK_SIZE);
+		assert(tds[i]);
+		tds_set_s(tds[i], sv[0]);
+		tds[i]->state = TDS_PENDING;
+		socks[i] = sv[1];
+		done[i] = 0;
+		if (tds_poller_add(poller, tds[i])) {
+			fprintf(stderr, "error adding socket\n");
+			return 1;
+		}
+	}
+
+	/* server starts sending when we tell it */
+	if (pipe(start_pipe) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		for (i = 0; i < NUM_CONN; ++i)
+			close(tds_get_s(tds[i]));
+		close(start_pipe[1]);
+		if (read(start_pipe[0], &c, 1) != 1)
+			exit(1);
+		server(socks);
+		exit(0);
+	}
+	for (i = 0; i < NUM_CONN; ++i)
+		close(socks[i]);
+	close(start_pipe[0]);
+
+	/* nothing sent yet */
+	if (tds_poller_wait(poller, 0, &ready) != 0 || ready != NULL) {
+		fprintf(stderr, "socket reported before any response\n");
+		return 1;
+	}
+	c = 0;
+	if (write(start_pipe[1], &c, 1) != 1) {
+		perror("write");
+		return 1;
+	}
+	close(start_pipe[1]);
+
+	while (num_done < NUM_CONN) {
+		if (tds_poller_wait(poller, 10000, &ready) != 1 || !ready) {
+			fprintf(stderr, "no response, %d responses received\n", num_done);
+			return 1;
+		}
+		for (i = 0; i < NUM_CONN && tds[i] != ready; ++i)
+			continue;
+		if (i >= NUM_CONN || done[i]) {
+			fprintf(stderr, "wrong socket reported\n");
+			return 1;
+		}
+
+		/* a not consumed response must be reported again */
+		if (num_done == 0) {
+			if (tds_poller_wait(poller, 0, &ready) != 1 || ready != tds[i]) {
+				fprintf(stderr, "response not reported again\n");
+				return 1;
+			}
+		}
+
+		/* response must be fully buffered */
+		if (!tds_response_ready(ready) || check_response(ready, i)) {
+			fprintf(stderr, "wrong response for connection %d\n", i);
+			return 1;
+		}
+		done[i] = 1;
+		++num_done;
+	}
+
+	/* all consumed, check timeout */
+	start = tds_gettime_ms();
+	if (tds_poller_wait(poller, 100, &ready) != 0 || ready != NULL) {
+		fprintf(stderr, "socket reported after all responses\n");
+		return 1;
+	}
+	if (tds_gettime_ms() - start < 90) {
+		fprintf(stderr, "timeout too short\n");
+		return 1;
+	}
+
+	if (tds_wait_response(tds[2], 50) != 0) {
+		fprintf(stderr, "response reported on idle connection\n");
+		return 1;
+	}
+
+	/* removed socket are not reported, closed connections are */
+	tds_poller_remove(poller, tds[0]);
+	if (write(tds_get_s(tds[0]), "x", 1) != 1) {
+		perror("write");
+		return 1;
+	}
+	if (tds_poller_wait(poller, 10000, &ready) != 1 || ready != tds[1]
+	    || tds_wait_response(tds[1], 0) != 1 || tds_read_packet(tds[1]) >= 0) {
+		fprintf(stderr, "closed connection not detected\n");
+		return 1;
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "server failed\n");
+		return 1;
+	}
+
+	tds_free_poller(poller);
+	for (i = 0; i < NUM_CONN; ++i)
+		tds_free_socket(tds[i]);
+	tds_free_context(ctx);
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,165 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test tds_put_string.
+ * Strings are converted directly into packets, check characters split
+ * between packets at every position are sent correctly.
+ * Packets are read back from the other end of a socket pair.
+ */
+#include "common.h"
+#include <tdsiconv.h>
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+static char software_version[] = "$Id: putstring.c,v 1.1 2011/09/02 15:37:12 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32)
+
+#define BLOCK_SIZE 512
+
+/* read a request and return payload */
+static size_t
+read_request(int s, unsigned char *out)
+{
+	unsigned char pkt[BLOCK_SIZE];
+	size_t total = 0;
+
+	for (;;) {
+		unsigned int got, len;
+		ssize_t res;
+
+		for (got = 0; got < 8; got += res)
+			if ((res = read(s, pkt + got, 8 - got)) <= 0)
+				return 0;
+		len = pkt[2] * 256u + pkt[3];
+		assert(len >= 8 && len <= BLOCK_SIZE);
+		for (; got < len; got += res)
+			if ((res = read(s, pkt + got, len - got)) <= 0)
+				return 0;
+		memcpy(out + total, pkt + 8, len - 8);
+		total += len - 8;
+		if (pkt[1])
+			return total;
+	}
+}
+
+static int
+test(const char *charset, const char *str, size_t len)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSICONV *conv;
+	static unsigned char expected[8192], got[8192];
+	const char *ib;
+	char *ob;
+	size_t il, ol, exp_len;
+	unsigned int shift;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, BLOCK_SIZE);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->tds_version = 0x702;
+	tds->state = TDS_IDLE;
+	tds->out_flag = TDS_QUERY;
+	tds_iconv_open(tds, charset);
+	conv = tds_conn(tds)->char_convs[client2ucs2];
+
+	ib = str;
+	il = len;
+	ob = (char *) expected;
+	ol = sizeof(expected);
+	if (tds_iconv(tds, conv, to_server, &ib, &il, &ob, &ol) == (size_t) -1 || il) {
+		fprintf(stderr, "error converting test string\n");
+		return 1;
+	}
+	exp_len = ob - (char *) expected;
+
+	/* move string start to make every character cross a packet boundary */
+	for (shift = 0; shift < 8; ++shift) {
+		int written;
+
+		tds_put_n(tds, NULL, BLOCK_SIZE - 8 - shift);
+		written = tds_put_string(tds, str, (int) len);
+		tds_flush_packet(tds);
+		if (written != (int) exp_len || read_request(sv[1], got) != BLOCK_SIZE - 8 - shift + exp_len
+		    || memcmp(got + BLOCK_SIZE - 8 - shift, expected, exp_len) != 0) {
+			fprintf(stderr, "wrong data for %s, shift %u\n", charset, shift);
+			return 1;
+		}
+	}
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	close(sv[1]);
+	return 0;
+}
+
+int
+main(void)
+{
+	char buf[1200];
+	unsigned int i;
+	int res;
+
+	/* long ASCII string, fast path */
+	for (i = 0; i < 1200; ++i)
+		buf[i] = 'a' + i % 26;
+	res = test("ISO-8859-1", buf, 1200);
+
+	/* one, two, three and four bytes UTF-8 characters */
+	for (i = 0; i < 1200; i += 10)
+		memcpy(buf + i, "a\xc3\xa8\xe2\x82\xac\xf0\x9f\x98\x80", 10);
+	res = res || test("UTF-8", buf, 1200);
+
+	/* Russian client, converted by iconv */
+	for (i = 0; i < 1200; ++i)
+		buf[i] = i % 3 ? 'a' + i % 26 : 0xc0 + i % 64;
+	res = res || test("CP1251", buf, 1200);
+
+	/* client using UCS-2, just copied */
+	res = res || test("UCS-2LE", "a\0b\0c\0", 6);
+
+	return res;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
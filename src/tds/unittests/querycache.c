@@ -0,0 +1,252 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test cache of converted queries.
+ * Queries sent with sp_executesql, sp_prepare and sp_prepexec are kept
+ * converted with their parameters declaration. Requests built from the
+ * cache must be the same as the ones built converting the query again
+ * and a change of query text or parameter types must not reuse a
+ * previous conversion. Requests are sent to the other end of a socket
+ * pair and checked.
+ */
+#include "common.h"
+#include <assert.h>
+#include <time.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+static char software_version[] = "$Id: querycache.c,v 1.1 2011/09/28 09:52:17 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32)
+
+#define BIG_QUERY_LEN 20000
+
+static TDSSOCKET *tds;
+static int sv[2];
+
+typedef struct
+{
+	unsigned char data[2 * BIG_QUERY_LEN + 1024];
+	size_t len;
+} request;
+
+static void
+read_all(unsigned char *buf, size_t len)
+{
+	while (len) {
+		ssize_t res = read(sv[1], buf, len);
+		if (res <= 0) {
+			fprintf(stderr, "short packet\n");
+			exit(1);
+		}
+		buf += res;
+		len -= res;
+	}
+}
+
+/* read a whole request, all packets */
+static void
+read_request(request * req)
+{
+	unsigned char header[8];
+	size_t len;
+
+	req->len = 0;
+	do {
+		read_all(header, 8);
+		if (header[0] != TDS_RPC) {
+			fprintf(stderr, "wrong packet header\n");
+			exit(1);
+		}
+		len = header[2] * 256u + header[3] - 8;
+		assert(req->len + len <= sizeof(req->data));
+		read_all(req->data + req->len, len);
+		req->len += len;
+	} while (!(header[1] & 1));
+	tds->state = TDS_IDLE;
+}
+
+static void
+execdirect(request * req, const char *query, TDSPARAMINFO * params)
+{
+	assert(tds_submit_execdirect(tds, query, params) == TDS_SUCCESS);
+	read_request(req);
+}
+
+static int
+same(const request * req1, const request * req2)
+{
+	return req1->len == req2->len && memcmp(req1->data, req2->data, req1->len) == 0;
+}
+
+/* check request contains a string (converted to ucs2le) */
+static int
+contains(const request * req, const char *s)
+{
+	unsigned char ucs2[256];
+	size_t len = strlen(s), i;
+
+	assert(len * 2 <= sizeof(ucs2));
+	for (i = 0; i < len; ++i) {
+		ucs2[i * 2] = (unsigned char) s[i];
+		ucs2[i * 2 + 1] = 0;
+	}
+	len *= 2;
+	for (i = 0; i + len <= req->len; ++i)
+		if (memcmp(req->data + i, ucs2, len) == 0)
+			return 1;
+	return 0;
+}
+
+static void
+check(int cond, const char *what)
+{
+	if (!cond) {
+		fprintf(stderr, "failed: %s\n", what);
+		exit(1);
+	}
+}
+
+static TDSPARAMINFO *
+add_param(TDSPARAMINFO * params, int type, const void *value, int len)
+{
+	TDSCOLUMN *curcol;
+
+	params = tds_alloc_param_result(params);
+	assert(params);
+	curcol = params->columns[params->num_cols - 1];
+	tds_set_param_type(tds, curcol, type);
+	curcol->column_size = curcol->on_server.column_size = len;
+	assert(tds_alloc_param_data(curcol));
+	curcol->column_cur_size = len;
+	memcpy(curcol->column_data, value, len);
+	return params;
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSPARAMINFO *params1, *params2, *params3;
+	TDSDYNAMIC *dyn = NULL;
+	TDS_INT one = 1, two = 2;
+	char query[64], *big_query;
+	static request req1, req2, req3;
+	clock_t start;
+	int i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->state = TDS_IDLE;
+	tds_iconv_open(tds, "ISO-8859-1");
+	tds->tds_version = 0x702;
+
+	params1 = add_param(add_param(NULL, SYBINT4, &one, 4), SYBINT4, &two, 4);
+	params2 = add_param(add_param(NULL, SYBINT4, &two, 4), SYBINT4, &one, 4);
+	params3 = add_param(add_param(NULL, SYBINT4, &one, 4), SYBVARCHAR, "abc", 3);
+
+	/* first request converts the query, second one uses cache */
+	execdirect(&req1, "select ?, ?", params1);
+	check(contains(&req1, "select @P1, @P2"), "placeholders replaced");
+	check(contains(&req1, "@P1 INT,@P2 INT"), "parameters declared");
+	execdirect(&req2, "select ?, ?", params1);
+	check(same(&req1, &req2), "cached request");
+
+	/* same types, different values */
+	execdirect(&req2, "select ?, ?", params2);
+	check(req1.len == req2.len && !same(&req1, &req2), "values changed");
+
+	/* different types must declare parameters again */
+	execdirect(&req2, "select ?, ?", params3);
+	check(contains(&req2, "@P1 INT,@P2 VARCHAR(3)"), "types changed");
+
+	/* same buffer with a different query */
+	strcpy(query, "select ?, ?");
+	execdirect(&req2, query, params1);
+	check(same(&req1, &req2), "query in buffer");
+	strcpy(query, "select ?+1, ?");
+	execdirect(&req2, query, params1);
+	check(contains(&req2, "select @P1+1, @P2"), "query changed");
+
+	/* evict all entries, request must be built the same way */
+	for (i = 0; i < TDS_QUERY_CACHE_SIZE * 2; ++i) {
+		sprintf(query, "select ?, %d", i);
+		execdirect(&req2, query, params1);
+	}
+	execdirect(&req2, "select ?, ?", params1);
+	check(same(&req1, &req2), "request after eviction");
+
+	/* prepare share the conversion */
+	assert(tds_submit_prepare(tds, "select ?, ?", NULL, &dyn, params1) == TDS_SUCCESS);
+	read_request(&req2);
+	check(contains(&req2, "select @P1, @P2") && contains(&req2, "@P1 INT,@P2 INT"), "prepare");
+	tds->cur_dyn = NULL;
+	tds_free_dynamic(tds, dyn);
+
+	/* big queries are not kept but converted correctly */
+	big_query = (char *) malloc(BIG_QUERY_LEN + 1);
+	assert(big_query);
+	memset(big_query, ' ', BIG_QUERY_LEN);
+	memcpy(big_query, "select ?, ?", 11);
+	big_query[BIG_QUERY_LEN] = 0;
+	execdirect(&req2, big_query, params1);
+	execdirect(&req3, big_query, params1);
+	check(same(&req2, &req3) && contains(&req3, "select @P1, @P2 "), "big query");
+	free(big_query);
+	execdirect(&req2, "select ?, ?", params1);
+	check(same(&req1, &req2), "request after big query");
+
+	start = clock();
+	for (i = 0; i < 10000; ++i)
+		execdirect(&req2, "select ?, ?", params1);
+	printf("10000 cached requests in %.3f seconds\n", (double) (clock() - start) / CLOCKS_PER_SEC);
+
+	tds_free_param_results(params1);
+	tds_free_param_results(params2);
+	tds_free_param_results(params3);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	close(sv[1]);
+	return 0;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
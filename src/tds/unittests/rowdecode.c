@@ -0,0 +1,410 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2011  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test row decoding using result decode plan.
+ * A canned stream with a narrow result set (int, intn, float, datetime,
+ * nvarchar and varbinary columns, some binary values longer than the
+ * column and so truncated) is sent by a child process and read
+ * calling column get_data functions for every column (as libtds did
+ * before decode plans), with tds_process_tokens and with
+ * tds_process_tokens leaving data in network buffer (zero-copy),
+ * checking values.
+ * To compare the three ways pass the number of rows, like
+ * $ ./rowdecode 1000000
+ * It prints rows/s for each way.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif /* HAVE_SYS_SOCKET_H */
+
+#if HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif /* HAVE_SYS_WAIT_H */
+
+static char software_version[] = "$Id: rowdecode.c,v 1.1 2011/09/02 08:41:37 freddy77 Exp $";
+static void *no_unused_var_warn[] = { software_version, no_unused_var_warn };
+
+#if !defined(_WIN32) && HAVE_FORK
+
+#define NUM_COLS 6
+#define BLOCK_SIZE 4096
+
+/* canned server response */
+typedef struct
+{
+	unsigned char *data;
+	size_t len, alloc;
+	unsigned int pkt_start;
+} STREAM;
+
+static void
+put_byte(STREAM * st, unsigned char c);
+
+static void
+flush_pkt(STREAM * st, int last)
+{
+	unsigned char *pkt = st->data + st->pkt_start;
+	unsigned int len = st->len - st->pkt_start;
+
+	pkt[0] = TDS_REPLY;
+	pkt[1] = last ? 1 : 0;
+	pkt[2] = len >> 8;
+	pkt[3] = len & 0xff;
+	pkt[4] = pkt[5] = pkt[6] = pkt[7] = 0;
+	st->pkt_start = st->len;
+	if (!last) {
+		unsigned int i;
+
+		for (i = 0; i < 8; ++i)
+			put_byte(st, 0);
+	}
+}
+
+static void
+put_byte(STREAM * st, unsigned char c)
+{
+	if (st->len - st->pkt_start >= BLOCK_SIZE)
+		flush_pkt(st, 0);
+	if (st->len >= st->alloc) {
+		st->alloc = st->alloc ? st->alloc * 2 : 65536;
+		st->data = (unsigned char *) realloc(st->data, st->alloc);
+		assert(st->data);
+	}
+	st->data[st->len++] = c;
+}
+
+static void
+put_le(STREAM * st, TDS_UINT8 n, unsigned int len)
+{
+	while (len--) {
+		put_byte(st, (unsigned char) (n & 0xff));
+		n >>= 8;
+	}
+}
+
+static void
+put_coldef(STREAM * st, int type, int size)
+{
+	put_le(st, 0, 4);	/* usertype */
+	put_le(st, 1, 2);	/* flags, nullable */
+	put_byte(st, type);
+	switch (type) {
+	case SYBINTN:
+		put_byte(st, size);
+		break;
+	case XSYBNVARCHAR:
+		put_le(st, size, 2);
+		/* collation */
+		put_le(st, 0x00d00409u, 4);
+		put_byte(st, 0x34);
+		break;
+	case XSYBVARBINARY:
+		put_le(st, size, 2);
+		break;
+	}
+	put_byte(st, 0);	/* no name */
+}
+
+static int
+name_len(unsigned int row)
+{
+	return row % 7u == 0 ? -1 : (int) (row % 13u);
+}
+
+/* longer than declared column size (16) for some rows */
+static unsigned int
+bin_len(unsigned int row)
+{
+	return row % 20u + 1u;
+}
+
+static void
+build_stream(STREAM * st, unsigned int num_rows)
+{
+	unsigned int row, i;
+	int len;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < 8; ++i)
+		put_byte(st, 0);
+
+	put_byte(st, TDS7_RESULT_TOKEN);
+	put_le(st, NUM_COLS, 2);
+	put_coldef(st, SYBINT4, 4);
+	put_coldef(st, SYBINTN, 4);
+	put_coldef(st, SYBFLT8, 8);
+	put_coldef(st, SYBDATETIME, 8);
+	put_coldef(st, XSYBNVARCHAR, 40);
+	put_coldef(st, XSYBVARBINARY, 16);
+
+	for (row = 0; row < num_rows; ++row) {
+		double d = row * 0.5;
+		unsigned char *p = (unsigned char *) &d;
+
+		put_byte(st, TDS_ROW_TOKEN);
+		put_le(st, row, 4);
+		if (row % 5u == 0) {
+			put_byte(st, 0);
+		} else {
+			put_byte(st, 4);
+			put_le(st, row * 3u, 4);
+		}
+		for (i = 0; i < 8; ++i)
+			put_byte(st, p[i]);
+		put_le(st, row % 10000u, 4);
+		put_le(st, row * 300u, 4);
+		len = name_len(row);
+		put_le(st, len < 0 ? 0xffff : len * 2, 2);
+		for (i = 0; (int) i < len; ++i)
+			put_le(st, 'a' + (row + i) % 26u, 2);
+		put_le(st, bin_len(row), 2);
+		for (i = 0; i < bin_len(row); ++i)
+			put_byte(st, (unsigned char) (row + i));
+	}
+
+	put_byte(st, TDS_DONE_TOKEN);
+	put_le(st, TDS_DONE_COUNT, 2);
+	put_le(st, 0xc1, 2);
+	put_le(st, num_rows, 8);
+	flush_pkt(st, 1);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static int
+check_row(TDSRESULTINFO * info, unsigned int row)
+{
+	TDSCOLUMN **cols = info->columns;
+	TDS_INT n;
+	TDS_FLOAT d;
+	TDS_DATETIME dt;
+	int i, len;
+
+	memcpy(&n, cols[0]->column_data, sizeof(n));
+	if (cols[0]->column_cur_size != 4 || n != (TDS_INT) row)
+		return 1;
+	if (row % 5u == 0) {
+		if (cols[1]->column_cur_size != -1)
+			return 1;
+	} else {
+		memcpy(&n, cols[1]->column_data, sizeof(n));
+		if (cols[1]->column_cur_size != 4 || n != (TDS_INT) (row * 3u))
+			return 1;
+	}
+	memcpy(&d, cols[2]->column_data, sizeof(d));
+	if (cols[2]->column_cur_size != 8 || d != row * 0.5)
+		return 1;
+	memcpy(&dt, cols[3]->column_data, sizeof(dt));
+	if (cols[3]->column_cur_size != 8 || dt.dtdays != (TDS_INT) (row % 10000u) || dt.dttime != (TDS_INT) (row * 300u))
+		return 1;
+	len = name_len(row);
+	if (cols[4]->column_cur_size != len)
+		return 1;
+	for (i = 0; i < len; ++i)
+		if (cols[4]->column_data[i] != 'a' + (row + i) % 26u)
+			return 1;
+	len = bin_len(row) > 16u ? 16 : (int) bin_len(row);
+	if (cols[5]->column_cur_size != len)
+		return 1;
+	for (i = 0; i < cols[5]->column_cur_size; ++i)
+		if (cols[5]->column_data[i] != (unsigned char) (row + i))
+			return 1;
+	return 0;
+}
+
+/* read rows calling column functions, like tds_process_row did */
+static int
+read_generic(TDSSOCKET * tds, unsigned int *prow)
+{
+	TDSRESULTINFO *info;
+	TDS_INT result_type;
+	int i;
+
+	if (tds_process_tokens(tds, &result_type, NULL, TDS_RETURN_ROWFMT) != TDS_SUCCESS || result_type != TDS_ROWFMT_RESULT)
+		return 1;
+	info = tds->current_results;
+	while (tds_peek(tds) == TDS_ROW_TOKEN) {
+		tds_get_byte(tds);
+		info->row_count++;
+		for (i = 0; i < info->num_cols; i++) {
+			tdsdump_log(TDS_DBG_INFO1, "tds_process_row(): reading column %d \n", i);
+			if (info->columns[i]->funcs->get_data(tds, info->columns[i]) != TDS_SUCCESS)
+				return 1;
+		}
+		if (check_row(info, *prow))
+			return 1;
+		++*prow;
+	}
+	return 0;
+}
+
+static int
+read_plan(TDSSOCKET * tds, unsigned int *prow)
+{
+	TDS_INT result_type;
+	unsigned int wired = 0;
+
+	while (tds_process_tokens(tds, &result_type, NULL, TDS_RETURN_ROW|TDS_RETURN_DONE) == TDS_SUCCESS) {
+		if (result_type != TDS_ROW_RESULT)
+			break;
+		if (tds->current_results->num_cols != NUM_COLS || check_row(tds->current_results, *prow))
+			return 1;
+		if (tds->current_results->columns[5]->column_row_data)
+			++wired;
+		++*prow;
+	}
+	/* with zero-copy most binary values should be in network buffer */
+	if (tds->zero_copy && wired < *prow / 2u)
+		return 1;
+	if (!tds->zero_copy && wired)
+		return 1;
+	/* last row must be still valid */
+	if (*prow && check_row(tds->current_results, *prow - 1))
+		return 1;
+	return 0;
+}
+
+static int
+test(const STREAM * st, unsigned int num_rows, int mode, int verbose)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	int sv[2], status;
+	pid_t pid;
+	unsigned int row = 0;
+	TDS_INT result_type;
+	TDSRET rc;
+	double start, end;
+	static const char *const names[] = { "generic", "plan", "zerocopy" };
+	const char *name = names[mode];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		const unsigned char *p = st->data;
+		size_t left = st->len;
+
+		close(sv[0]);
+		while (left) {
+			ssize_t res = write(sv[1], p, left);
+			if (res <= 0) {
+				perror("write");
+				exit(1);
+			}
+			p += res;
+			left -= res;
+		}
+		close(sv[1]);
+		exit(0);
+	}
+	close(sv[1]);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, BLOCK_SIZE);
+	assert(tds);
+	tds_set_s(tds, sv[0]);
+	tds->tds_version = 0x702;
+	tds_iconv_open(tds, "ISO-8859-1");
+	tds->state = TDS_PENDING;
+	tds->zero_copy = (mode == 2);
+
+	start = now();
+	if ((mode ? read_plan(tds, &row) : read_generic(tds, &row)) != 0) {
+		fprintf(stderr, "wrong row %u (%s)\n", row, name);
+		return 1;
+	}
+	end = now();
+
+	while ((rc = tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS)) == TDS_SUCCESS)
+		continue;
+	if (rc != TDS_NO_MORE_RESULTS || row != num_rows || tds->rows_affected != num_rows) {
+		fprintf(stderr, "wrong result %d, %u rows (%s)\n", (int) rc, row, name);
+		return 1;
+	}
+
+	if (verbose && end > start)
+		printf("%-8s %10.0f rows/s\n", name, num_rows / (end - start));
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "sender failed\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int num_rows = 1000;
+	int verbose = 0, res;
+	STREAM st;
+
+	if (argc > 1) {
+		num_rows = atoi(argv[1]);
+		verbose = 1;
+	}
+	if (num_rows < 1)
+		num_rows = 1;
+
+	build_stream(&st, num_rows);
+	res = test(&st, num_rows, 0, verbose) || test(&st, num_rows, 1, verbose) || test(&st, num_rows, 2, verbose);
+	free(st.data);
+	return res;
+}
+
+#else
+int
+main(void)
+{
+	printf("Not possible for this platform.\n");
+	return 0;
+}
+#endif
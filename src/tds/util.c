@@ -70,6 +70,7 @@ TDS_RCSID(var, "$Id: util.c,v 1.101 2011/08/08 07:06:17 freddy77 Exp $");
  * \param tds	  state information for the socket and the TDS protocol
  * \param state	  the new state of the connection, cf. TDS_STATE.
  * \return 	  the new state, which might not be \a state.
+ *		  TDS_PENDING if requests are pipelined but not sent.
  */
 TDS_STATE
 tds_set_state(TDSSOCKET * tds, TDS_STATE state)
@@ -85,8 +86,15 @@ tds_set_state(TDSSOCKET * tds, TDS_STATE state)
 	assert(state < TDS_VECTOR_SIZE(state_names));
 	assert(tds->state < TDS_VECTOR_SIZE(state_names));
 	
-	if (state == tds->state)
+	if (state == tds->state) {
+		/* requests queued in the pipeline must be sent before starting another one */
+		if (state == TDS_QUERYING && tds->pipeline.num_requests) {
+			tdsdump_log(TDS_DBG_ERROR, "logic error: cannot start a request with pipelined requests not sent\n");
+			tdserror(tds_get_ctx(tds), tds, TDSERPND, 0);
+			return TDS_PENDING;
+		}
 		return state;
+	}
 	
 	switch(state) {
 		/* transition to READING are valid only from PENDING */
@@ -113,6 +121,12 @@ tds_set_state(TDSSOCKET * tds, TDS_STATE state)
 			return tds->state;
 		}
 	case TDS_DEAD:
+		/* pipelined requests, if any, are over */
+		tds->pipeline.num_requests = 0;
+		tds->pipeline.boundary = 0;
+		tds->pipeline.held_status = 0;
+		tds->pipeline.mark = 0;
+		tds->pipeline.param_pending = 0;
 		tds->state = state;
 		break;
 	case TDS_QUERYING:
@@ -136,6 +150,7 @@ tds_set_state(TDSSOCKET * tds, TDS_STATE state)
 		tds_release_cursor(tds, tds->cur_cursor);
 		tds->cur_cursor = NULL;
 		tds->internal_sp_called = 0;
+		tds->multiple_query = 0;
 
 		tds->state = state;
 		break;
@@ -166,8 +181,10 @@ tds_swap_bytes(unsigned char *buf, int bytes)
 	return bytes;
 }
 
-/* not used by FreeTDS, uncomment if needed */
-#ifdef ENABLE_DEVELOPING
+/**
+ * Get a monotonic time in milliseconds, used to compute timeouts.
+ * Value can wrap so only differences are meaningful.
+ */
 unsigned int
 tds_gettime_ms(void)
 {
@@ -187,7 +204,6 @@ tds_gettime_ms(void)
 #error How to implement tds_gettime_ms ??
 #endif
 }
-#endif
 
 /*
  * Call the client library's error handler
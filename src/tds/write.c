@@ -70,6 +70,16 @@ tds_put_n(TDSSOCKET * tds, const void *buf, size_t n)
 			tds_write_packet(tds, 0x0);
 			continue;
 		}
+		/* big buffer, send directly from caller memory */
+		if (bufp && n > left + tds->env.block_size) {
+			int sent = tds_write_direct(tds, bufp, n);
+
+			if (sent < 0)
+				return -1;
+			bufp += sent;
+			n -= sent;
+			left = tds->env.block_size - tds->out_pos;
+		}
 		if (left > n)
 			left = n;
 		if (bufp) {
@@ -96,11 +106,11 @@ int
 tds_put_string(TDSSOCKET * tds, const char *s, int len)
 {
 	TDS_ENCODING *client, *server;
-	char outbuf[256], *poutbuf;
+	char *poutbuf;
 	size_t inbytesleft, outbytesleft, bytes_out = 0;
 
-	client = &tds->char_convs[client2ucs2]->client_charset;
-	server = &tds->char_convs[client2ucs2]->server_charset;
+	client = &tds_conn(tds)->char_convs[client2ucs2]->client_charset;
+	server = &tds_conn(tds)->char_convs[client2ucs2]->server_charset;
 
 	if (len < 0) {
 		if (client->min_bytes_per_char == 1) {	/* ascii or UTF-8 */
@@ -131,21 +141,44 @@ tds_put_string(TDSSOCKET * tds, const char *s, int len)
 		return len;
 	}
 
-	memset(&tds->char_convs[client2ucs2]->suppress, 0, sizeof(tds->char_convs[client2ucs2]->suppress));
-	tds->char_convs[client2ucs2]->suppress.e2big = 1;
+	memset(&tds_conn(tds)->char_convs[client2ucs2]->suppress, 0, sizeof(tds_conn(tds)->char_convs[client2ucs2]->suppress));
+	tds_conn(tds)->char_convs[client2ucs2]->suppress.e2big = 1;
 	inbytesleft = len;
 	while (inbytesleft) {
+		char *start;
+
+		/* convert directly into the free space of the packet */
+		if (tds->out_pos >= tds->env.block_size) {
+			tds_write_packet(tds, 0x0);
+			continue;
+		}
 		tdsdump_log(TDS_DBG_NETWORK, "tds_put_string converting %d bytes of \"%.*s\"\n", (int) inbytesleft, (int) inbytesleft, s);
-		outbytesleft = sizeof(outbuf);
-		poutbuf = outbuf;
-		
-		if ((size_t)-1 == tds_iconv(tds, tds->char_convs[client2ucs2], to_server, &s, &inbytesleft, &poutbuf, &outbytesleft)) {
-		
+		start = poutbuf = (char *) tds->out_buf + tds->out_pos;
+		outbytesleft = tds->env.block_size - tds->out_pos;
+
+		if ((size_t)-1 == tds_iconv(tds, tds_conn(tds)->char_convs[client2ucs2], to_server, &s, &inbytesleft, &poutbuf, &outbytesleft)) {
+
 			if (errno == EINVAL) {
 				tdsdump_log(TDS_DBG_NETWORK, "tds_put_string: tds_iconv() encountered partial sequence. "
 							     "%d bytes remain.\n", (int) inbytesleft);
 				/* TODO return some sort or error ?? */
+				tds->out_pos += (unsigned int) (poutbuf - start);
+				bytes_out += poutbuf - start;
 				break;
+			} else if (errno == E2BIG && poutbuf == start) {
+				/* a character crosses the packet boundary, convert it apart and split it */
+				char outbuf[8];
+
+				poutbuf = outbuf;
+				outbytesleft = sizeof(outbuf);
+				tds_iconv(tds, tds_conn(tds)->char_convs[client2ucs2], to_server, &s, &inbytesleft, &poutbuf, &outbytesleft);
+				if (poutbuf == outbuf) {
+					tdsdump_log(TDS_DBG_NETWORK, "Error: tds_put_string: No conversion possible, giving up.\n");
+					break;
+				}
+				bytes_out += poutbuf - outbuf;
+				tds_put_n(tds, outbuf, poutbuf - outbuf);
+				continue;
 			} else if (errno != E2BIG) {
 				/* It's not an incomplete multibyte sequence, or it IS, but we're not anticipating one. */
 				tdsdump_log(TDS_DBG_NETWORK, "Error: tds_put_string: "
@@ -154,14 +187,14 @@ tds_put_string(TDSSOCKET * tds, const char *s, int len)
 				tdsdump_dump_buf(TDS_DBG_NETWORK, "Troublesome bytes", s, inbytesleft);
 			}
 
-			if (poutbuf == outbuf) {	/* tds_iconv did not convert anything, avoid infinite loop */
+			if (poutbuf == start) {	/* tds_iconv did not convert anything, avoid infinite loop */
 				tdsdump_log(TDS_DBG_NETWORK, "Error: tds_put_string: No conversion possible, giving up.\n");
 				break;
 			}
 		}
 		
-		bytes_out += poutbuf - outbuf;
-		tds_put_n(tds, outbuf, poutbuf - outbuf);
+		tds->out_pos += (unsigned int) (poutbuf - start);
+		bytes_out += poutbuf - start;
 	}
 	tdsdump_log(TDS_DBG_NETWORK, "tds_put_string wrote %d bytes\n", (int) bytes_out);
 	return (int)bytes_out;
@@ -304,6 +337,7 @@ int
 tds_init_write_buf(TDSSOCKET * tds)
 {
 	/* TODO needed ?? */
+	tds->out_buf = tds->send_buf;
 	memset(tds->out_buf, '\0', tds->env.block_size);
 	tds->out_pos = 8;
 	return 0;
@@ -149,6 +149,10 @@ SOURCE=..\..\src\tds\numeric.c
 # End Source File
 # Begin Source File
 
+SOURCE=..\..\src\tds\poller.c
+# End Source File
+# Begin Source File
+
 SOURCE=..\..\src\tds\query.c
 # End Source File
 # Begin Source File